@@ -49,7 +49,9 @@
 #ifndef _FPU_H
 #define _FPU_H
 
-#include <TargetConditionals.h>
+#if defined(__APPLE__)
+	#include <TargetConditionals.h>
+#endif
 
 #if TARGET_OS_MAC && (TARGET_CPU_PPC || TARGET_CPU_PPC64)
 	#define SET_ROUNDMODE \
@@ -81,7 +83,8 @@
 	#define DISABLE_DENORMALS
 	#define RESTORE_DENORMALS
 	
-#elif TARGET_OS_MAC && (TARGET_CPU_X86 || TARGET_CPU_X86_64)
+#elif (TARGET_OS_MAC && (TARGET_CPU_X86 || TARGET_CPU_X86_64)) || \
+	  (!defined(__APPLE__) && (defined(__i386__) || defined(__x86_64__)))
 	// our compiler does ALL floating point with SSE
 	#define GETCSR()    ({ int _result; asm volatile ("stmxcsr %0" : "=m" (*&_result) ); /*return*/ _result; })
 	#define SETCSR( a )    { int _temp = a; asm volatile( "ldmxcsr %0" : : "m" (*&_temp ) ); }
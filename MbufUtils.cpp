@@ -28,6 +28,7 @@
 
 #include <IOKit/IOLib.h>
 #include "REACConstants.h"
+#include "PCMBlitterLib.h"
 
 // Double-evaluation caveats apply
 #define min_macro(a, b) ((a) < (b) ? (a) : (b))
@@ -90,147 +91,431 @@ size_t MbufUtils::mbufTotalMaxLength(mbuf_t mbuf) {
         next_mbuf_macro(); \
     }
 
-#define skip_mbuf_macro() \
-    { \
-        UInt32 skip = from; \
-        while (skip) { \
-            if (skip >= mbufLength) { \
-                skip -= mbufLength; \
-                next_mbuf_macro(); \
-            } \
-            else { \
-                mbufLength -= skip; \
-                mbufBuffer += skip; \
-                skip = 0; \
-            } \
-        } \
+IOReturn MbufUtils::zeroMbuf(mbuf_t mbuf, UInt32 from, UInt32 len) {
+    MbufCursor cursor;
+    IOReturn result = cursor.init(mbuf, from);
+    return kIOReturnSuccess == result ? cursor.zero(len) : result;
+}
+
+IOReturn MbufUtils::copyFromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, void *data) {
+    MbufCursor cursor;
+    IOReturn result = cursor.init(mbuf, from);
+    return kIOReturnSuccess == result ? cursor.copyFromBuffer(bufferSize, data) : result;
+}
+
+IOReturn MbufUtils::copyAudioFromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer) {
+    MbufCursor cursor;
+    IOReturn result = cursor.init(mbuf, from);
+    return kIOReturnSuccess == result ? cursor.copyAudioFromBuffer(bufferSize, inBuffer) : result;
+}
+
+IOReturn MbufUtils::copyAudioFromMbufToBuffer(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer) {
+    MbufCursor cursor;
+    IOReturn result = cursor.init(mbuf, from);
+    return kIOReturnSuccess == result ? cursor.copyAudioToBuffer(bufferSize, inBuffer) : result;
+}
+
+IOReturn MbufUtils::copyAudio32FromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer) {
+    MbufCursor cursor;
+    IOReturn result = cursor.init(mbuf, from);
+    return kIOReturnSuccess == result ? cursor.copyAudio32FromBuffer(bufferSize, inBuffer) : result;
+}
+
+IOReturn MbufUtils::copyAudio32FromMbufToBuffer(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer) {
+    MbufCursor cursor;
+    IOReturn result = cursor.init(mbuf, from);
+    return kIOReturnSuccess == result ? cursor.copyAudio32ToBuffer(bufferSize, inBuffer) : result;
+}
+
+IOReturn MbufUtils::copyRoutedAudioFromMbufToBuffer(mbuf_t mbuf, UInt32 from, UInt32 wireChannels,
+                                                    const UInt8 *routing, UInt32 numRouted, bool int32,
+                                                    UInt32 bufferSize, UInt8 *inBuffer) {
+    MbufCursor cursor;
+    IOReturn result = cursor.init(mbuf, from);
+    return kIOReturnSuccess == result ?
+        cursor.copyRoutedAudioToBuffer(wireChannels, routing, numRouted, int32, bufferSize, inBuffer) : result;
+}
+
+IOReturn MbufCursor::init(mbuf_t mbuf_, UInt32 from) {
+    if (NULL == mbuf_) {
+        IOLog("MbufCursor::init(): Got NULL mbuf.\n");
+        return kIOReturnBadArgument;
+    }
+    
+    head = mbuf_;
+    tail = mbuf_;
+    totalLength = 0;
+    for (mbuf_t m = mbuf_; m; m = mbuf_next(m)) {
+        if (mbuf_len(m)) {
+            tail = m;
+            totalLength += mbuf_len(m);
+        }
     }
+    
+    mbuf = mbuf_;
+    mbufBuffer = (UInt8 *)mbuf_data(mbuf);
+    mbufLength = mbuf_len(mbuf);
+    remaining = totalLength;
+    
+    return skip(from);
+}
 
-IOReturn MbufUtils::zeroMbuf(mbuf_t mbuf, UInt32 from, UInt32 len) {
-    if (from+len > (UInt32) MbufUtils::mbufTotalLength(mbuf)) {
-        IOLog("MbufUtils::zeroMbuf(): Got insufficiently large buffer.\n");
+IOReturn MbufCursor::skip(UInt32 len) {
+    if (len > remaining) {
+        IOLog("MbufCursor::skip(): Got insufficiently large buffer.\n");
         return kIOReturnNoMemory;
     }
+    remaining -= len;
     
-    UInt8 *mbufBuffer = (UInt8 *)mbuf_data(mbuf);
-    size_t mbufLength = mbuf_len(mbuf);
-    UInt32 bytesLeft = len;
+    while (len) {
+        if (len > mbufLength) {
+            len -= mbufLength;
+            next_mbuf_macro();
+        }
+        else {
+            mbufLength -= len;
+            mbufBuffer += len;
+            len = 0;
+        }
+    }
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn MbufCursor::zero(UInt32 numBytes) {
+    if (numBytes > remaining) {
+        IOLog("MbufCursor::zero(): Got insufficiently large buffer.\n");
+        return kIOReturnNoMemory;
+    }
     
-    skip_mbuf_macro();
+    UInt32 bytesLeft = numBytes;
     
+    // One bzero per mbuf segment
     while (bytesLeft) {
         ensure_mbuf_macro();
-        *mbufBuffer = 0;
+        UInt32 len = min_macro(bytesLeft, (UInt32) mbufLength);
+        bzero(mbufBuffer, len);
         
-        ++mbufBuffer;
-        --mbufLength;
-        --bytesLeft;
+        mbufBuffer += len;
+        mbufLength -= len;
+        bytesLeft -= len;
     }
     
+    remaining -= numBytes;
     return kIOReturnSuccess;
 }
 
-IOReturn MbufUtils::copyFromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, void *data) {
-    if (bufferSize > (UInt32) MbufUtils::mbufTotalLength(mbuf)-from) {
-        IOLog("MbufUtils::copyFromBufferToMbuf(): Got insufficiently large buffer (mbuf too small).\n");
+IOReturn MbufCursor::copyFromBuffer(UInt32 bufferSize, const void *data) {
+    if (bufferSize > remaining) {
+        IOLog("MbufCursor::copyFromBuffer(): Got insufficiently large buffer (mbuf too small).\n");
         return kIOReturnNoMemory;
     }
     
-    UInt8 *inBuffer = (UInt8 *)data;
-    UInt8 *mbufBuffer = (UInt8 *)mbuf_data(mbuf);
-    size_t mbufLength = mbuf_len(mbuf);
+    const UInt8 *inBuffer = (const UInt8 *)data;
     UInt32 bytesLeft = bufferSize;
     
-    skip_mbuf_macro();
-    
+    // One memcpy per mbuf segment
     while (bytesLeft) {
         ensure_mbuf_macro();
+        UInt32 len = min_macro(bytesLeft, (UInt32) mbufLength);
+        memcpy(mbufBuffer, inBuffer, len);
         
-        *mbufBuffer = *inBuffer;
+        mbufBuffer += len;
+        inBuffer += len;
+        mbufLength -= len;
+        bytesLeft -= len;
+    }
+    
+    remaining -= bufferSize;
+    return kIOReturnSuccess;
+}
+
+IOReturn MbufCursor::copyToBuffer(UInt32 bufferSize, void *data) {
+    if (bufferSize > remaining) {
+        IOLog("MbufCursor::copyToBuffer(): Got insufficiently large buffer (mbuf too small).\n");
+        return kIOReturnNoMemory;
+    }
+    
+    UInt8 *outBuffer = (UInt8 *)data;
+    UInt32 bytesLeft = bufferSize;
+    
+    // One memcpy per mbuf segment
+    while (bytesLeft) {
+        ensure_mbuf_macro();
+        UInt32 len = min_macro(bytesLeft, (UInt32) mbufLength);
+        memcpy(outBuffer, mbufBuffer, len);
         
-        ++mbufBuffer;
-        ++inBuffer;
-        --mbufLength;
-        --bytesLeft;
+        mbufBuffer += len;
+        outBuffer += len;
+        mbufLength -= len;
+        bytesLeft -= len;
     }
     
+    remaining -= bufferSize;
     return kIOReturnSuccess;
 }
 
-IOReturn MbufUtils::copyAudioFromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer) {
-    if (bufferSize > (UInt32) MbufUtils::mbufTotalLength(mbuf)-from) {
-        IOLog("MbufUtils::copyAudioFromBufferToMbuf(): Got insufficiently large buffer (mbuf too small).\n");
+IOReturn MbufCursor::copyEndToBuffer(UInt32 bufferSize, void *data) const {
+    if (bufferSize > totalLength) {
+        IOLog("MbufCursor::copyEndToBuffer(): Got insufficiently large buffer (mbuf too small).\n");
+        return kIOReturnNoMemory;
+    }
+    
+    // The end is nearly always within the last segment, which init has found already
+    if (bufferSize <= mbuf_len(tail)) {
+        memcpy(data, (UInt8 *)mbuf_data(tail) + mbuf_len(tail) - bufferSize, bufferSize);
+        return kIOReturnSuccess;
+    }
+    
+    MbufCursor end;
+    IOReturn result = end.init(head, totalLength - bufferSize);
+    return kIOReturnSuccess == result ? end.copyToBuffer(bufferSize, data) : result;
+}
+
+IOReturn MbufCursor::copyAudioFromBuffer(UInt32 bufferSize, const UInt8 *inBuffer) {
+    if (bufferSize > remaining) {
+        IOLog("MbufCursor::copyAudioFromBuffer(): Got insufficiently large buffer (mbuf too small).\n");
         return kIOReturnNoMemory;
     }
     
     if (0 != bufferSize % (REAC_RESOLUTION*2)) {
-        IOLog("MbufUtils::copyAudioFromBufferToMbuf(): Buffer size must be a multiple of %d.\n", REAC_RESOLUTION*2);
+        IOLog("MbufCursor::copyAudioFromBuffer(): Buffer size must be a multiple of %d.\n", REAC_RESOLUTION*2);
         return kIOReturnBadArgument;
     }
     
-    UInt8 *mbufBuffer = (UInt8 *)mbuf_data(mbuf);
-    size_t mbufLength = mbuf_len(mbuf);
     UInt32 bytesLeft = bufferSize;
     
-    skip_mbuf_macro();
-
-#   define mbuf_move_buffer_forward_macro() \
-        ++mbufBuffer; \
-        --mbufLength;
-    
+    // The swizzle works on 16 bit words, so whole segments go through REACInt24Swizzle. Only a
+    // word that is split between two segments is swizzled by hand.
     while (bytesLeft) {
-        ensure_mbuf_macro(); *mbufBuffer = inBuffer[1]; mbuf_move_buffer_forward_macro();
-        ensure_mbuf_macro(); *mbufBuffer = inBuffer[0]; mbuf_move_buffer_forward_macro();
-        ensure_mbuf_macro(); *mbufBuffer = inBuffer[3]; mbuf_move_buffer_forward_macro();
-        
-        ensure_mbuf_macro(); *mbufBuffer = inBuffer[2]; mbuf_move_buffer_forward_macro();
-        ensure_mbuf_macro(); *mbufBuffer = inBuffer[5]; mbuf_move_buffer_forward_macro();
-        ensure_mbuf_macro(); *mbufBuffer = inBuffer[4]; mbuf_move_buffer_forward_macro();
+        ensure_mbuf_macro();
+        UInt32 len = min_macro(bytesLeft, (UInt32) mbufLength) & ~1;
+        if (len) {
+            REACInt24Swizzle(inBuffer, mbufBuffer, len);
+            mbufBuffer += len;
+            mbufLength -= len;
+        }
+        else {
+            // One byte left in this segment
+            *mbufBuffer = inBuffer[1];
+            next_mbuf_macro();
+            ensure_mbuf_macro();
+            *mbufBuffer = inBuffer[0];
+            ++mbufBuffer;
+            --mbufLength;
+            len = 2;
+        }
         
-        inBuffer += REAC_RESOLUTION*2;
-        bytesLeft -= REAC_RESOLUTION*2;
+        inBuffer += len;
+        bytesLeft -= len;
     }
     
+    remaining -= bufferSize;
     return kIOReturnSuccess;
 }
 
-IOReturn MbufUtils::copyAudioFromMbufToBuffer(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer) {
-    if (bufferSize > (UInt32) MbufUtils::mbufTotalLength(mbuf)-from) {
-        IOLog("MbufUtils::copyAudioFromMbufToBuffer(): Got insufficiently large buffer (mbuf too small).\n");
+IOReturn MbufCursor::copyAudioToBuffer(UInt32 bufferSize, UInt8 *outBuffer) {
+    if (bufferSize > remaining) {
+        IOLog("MbufCursor::copyAudioToBuffer(): Got insufficiently large buffer (mbuf too small).\n");
         return kIOReturnNoMemory;
     }
     
     if (0 != bufferSize % (REAC_RESOLUTION*2)) {
-        IOLog("MbufUtils::copyAudioFromMbufToBuffer(): Buffer size must be a multiple of %d.\n", REAC_RESOLUTION*2);
+        IOLog("MbufCursor::copyAudioToBuffer(): Buffer size must be a multiple of %d.\n", REAC_RESOLUTION*2);
         return kIOReturnBadArgument;
     }
     
-    UInt8 *inBufferEnd = inBuffer + bufferSize;
-    UInt8 intermediaryBuffer[6];
-    UInt8 *mbufBuffer = (UInt8 *)mbuf_data(mbuf);
-    size_t mbufLength = mbuf_len(mbuf);
-    
-    skip_mbuf_macro();
+    UInt32 bytesLeft = bufferSize;
     
-    while (inBuffer < inBufferEnd) {
-        for (UInt32 i=0; i<sizeof(intermediaryBuffer); i++) {
+    // Swizzled a segment at a time, as in copyAudioFromBuffer
+    while (bytesLeft) {
+        ensure_mbuf_macro();
+        UInt32 len = min_macro(bytesLeft, (UInt32) mbufLength) & ~1;
+        if (len) {
+            REACInt24Swizzle(mbufBuffer, outBuffer, len);
+            mbufBuffer += len;
+            mbufLength -= len;
+        }
+        else {
+            // One byte left in this segment
+            outBuffer[1] = *mbufBuffer;
+            next_mbuf_macro();
             ensure_mbuf_macro();
-            
-            intermediaryBuffer[i] = *mbufBuffer;
+            outBuffer[0] = *mbufBuffer;
             ++mbufBuffer;
             --mbufLength;
+            len = 2;
+        }
+        
+        outBuffer += len;
+        bytesLeft -= len;
+    }
+    
+    remaining -= bufferSize;
+    return kIOReturnSuccess;
+}
+
+IOReturn MbufCursor::copyAudio32FromBuffer(UInt32 bufferSize, const UInt8 *inBuffer) {
+    if (0 != bufferSize % (sizeof(UInt32)*2)) {
+        IOLog("MbufCursor::copyAudio32FromBuffer(): Buffer size must be a multiple of %d.\n", (int) sizeof(UInt32)*2);
+        return kIOReturnBadArgument;
+    }
+    
+    const UInt32 wireSize = bufferSize/4*REAC_RESOLUTION;
+    if (wireSize > remaining) {
+        IOLog("MbufCursor::copyAudio32FromBuffer(): Got insufficiently large buffer (mbuf too small).\n");
+        return kIOReturnNoMemory;
+    }
+    
+    UInt32 bytesLeft = bufferSize;
+    
+    // The low byte of each 32 bit int is dropped; the other bytes go out in REAC wire order. The
+    // sample pairs that fit in a segment are packed there in one go, as in copyAudioFromBuffer; only a
+    // pair that is split between two segments is packed on the side and copied a byte at a time.
+    while (bytesLeft) {
+        ensure_mbuf_macro();
+        UInt32 pairs = min_macro(bytesLeft/(sizeof(UInt32)*2), (UInt32) mbufLength/(REAC_RESOLUTION*2));
+        if (pairs) {
+            Int24In32ToREACInt24(inBuffer, mbufBuffer, 2*pairs);
+            mbufBuffer += REAC_RESOLUTION*2*pairs;
+            mbufLength -= REAC_RESOLUTION*2*pairs;
+        }
+        else {
+            UInt8 pair[REAC_RESOLUTION*2];
+            Int24In32ToREACInt24(inBuffer, pair, 2);
+            for (UInt32 i=0; i<sizeof(pair); i++) {
+                ensure_mbuf_macro();
+                *mbufBuffer = pair[i];
+                ++mbufBuffer;
+                --mbufLength;
+            }
+            pairs = 1;
+        }
+        
+        inBuffer += sizeof(UInt32)*2*pairs;
+        bytesLeft -= sizeof(UInt32)*2*pairs;
+    }
+    
+    remaining -= wireSize;
+    return kIOReturnSuccess;
+}
+
+IOReturn MbufCursor::copyAudio32ToBuffer(UInt32 bufferSize, UInt8 *outBuffer) {
+    if (0 != bufferSize % (sizeof(UInt32)*2)) {
+        IOLog("MbufCursor::copyAudio32ToBuffer(): Buffer size must be a multiple of %d.\n", (int) sizeof(UInt32)*2);
+        return kIOReturnBadArgument;
+    }
+    
+    const UInt32 wireSize = bufferSize/4*REAC_RESOLUTION;
+    if (wireSize > remaining) {
+        IOLog("MbufCursor::copyAudio32ToBuffer(): Got insufficiently large buffer (mbuf too small).\n");
+        return kIOReturnNoMemory;
+    }
+    
+    UInt32 bytesLeft = bufferSize;
+    
+    // A segment at a time, as in copyAudio32FromBuffer
+    while (bytesLeft) {
+        ensure_mbuf_macro();
+        UInt32 pairs = min_macro(bytesLeft/(sizeof(UInt32)*2), (UInt32) mbufLength/(REAC_RESOLUTION*2));
+        if (pairs) {
+            REACInt24ToInt24In32(mbufBuffer, outBuffer, 2*pairs);
+            mbufBuffer += REAC_RESOLUTION*2*pairs;
+            mbufLength -= REAC_RESOLUTION*2*pairs;
+        }
+        else {
+            UInt8 pair[REAC_RESOLUTION*2];
+            for (UInt32 i=0; i<sizeof(pair); i++) {
+                ensure_mbuf_macro();
+                pair[i] = *mbufBuffer;
+                ++mbufBuffer;
+                --mbufLength;
+            }
+            REACInt24ToInt24In32(pair, outBuffer, 2);
+            pairs = 1;
         }
         
-        inBuffer[0] = intermediaryBuffer[1];
-        inBuffer[1] = intermediaryBuffer[0];
-        inBuffer[2] = intermediaryBuffer[3];
+        outBuffer += sizeof(UInt32)*2*pairs;
+        bytesLeft -= sizeof(UInt32)*2*pairs;
+    }
+    
+    remaining -= wireSize;
+    return kIOReturnSuccess;
+}
+
+IOReturn MbufCursor::copyRoutedAudioToBuffer(UInt32 wireChannels, const UInt8 *routing, UInt32 numRouted, bool int32,
+                                             UInt32 bufferSize, UInt8 *outBuffer) {
+    const UInt32 resolution = (int32 ? sizeof(UInt32) : REAC_RESOLUTION);
+    const UInt32 frameSize = wireChannels*REAC_RESOLUTION;
+    
+    if (0 == numRouted || 0 != wireChannels % 2 || wireChannels > REAC_MAX_CHANNEL_COUNT ||
+        0 != bufferSize % (numRouted*resolution)) {
+        IOLog("MbufCursor::copyRoutedAudioToBuffer(): Invalid channel counts or buffer size.\n");
+        return kIOReturnBadArgument;
+    }
+    
+    const UInt32 numFrames = bufferSize / (numRouted*resolution);
+    
+    if (numFrames*frameSize > remaining) {
+        IOLog("MbufCursor::copyRoutedAudioToBuffer(): Got insufficiently large buffer (mbuf too small).\n");
+        return kIOReturnNoMemory;
+    }
+    
+    for (UInt32 i=0; i<numRouted; i++) {
+        if (routing[i] >= wireChannels) {
+            IOLog("MbufCursor::copyRoutedAudioToBuffer(): Routed channel %d is out of range.\n", routing[i]+1);
+            return kIOReturnBadArgument;
+        }
+    }
+    
+    UInt8 frameBuffer[REAC_MAX_CHANNEL_COUNT*REAC_RESOLUTION];
+    
+    for (UInt32 frame=0; frame<numFrames; frame++) {
+        const UInt8 *wireFrame;
         
-        inBuffer[3] = intermediaryBuffer[2];
-        inBuffer[4] = intermediaryBuffer[5];
-        inBuffer[5] = intermediaryBuffer[4];
+        ensure_mbuf_macro();
+        if (mbufLength >= frameSize) {
+            // The whole frame is in this mbuf; only the routed samples are read
+            wireFrame = mbufBuffer;
+            mbufBuffer += frameSize;
+            mbufLength -= frameSize;
+        }
+        else {
+            // The frame continues in the next mbuf; gather it first
+            UInt32 gathered = 0;
+            while (gathered < frameSize) {
+                ensure_mbuf_macro();
+                UInt32 len = min_macro(frameSize-gathered, (UInt32) mbufLength);
+                memcpy(frameBuffer+gathered, mbufBuffer, len);
+                gathered += len;
+                mbufBuffer += len;
+                mbufLength -= len;
+            }
+            wireFrame = frameBuffer;
+        }
         
-        inBuffer += REAC_RESOLUTION*2;
+        // The samples are swizzled as in copyAudioToBuffer, which works on pairs of them
+        for (UInt32 i=0; i<numRouted; i++) {
+            const UInt8 *pair = wireFrame + routing[i]/2*REAC_RESOLUTION*2;
+            UInt8 *sample = (int32 ? outBuffer+1 : outBuffer);
+            
+            if (int32) {
+                outBuffer[0] = 0;
+            }
+            if (routing[i] % 2) {
+                sample[0] = pair[2];
+                sample[1] = pair[5];
+                sample[2] = pair[4];
+            }
+            else {
+                sample[0] = pair[1];
+                sample[1] = pair[0];
+                sample[2] = pair[3];
+            }
+            outBuffer += resolution;
+        }
     }
     
+    remaining -= numFrames*frameSize;
     return kIOReturnSuccess;
 }
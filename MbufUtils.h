@@ -33,6 +33,7 @@
 #include <sys/kpi_mbuf.h>
 
 #define MbufUtils          com_pereckerdal_driver_MbufUtils
+#define MbufCursor         com_pereckerdal_driver_MbufCursor
 
 // TODO Private constructor?
 class MbufUtils {
@@ -48,6 +49,52 @@ public:
     static IOReturn copyFromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, void *inBuffer);
     static IOReturn copyAudioFromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer);
     static IOReturn copyAudioFromMbufToBuffer(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer);
+    // Like copyAudioFromBufferToMbuf and copyAudioFromMbufToBuffer, but for buffers that hold the 24 bit
+    // samples in the high bytes of native endian 32 bit ints. bufferSize is the size of the buffer, which
+    // is 4/3 of the number of bytes in the mbuf.
+    static IOReturn copyAudio32FromBufferToMbuf(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer);
+    static IOReturn copyAudio32FromMbufToBuffer(mbuf_t mbuf, UInt32 from, UInt32 bufferSize, UInt8 *inBuffer);
+    // Copies the samples of the wire channels in routing (0 based, numRouted of them) out of frames of
+    // wireChannels samples, so that each frame of the buffer holds numRouted samples in that order.
+    // The other channels are skipped. The buffer holds packed 24 bit native endian ints, or with int32
+    // the layout of copyAudio32FromMbufToBuffer; bufferSize has to be whole frames of it.
+    static IOReturn copyRoutedAudioFromMbufToBuffer(mbuf_t mbuf, UInt32 from, UInt32 wireChannels,
+                                                    const UInt8 *routing, UInt32 numRouted, bool int32,
+                                                    UInt32 bufferSize, UInt8 *inBuffer);
+};
+
+// A position in an mbuf chain that moves forward as it is read or written, so that a packet is built
+// or parsed in one pass over the chain instead of walking it from the start for each part. Each
+// function works like the MbufUtils function of the same name, starting where the previous one
+// stopped. After a failure, the position is undefined.
+class MbufCursor {
+public:
+    // Walks the segment lengths of the chain once, and moves to from
+    IOReturn init(mbuf_t mbuf, UInt32 from = 0);
+    // The number of bytes between the position and the end of the chain
+    UInt32 getRemaining() const { return remaining; }
+    
+    IOReturn skip(UInt32 len);
+    IOReturn zero(UInt32 numBytes);
+    IOReturn copyFromBuffer(UInt32 bufferSize, const void *inBuffer);
+    IOReturn copyToBuffer(UInt32 bufferSize, void *outBuffer);
+    // Copies the last bufferSize bytes of the chain, without moving
+    IOReturn copyEndToBuffer(UInt32 bufferSize, void *outBuffer) const;
+    IOReturn copyAudioFromBuffer(UInt32 bufferSize, const UInt8 *inBuffer);
+    IOReturn copyAudioToBuffer(UInt32 bufferSize, UInt8 *outBuffer);
+    IOReturn copyAudio32FromBuffer(UInt32 bufferSize, const UInt8 *inBuffer);
+    IOReturn copyAudio32ToBuffer(UInt32 bufferSize, UInt8 *outBuffer);
+    IOReturn copyRoutedAudioToBuffer(UInt32 wireChannels, const UInt8 *routing, UInt32 numRouted, bool int32,
+                                     UInt32 bufferSize, UInt8 *outBuffer);
+    
+private:
+    mbuf_t mbuf;            // The segment of the position
+    UInt8 *mbufBuffer;      // The position
+    size_t mbufLength;      // The bytes left in the segment
+    UInt32 remaining;       // The bytes left in the chain
+    mbuf_t head;
+    mbuf_t tail;            // The last segment that isn't empty
+    UInt32 totalLength;
 };
 
 
@@ -50,13 +50,55 @@
 #include "FPU.h"
 #include "PCMBlitterLib.h"
 #include <xmmintrin.h>
-#include <libkern/OSByteOrder.h>
+
+#if defined(__APPLE__)
+	#include <libkern/OSByteOrder.h>
+#else
+	// user space builds on other hosts
+	#define OSReadBigInt16(base, offset)		((SInt16)__builtin_bswap16(*(const UInt16 *)((const UInt8 *)(base) + (offset))))
+	#define OSReadBigInt32(base, offset)		((SInt32)__builtin_bswap32(*(const UInt32 *)((const UInt8 *)(base) + (offset))))
+	#define OSWriteBigInt16(base, offset, data)	(*(UInt16 *)((UInt8 *)(base) + (offset)) = __builtin_bswap16((UInt16)(data)))
+	#define OSWriteBigInt32(base, offset, data)	(*(UInt32 *)((UInt8 *)(base) + (offset)) = __builtin_bswap32((UInt32)(data)))
+#endif
+
+// The AVX2 blitters need a compiler that can target AVX2 for single functions
+#if defined(__x86_64__) && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+	#define PCMBLITTER_HAVE_AVX2 1
+	#include <immintrin.h>
+	#define PCM_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define PCMBLITTER_HAVE_AVX2 0
+#endif
+
+// The AVX-512 VBMI blitters also need the VBMI intrinsics. They are left out of the kext: xnu sets
+// XCR0 per thread and only enables the AVX-512 state for a thread once it has used it, so the XCR0
+// that PCMBlitterLibCPULevel reads on the thread that loads the kext says nothing about the HAL
+// client threads that clipOutputSamples and convertInputSamples run on, where an AVX-512
+// instruction without that state is a #UD in the kernel. The AVX state is always enabled when the
+// CPU has AVX, so the AVX2 blitters are safe on any thread.
+#if PCMBLITTER_HAVE_AVX2 && !KERNEL && ((defined(__clang__) && __clang_major__ >= 4) || (!defined(__clang__) && __GNUC__ >= 6))
+	#define PCMBLITTER_HAVE_AVX512VBMI 1
+	#define PCM_TARGET_AVX512VBMI __attribute__((target("avx512f,avx512bw,avx512vbmi")))
+#else
+	#define PCMBLITTER_HAVE_AVX512VBMI 0
+#endif
 
 #define kMaxFloat32 2147483520.0f
 	// this is the biggest floating point number that result from a 32-bit int (bits are lost)
 	// it's 2^31 - 128
 #define kTwoToMinus31 ((Float32)(1.0/2147483648.0))
 
+// ____________________________________________________________
+// FloatToInt
+// N.B. Functions which use this should invoke SET_ROUNDMODE / RESTORE_ROUNDMODE.
+// Rounds in the current (-Inf) mode and clips high to kMaxFloat32 like the vector
+// code does, so the scalar cleanup gives the same results as the vector loops.
+static inline SInt32 FloatToInt(double inf, double max32)
+{
+	if (inf >= max32) return (SInt32)kMaxFloat32;
+	return _mm_cvtsd_si32(_mm_set_sd(inf));	// x86 saturates low (and NaN) by itself
+}
+
 
 static inline __m128i  byteswap16( __m128i v )
 {
@@ -87,6 +129,8 @@ void Float32ToNativeInt16_X86( const Float32 *src, SInt16 *dst, unsigned int num
 		// vector -- requires 8+ samples
 		ROUNDMODE_NEG_INF
 		const __m128 vround = (const __m128) { 0.5f, 0.5f, 0.5f, 0.5f };
+		const __m128 vmin = (const __m128) { -32768.0f, -32768.0f, -32768.0f, -32768.0f };
+		const __m128 vmax = (const __m128) { 32767.0f, 32767.0f, 32767.0f, 32767.0f };
 		const __m128 vscale = (const __m128) { 32768.0f, 32768.0f, 32768.0f, 32768.0f  };
 		__m128 vf0, vf1;
 		__m128i vi0, vi1, vpack0;
@@ -96,10 +140,14 @@ void Float32ToNativeInt16_X86( const Float32 *src, SInt16 *dst, unsigned int num
 		vf1 = _mm_mul_ps(vf1, vscale);			\
 		vf0 = _mm_add_ps(vf0, vround);			\
 		vf1 = _mm_add_ps(vf1, vround);			\
+		vf0 = _mm_max_ps(vf0, vmin);			\
+		vf1 = _mm_max_ps(vf1, vmin);			\
+		vf0 = _mm_min_ps(vf0, vmax);			\
+		vf1 = _mm_min_ps(vf1, vmax);			\
 		vi0 = _mm_cvtps_epi32(vf0);			\
 		vi1 = _mm_cvtps_epi32(vf1);			\
 		vpack0 = _mm_packs_epi32(vi0, vi1);
-			// mm_packs_epi32 saturates
+			// clip before converting; out of range floats would convert to 0x80000000
 
 		if (falign != 0 || ialign != 0) {
 			// do one unaligned conversion
@@ -158,13 +206,13 @@ VectorCleanup:
 Scalar:
 	// scalar for small numbers of samples
 	if (count > 0) {
-		double scale = 2147483648.0, round = 32768.0, max32 = 2147483648.0 - 1.0 - 32768.0, min32 = 0.;
+		double scale = 2147483648.0, round = 32768.0, max32 = 2147483648.0 - 1.0 - 32768.0;
 		SET_ROUNDMODE
 		
 		while (count-- > 0) {
 			double f0 = *src++;
 			f0 = f0 * scale + round;
-			SInt32 i0 = FloatToInt(f0, min32, max32);
+			SInt32 i0 = FloatToInt(f0, max32);
 			i0 >>= 16;
 			*dst++ = i0;
 		}
@@ -189,6 +237,8 @@ void Float32ToSwapInt16_X86( const Float32 *src, SInt16 *dst, unsigned int numTo
 
 		ROUNDMODE_NEG_INF
 		const __m128 vround = (const __m128) { 0.5f, 0.5f, 0.5f, 0.5f };
+		const __m128 vmin = (const __m128) { -32768.0f, -32768.0f, -32768.0f, -32768.0f };
+		const __m128 vmax = (const __m128) { 32767.0f, 32767.0f, 32767.0f, 32767.0f };
 		const __m128 vscale = (const __m128) { 32768.0f, 32768.0f, 32768.0f, 32768.0f  };
 		__m128 vf0, vf1;
 		__m128i vi0, vi1, vpack0;
@@ -198,11 +248,15 @@ void Float32ToSwapInt16_X86( const Float32 *src, SInt16 *dst, unsigned int numTo
 		vf1 = _mm_mul_ps(vf1, vscale);			\
 		vf0 = _mm_add_ps(vf0, vround);			\
 		vf1 = _mm_add_ps(vf1, vround);			\
+		vf0 = _mm_max_ps(vf0, vmin);			\
+		vf1 = _mm_max_ps(vf1, vmin);			\
+		vf0 = _mm_min_ps(vf0, vmax);			\
+		vf1 = _mm_min_ps(vf1, vmax);			\
 		vi0 = _mm_cvtps_epi32(vf0);			\
 		vi1 = _mm_cvtps_epi32(vf1);			\
 		vpack0 = _mm_packs_epi32(vi0, vi1);		\
 		vpack0 = byteswap16(vpack0);
-			// mm_packs_epi32 saturates
+			// clip before converting; out of range floats would convert to 0x80000000
 
 		if (falign != 0 || ialign != 0) {
 			// do one unaligned conversion
@@ -261,13 +315,13 @@ VectorCleanup:
 	// scalar for small numbers of samples
 Scalar:
 	if (count > 0) {
-		double scale = 2147483648.0, round = 32768.0, max32 = 2147483648.0 - 1.0 - 32768.0, min32 = 0.;
+		double scale = 2147483648.0, round = 32768.0, max32 = 2147483648.0 - 1.0 - 32768.0;
 		SET_ROUNDMODE
 		
 		while (count-- > 0) {
 			double f0 = *src++;
 			f0 = f0 * scale + round;
-			SInt32 i0 = FloatToInt(f0, min32, max32);
+			SInt32 i0 = FloatToInt(f0, max32);
 			i0 >>= 16;
 			OSWriteBigInt16(dst++, 0, i0);
 		}
@@ -357,13 +411,13 @@ VectorCleanup:
 	// scalar for small numbers of samples
 Scalar:
 	if (count > 0) {
-		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5, min32 = 0.;
+		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5;
 		SET_ROUNDMODE
 		
 		while (count-- > 0) {
 			double f0 = *src++;
 			f0 = f0 * scale + round;
-			SInt32 i0 = FloatToInt(f0, min32, max32);
+			SInt32 i0 = FloatToInt(f0, max32);
 			*dst++ = i0;
 		}
 		RESTORE_ROUNDMODE
@@ -453,13 +507,13 @@ VectorCleanup:
 	// scalar for small numbers of samples
 Scalar:
 	if (count > 0) {
-		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5, min32 = 0.;
+		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5;
 		SET_ROUNDMODE
 		
 		while (count-- > 0) {
 			double f0 = *src++;
 			f0 = f0 * scale + round;
-			SInt32 i0 = FloatToInt(f0, min32, max32);
+			SInt32 i0 = FloatToInt(f0, max32);
 			OSWriteBigInt32(dst++, 0, i0);
 		}
 		RESTORE_ROUNDMODE
@@ -818,10 +872,9 @@ Scalar:
 
 #pragma mark -
 
-// load 4 24-bit packed little-endian ints into the high 24 bits of 4 32-bit ints
-static inline __m128i UnpackLE24To32(const UInt8 *loadAddr, __m128i mask)
+// move 4 24-bit packed little-endian ints into the high 24 bits of 4 32-bit ints
+static inline __m128i UnpackLE24To32(__m128i load, __m128i mask)
 {
-	__m128i load = _mm_loadu_si128((__m128i *)loadAddr);
 	__m128i result;
 	
 	load = _mm_slli_si128(load, 1);
@@ -838,6 +891,12 @@ static inline __m128i UnpackLE24To32(const UInt8 *loadAddr, __m128i mask)
 	return result;
 }
 
+// load 4 24-bit packed little-endian ints into the high 24 bits of 4 32-bit ints
+static inline __m128i UnpackLE24To32(const UInt8 *loadAddr, __m128i mask)
+{
+	return UnpackLE24To32(_mm_loadu_si128((__m128i *)loadAddr), mask);
+}
+
 void NativeInt24ToFloat32_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert )
 {
 	const UInt8 *src0 = src;
@@ -1166,13 +1225,13 @@ void Float32ToNativeInt24_X86( const Float32 *src, UInt8 *dst, unsigned int numT
 	// scalar for small numbers of samples
 Scalar:
 	if (count > 0) {
-		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5, min32 = 0.;
+		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5;
 		SET_ROUNDMODE
 		
 		while (count-- > 0) {
 			double f0 = *src++;
 			f0 = f0 * scale + round;
-			UInt32 i0 = FloatToInt(f0, min32, max32);
+			UInt32 i0 = FloatToInt(f0, max32);
 			dst[0] = (UInt8)(i0 >> 8);
 			dst[1] = (UInt8)(i0 >> 16);
 			dst[2] = (UInt8)(i0 >> 24);
@@ -1263,13 +1322,13 @@ void Float32ToSwapInt24_X86( const Float32 *src, UInt8 *dst, unsigned int numToC
 	
 	// scalar for small numbers of samples
 	if (count > 0) {
-		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5, min32 = 0.;
+		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5;
 		SET_ROUNDMODE
 		
 		while (count-- > 0) {
 			double f0 = *src++;
 			f0 = f0 * scale + round;
-			UInt32 i0 = FloatToInt(f0, min32, max32);
+			UInt32 i0 = FloatToInt(f0, max32);
 			dst[0] = (UInt8)(i0 >> 24);
 			dst[1] = (UInt8)(i0 >> 16);
 			dst[2] = (UInt8)(i0 >> 8);
@@ -1279,6 +1338,2565 @@ void Float32ToSwapInt24_X86( const Float32 *src, UInt8 *dst, unsigned int numToC
 	}
 }
 
+// ===================================================================================================
+#pragma mark -
+#pragma mark REAC wire order
+
+// REAC sends 24-bit little-endian samples with the bytes of every 16-bit word swapped; a pair of
+// samples (bytes 0-5 in little-endian order) goes on the wire as 1, 0, 3, 2, 5, 4. Starting from
+// an even sample, that is just a 16-bit byte swap of the packed little-endian stream, so these
+// blitters add a byteswap16 to the little-endian ones. They require an even number of samples.
+
+// load 4 24-bit packed ints in REAC wire order into the high 24 bits of 4 32-bit ints
+// loadAddr has to be at an even sample
+static inline __m128i UnpackREAC24To32(const UInt8 *loadAddr, __m128i mask)
+{
+	__m128i load = byteswap16(_mm_loadu_si128((__m128i *)loadAddr));
+	__m128i result;
+	
+	load = _mm_slli_si128(load, 1);
+	result = _mm_and_si128(load, mask);
+
+	mask = _mm_slli_si128(mask, 3);
+	result = _mm_or_si128(result, _mm_slli_si128(_mm_and_si128(load, mask), 1));
+	
+	mask = _mm_slli_si128(mask, 3);
+	result = _mm_or_si128(result, _mm_slli_si128(_mm_and_si128(load, mask), 2));
+	
+	mask = _mm_slli_si128(mask, 3);
+	result = _mm_or_si128(result, _mm_slli_si128(_mm_and_si128(load, mask), 3));
+	return result;
+}
+
+void REACInt24ToFloat32_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert )
+{
+	const UInt8 *src0 = src;
+	Float32 *dst0 = dst;
+	unsigned int count = numToConvert;
+
+	if (count >= 6) {
+		// vector -- requires 6+ samples (18 source bytes)
+		// The loads have to start at even samples, so this uses unaligned stores throughout.
+		const __m128 vscale = (const __m128) { kTwoToMinus31, kTwoToMinus31, kTwoToMinus31, kTwoToMinus31  };
+		const __m128i mask = _mm_setr_epi32(0xFFFFFF00, 0, 0, 0);
+		__m128 vf0;
+		__m128i vi0;
+
+		union {
+			UInt32 i[4];
+			__m128i v;
+		} u;
+	
+		while (count >= 6) {
+			vi0 = UnpackREAC24To32(src, mask);
+			LEI32TOF32(0)
+			_mm_storeu_ps(dst, vf0);
+			src += 3*4;
+			dst += 4;
+			count -= 4;
+		}
+
+		if (count >= 4) {
+			u.i[0] = ((UInt32 *)src)[0];
+			u.i[1] = ((UInt32 *)src)[1];
+			u.i[2] = ((UInt32 *)src)[2];
+			vi0 = UnpackREAC24To32((UInt8 *)u.i, mask);
+			LEI32TOF32(0)
+			_mm_storeu_ps(dst, vf0);
+			src += 3*4;
+			dst += 4;
+			count -= 4;
+		}
+		
+		if (count > 0) {
+			// unaligned cleanup -- just do one unaligned vector at the end
+			src = src0 + 3*numToConvert - 12;
+			dst = dst0 + numToConvert - 4;
+			u.i[0] = ((UInt32 *)src)[0];
+			u.i[1] = ((UInt32 *)src)[1];
+			u.i[2] = ((UInt32 *)src)[2];
+			vi0 = UnpackREAC24To32((UInt8 *)u.i, mask);
+			LEI32TOF32(0)
+			_mm_storeu_ps(dst, vf0);
+		}
+		return;
+	}
+	// scalar for small numbers of samples
+	if (count > 0) {
+		double scale = 1./8388608.0f;
+		while (count >= 2) {
+			SInt32 i0 = ((signed char)src[3] << 16) | (src[0] << 8) | src[1];
+			SInt32 i1 = ((signed char)src[4] << 16) | (src[5] << 8) | src[2];
+			dst[0] = (Float32)((double)i0 * scale);
+			dst[1] = (Float32)((double)i1 * scale);
+			src += 6;
+			dst += 2;
+			count -= 2;
+		}
+	}
+}
+
+void Float32ToREACInt24_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	const Float32 *src0 = src;
+	UInt8 *dst0 = dst;
+	unsigned int count = numToConvert;
+	
+	if (count >= 6) {
+		// vector -- requires 6+ samples
+		// The stores have to start at even samples, so instead of aligning the source floats
+		// like the other blitters do, this uses unaligned loads throughout.
+		ROUNDMODE_NEG_INF
+		const __m128 vround = (const __m128) { 0.5f, 0.5f, 0.5f, 0.5f };
+		const __m128 vmin = (const __m128) { -2147483648.0f, -2147483648.0f, -2147483648.0f, -2147483648.0f };
+		const __m128 vmax = (const __m128) { kMaxFloat32, kMaxFloat32, kMaxFloat32, kMaxFloat32  };
+		const __m128 vscale = (const __m128) { 2147483648.0f, 2147483648.0f, 2147483648.0f, 2147483648.0f  };
+		__m128i mask = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+
+		__m128i store;
+		union {
+			UInt32 i[4];
+			__m128i v;
+		} u;
+
+		__m128 vf0;
+		__m128i vi0;
+
+		while (count >= 6) {
+			vf0 = _mm_loadu_ps(src);
+			F32TOLE32(0)
+			store = byteswap16(Pack32ToLE24(vi0, mask));
+			_mm_storeu_si128((__m128i *)dst, store);
+			
+			src += 4;
+			dst += 12;	// bytes
+			count -= 4;
+		}
+		
+		if (count >= 4) {
+			vf0 = _mm_loadu_ps(src);
+			F32TOLE32(0)
+			u.v = byteswap16(Pack32ToLE24(vi0, mask));
+			((UInt32 *)dst)[0] = u.i[0];
+			((UInt32 *)dst)[1] = u.i[1];
+			((UInt32 *)dst)[2] = u.i[2];
+			
+			src += 4;
+			dst += 12;	// bytes
+			count -= 4;
+		}
+
+		if (count > 0) {
+			// unaligned cleanup -- just do one unaligned vector at the end
+			src = src0 + numToConvert - 4;
+			dst = dst0 + 3*numToConvert - 12;
+			vf0 = _mm_loadu_ps(src);
+			F32TOLE32(0)
+			u.v = byteswap16(Pack32ToLE24(vi0, mask));
+			((UInt32 *)dst)[0] = u.i[0];
+			((UInt32 *)dst)[1] = u.i[1];
+			((UInt32 *)dst)[2] = u.i[2];
+		}
+		RESTORE_ROUNDMODE
+		return;
+	}
+	
+	// scalar for small numbers of samples
+	if (count > 0) {
+		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5;
+		SET_ROUNDMODE
+		
+		while (count >= 2) {
+			double f0 = src[0], f1 = src[1];
+			f0 = f0 * scale + round;
+			f1 = f1 * scale + round;
+			UInt32 i0 = FloatToInt(f0, max32);
+			UInt32 i1 = FloatToInt(f1, max32);
+			dst[0] = (UInt8)(i0 >> 16);
+			dst[1] = (UInt8)(i0 >> 8);
+			dst[2] = (UInt8)(i1 >> 8);
+			dst[3] = (UInt8)(i0 >> 24);
+			dst[4] = (UInt8)(i1 >> 24);
+			dst[5] = (UInt8)(i1 >> 16);
+			src += 2;
+			dst += 6;
+			count -= 2;
+		}
+		RESTORE_ROUNDMODE
+	}
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Channel gains
+
+// The gain blitters multiply each sample by the gain of its channel while it is in a register, so
+// applying volume costs no extra pass over the buffers. They share the vector loops of the plain
+// blitters, and with all gains at 1.0 they give the same results. Float32 to int conversions
+// multiply by the gains while rounding to -Inf, so the products can be 1 ulp lower than they would
+// be in the default rounding mode.
+
+void PCMChannelGainsSet( PCMChannelGains *gains, unsigned int numChannels, const Float32 *gain, const Float32 *step )
+{
+	if (numChannels < 1) numChannels = 1;
+	if (numChannels > kPCMMaxGainChannels) numChannels = kPCMMaxGainChannels;
+	
+	gains->numChannels = numChannels;
+	gains->ramping = 0;
+	for (unsigned int k = 0; k < kPCMMaxGainChannels + kPCMGainTablePadding; k++) {
+		unsigned int channel = k % numChannels;
+		gains->gain[k] = gain[channel];
+		gains->step[k] = (NULL != step) ? step[channel] : 0.f;
+		gains->frame[k] = (Float32)(k / numChannels);
+		if (0.f != gains->step[k])
+			gains->ramping = 1;
+	}
+}
+
+// Tracks which channel and frame the sample at the current position of a gain blitter belongs to
+struct PCMGainCursor {
+	const PCMChannelGains *gains;
+	unsigned int channel;
+	Float32 frame;
+	
+	PCMGainCursor(const PCMChannelGains *g, Float32 firstFrame) : gains(g), channel(0), frame(firstFrame) {}
+	
+	void Advance(unsigned int samples)
+	{
+		channel += samples;
+		while (channel >= gains->numChannels) {
+			channel -= gains->numChannels;
+			frame += 1.f;
+		}
+	}
+	
+	// Moves to sample number sample of a buffer that starts at frame firstFrame
+	void Seek(Float32 firstFrame, unsigned int sample)
+	{
+		channel = sample % gains->numChannels;
+		frame = firstFrame + (Float32)(sample / gains->numChannels);
+	}
+	
+	// The gain of sample i from the current position. The vector versions do the same operations.
+	Float32 Gain(unsigned int i) const
+	{
+		Float32 g = gains->gain[channel + i];
+		if (gains->ramping)
+			g = g + gains->step[channel + i] * (frame + gains->frame[channel + i]);
+		return g;
+	}
+	
+	__m128 Gain4() const
+	{
+		__m128 vg = _mm_loadu_ps(gains->gain + channel);
+		if (gains->ramping) {
+			__m128 vframe = _mm_add_ps(_mm_set1_ps(frame), _mm_loadu_ps(gains->frame + channel));
+			vg = _mm_add_ps(vg, _mm_mul_ps(_mm_loadu_ps(gains->step + channel), vframe));
+		}
+		return vg;
+	}
+};
+
+// kPCMInt24High32 is only used by the dithering blitters: native 32-bit ints with the sample in the high 24 bits
+enum PCMInt24Order { kPCMInt24Native, kPCMInt24Swap, kPCMInt24REAC, kPCMInt24High32 };
+
+template <int kOrder>
+static inline __m128i UnpackInt24To32(const UInt8 *loadAddr)
+{
+	if (kPCMInt24Native == kOrder)
+		return UnpackLE24To32(loadAddr, _mm_setr_epi32(0xFFFFFF00, 0, 0, 0));
+	else if (kPCMInt24Swap == kOrder)
+		return UnpackBE24To32(loadAddr, _mm_setr_epi32(0xFFFFFF, 0, 0, 0));
+	else
+		return UnpackREAC24To32(loadAddr, _mm_setr_epi32(0xFFFFFF00, 0, 0, 0));
+}
+
+template <int kOrder>
+static inline __m128i Pack32ToInt24(__m128i val)
+{
+	if (kPCMInt24Native == kOrder)
+		return Pack32ToLE24(val, _mm_setr_epi32(0x00FFFFFF, 0, 0, 0));
+	else if (kPCMInt24Swap == kOrder)
+		return Pack32ToBE24(val);
+	else
+		return byteswap16(Pack32ToLE24(val, _mm_setr_epi32(0x00FFFFFF, 0, 0, 0)));
+}
+
+// Reads sample i of a buffer of packed 24-bit ints (i has to be even for every other REAC sample)
+template <int kOrder>
+static inline SInt32 ReadInt24(const UInt8 *src, unsigned int i)
+{
+	if (kPCMInt24Native == kOrder) {
+		src += 3*i;
+		return ((signed char)src[2] << 16) | (src[1] << 8) | src[0];
+	}
+	else if (kPCMInt24Swap == kOrder) {
+		src += 3*i;
+		return ((signed char)src[0] << 16) | (src[1] << 8) | src[2];
+	}
+	else {
+		src += 3*(i & ~1U);
+		if (0 == (i & 1))
+			return ((signed char)src[3] << 16) | (src[0] << 8) | src[1];
+		else
+			return ((signed char)src[4] << 16) | (src[5] << 8) | src[2];
+	}
+}
+
+// Writes the high 24 bits of val as sample i
+template <int kOrder>
+static inline void WriteInt24(UInt8 *dst, unsigned int i, UInt32 val)
+{
+	if (kPCMInt24Native == kOrder) {
+		dst += 3*i;
+		dst[0] = (UInt8)(val >> 8);
+		dst[1] = (UInt8)(val >> 16);
+		dst[2] = (UInt8)(val >> 24);
+	}
+	else if (kPCMInt24Swap == kOrder) {
+		dst += 3*i;
+		dst[0] = (UInt8)(val >> 24);
+		dst[1] = (UInt8)(val >> 16);
+		dst[2] = (UInt8)(val >> 8);
+	}
+	else {
+		dst += 3*(i & ~1U);
+		if (0 == (i & 1)) {
+			dst[1] = (UInt8)(val >> 8);
+			dst[0] = (UInt8)(val >> 16);
+			dst[3] = (UInt8)(val >> 24);
+		}
+		else {
+			dst[2] = (UInt8)(val >> 8);
+			dst[5] = (UInt8)(val >> 16);
+			dst[4] = (UInt8)(val >> 24);
+		}
+	}
+}
+
+template <int kOrder>
+static void Int24ToFloat32Gain_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert,
+	const PCMChannelGains *gains, Float32 firstFrame )
+{
+	PCMGainCursor cursor(gains, firstFrame);
+	unsigned int count = numToConvert;
+
+	if (count >= 6) {
+		// vector -- requires 6+ samples (18 source bytes)
+		const __m128 vscale = (const __m128) { kTwoToMinus31, kTwoToMinus31, kTwoToMinus31, kTwoToMinus31  };
+		__m128 vf0;
+		__m128i vi0;
+		unsigned int i = 0;
+
+		union {
+			UInt32 i[4];
+			__m128i v;
+		} u;
+	
+		// unaligned loads, unaligned stores
+		while (count - i >= 6) {
+			vi0 = UnpackInt24To32<kOrder>(src + 3*i);
+			LEI32TOF32(0)
+			_mm_storeu_ps(dst + i, _mm_mul_ps(vf0, cursor.Gain4()));
+			cursor.Advance(4);
+			i += 4;
+		}
+
+		if (count - i >= 4) {
+			u.i[0] = ((UInt32 *)(src + 3*i))[0];
+			u.i[1] = ((UInt32 *)(src + 3*i))[1];
+			u.i[2] = ((UInt32 *)(src + 3*i))[2];
+			vi0 = UnpackInt24To32<kOrder>((UInt8 *)u.i);
+			LEI32TOF32(0)
+			_mm_storeu_ps(dst + i, _mm_mul_ps(vf0, cursor.Gain4()));
+			i += 4;
+		}
+		
+		if (count > i) {
+			// unaligned cleanup -- just do one unaligned vector at the end
+			i = count - 4;
+			cursor.Seek(firstFrame, i);
+			u.i[0] = ((UInt32 *)(src + 3*i))[0];
+			u.i[1] = ((UInt32 *)(src + 3*i))[1];
+			u.i[2] = ((UInt32 *)(src + 3*i))[2];
+			vi0 = UnpackInt24To32<kOrder>((UInt8 *)u.i);
+			LEI32TOF32(0)
+			_mm_storeu_ps(dst + i, _mm_mul_ps(vf0, cursor.Gain4()));
+		}
+		return;
+	}
+	// scalar for small numbers of samples
+	double scale = 1./8388608.0f;
+	for (unsigned int i = 0; i < count; i++) {
+		Float32 f = (Float32)((double)ReadInt24<kOrder>(src, i) * scale);
+		dst[i] = f * cursor.Gain(0);
+		cursor.Advance(1);
+	}
+}
+
+template <int kOrder>
+static void Float32ToInt24Gain_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert,
+	const PCMChannelGains *gains, Float32 firstFrame )
+{
+	PCMGainCursor cursor(gains, firstFrame);
+	unsigned int count = numToConvert;
+	
+	if (count >= 6) {
+		// vector -- requires 6+ samples
+		ROUNDMODE_NEG_INF
+		const __m128 vround = (const __m128) { 0.5f, 0.5f, 0.5f, 0.5f };
+		const __m128 vmin = (const __m128) { -2147483648.0f, -2147483648.0f, -2147483648.0f, -2147483648.0f };
+		const __m128 vmax = (const __m128) { kMaxFloat32, kMaxFloat32, kMaxFloat32, kMaxFloat32  };
+		const __m128 vscale = (const __m128) { 2147483648.0f, 2147483648.0f, 2147483648.0f, 2147483648.0f  };
+		__m128 vf0;
+		__m128i vi0;
+		unsigned int i = 0;
+
+		union {
+			UInt32 i[4];
+			__m128i v;
+		} u;
+
+		while (count - i >= 6) {
+			vf0 = _mm_mul_ps(_mm_loadu_ps(src + i), cursor.Gain4());
+			F32TOLE32(0)
+			_mm_storeu_si128((__m128i *)(dst + 3*i), Pack32ToInt24<kOrder>(vi0));
+			cursor.Advance(4);
+			i += 4;
+		}
+		
+		if (count - i >= 4) {
+			vf0 = _mm_mul_ps(_mm_loadu_ps(src + i), cursor.Gain4());
+			F32TOLE32(0)
+			u.v = Pack32ToInt24<kOrder>(vi0);
+			((UInt32 *)(dst + 3*i))[0] = u.i[0];
+			((UInt32 *)(dst + 3*i))[1] = u.i[1];
+			((UInt32 *)(dst + 3*i))[2] = u.i[2];
+			i += 4;
+		}
+
+		if (count > i) {
+			// unaligned cleanup -- just do one unaligned vector at the end
+			i = count - 4;
+			cursor.Seek(firstFrame, i);
+			vf0 = _mm_mul_ps(_mm_loadu_ps(src + i), cursor.Gain4());
+			F32TOLE32(0)
+			u.v = Pack32ToInt24<kOrder>(vi0);
+			((UInt32 *)(dst + 3*i))[0] = u.i[0];
+			((UInt32 *)(dst + 3*i))[1] = u.i[1];
+			((UInt32 *)(dst + 3*i))[2] = u.i[2];
+		}
+		RESTORE_ROUNDMODE
+		return;
+	}
+	
+	// scalar for small numbers of samples
+	if (count > 0) {
+		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5;
+		SET_ROUNDMODE
+		
+		for (unsigned int i = 0; i < count; i++) {
+			double f0 = src[i] * cursor.Gain(0);
+			f0 = f0 * scale + round;
+			WriteInt24<kOrder>(dst, i, FloatToInt(f0, max32));
+			cursor.Advance(1);
+		}
+		RESTORE_ROUNDMODE
+	}
+}
+
+void NativeInt24ToFloat32Gain_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Int24ToFloat32Gain_X86<kPCMInt24Native>(src, dst, numToConvert, gains, firstFrame);
+}
+
+void SwapInt24ToFloat32Gain_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Int24ToFloat32Gain_X86<kPCMInt24Swap>(src, dst, numToConvert, gains, firstFrame);
+}
+
+void REACInt24ToFloat32Gain_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Int24ToFloat32Gain_X86<kPCMInt24REAC>(src, dst, numToConvert, gains, firstFrame);
+}
+
+void Float32ToNativeInt24Gain_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToInt24Gain_X86<kPCMInt24Native>(src, dst, numToConvert, gains, firstFrame);
+}
+
+void Float32ToSwapInt24Gain_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToInt24Gain_X86<kPCMInt24Swap>(src, dst, numToConvert, gains, firstFrame);
+}
+
+void Float32ToREACInt24Gain_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToInt24Gain_X86<kPCMInt24REAC>(src, dst, numToConvert, gains, firstFrame);
+}
+
+void NativeInt32ToFloat32Gain_X86( const SInt32 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	PCMGainCursor cursor(gains, firstFrame);
+	unsigned int count = numToConvert;
+
+	if (count >= 4) {
+		// vector -- requires 4+ samples
+		const __m128 vscale = (const __m128) { kTwoToMinus31, kTwoToMinus31, kTwoToMinus31, kTwoToMinus31  };
+		__m128 vf0;
+		__m128i vi0;
+		unsigned int i = 0;
+
+		// unaligned loads, unaligned stores
+		while (count - i >= 4) {
+			vi0 = _mm_loadu_si128((const __m128i *)(src + i));
+			LEI32TOF32(0)
+			_mm_storeu_ps(dst + i, _mm_mul_ps(vf0, cursor.Gain4()));
+			cursor.Advance(4);
+			i += 4;
+		}
+		
+		if (count > i) {
+			// unaligned cleanup -- just do one unaligned vector at the end
+			i = count - 4;
+			cursor.Seek(firstFrame, i);
+			vi0 = _mm_loadu_si128((const __m128i *)(src + i));
+			LEI32TOF32(0)
+			_mm_storeu_ps(dst + i, _mm_mul_ps(vf0, cursor.Gain4()));
+		}
+		return;
+	}
+	// scalar for small numbers of samples
+	for (unsigned int i = 0; i < count; i++) {
+		Float32 f = (Float32)src[i] * kTwoToMinus31;
+		dst[i] = f * cursor.Gain(0);
+		cursor.Advance(1);
+	}
+}
+
+void Float32ToNativeInt32Gain_X86( const Float32 *src, SInt32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	PCMGainCursor cursor(gains, firstFrame);
+	unsigned int count = numToConvert;
+	
+	if (count >= 4) {
+		// vector -- requires 4+ samples
+		ROUNDMODE_NEG_INF
+		const __m128 vround = (const __m128) { 0.5f, 0.5f, 0.5f, 0.5f };
+		const __m128 vmin = (const __m128) { -2147483648.0f, -2147483648.0f, -2147483648.0f, -2147483648.0f };
+		const __m128 vmax = (const __m128) { kMaxFloat32, kMaxFloat32, kMaxFloat32, kMaxFloat32  };
+		const __m128 vscale = (const __m128) { 2147483648.0f, 2147483648.0f, 2147483648.0f, 2147483648.0f  };
+		__m128 vf0;
+		__m128i vi0;
+		unsigned int i = 0;
+
+		while (count - i >= 4) {
+			vf0 = _mm_mul_ps(_mm_loadu_ps(src + i), cursor.Gain4());
+			F32TOLE32(0)
+			_mm_storeu_si128((__m128i *)(dst + i), vi0);
+			cursor.Advance(4);
+			i += 4;
+		}
+
+		if (count > i) {
+			// unaligned cleanup -- just do one unaligned vector at the end
+			i = count - 4;
+			cursor.Seek(firstFrame, i);
+			vf0 = _mm_mul_ps(_mm_loadu_ps(src + i), cursor.Gain4());
+			F32TOLE32(0)
+			_mm_storeu_si128((__m128i *)(dst + i), vi0);
+		}
+		RESTORE_ROUNDMODE
+		return;
+	}
+	
+	// scalar for small numbers of samples
+	if (count > 0) {
+		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5;
+		SET_ROUNDMODE
+		
+		for (unsigned int i = 0; i < count; i++) {
+			double f0 = src[i] * cursor.Gain(0);
+			f0 = f0 * scale + round;
+			dst[i] = FloatToInt(f0, max32);
+			cursor.Advance(1);
+		}
+		RESTORE_ROUNDMODE
+	}
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Gain blitters for a fixed number of channels
+
+// REAC devices have 8, 16, 24, 32 or 40 channels, which are whole vectors of 4 (and of 8 for AVX2).
+// For those, the gain blitters can go through the buffers a frame at a time, with the gains of the
+// frame held in registers: the vectors never straddle two frames, so there is no channel to track
+// and no gain table to load from, and the loop over the vectors of a frame unrolls completely.
+// The arithmetic is that of PCMGainCursor, so they give the same results as the *Gain blitters.
+// They fall back on those if the buffers don't hold whole frames of kNumChannels.
+
+template <int kOrder>
+static inline void Int24ToFloat32Gain_Any( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (kPCMInt24Native == kOrder)
+		NativeInt24ToFloat32Gain(src, dst, numToConvert, gains, firstFrame);
+	else if (kPCMInt24Swap == kOrder)
+		SwapInt24ToFloat32Gain(src, dst, numToConvert, gains, firstFrame);
+	else
+		REACInt24ToFloat32Gain(src, dst, numToConvert, gains, firstFrame);
+}
+
+template <int kOrder>
+static inline void Float32ToInt24Gain_Any( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (kPCMInt24Native == kOrder)
+		Float32ToNativeInt24Gain(src, dst, numToConvert, gains, firstFrame);
+	else if (kPCMInt24Swap == kOrder)
+		Float32ToSwapInt24Gain(src, dst, numToConvert, gains, firstFrame);
+	else
+		Float32ToREACInt24Gain(src, dst, numToConvert, gains, firstFrame);
+}
+
+template <int kOrder, unsigned int kNumChannels, bool kRamping>
+static inline void Int24ToFloat32Frames_X86( const UInt8 *src, Float32 *dst, unsigned int numFrames,
+	const PCMChannelGains *gains, Float32 frame )
+{
+	enum { kVectors = kNumChannels / 4 };
+	const __m128 vscale = (const __m128) { kTwoToMinus31, kTwoToMinus31, kTwoToMinus31, kTwoToMinus31  };
+	const __m128 vzero = _mm_setzero_ps();
+	__m128 vgain[kVectors], vstep[kVectors];
+	__m128 vf0;
+	__m128i vi0;
+
+	union {
+		UInt32 i[4];
+		__m128i v;
+	} u;
+
+	for (unsigned int v = 0; v < kVectors; v++) {
+		vgain[v] = _mm_loadu_ps(gains->gain + 4*v);
+		if (kRamping)
+			vstep[v] = _mm_loadu_ps(gains->step + 4*v);
+	}
+
+	for (unsigned int f = 0; f < numFrames; f++, src += 3*kNumChannels, dst += kNumChannels, frame += 1.f) {
+		__m128 vframe = _mm_add_ps(_mm_set1_ps(frame), vzero);	// the frame table of the gains is all zero here
+		for (unsigned int v = 0; v < kVectors; v++) {
+			if (f + 1 < numFrames || v + 1 < kVectors) {
+				vi0 = UnpackInt24To32<kOrder>(src + 12*v);
+			}
+			else {
+				// the last vector; the load would read 4 bytes past the buffer
+				u.i[0] = ((UInt32 *)(src + 12*v))[0];
+				u.i[1] = ((UInt32 *)(src + 12*v))[1];
+				u.i[2] = ((UInt32 *)(src + 12*v))[2];
+				vi0 = UnpackInt24To32<kOrder>((UInt8 *)u.i);
+			}
+			LEI32TOF32(0)
+			__m128 vg = vgain[v];
+			if (kRamping)
+				vg = _mm_add_ps(vg, _mm_mul_ps(vstep[v], vframe));
+			_mm_storeu_ps(dst + 4*v, _mm_mul_ps(vf0, vg));
+		}
+	}
+}
+
+template <int kOrder, unsigned int kNumChannels>
+static void Int24ToFloat32GainFrames_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert,
+	const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (kNumChannels != gains->numChannels || 0 != numToConvert % kNumChannels) {
+		Int24ToFloat32Gain_Any<kOrder>(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	if (gains->ramping)
+		Int24ToFloat32Frames_X86<kOrder, kNumChannels, true>(src, dst, numToConvert / kNumChannels, gains, firstFrame);
+	else
+		Int24ToFloat32Frames_X86<kOrder, kNumChannels, false>(src, dst, numToConvert / kNumChannels, gains, firstFrame);
+}
+
+template <int kOrder, unsigned int kNumChannels, bool kRamping>
+static inline void Float32ToInt24Frames_X86( const Float32 *src, UInt8 *dst, unsigned int numFrames,
+	const PCMChannelGains *gains, Float32 frame )
+{
+	enum { kVectors = kNumChannels / 4 };
+	const __m128 vround = (const __m128) { 0.5f, 0.5f, 0.5f, 0.5f };
+	const __m128 vmin = (const __m128) { -2147483648.0f, -2147483648.0f, -2147483648.0f, -2147483648.0f };
+	const __m128 vmax = (const __m128) { kMaxFloat32, kMaxFloat32, kMaxFloat32, kMaxFloat32  };
+	const __m128 vscale = (const __m128) { 2147483648.0f, 2147483648.0f, 2147483648.0f, 2147483648.0f  };
+	const __m128 vzero = _mm_setzero_ps();
+	__m128 vgain[kVectors], vstep[kVectors];
+	__m128 vf0;
+	__m128i vi0;
+
+	union {
+		UInt32 i[4];
+		__m128i v;
+	} u;
+
+	for (unsigned int v = 0; v < kVectors; v++) {
+		vgain[v] = _mm_loadu_ps(gains->gain + 4*v);
+		if (kRamping)
+			vstep[v] = _mm_loadu_ps(gains->step + 4*v);
+	}
+
+	// the ramps are computed in this rounding mode as well, as in Float32ToInt24Gain_X86
+	ROUNDMODE_NEG_INF
+	for (unsigned int f = 0; f < numFrames; f++, src += kNumChannels, dst += 3*kNumChannels, frame += 1.f) {
+		__m128 vframe = _mm_add_ps(_mm_set1_ps(frame), vzero);
+		for (unsigned int v = 0; v < kVectors; v++) {
+			__m128 vg = vgain[v];
+			if (kRamping)
+				vg = _mm_add_ps(vg, _mm_mul_ps(vstep[v], vframe));
+			vf0 = _mm_mul_ps(_mm_loadu_ps(src + 4*v), vg);
+			F32TOLE32(0)
+			if (f + 1 < numFrames || v + 1 < kVectors) {
+				_mm_storeu_si128((__m128i *)(dst + 12*v), Pack32ToInt24<kOrder>(vi0));
+			}
+			else {
+				// the last vector; the store would write 4 bytes past the buffer
+				u.v = Pack32ToInt24<kOrder>(vi0);
+				((UInt32 *)(dst + 12*v))[0] = u.i[0];
+				((UInt32 *)(dst + 12*v))[1] = u.i[1];
+				((UInt32 *)(dst + 12*v))[2] = u.i[2];
+			}
+		}
+	}
+	RESTORE_ROUNDMODE
+}
+
+template <int kOrder, unsigned int kNumChannels>
+static void Float32ToInt24GainFrames_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert,
+	const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (kNumChannels != gains->numChannels || 0 != numToConvert % kNumChannels) {
+		Float32ToInt24Gain_Any<kOrder>(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	if (gains->ramping)
+		Float32ToInt24Frames_X86<kOrder, kNumChannels, true>(src, dst, numToConvert / kNumChannels, gains, firstFrame);
+	else
+		Float32ToInt24Frames_X86<kOrder, kNumChannels, false>(src, dst, numToConvert / kNumChannels, gains, firstFrame);
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Dither
+
+// The dithering blitters add TPDF dither of +-1 LSB before rounding, and with kPCMDitherNoiseShaped
+// also feed the rounding error of each sample back into the next sample of the same channel, which
+// moves the noise up towards Nyquist. They go through the buffer one frame at a time, with the
+// channels of a frame in vectors of 4, so that the error of a channel is ready when its sample in
+// the next frame needs it. The random numbers come from xorshift32 generators, one per lane.
+
+// The error that is fed back is limited, so that clipping can't make the noise shaping run away
+static const Float32 kPCMDitherMaxError = 2.0f;
+
+void PCMDitherStateInit( PCMDitherState *state, unsigned int numChannels, int mode )
+{
+	if (numChannels < 1) numChannels = 1;
+	if (numChannels > kPCMMaxDitherChannels) numChannels = kPCMMaxDitherChannels;
+	
+	state->numChannels = numChannels;
+	state->mode = mode;
+	for (unsigned int i = 0; i < 8; i++)
+		state->rng[i] = 0x9E3779B9 * (i + 1);	// any non-zero seeds will do
+	for (unsigned int k = 0; k < kPCMMaxDitherChannels + 4; k++)
+		state->error[k] = 0.f;
+}
+
+static inline __m128i XorShift32x4(__m128i &state)
+{
+	state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+	state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+	state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+	return state;
+}
+
+// TPDF dither in LSBs from 32 random bits: the difference of two uniform 16-bit values
+static inline __m128 TPDFx4(__m128i r)
+{
+	__m128i diff = _mm_sub_epi32(_mm_srli_epi32(r, 16), _mm_and_si128(r, _mm_set1_epi32(0xFFFF)));
+	return _mm_mul_ps(_mm_cvtepi32_ps(diff), _mm_set1_ps(1.f / 65536.f));
+}
+
+// kBits is 16 or 24; kOrder is a PCMInt24Order (only native and swapped for 16 bits, and
+// kPCMInt24High32 only for 24 bits)
+template <int kBits, int kOrder>
+static void Float32ToIntDither_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert,
+	PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	const unsigned int numChannels = dither->numChannels;
+	const unsigned int numFrames = numToConvert / numChannels;
+	const bool shaped = (kPCMDitherNoiseShaped == dither->mode);
+	const __m128 vscale = _mm_set1_ps((Float32)(1 << (kBits - 1)));
+	const __m128 vround = _mm_set1_ps(0.5f);
+	const __m128 vmin = _mm_set1_ps(-(Float32)(1 << (kBits - 1)));
+	const __m128 vmax = _mm_set1_ps((Float32)((1 << (kBits - 1)) - 1));
+	const __m128 vmaxError = _mm_set1_ps(kPCMDitherMaxError);
+	const __m128 vminError = _mm_set1_ps(-kPCMDitherMaxError);
+	// two sets of generators, used by every other vector, so that the xorshift latency is hidden
+	__m128i rng = _mm_loadu_si128((const __m128i *)dither->rng);
+	__m128i rngNext = _mm_loadu_si128((const __m128i *)(dither->rng + 4));
+	__m128 vf, verr;
+	__m128i vi;
+
+	union {
+		UInt32 i[4];
+		SInt16 s[8];
+		__m128i v;
+	} u;
+
+	ROUNDMODE_NEG_INF
+	for (unsigned int frame = 0; frame < numFrames; frame++) {
+		const __m128 vframe = _mm_set1_ps(firstFrame + frame);
+		
+		for (unsigned int channel = 0; channel < numChannels; channel += 4) {
+			const unsigned int i = frame * numChannels + channel;
+			const unsigned int n = (numChannels - channel < 4) ? numChannels - channel : 4;
+			
+			if (4 == n)
+				vf = _mm_loadu_ps(src + i);
+			else {
+				Float32 partial[4] = { 0.f, 0.f, 0.f, 0.f };
+				for (unsigned int k = 0; k < n; k++)
+					partial[k] = src[i + k];
+				vf = _mm_loadu_ps(partial);
+			}
+			
+			if (NULL != gains) {
+				__m128 vg = _mm_loadu_ps(gains->gain + channel);
+				if (gains->ramping)
+					vg = _mm_add_ps(vg, _mm_mul_ps(_mm_loadu_ps(gains->step + channel), vframe));
+				vf = _mm_mul_ps(vf, vg);
+			}
+			
+			// in LSBs from here on
+			vf = _mm_mul_ps(vf, vscale);
+			if (shaped) {
+				verr = _mm_loadu_ps(dither->error + channel);
+				vf = _mm_sub_ps(vf, verr);
+			}
+			verr = _mm_add_ps(vf, TPDFx4(XorShift32x4(rng)));
+			vi = rng;
+			rng = rngNext;
+			rngNext = vi;
+			verr = _mm_add_ps(verr, vround);
+			verr = _mm_max_ps(verr, vmin);
+			verr = _mm_min_ps(verr, vmax);
+			vi = _mm_cvtps_epi32(verr);
+			if (shaped) {
+				verr = _mm_sub_ps(_mm_cvtepi32_ps(vi), vf);
+				verr = _mm_max_ps(verr, vminError);
+				verr = _mm_min_ps(verr, vmaxError);
+				_mm_storeu_ps(dither->error + channel, verr);	// the lanes past numChannels land in the padding
+			}
+			
+			if (kPCMInt24High32 == kOrder) {
+				vi = _mm_slli_epi32(vi, 8);
+				if (4 == n)
+					_mm_storeu_si128((__m128i *)(dst + 4*i), vi);
+				else {
+					u.v = vi;
+					for (unsigned int k = 0; k < n; k++)
+						((UInt32 *)dst)[i + k] = u.i[k];
+				}
+			} else if (24 == kBits) {
+				vi = _mm_slli_epi32(vi, 8);
+				if (4 == n && i + 6 <= numFrames * numChannels) {
+					// the 4 bytes past the samples are overwritten by the next ones
+					_mm_storeu_si128((__m128i *)(dst + 3*i), Pack32ToInt24<kOrder>(vi));
+				} else if (4 == n) {
+					u.v = Pack32ToInt24<kOrder>(vi);
+					((UInt32 *)(dst + 3*i))[0] = u.i[0];
+					((UInt32 *)(dst + 3*i))[1] = u.i[1];
+					((UInt32 *)(dst + 3*i))[2] = u.i[2];
+				} else {
+					u.v = vi;
+					for (unsigned int k = 0; k < n; k++)
+						WriteInt24<kOrder>(dst, i + k, u.i[k]);
+				}
+			} else {
+				vi = _mm_packs_epi32(vi, vi);
+				if (kPCMInt24Swap == kOrder)
+					vi = byteswap16(vi);
+				if (4 == n)
+					_mm_storel_epi64((__m128i *)(dst + 2*i), vi);
+				else {
+					u.v = vi;
+					for (unsigned int k = 0; k < n; k++)
+						((SInt16 *)dst)[i + k] = u.s[k];
+				}
+			}
+		}
+	}
+	RESTORE_ROUNDMODE
+	
+	_mm_storeu_si128((__m128i *)dither->rng, rng);
+	_mm_storeu_si128((__m128i *)(dither->rng + 4), rngNext);
+}
+
+void Float32ToNativeInt16Dither_X86( const Float32 *src, SInt16 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToIntDither_X86<16, kPCMInt24Native>(src, (UInt8 *)dst, numToConvert, dither, gains, firstFrame);
+}
+
+void Float32ToSwapInt16Dither_X86( const Float32 *src, SInt16 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToIntDither_X86<16, kPCMInt24Swap>(src, (UInt8 *)dst, numToConvert, dither, gains, firstFrame);
+}
+
+void Float32ToNativeInt24Dither_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToIntDither_X86<24, kPCMInt24Native>(src, dst, numToConvert, dither, gains, firstFrame);
+}
+
+void Float32ToSwapInt24Dither_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToIntDither_X86<24, kPCMInt24Swap>(src, dst, numToConvert, dither, gains, firstFrame);
+}
+
+void Float32ToREACInt24Dither_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToIntDither_X86<24, kPCMInt24REAC>(src, dst, numToConvert, dither, gains, firstFrame);
+}
+
+void Float32ToNativeInt24In32Dither_X86( const Float32 *src, SInt32 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	Float32ToIntDither_X86<24, kPCMInt24High32>(src, (UInt8 *)dst, numToConvert, dither, gains, firstFrame);
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Meters
+
+// The metering blitters are the gain blitters with the measurements added while the samples are
+// in registers. Vectors start at multiples of 4 samples from the start of the buffer, and since
+// the buffer starts at a frame, sample k of the meter period always belongs to channel
+// k % numChannels. The samples that the vector loops leave over are measured one at a time, into
+// the entries of their positions in the period.
+
+void PCMChannelMetersInit( PCMChannelMeters *meters, unsigned int numChannels )
+{
+	if (numChannels < 1) numChannels = 1;
+	if (numChannels > kPCMMaxMeterChannels) numChannels = kPCMMaxMeterChannels;
+	
+	meters->numChannels = numChannels;
+	meters->period = (0 == numChannels % 4) ? numChannels : (0 == numChannels % 2) ? 2 * numChannels : 4 * numChannels;
+	meters->numSamples = 0;
+	for (unsigned int k = 0; k < 4 * kPCMMaxMeterChannels; k++) {
+		meters->peak[k] = 0.f;
+		meters->squares[k] = 0.f;
+		meters->clipped[k] = 0;
+	}
+}
+
+void PCMChannelMetersRead( PCMChannelMeters *meters, Float32 *peak, Float32 *rms, UInt32 *clipped )
+{
+	unsigned int numChannels = meters->numChannels;
+	unsigned int numFrames = meters->numSamples / numChannels;
+	Float64 squares[kPCMMaxMeterChannels];
+	
+	for (unsigned int c = 0; c < numChannels; c++) {
+		peak[c] = 0.f;
+		squares[c] = 0.;
+		clipped[c] = 0;
+	}
+	for (unsigned int k = 0; k < meters->period; k++) {
+		unsigned int c = k % numChannels;
+		if (meters->peak[k] > peak[c])
+			peak[c] = meters->peak[k];
+		squares[c] += meters->squares[k];
+		clipped[c] += meters->clipped[k];
+		meters->peak[k] = 0.f;
+		meters->squares[k] = 0.f;
+		meters->clipped[k] = 0;
+	}
+	for (unsigned int c = 0; c < numChannels; c++) {
+		Float64 meanSquare = (numFrames > 0) ? squares[c] / numFrames : 0.;
+		rms[c] = (Float32)_mm_cvtsd_f64(_mm_sqrt_sd(_mm_setzero_pd(), _mm_set_sd(meanSquare)));
+	}
+	meters->numSamples = 0;
+}
+
+// Measures the 4 samples of vf at position k of the period (a multiple of 4). NaNs don't count
+// as peaks, because maxps returns its second operand when either one is a NaN.
+static inline void Meter4(PCMChannelMeters *meters, unsigned int k, __m128 vf)
+{
+	const __m128 vabs = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const __m128 vclip = (const __m128) { kPCMMeterClipLevel, kPCMMeterClipLevel, kPCMMeterClipLevel, kPCMMeterClipLevel };
+	__m128 va = _mm_and_ps(vf, vabs);
+	
+	_mm_storeu_ps(meters->peak + k, _mm_max_ps(va, _mm_loadu_ps(meters->peak + k)));
+	_mm_storeu_ps(meters->squares + k, _mm_add_ps(_mm_loadu_ps(meters->squares + k), _mm_mul_ps(vf, vf)));
+	_mm_storeu_si128((__m128i *)(meters->clipped + k),
+		_mm_sub_epi32(_mm_loadu_si128((const __m128i *)(meters->clipped + k)), _mm_castps_si128(_mm_cmpge_ps(va, vclip))));
+}
+
+// The same for one sample
+static inline void Meter1(PCMChannelMeters *meters, unsigned int k, Float32 f)
+{
+	union { Float32 f; UInt32 i; } a;
+	a.f = f;
+	a.i &= 0x7FFFFFFF;
+	if (a.f > meters->peak[k])
+		meters->peak[k] = a.f;
+	meters->squares[k] += f * f;
+	if (a.f >= kPCMMeterClipLevel)
+		meters->clipped[k]++;
+}
+
+// Measures lanes first..3 of vf, which hold samples i..i+3 of the buffer
+static inline void MeterTail(PCMChannelMeters *meters, unsigned int i, unsigned int first, __m128 vf)
+{
+	union {
+		Float32 f[4];
+		__m128 v;
+	} u;
+	u.v = vf;
+	for (unsigned int l = first; l < 4; l++)
+		Meter1(meters, (i + l) % meters->period, u.f[l]);
+}
+
+template <int kOrder, bool kGain>
+static void Int24ToFloat32Meter_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert,
+	const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	PCMGainCursor cursor(gains, firstFrame);
+	unsigned int count = numToConvert;
+	unsigned int period = meters->period;
+
+	meters->numSamples += count;
+	if (count >= 6) {
+		// vector -- requires 6+ samples (18 source bytes)
+		const __m128 vscale = (const __m128) { kTwoToMinus31, kTwoToMinus31, kTwoToMinus31, kTwoToMinus31  };
+		__m128 vf0;
+		__m128i vi0;
+		unsigned int i = 0, k = 0;
+
+		union {
+			UInt32 i[4];
+			__m128i v;
+		} u;
+	
+		// unaligned loads, unaligned stores
+		while (count - i >= 6) {
+			vi0 = UnpackInt24To32<kOrder>(src + 3*i);
+			LEI32TOF32(0)
+			if (kGain) {
+				vf0 = _mm_mul_ps(vf0, cursor.Gain4());
+				cursor.Advance(4);
+			}
+			_mm_storeu_ps(dst + i, vf0);
+			Meter4(meters, k, vf0);
+			k += 4;
+			if (k == period) k = 0;
+			i += 4;
+		}
+
+		if (count - i >= 4) {
+			u.i[0] = ((UInt32 *)(src + 3*i))[0];
+			u.i[1] = ((UInt32 *)(src + 3*i))[1];
+			u.i[2] = ((UInt32 *)(src + 3*i))[2];
+			vi0 = UnpackInt24To32<kOrder>((UInt8 *)u.i);
+			LEI32TOF32(0)
+			if (kGain)
+				vf0 = _mm_mul_ps(vf0, cursor.Gain4());
+			_mm_storeu_ps(dst + i, vf0);
+			Meter4(meters, k, vf0);
+			i += 4;
+		}
+		
+		if (count > i) {
+			// unaligned cleanup -- just do one unaligned vector at the end, and only measure
+			// the samples that the loops above didn't get to
+			unsigned int done = i;
+			i = count - 4;
+			u.i[0] = ((UInt32 *)(src + 3*i))[0];
+			u.i[1] = ((UInt32 *)(src + 3*i))[1];
+			u.i[2] = ((UInt32 *)(src + 3*i))[2];
+			vi0 = UnpackInt24To32<kOrder>((UInt8 *)u.i);
+			LEI32TOF32(0)
+			if (kGain) {
+				cursor.Seek(firstFrame, i);
+				vf0 = _mm_mul_ps(vf0, cursor.Gain4());
+			}
+			_mm_storeu_ps(dst + i, vf0);
+			MeterTail(meters, i, done - i, vf0);
+		}
+		return;
+	}
+	// scalar for small numbers of samples
+	double scale = 1./8388608.0f;
+	for (unsigned int i = 0; i < count; i++) {
+		Float32 f = (Float32)((double)ReadInt24<kOrder>(src, i) * scale);
+		if (kGain) {
+			f = f * cursor.Gain(0);
+			cursor.Advance(1);
+		}
+		dst[i] = f;
+		Meter1(meters, i % period, f);
+	}
+}
+
+template <int kOrder, bool kGain>
+static void Float32ToInt24Meter_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert,
+	const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	PCMGainCursor cursor(gains, firstFrame);
+	unsigned int count = numToConvert;
+	unsigned int period = meters->period;
+	
+	meters->numSamples += count;
+	if (count >= 6) {
+		// vector -- requires 6+ samples
+		ROUNDMODE_NEG_INF
+		const __m128 vround = (const __m128) { 0.5f, 0.5f, 0.5f, 0.5f };
+		const __m128 vmin = (const __m128) { -2147483648.0f, -2147483648.0f, -2147483648.0f, -2147483648.0f };
+		const __m128 vmax = (const __m128) { kMaxFloat32, kMaxFloat32, kMaxFloat32, kMaxFloat32  };
+		const __m128 vscale = (const __m128) { 2147483648.0f, 2147483648.0f, 2147483648.0f, 2147483648.0f  };
+		__m128 vf0;
+		__m128i vi0;
+		unsigned int i = 0, k = 0;
+
+		union {
+			UInt32 i[4];
+			__m128i v;
+		} u;
+
+		while (count - i >= 6) {
+			vf0 = _mm_loadu_ps(src + i);
+			if (kGain) {
+				vf0 = _mm_mul_ps(vf0, cursor.Gain4());
+				cursor.Advance(4);
+			}
+			Meter4(meters, k, vf0);
+			F32TOLE32(0)
+			_mm_storeu_si128((__m128i *)(dst + 3*i), Pack32ToInt24<kOrder>(vi0));
+			k += 4;
+			if (k == period) k = 0;
+			i += 4;
+		}
+		
+		if (count - i >= 4) {
+			vf0 = _mm_loadu_ps(src + i);
+			if (kGain)
+				vf0 = _mm_mul_ps(vf0, cursor.Gain4());
+			Meter4(meters, k, vf0);
+			F32TOLE32(0)
+			u.v = Pack32ToInt24<kOrder>(vi0);
+			((UInt32 *)(dst + 3*i))[0] = u.i[0];
+			((UInt32 *)(dst + 3*i))[1] = u.i[1];
+			((UInt32 *)(dst + 3*i))[2] = u.i[2];
+			i += 4;
+		}
+
+		if (count > i) {
+			// unaligned cleanup -- just do one unaligned vector at the end, and only measure
+			// the samples that the loops above didn't get to
+			unsigned int done = i;
+			i = count - 4;
+			vf0 = _mm_loadu_ps(src + i);
+			if (kGain) {
+				cursor.Seek(firstFrame, i);
+				vf0 = _mm_mul_ps(vf0, cursor.Gain4());
+			}
+			MeterTail(meters, i, done - i, vf0);
+			F32TOLE32(0)
+			u.v = Pack32ToInt24<kOrder>(vi0);
+			((UInt32 *)(dst + 3*i))[0] = u.i[0];
+			((UInt32 *)(dst + 3*i))[1] = u.i[1];
+			((UInt32 *)(dst + 3*i))[2] = u.i[2];
+		}
+		RESTORE_ROUNDMODE
+		return;
+	}
+	
+	// scalar for small numbers of samples
+	if (count > 0) {
+		double scale = 2147483648.0, round = 0.5, max32 = 2147483648.0 - 1.0 - 0.5;
+		SET_ROUNDMODE
+		
+		for (unsigned int i = 0; i < count; i++) {
+			Float32 x = src[i];
+			if (kGain) {
+				x = x * cursor.Gain(0);
+				cursor.Advance(1);
+			}
+			Meter1(meters, i % period, x);
+			double f0 = x;
+			f0 = f0 * scale + round;
+			WriteInt24<kOrder>(dst, i, FloatToInt(f0, max32));
+		}
+		RESTORE_ROUNDMODE
+	}
+}
+
+void NativeInt24ToFloat32Meter_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	if (gains)
+		Int24ToFloat32Meter_X86<kPCMInt24Native, true>(src, dst, numToConvert, gains, firstFrame, meters);
+	else
+		Int24ToFloat32Meter_X86<kPCMInt24Native, false>(src, dst, numToConvert, gains, firstFrame, meters);
+}
+
+void SwapInt24ToFloat32Meter_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	if (gains)
+		Int24ToFloat32Meter_X86<kPCMInt24Swap, true>(src, dst, numToConvert, gains, firstFrame, meters);
+	else
+		Int24ToFloat32Meter_X86<kPCMInt24Swap, false>(src, dst, numToConvert, gains, firstFrame, meters);
+}
+
+void REACInt24ToFloat32Meter_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	if (gains)
+		Int24ToFloat32Meter_X86<kPCMInt24REAC, true>(src, dst, numToConvert, gains, firstFrame, meters);
+	else
+		Int24ToFloat32Meter_X86<kPCMInt24REAC, false>(src, dst, numToConvert, gains, firstFrame, meters);
+}
+
+void Float32ToNativeInt24Meter_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	if (gains)
+		Float32ToInt24Meter_X86<kPCMInt24Native, true>(src, dst, numToConvert, gains, firstFrame, meters);
+	else
+		Float32ToInt24Meter_X86<kPCMInt24Native, false>(src, dst, numToConvert, gains, firstFrame, meters);
+}
+
+void Float32ToSwapInt24Meter_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	if (gains)
+		Float32ToInt24Meter_X86<kPCMInt24Swap, true>(src, dst, numToConvert, gains, firstFrame, meters);
+	else
+		Float32ToInt24Meter_X86<kPCMInt24Swap, false>(src, dst, numToConvert, gains, firstFrame, meters);
+}
+
+void Float32ToREACInt24Meter_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	if (gains)
+		Float32ToInt24Meter_X86<kPCMInt24REAC, true>(src, dst, numToConvert, gains, firstFrame, meters);
+	else
+		Float32ToInt24Meter_X86<kPCMInt24REAC, false>(src, dst, numToConvert, gains, firstFrame, meters);
+}
+
+void Float32Meter_X86( const Float32 *src, unsigned int numToMeter, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters )
+{
+	PCMGainCursor cursor(gains, firstFrame);
+	unsigned int period = meters->period;
+	unsigned int i = 0, k = 0;
+	
+	meters->numSamples += numToMeter;
+	for (; numToMeter - i >= 4; i += 4) {
+		__m128 vf = _mm_loadu_ps(src + i);
+		if (gains) {
+			vf = _mm_mul_ps(vf, cursor.Gain4());
+			cursor.Advance(4);
+		}
+		Meter4(meters, k, vf);
+		k += 4;
+		if (k == period) k = 0;
+	}
+	for (; i < numToMeter; i++) {
+		Float32 f = src[i];
+		if (gains) {
+			f = f * cursor.Gain(0);
+			cursor.Advance(1);
+		}
+		Meter1(meters, i % period, f);
+	}
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Resampler
+
+// The ratio outRate / inRate is reduced to L / M. Output frame k is then sum_t h[p + t*L] * x[i - t],
+// where i = floor(k*M/L) is the newest input frame that it depends on and p = k*M mod L is its phase.
+// The prototype filter h is a Kaiser windowed sinc for the rate inRate*L, with its cutoff at half
+// the lower of the rates, the passband up to 20 kHz (or 0.45 times the lower rate) and about 96 dB
+// of stopband attenuation. It is stored phase by phase, so that each phase is a run of
+// taps coefficients for x[i], x[i-1], ...
+//
+// For 2:1 and 1:2 a half-band filter of 4K+3 taps is used: every other tap but the center one is
+// zero and the rest are symmetric, so the decimator needs K+2 multiplications per output frame,
+// and every other output frame of the interpolator is a delayed input frame. Only the K+1 taps
+// on one side of the center are stored.
+//
+// The history holds the input frames, padded to stride channels, and the filters run across the
+// channels, 4 at a time and 16 at a time where there are enough of them. It is moved back to the
+// start when it fills up, which for the usual maxInFrames is once every few calls.
+
+#define kResamplerAttenuation	96.0
+#define kResamplerPassband		20000.0
+#define kResamplerPi			3.14159265358979323846
+
+// There is no libm in the kernel. sin(pi*x), exactly 0 for integer x, and accurate to about 1e-13.
+static double SinPi(double x)
+{
+	SInt64 n = (SInt64)(x + (x < 0 ? -0.5 : 0.5));
+	double y = (x - n) * kResamplerPi;	// in [-pi/2, pi/2]
+	double y2 = y * y;
+	double s = y * (1. + y2 * (-1. / 6 + y2 * (1. / 120 + y2 * (-1. / 5040 + y2 * (1. / 362880 +
+		y2 * (-1. / 39916800 + y2 * (1. / 6227020800. + y2 * (-1. / 1307674368000. + y2 * (1. / 355687428096000.)))))))));
+	return (n & 1) ? -s : s;
+}
+
+// The modified Bessel function I0, by its power series
+static double BesselI0(double x)
+{
+	double q = x * x * 0.25, term = 1., sum = 1.;
+	for (int k = 1; k < 100 && term > sum * 1e-17; k++) {
+		term *= q / ((double)k * k);
+		sum += term;
+	}
+	return sum;
+}
+
+static inline double SqrtD(double x)
+{
+	return _mm_cvtsd_f64(_mm_sqrt_sd(_mm_setzero_pd(), _mm_set_sd(x)));
+}
+
+static unsigned int GCD(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+typedef struct ResamplerDesign {
+	unsigned int	L, M, kind, taps, halfTaps, filterSize;
+	unsigned int	length;		// of the prototype filter
+	double			cutoff;		// 2 * cutoff / (inRate * L)
+	double			beta;
+} ResamplerDesign;
+
+static bool DesignResampler(unsigned int inRate, unsigned int outRate, ResamplerDesign *d)
+{
+	if (0 == inRate || 0 == outRate || inRate == outRate)
+		return false;
+	unsigned int g = GCD(inRate, outRate);
+	d->L = outRate / g;
+	d->M = inRate / g;
+	if (d->L > kPCMResamplerMaxTerm || d->M > kPCMResamplerMaxTerm)
+		return false;
+
+	double lowRate = (inRate < outRate) ? inRate : outRate;
+	double pass = (0.45 * lowRate < kResamplerPassband) ? 0.45 * lowRate : kResamplerPassband;
+	double transition = (lowRate - pass - pass) / ((double)inRate * d->L);
+	double length = (kResamplerAttenuation - 7.95) / (2.285 * 2 * kResamplerPi * transition) + 1;
+
+	d->cutoff = 1. / (d->L > d->M ? d->L : d->M);
+	d->beta = 0.1102 * (kResamplerAttenuation - 8.7);
+	if (1 == d->M && 2 == d->L) {
+		d->kind = kPCMResamplerHalfBandInterpolator;
+		d->halfTaps = (unsigned int)((length - 3) / 4) + 1;
+		d->length = 4 * d->halfTaps + 3;
+		d->taps = 2 * d->halfTaps + 2;
+		d->filterSize = d->halfTaps + 1;
+	}
+	else if (2 == d->M && 1 == d->L) {
+		d->kind = kPCMResamplerHalfBandDecimator;
+		d->halfTaps = (unsigned int)((length - 3) / 4) + 1;
+		d->length = 4 * d->halfTaps + 3;
+		d->taps = d->length;
+		d->filterSize = d->halfTaps + 1;
+	}
+	else {
+		d->kind = kPCMResamplerPolyphase;
+		d->halfTaps = 0;
+		d->taps = (unsigned int)(length / d->L) + 1;
+		if (d->taps < 2) d->taps = 2;
+		d->length = d->L * d->taps;
+		d->filterSize = d->length;
+	}
+	return true;
+}
+
+// Tap j of the prototype filter
+static double PrototypeTap(const ResamplerDesign *d, unsigned int j, double i0Beta)
+{
+	double m = j - (d->length - 1) * 0.5;
+	double x = d->cutoff * m;
+	double r = 2. * m / (d->length - 1);
+	double sinc = (0. == m) ? 1. : SinPi(x) / (kResamplerPi * x);
+	return d->cutoff * sinc * BesselI0(d->beta * SqrtD(1. - r * r)) / i0Beta;
+}
+
+static unsigned int HistoryFrames(const ResamplerDesign *d, unsigned int maxInFrames)
+{
+	return 2 * (d->taps - 1 + maxInFrames);
+}
+
+unsigned int PCMResamplerFilterSize( unsigned int inRate, unsigned int outRate )
+{
+	ResamplerDesign d;
+	return DesignResampler(inRate, outRate, &d) ? d.filterSize : 0;
+}
+
+unsigned int PCMResamplerHistorySize( unsigned int inRate, unsigned int outRate, unsigned int numChannels, unsigned int maxInFrames )
+{
+	ResamplerDesign d;
+	return DesignResampler(inRate, outRate, &d) ? HistoryFrames(&d, maxInFrames) * ((numChannels + 3) & ~3) : 0;
+}
+
+int PCMResamplerInit( PCMResampler *resampler, unsigned int inRate, unsigned int outRate, unsigned int numChannels,
+	unsigned int maxInFrames, Float32 *filter, Float32 *history )
+{
+	ResamplerDesign d;
+	if (0 == numChannels || !DesignResampler(inRate, outRate, &d))
+		return 0;
+
+	resampler->numChannels = numChannels;
+	resampler->stride = (numChannels + 3) & ~3;
+	resampler->L = d.L;
+	resampler->M = d.M;
+	resampler->kind = d.kind;
+	resampler->taps = d.taps;
+	resampler->halfTaps = d.halfTaps;
+	resampler->maxFrames = HistoryFrames(&d, maxInFrames);
+	resampler->filter = filter;
+	resampler->history = history;
+
+	double i0Beta = BesselI0(d.beta);
+	double sum = 0.;
+	if (kPCMResamplerPolyphase == d.kind) {
+		// normalized to a gain of 1 after the upsampling by L
+		for (unsigned int p = 0; p < d.L; p++) {
+			for (unsigned int t = 0; t < d.taps; t++) {
+				double h = PrototypeTap(&d, p + t * d.L, i0Beta);
+				filter[p * d.taps + t] = (Float32)h;
+				sum += h;
+			}
+		}
+		Float32 scale = (Float32)(d.L / sum);
+		for (unsigned int j = 0; j < d.filterSize; j++)
+			filter[j] *= scale;
+	}
+	else {
+		// The center tap is 1/2 (times L) exactly, so that the delayed frames of the interpolator
+		// need no multiplication, and the other taps add up to the same
+		unsigned int center = 2 * d.halfTaps + 1;
+		for (unsigned int m = 0; m <= d.halfTaps; m++) {
+			double h = PrototypeTap(&d, center + 2 * m + 1, i0Beta);
+			filter[m] = (Float32)h;
+			sum += 2. * h;
+		}
+		Float32 scale = (Float32)(0.5 * d.L / sum);
+		for (unsigned int m = 0; m <= d.halfTaps; m++)
+			filter[m] *= scale;
+	}
+
+	PCMResamplerReset(resampler);
+	return 1;
+}
+
+void PCMResamplerReset( PCMResampler *resampler )
+{
+	unsigned int size = resampler->maxFrames * resampler->stride;
+	for (unsigned int i = 0; i < size; i++)
+		resampler->history[i] = 0.f;
+	resampler->phase = 0;
+	resampler->numFrames = resampler->next = resampler->taps - 1;
+}
+
+// The sums of V vectors (4*V channels) of an output frame. x is the newest input frame.
+template <int kKind, int V>
+static inline void ResampleBlock(const PCMResampler *r, const Float32 *x, unsigned int phase, __m128 *acc)
+{
+	const unsigned int stride = r->stride;
+
+	if (kPCMResamplerPolyphase == kKind) {
+		const Float32 *coef = r->filter + phase * r->taps;
+		for (int v = 0; v < V; v++)
+			acc[v] = _mm_setzero_ps();
+		for (unsigned int t = 0; t < r->taps; t++, x -= stride) {
+			__m128 vc = _mm_set1_ps(coef[t]);
+			for (int v = 0; v < V; v++)
+				acc[v] = _mm_add_ps(acc[v], _mm_mul_ps(vc, _mm_loadu_ps(x + 4 * v)));
+		}
+	}
+	else if (kPCMResamplerHalfBandDecimator == kKind) {
+		// 1/2 x[i-c] + sum_m h_m (x[i-c+2m+1] + x[i-c-2m-1]), c = 2K+1
+		const unsigned int c = 2 * r->halfTaps + 1;
+		const __m128 vhalf = _mm_set1_ps(0.5f);
+		const Float32 *xc = x - c * stride;
+		for (int v = 0; v < V; v++)
+			acc[v] = _mm_mul_ps(vhalf, _mm_loadu_ps(xc + 4 * v));
+		for (unsigned int m = 0; m <= r->halfTaps; m++) {
+			__m128 vc = _mm_set1_ps(r->filter[m]);
+			const Float32 *xa = xc + (2 * m + 1) * stride, *xb = xc - (2 * m + 1) * stride;
+			for (int v = 0; v < V; v++)
+				acc[v] = _mm_add_ps(acc[v], _mm_mul_ps(vc, _mm_add_ps(_mm_loadu_ps(xa + 4 * v), _mm_loadu_ps(xb + 4 * v))));
+		}
+	}
+	else if (phase) {
+		// the center tap of the interpolator
+		const Float32 *xc = x - r->halfTaps * stride;
+		for (int v = 0; v < V; v++)
+			acc[v] = _mm_loadu_ps(xc + 4 * v);
+	}
+	else {
+		// sum_t h_(K-t) (x[i-t] + x[i-2K-1+t])
+		const unsigned int K = r->halfTaps;
+		for (int v = 0; v < V; v++)
+			acc[v] = _mm_setzero_ps();
+		for (unsigned int t = 0; t <= K; t++) {
+			__m128 vc = _mm_set1_ps(r->filter[K - t]);
+			const Float32 *xa = x - t * stride, *xb = x - (2 * K + 1 - t) * stride;
+			for (int v = 0; v < V; v++)
+				acc[v] = _mm_add_ps(acc[v], _mm_mul_ps(vc, _mm_add_ps(_mm_loadu_ps(xa + 4 * v), _mm_loadu_ps(xb + 4 * v))));
+		}
+	}
+}
+
+// Stores channels c..c+3 of an output frame, leaving out the padding
+static inline void StoreChannels(Float32 *dst, unsigned int c, unsigned int numChannels, __m128 v)
+{
+	if (c + 4 <= numChannels) {
+		_mm_storeu_ps(dst + c, v);
+	}
+	else {
+		union {
+			Float32 f[4];
+			__m128 v;
+		} u;
+		u.v = v;
+		for (unsigned int l = 0; c + l < numChannels; l++)
+			dst[c + l] = u.f[l];
+	}
+}
+
+template <int kKind>
+static unsigned int ResampleFrames(PCMResampler *r, Float32 *dst, unsigned int maxOutFrames)
+{
+	const unsigned int numChannels = r->numChannels, stride = r->stride;
+	unsigned int out = 0;
+
+	for (; out < maxOutFrames && r->next < r->numFrames; out++, dst += numChannels) {
+		const Float32 *x = r->history + r->next * stride;
+		__m128 acc[4];
+		unsigned int c = 0;
+
+		for (; c + 16 <= stride; c += 16) {
+			ResampleBlock<kKind, 4>(r, x + c, r->phase, acc);
+			for (unsigned int v = 0; v < 4; v++)
+				StoreChannels(dst, c + 4 * v, numChannels, acc[v]);
+		}
+		// the rest in one go as well, since the sums of one vector would wait for each other
+		switch ((stride - c) / 4) {
+		case 3:
+			ResampleBlock<kKind, 3>(r, x + c, r->phase, acc);
+			break;
+		case 2:
+			ResampleBlock<kKind, 2>(r, x + c, r->phase, acc);
+			break;
+		case 1:
+			ResampleBlock<kKind, 1>(r, x + c, r->phase, acc);
+			break;
+		}
+		for (unsigned int v = 0; c < stride; c += 4, v++)
+			StoreChannels(dst, c, numChannels, acc[v]);
+
+		r->phase += r->M;
+		while (r->phase >= r->L) {
+			r->phase -= r->L;
+			r->next++;
+		}
+	}
+	return out;
+}
+
+unsigned int PCMResamplerProcess( PCMResampler *resampler, const Float32 *src, unsigned int numInFrames,
+	Float32 *dst, unsigned int maxOutFrames )
+{
+	PCMResampler *r = resampler;
+	const unsigned int numChannels = r->numChannels, stride = r->stride;
+
+	if (r->numFrames + numInFrames > r->maxFrames) {
+		// Move the frames that are still needed to the start. The decimators can be past the
+		// end of the history by a frame or so, waiting for input. The padding is zero throughout.
+		unsigned int first = r->next - (r->taps - 1);
+		unsigned int keep = (r->numFrames > first) ? r->numFrames - first : 0;
+		const Float32 *from = r->history + first * stride;
+		for (unsigned int i = 0; i < keep * stride; i += 4)
+			_mm_storeu_ps(r->history + i, _mm_loadu_ps(from + i));
+		r->numFrames = keep;
+		r->next -= first;
+		if (r->numFrames + numInFrames > r->maxFrames)	// only when called with more than maxInFrames
+			numInFrames = r->maxFrames - r->numFrames;
+	}
+
+	Float32 *h = r->history + r->numFrames * stride;
+	for (unsigned int f = 0; f < numInFrames; f++, h += stride, src += numChannels)
+		for (unsigned int c = 0; c < numChannels; c++)
+			h[c] = src[c];
+	r->numFrames += numInFrames;
+
+	switch (r->kind) {
+	case kPCMResamplerHalfBandDecimator:
+		return ResampleFrames<kPCMResamplerHalfBandDecimator>(r, dst, maxOutFrames);
+	case kPCMResamplerHalfBandInterpolator:
+		return ResampleFrames<kPCMResamplerHalfBandInterpolator>(r, dst, maxOutFrames);
+	default:
+		return ResampleFrames<kPCMResamplerPolyphase>(r, dst, maxOutFrames);
+	}
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark Planar buffers
+
+// One buffer per channel is a transpose of the frames. It is done a block of 4 frames by 4
+// channels at a time, which is 4 unaligned loads, _MM_TRANSPOSE4_PS and 4 unaligned stores; a
+// packet of 12 frames of up to 40 channels fits in the L1 cache as a whole, so the blocks are
+// simply walked a row of 4 frames at a time. kNumChannels is non-zero for the channel counts that
+// get a copy of their own, where the loop over the channels unrolls completely.
+template <unsigned int kNumChannels>
+static void TransposeToPlanar(const Float32 *src, Float32 * const *dst, unsigned int numChannels, unsigned int numFrames)
+{
+	const unsigned int nc = kNumChannels ? kNumChannels : numChannels;
+	unsigned int f = 0;
+
+	for (; f + 4 <= numFrames; f += 4, src += 4 * nc) {
+		unsigned int c = 0;
+		for (; c + 4 <= nc; c += 4) {
+			__m128 r0 = _mm_loadu_ps(src + c);
+			__m128 r1 = _mm_loadu_ps(src + nc + c);
+			__m128 r2 = _mm_loadu_ps(src + 2 * nc + c);
+			__m128 r3 = _mm_loadu_ps(src + 3 * nc + c);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(dst[c] + f, r0);
+			_mm_storeu_ps(dst[c + 1] + f, r1);
+			_mm_storeu_ps(dst[c + 2] + f, r2);
+			_mm_storeu_ps(dst[c + 3] + f, r3);
+		}
+		for (; c < nc; c++)
+			for (unsigned int i = 0; i < 4; i++)
+				dst[c][f + i] = src[i * nc + c];
+	}
+	for (; f < numFrames; f++, src += nc)
+		for (unsigned int c = 0; c < nc; c++)
+			dst[c][f] = src[c];
+}
+
+template <unsigned int kNumChannels>
+static void TransposeFromPlanar(const Float32 * const *src, Float32 *dst, unsigned int numChannels, unsigned int numFrames)
+{
+	const unsigned int nc = kNumChannels ? kNumChannels : numChannels;
+	unsigned int f = 0;
+
+	for (; f + 4 <= numFrames; f += 4, dst += 4 * nc) {
+		unsigned int c = 0;
+		for (; c + 4 <= nc; c += 4) {
+			__m128 r0 = _mm_loadu_ps(src[c] + f);
+			__m128 r1 = _mm_loadu_ps(src[c + 1] + f);
+			__m128 r2 = _mm_loadu_ps(src[c + 2] + f);
+			__m128 r3 = _mm_loadu_ps(src[c + 3] + f);
+			_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+			_mm_storeu_ps(dst + c, r0);
+			_mm_storeu_ps(dst + nc + c, r1);
+			_mm_storeu_ps(dst + 2 * nc + c, r2);
+			_mm_storeu_ps(dst + 3 * nc + c, r3);
+		}
+		for (; c < nc; c++)
+			for (unsigned int i = 0; i < 4; i++)
+				dst[i * nc + c] = src[c][f + i];
+	}
+	for (; f < numFrames; f++, dst += nc)
+		for (unsigned int c = 0; c < nc; c++)
+			dst[c] = src[c][f];
+}
+
+// Copies count Float32s, 4 at a time as far as it goes
+static inline void CopyChannels(const Float32 *src, Float32 *dst, unsigned int count)
+{
+	unsigned int i = 0;
+	for (; i + 4 <= count; i += 4)
+		_mm_storeu_ps(dst + i, _mm_loadu_ps(src + i));
+	for (; i < count; i++)
+		dst[i] = src[i];
+}
+
+void Float32ToPlanar_X86( const Float32 *src, Float32 * const *dst, unsigned int numChannels, unsigned int channelsPerBuffer, unsigned int numFrames )
+{
+	if (1 == channelsPerBuffer) {
+		switch (numChannels) {
+		case 8:		TransposeToPlanar<8>(src, dst, numChannels, numFrames); break;
+		case 16:	TransposeToPlanar<16>(src, dst, numChannels, numFrames); break;
+		case 24:	TransposeToPlanar<24>(src, dst, numChannels, numFrames); break;
+		case 40:	TransposeToPlanar<40>(src, dst, numChannels, numFrames); break;
+		default:	TransposeToPlanar<0>(src, dst, numChannels, numFrames); break;
+		}
+		return;
+	}
+
+	for (unsigned int f = 0; f < numFrames; f++, src += numChannels) {
+		for (unsigned int c = 0, b = 0; c < numChannels; c += channelsPerBuffer, b++) {
+			unsigned int count = (numChannels - c < channelsPerBuffer) ? numChannels - c : channelsPerBuffer;
+			CopyChannels(src + c, dst[b] + f * count, count);
+		}
+	}
+}
+
+void PlanarToFloat32_X86( const Float32 * const *src, Float32 *dst, unsigned int numChannels, unsigned int channelsPerBuffer, unsigned int numFrames )
+{
+	if (1 == channelsPerBuffer) {
+		switch (numChannels) {
+		case 8:		TransposeFromPlanar<8>(src, dst, numChannels, numFrames); break;
+		case 16:	TransposeFromPlanar<16>(src, dst, numChannels, numFrames); break;
+		case 24:	TransposeFromPlanar<24>(src, dst, numChannels, numFrames); break;
+		case 40:	TransposeFromPlanar<40>(src, dst, numChannels, numFrames); break;
+		default:	TransposeFromPlanar<0>(src, dst, numChannels, numFrames); break;
+		}
+		return;
+	}
+
+	for (unsigned int f = 0; f < numFrames; f++, dst += numChannels) {
+		for (unsigned int c = 0, b = 0; c < numChannels; c += channelsPerBuffer, b++) {
+			unsigned int count = (numChannels - c < channelsPerBuffer) ? numChannels - c : channelsPerBuffer;
+			CopyChannels(src[b] + f * count, dst + c, count);
+		}
+	}
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark REAC wire order swizzle
+
+// Packed little-endian 24-bit ints and REAC wire order differ by a byte swap of each 16-bit word,
+// so the same swizzle goes both ways and works on any even number of bytes. It is done a block of
+// 8 pairs of samples (3 vectors, 48 bytes) at a time with byteswap16, whose SSE2 shifts are as
+// fast as a pshufb here and also run on the first Intel Macs, which lack SSSE3.
+void REACInt24Swizzle_X86( const UInt8 *src, UInt8 *dst, unsigned int numBytes )
+{
+	while (numBytes >= 48) {
+		__m128i v0 = _mm_loadu_si128((const __m128i *)src);
+		__m128i v1 = _mm_loadu_si128((const __m128i *)(src + 16));
+		__m128i v2 = _mm_loadu_si128((const __m128i *)(src + 32));
+		_mm_storeu_si128((__m128i *)dst, byteswap16(v0));
+		_mm_storeu_si128((__m128i *)(dst + 16), byteswap16(v1));
+		_mm_storeu_si128((__m128i *)(dst + 32), byteswap16(v2));
+		src += 48;
+		dst += 48;
+		numBytes -= 48;
+	}
+	
+	while (numBytes >= 16) {
+		_mm_storeu_si128((__m128i *)dst, byteswap16(_mm_loadu_si128((const __m128i *)src)));
+		src += 16;
+		dst += 16;
+		numBytes -= 16;
+	}
+	
+	for (; numBytes >= 2; numBytes -= 2, src += 2, dst += 2) {
+		UInt8 b0 = src[0];
+		dst[0] = src[1];
+		dst[1] = b0;
+	}
+}
+
+// The 32-bit ints are packed (or unpacked) 4 at a time with Pack32ToLE24 (UnpackLE24To32), and the
+// 12 bytes of them are swizzled in the same register. A vector access covers 16 bytes of the packed
+// side, so the vector loops only run while at least 6 ints are left; the last pairs are done one at
+// a time.
+void Int24In32ToREACInt24_X86( const UInt8 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	const __m128i mask = _mm_setr_epi32(0x00FFFFFF, 0, 0, 0);
+	
+	while (numToConvert >= 6) {
+		__m128i vi = _mm_loadu_si128((const __m128i *)src);
+		_mm_storeu_si128((__m128i *)dst, byteswap16(Pack32ToLE24(vi, mask)));
+		src += 16;
+		dst += 12;	// bytes
+		numToConvert -= 4;
+	}
+	
+	for (; numToConvert >= 2; numToConvert -= 2, src += 8, dst += 6) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[5];
+		dst[3] = src[3];
+		dst[4] = src[7];
+		dst[5] = src[6];
+	}
+}
+
+void REACInt24ToInt24In32_X86( const UInt8 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	const __m128i mask = _mm_setr_epi32(0xFFFFFF00, 0, 0, 0);
+	
+	while (numToConvert >= 6) {
+		__m128i load = byteswap16(_mm_loadu_si128((const __m128i *)src));
+		_mm_storeu_si128((__m128i *)dst, UnpackLE24To32(load, mask));
+		src += 12;	// bytes
+		dst += 16;
+		numToConvert -= 4;
+	}
+	
+	for (; numToConvert >= 2; numToConvert -= 2, src += 6, dst += 8) {
+		dst[0] = 0;
+		dst[1] = src[1];
+		dst[2] = src[0];
+		dst[3] = src[3];
+		dst[4] = 0;
+		dst[5] = src[2];
+		dst[6] = src[5];
+		dst[7] = src[4];
+	}
+}
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark AVX2
+
+#if PCMBLITTER_HAVE_AVX2
+
+// AVX2 can permute dwords across the two 128-bit lanes, so 8 packed 24-bit ints can be moved
+// into place with one vpermd and one vpshufb, instead of the mask/shift/or sequences of
+// UnpackLE24To32 and Pack32ToLE24. The arithmetic is the same as for the SSE versions, so
+// the results are bit-identical.
+
+// Shuffle masks that move 4 packed 24-bit ints at the start of a 128-bit lane into the high
+// 24 bits of 4 32-bit ints (-1 clears the byte). The *End variants are for a lane where the
+// 4 ints start at byte 4.
+#define kUnpackLE24Lane(o)	-1, o+0, o+1, o+2, -1, o+3, o+4, o+5, -1, o+6, o+7, o+8, -1, o+9, o+10, o+11
+#define kUnpackBE24Lane(o)	-1, o+2, o+1, o+0, -1, o+5, o+4, o+3, -1, o+8, o+7, o+6, -1, o+11, o+10, o+9
+// kUnpackLE24Lane for REAC wire order; the lane bytes have to start at an even byte of the source
+#define kUnpackREAC24Lane(o)	-1, (o+0)^1, (o+1)^1, (o+2)^1, -1, (o+3)^1, (o+4)^1, (o+5)^1, \
+								-1, (o+6)^1, (o+7)^1, (o+8)^1, -1, (o+9)^1, (o+10)^1, (o+11)^1
+#define kPackLE24Lane		1, 2, 3, 5, 6, 7, 9, 10, 11, 13, 14, 15, -1, -1, -1, -1
+#define kPackBE24Lane		3, 2, 1, 7, 6, 5, 11, 10, 9, 15, 14, 13, -1, -1, -1, -1
+// kPackLE24Lane with the bytes of each 16-bit word swapped. Each lane stores 12 bytes at an
+// even sample, so this gives REAC wire order.
+#define kPackREAC24Lane		2, 1, 5, 3, 7, 6, 10, 9, 13, 11, 15, 14, -1, -1, -1, -1
+
+// Converts 8 packed 24-bit ints to floats. The load always reads 32 bytes; perm selects which
+// of its dwords go into each lane.
+PCM_TARGET_AVX2
+static inline __m256 Int24x8ToFloat32_AVX2(const UInt8 *loadAddr, __m256i perm, __m256i shuf, __m256 vscale)
+{
+	__m256i vi = _mm256_loadu_si256((const __m256i *)loadAddr);
+	vi = _mm256_permutevar8x32_epi32(vi, perm);
+	vi = _mm256_shuffle_epi8(vi, shuf);
+	return _mm256_mul_ps(_mm256_cvtepi32_ps(vi), vscale);
+}
+
+// The gain of the 8 samples at the cursor position, as in PCMGainCursor::Gain4
+PCM_TARGET_AVX2
+static inline __m256 Gain8_AVX2(const PCMGainCursor &cursor)
+{
+	const PCMChannelGains *gains = cursor.gains;
+	__m256 vg = _mm256_loadu_ps(gains->gain + cursor.channel);
+	if (gains->ramping) {
+		__m256 vframe = _mm256_add_ps(_mm256_set1_ps(cursor.frame), _mm256_loadu_ps(gains->frame + cursor.channel));
+		vg = _mm256_add_ps(vg, _mm256_mul_ps(_mm256_loadu_ps(gains->step + cursor.channel), vframe));
+	}
+	return vg;
+}
+
+// With kGain, multiplies the samples by the channel gains as well
+template <bool kGain>
+PCM_TARGET_AVX2
+static void Int24ToFloat32_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert,
+	__m256i shuf, __m256i shufEnd, const PCMChannelGains *gains = NULL, Float32 firstFrame = 0.f )
+{
+	const UInt8 *src0 = src;
+	Float32 *dst0 = dst;
+	unsigned int count = numToConvert;
+	PCMGainCursor cursor(gains, firstFrame);
+	__m256 vf;
+
+	const __m256 vscale = _mm256_set1_ps(kTwoToMinus31);
+	// bytes 0-11 into the low lane, bytes 12-27 into the high lane
+	const __m256i perm = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+	// for a load that ends where the 8 ints end: bytes 8-19 into the low lane, and bytes
+	// 16-31 (with the ints starting at byte 20) into the high lane
+	const __m256i permEnd = _mm256_setr_epi32(2, 3, 4, 5, 4, 5, 6, 7);
+
+	// requires 11+ samples (33+ source bytes), so that there are always 32 bytes to load
+	while (count >= 11) {
+		vf = Int24x8ToFloat32_AVX2(src, perm, shuf, vscale);
+		if (kGain) {
+			vf = _mm256_mul_ps(vf, Gain8_AVX2(cursor));
+			cursor.Advance(8);
+		}
+		_mm256_storeu_ps(dst, vf);
+		src += 3*8;
+		dst += 8;
+		count -= 8;
+	}
+
+	// 8-10 samples left: load the 32 bytes that end where the next 8 ints end. We are at
+	// least 24 bytes into the source buffer here, so this does not read before it.
+	if (count >= 8) {
+		vf = Int24x8ToFloat32_AVX2(src + 3*8 - 32, permEnd, shufEnd, vscale);
+		if (kGain) {
+			vf = _mm256_mul_ps(vf, Gain8_AVX2(cursor));
+			cursor.Advance(8);
+		}
+		_mm256_storeu_ps(dst, vf);
+		src += 3*8;
+		dst += 8;
+		count -= 8;
+	}
+
+	if (count > 0) {
+		// unaligned cleanup -- just do one vector at the end
+		src = src0 + 3*numToConvert - 32;
+		dst = dst0 + numToConvert - 8;
+		vf = Int24x8ToFloat32_AVX2(src, permEnd, shufEnd, vscale);
+		if (kGain) {
+			cursor.Seek(firstFrame, numToConvert - 8);
+			vf = _mm256_mul_ps(vf, Gain8_AVX2(cursor));
+		}
+		_mm256_storeu_ps(dst, vf);
+	}
+	// The compiler leaves out the vzeroupper of functions with 256-bit arguments, and the
+	// callers tail call this, so the SSE code that runs after would pay for the dirty state.
+	_mm256_zeroupper();
+}
+
+PCM_TARGET_AVX2
+void NativeInt24ToFloat32_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 11) {
+		NativeInt24ToFloat32_X86(src, dst, numToConvert);
+		return;
+	}
+	Int24ToFloat32_AVX2<false>(src, dst, numToConvert,
+		_mm256_setr_epi8(kUnpackLE24Lane(0), kUnpackLE24Lane(0)),
+		_mm256_setr_epi8(kUnpackLE24Lane(0), kUnpackLE24Lane(4)));
+}
+
+PCM_TARGET_AVX2
+void SwapInt24ToFloat32_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 11) {
+		SwapInt24ToFloat32_X86(src, dst, numToConvert);
+		return;
+	}
+	Int24ToFloat32_AVX2<false>(src, dst, numToConvert,
+		_mm256_setr_epi8(kUnpackBE24Lane(0), kUnpackBE24Lane(0)),
+		_mm256_setr_epi8(kUnpackBE24Lane(0), kUnpackBE24Lane(4)));
+}
+
+PCM_TARGET_AVX2
+void REACInt24ToFloat32_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 11) {
+		REACInt24ToFloat32_X86(src, dst, numToConvert);
+		return;
+	}
+	// all the loads start at even samples, so the lanes start at even bytes
+	Int24ToFloat32_AVX2<false>(src, dst, numToConvert,
+		_mm256_setr_epi8(kUnpackREAC24Lane(0), kUnpackREAC24Lane(0)),
+		_mm256_setr_epi8(kUnpackREAC24Lane(0), kUnpackREAC24Lane(4)));
+}
+
+// Converts 8 floats and stores them as 24 bytes of packed 24-bit ints
+PCM_TARGET_AVX2
+static inline void Float32x8ToInt24_AVX2(__m256 vf, UInt8 *dst, __m256i shuf)
+{
+	const __m256 vround = _mm256_set1_ps(0.5f);
+	const __m256 vmin = _mm256_set1_ps(-2147483648.0f);
+	const __m256 vmax = _mm256_set1_ps(kMaxFloat32);
+	const __m256 vscale = _mm256_set1_ps(2147483648.0f);
+	// gather the 12 packed bytes of each lane into the low 24 bytes
+	const __m256i perm = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+	vf = _mm256_mul_ps(vf, vscale);
+	vf = _mm256_add_ps(vf, vround);
+	vf = _mm256_max_ps(vf, vmin);
+	vf = _mm256_min_ps(vf, vmax);
+	__m256i vi = _mm256_cvtps_epi32(vf);
+	vi = _mm256_shuffle_epi8(vi, shuf);
+	vi = _mm256_permutevar8x32_epi32(vi, perm);
+
+	_mm_storeu_si128((__m128i *)dst, _mm256_castsi256_si128(vi));
+	_mm_storel_epi64((__m128i *)(dst + 16), _mm256_extracti128_si256(vi, 1));
+}
+
+// With kGain, multiplies the samples by the channel gains as well
+template <bool kGain>
+PCM_TARGET_AVX2
+static void Float32ToInt24_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert, __m256i shuf,
+	const PCMChannelGains *gains = NULL, Float32 firstFrame = 0.f )
+{
+	const Float32 *src0 = src;
+	UInt8 *dst0 = dst;
+	unsigned int count = numToConvert;
+	PCMGainCursor cursor(gains, firstFrame);
+	__m256 vf;
+
+	// vector -- requires 8+ samples
+	ROUNDMODE_NEG_INF
+
+	// unaligned loads, unaligned stores
+	while (count >= 8) {
+		vf = _mm256_loadu_ps(src);
+		if (kGain) {
+			vf = _mm256_mul_ps(vf, Gain8_AVX2(cursor));
+			cursor.Advance(8);
+		}
+		Float32x8ToInt24_AVX2(vf, dst, shuf);
+		src += 8;
+		dst += 3*8;	// bytes
+		count -= 8;
+	}
+
+	if (count > 0) {
+		// unaligned cleanup -- just do one vector at the end
+		vf = _mm256_loadu_ps(src0 + numToConvert - 8);
+		if (kGain) {
+			cursor.Seek(firstFrame, numToConvert - 8);
+			vf = _mm256_mul_ps(vf, Gain8_AVX2(cursor));
+		}
+		Float32x8ToInt24_AVX2(vf, dst0 + 3*numToConvert - 3*8, shuf);
+	}
+	RESTORE_ROUNDMODE
+	_mm256_zeroupper();	// as in Int24ToFloat32_AVX2
+}
+
+PCM_TARGET_AVX2
+void Float32ToNativeInt24_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 8) {
+		Float32ToNativeInt24_X86(src, dst, numToConvert);
+		return;
+	}
+	Float32ToInt24_AVX2<false>(src, dst, numToConvert, _mm256_setr_epi8(kPackLE24Lane, kPackLE24Lane));
+}
+
+PCM_TARGET_AVX2
+void Float32ToSwapInt24_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 8) {
+		Float32ToSwapInt24_X86(src, dst, numToConvert);
+		return;
+	}
+	Float32ToInt24_AVX2<false>(src, dst, numToConvert, _mm256_setr_epi8(kPackBE24Lane, kPackBE24Lane));
+}
+
+PCM_TARGET_AVX2
+void Float32ToREACInt24_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 8) {
+		Float32ToREACInt24_X86(src, dst, numToConvert);
+		return;
+	}
+	// the cleanup vector starts at numToConvert-8, which is even as well
+	Float32ToInt24_AVX2<false>(src, dst, numToConvert, _mm256_setr_epi8(kPackREAC24Lane, kPackREAC24Lane));
+}
+
+PCM_TARGET_AVX2
+void NativeInt24ToFloat32Gain_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (numToConvert < 11) {
+		NativeInt24ToFloat32Gain_X86(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	Int24ToFloat32_AVX2<true>(src, dst, numToConvert,
+		_mm256_setr_epi8(kUnpackLE24Lane(0), kUnpackLE24Lane(0)),
+		_mm256_setr_epi8(kUnpackLE24Lane(0), kUnpackLE24Lane(4)), gains, firstFrame);
+}
+
+PCM_TARGET_AVX2
+void SwapInt24ToFloat32Gain_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (numToConvert < 11) {
+		SwapInt24ToFloat32Gain_X86(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	Int24ToFloat32_AVX2<true>(src, dst, numToConvert,
+		_mm256_setr_epi8(kUnpackBE24Lane(0), kUnpackBE24Lane(0)),
+		_mm256_setr_epi8(kUnpackBE24Lane(0), kUnpackBE24Lane(4)), gains, firstFrame);
+}
+
+PCM_TARGET_AVX2
+void REACInt24ToFloat32Gain_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (numToConvert < 11) {
+		REACInt24ToFloat32Gain_X86(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	Int24ToFloat32_AVX2<true>(src, dst, numToConvert,
+		_mm256_setr_epi8(kUnpackREAC24Lane(0), kUnpackREAC24Lane(0)),
+		_mm256_setr_epi8(kUnpackREAC24Lane(0), kUnpackREAC24Lane(4)), gains, firstFrame);
+}
+
+PCM_TARGET_AVX2
+void Float32ToNativeInt24Gain_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (numToConvert < 8) {
+		Float32ToNativeInt24Gain_X86(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	Float32ToInt24_AVX2<true>(src, dst, numToConvert, _mm256_setr_epi8(kPackLE24Lane, kPackLE24Lane), gains, firstFrame);
+}
+
+PCM_TARGET_AVX2
+void Float32ToSwapInt24Gain_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (numToConvert < 8) {
+		Float32ToSwapInt24Gain_X86(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	Float32ToInt24_AVX2<true>(src, dst, numToConvert, _mm256_setr_epi8(kPackBE24Lane, kPackBE24Lane), gains, firstFrame);
+}
+
+PCM_TARGET_AVX2
+void Float32ToREACInt24Gain_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (numToConvert < 8) {
+		Float32ToREACInt24Gain_X86(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	Float32ToInt24_AVX2<true>(src, dst, numToConvert, _mm256_setr_epi8(kPackREAC24Lane, kPackREAC24Lane), gains, firstFrame);
+}
+
+// The gain blitters for a fixed number of channels (see Int24ToFloat32GainFrames_X86), 8 samples at
+// a time. The loads read 8 bytes past the 24 bytes of a vector, so the last vector of the buffer is
+// loaded from 8 bytes earlier, as the cleanup vector of Int24ToFloat32_AVX2 is.
+template <int kOrder>
+PCM_TARGET_AVX2
+static inline __m256i Int24UnpackShuffle_AVX2(bool end)
+{
+	if (kPCMInt24Native == kOrder)
+		return end ? _mm256_setr_epi8(kUnpackLE24Lane(0), kUnpackLE24Lane(4)) : _mm256_setr_epi8(kUnpackLE24Lane(0), kUnpackLE24Lane(0));
+	else if (kPCMInt24Swap == kOrder)
+		return end ? _mm256_setr_epi8(kUnpackBE24Lane(0), kUnpackBE24Lane(4)) : _mm256_setr_epi8(kUnpackBE24Lane(0), kUnpackBE24Lane(0));
+	else
+		return end ? _mm256_setr_epi8(kUnpackREAC24Lane(0), kUnpackREAC24Lane(4)) : _mm256_setr_epi8(kUnpackREAC24Lane(0), kUnpackREAC24Lane(0));
+}
+
+template <int kOrder>
+PCM_TARGET_AVX2
+static inline __m256i Int24PackShuffle_AVX2()
+{
+	if (kPCMInt24Native == kOrder)
+		return _mm256_setr_epi8(kPackLE24Lane, kPackLE24Lane);
+	else if (kPCMInt24Swap == kOrder)
+		return _mm256_setr_epi8(kPackBE24Lane, kPackBE24Lane);
+	else
+		return _mm256_setr_epi8(kPackREAC24Lane, kPackREAC24Lane);
+}
+
+template <int kOrder, unsigned int kNumChannels, bool kRamping>
+PCM_TARGET_AVX2
+static inline void Int24ToFloat32Frames_AVX2( const UInt8 *src, Float32 *dst, unsigned int numFrames,
+	const PCMChannelGains *gains, Float32 frame )
+{
+	enum { kVectors = kNumChannels / 8 };
+	const __m256 vscale = _mm256_set1_ps(kTwoToMinus31);
+	const __m256 vzero = _mm256_setzero_ps();
+	const __m256i perm = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+	const __m256i permEnd = _mm256_setr_epi32(2, 3, 4, 5, 4, 5, 6, 7);
+	const __m256i shuf = Int24UnpackShuffle_AVX2<kOrder>(false);
+	const __m256i shufEnd = Int24UnpackShuffle_AVX2<kOrder>(true);
+	__m256 vgain[kVectors], vstep[kVectors];
+
+	for (unsigned int v = 0; v < kVectors; v++) {
+		vgain[v] = _mm256_loadu_ps(gains->gain + 8*v);
+		if (kRamping)
+			vstep[v] = _mm256_loadu_ps(gains->step + 8*v);
+	}
+
+	for (unsigned int f = 0; f < numFrames; f++, src += 3*kNumChannels, dst += kNumChannels, frame += 1.f) {
+		__m256 vframe = _mm256_add_ps(_mm256_set1_ps(frame), vzero);
+		for (unsigned int v = 0; v < kVectors; v++) {
+			__m256 vf;
+			if (f + 1 < numFrames || v + 1 < kVectors)
+				vf = Int24x8ToFloat32_AVX2(src + 24*v, perm, shuf, vscale);
+			else
+				vf = Int24x8ToFloat32_AVX2(src + 24*v + 24 - 32, permEnd, shufEnd, vscale);
+			__m256 vg = vgain[v];
+			if (kRamping)
+				vg = _mm256_add_ps(vg, _mm256_mul_ps(vstep[v], vframe));
+			_mm256_storeu_ps(dst + 8*v, _mm256_mul_ps(vf, vg));
+		}
+	}
+	_mm256_zeroupper();	// as in Int24ToFloat32_AVX2
+}
+
+template <int kOrder, unsigned int kNumChannels>
+PCM_TARGET_AVX2
+static void Int24ToFloat32GainFrames_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert,
+	const PCMChannelGains *gains, Float32 firstFrame )
+{
+	// the last vector is loaded from 8 bytes before it, so there has to be more than one
+	if (kNumChannels != gains->numChannels || 0 != numToConvert % kNumChannels || numToConvert < 16) {
+		Int24ToFloat32Gain_Any<kOrder>(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	if (gains->ramping)
+		Int24ToFloat32Frames_AVX2<kOrder, kNumChannels, true>(src, dst, numToConvert / kNumChannels, gains, firstFrame);
+	else
+		Int24ToFloat32Frames_AVX2<kOrder, kNumChannels, false>(src, dst, numToConvert / kNumChannels, gains, firstFrame);
+}
+
+template <int kOrder, unsigned int kNumChannels, bool kRamping>
+PCM_TARGET_AVX2
+static inline void Float32ToInt24Frames_AVX2( const Float32 *src, UInt8 *dst, unsigned int numFrames,
+	const PCMChannelGains *gains, Float32 frame )
+{
+	enum { kVectors = kNumChannels / 8 };
+	const __m256 vzero = _mm256_setzero_ps();
+	const __m256i shuf = Int24PackShuffle_AVX2<kOrder>();
+	__m256 vgain[kVectors], vstep[kVectors];
+
+	for (unsigned int v = 0; v < kVectors; v++) {
+		vgain[v] = _mm256_loadu_ps(gains->gain + 8*v);
+		if (kRamping)
+			vstep[v] = _mm256_loadu_ps(gains->step + 8*v);
+	}
+
+	ROUNDMODE_NEG_INF
+	for (unsigned int f = 0; f < numFrames; f++, src += kNumChannels, dst += 3*kNumChannels, frame += 1.f) {
+		__m256 vframe = _mm256_add_ps(_mm256_set1_ps(frame), vzero);
+		for (unsigned int v = 0; v < kVectors; v++) {
+			__m256 vg = vgain[v];
+			if (kRamping)
+				vg = _mm256_add_ps(vg, _mm256_mul_ps(vstep[v], vframe));
+			Float32x8ToInt24_AVX2(_mm256_mul_ps(_mm256_loadu_ps(src + 8*v), vg), dst + 24*v, shuf);
+		}
+	}
+	RESTORE_ROUNDMODE
+	_mm256_zeroupper();
+}
+
+template <int kOrder, unsigned int kNumChannels>
+PCM_TARGET_AVX2
+static void Float32ToInt24GainFrames_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert,
+	const PCMChannelGains *gains, Float32 firstFrame )
+{
+	if (kNumChannels != gains->numChannels || 0 != numToConvert % kNumChannels) {
+		Float32ToInt24Gain_Any<kOrder>(src, dst, numToConvert, gains, firstFrame);
+		return;
+	}
+	if (gains->ramping)
+		Float32ToInt24Frames_AVX2<kOrder, kNumChannels, true>(src, dst, numToConvert / kNumChannels, gains, firstFrame);
+	else
+		Float32ToInt24Frames_AVX2<kOrder, kNumChannels, false>(src, dst, numToConvert / kNumChannels, gains, firstFrame);
+}
+
+#endif // PCMBLITTER_HAVE_AVX2
+
+// ===================================================================================================
+#pragma mark -
+#pragma mark AVX-512 VBMI
+
+#if PCMBLITTER_HAVE_AVX512VBMI
+
+// vpermb permutes bytes across the whole 64-byte register, so 16 packed 24-bit ints (48 bytes)
+// are expanded to or packed from 16 32-bit ints in a single instruction. Masked loads and stores
+// take care of the last partial vector. As with AVX2, the arithmetic is the same as for the SSE
+// versions, and buffers too short for their vector code go to them for the scalar conversion.
+
+// Byte indices that move packed 24-bit int i to the high 3 bytes of 32-bit int i (the low byte
+// is zeroed by the 0xEEEE... mask, so its index does not matter)
+#define kUnpackLE24Int(i)	0, 3*i+0, 3*i+1, 3*i+2
+#define kUnpackBE24Int(i)	0, 3*i+2, 3*i+1, 3*i+0
+#define kUnpackREAC24Int(i)	0, (3*i+0)^1, (3*i+1)^1, (3*i+2)^1
+// ... and back. Bytes 48-63 of the result are never stored.
+#define kPackLE24Int(i)		4*i+1, 4*i+2, 4*i+3
+#define kPackBE24Int(i)		4*i+3, 4*i+2, 4*i+1
+// REAC wire order, for the pair of ints i and i+1
+#define kPackREAC24Pair(i)	4*i+2, 4*i+1, 4*i+5, 4*i+3, 4*i+7, 4*i+6
+#define k24x16(I)			I(0), I(1), I(2), I(3), I(4), I(5), I(6), I(7), \
+							I(8), I(9), I(10), I(11), I(12), I(13), I(14), I(15)
+
+static const UInt8 kUnpackLE24Perm[64] __attribute__((aligned(64))) = { k24x16(kUnpackLE24Int) };
+static const UInt8 kUnpackBE24Perm[64] __attribute__((aligned(64))) = { k24x16(kUnpackBE24Int) };
+static const UInt8 kUnpackREAC24Perm[64] __attribute__((aligned(64))) = { k24x16(kUnpackREAC24Int) };
+static const UInt8 kPackLE24Perm[64] __attribute__((aligned(64))) = { k24x16(kPackLE24Int) };
+static const UInt8 kPackBE24Perm[64] __attribute__((aligned(64))) = { k24x16(kPackBE24Int) };
+static const UInt8 kPackREAC24Perm[64] __attribute__((aligned(64))) = {
+	kPackREAC24Pair(0), kPackREAC24Pair(2), kPackREAC24Pair(4), kPackREAC24Pair(6),
+	kPackREAC24Pair(8), kPackREAC24Pair(10), kPackREAC24Pair(12), kPackREAC24Pair(14) };
+
+// A mask with the low n bits set, n <= 64
+static inline UInt64 LowBits64(unsigned int n)
+{
+	return (n >= 64) ? ~(UInt64)0 : (((UInt64)1 << n) - 1);
+}
+
+PCM_TARGET_AVX512VBMI
+static void Int24ToFloat32_VBMI( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const UInt8 *permTable )
+{
+	const __m512i perm = _mm512_load_si512((const void *)permTable);
+	const __m512 vscale = _mm512_set1_ps(kTwoToMinus31);
+	const __mmask64 kLoad48 = 0x0000FFFFFFFFFFFFULL;
+	const __mmask64 kHighBytes = 0xEEEEEEEEEEEEEEEEULL;
+	const __mmask16 kAll16 = 0xFFFF;
+	unsigned int count = numToConvert;
+
+	// The zero masked forms of the intrinsics are used throughout: the plain ones merge into an
+	// undefined register, which gcc warns about as maybe uninitialized
+	while (count >= 16) {
+		__m512i vi = _mm512_maskz_loadu_epi8(kLoad48, src);
+		vi = _mm512_maskz_permutexvar_epi8(kHighBytes, perm, vi);
+		_mm512_storeu_ps(dst, _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(kAll16, vi), vscale));
+		src += 3*16;
+		dst += 16;
+		count -= 16;
+	}
+
+	if (count > 0) {
+		// masked cleanup -- the masked off bytes are neither read nor written
+		__m512i vi = _mm512_maskz_loadu_epi8(LowBits64(3*count), src);
+		vi = _mm512_maskz_permutexvar_epi8(kHighBytes, perm, vi);
+		_mm512_mask_storeu_ps(dst, (__mmask16)LowBits64(count), _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(kAll16, vi), vscale));
+	}
+}
+
+void NativeInt24ToFloat32_VBMI( const UInt8 *src, Float32 *dst, unsigned int numToConvert )
+{
+	Int24ToFloat32_VBMI(src, dst, numToConvert, kUnpackLE24Perm);
+}
+
+void SwapInt24ToFloat32_VBMI( const UInt8 *src, Float32 *dst, unsigned int numToConvert )
+{
+	Int24ToFloat32_VBMI(src, dst, numToConvert, kUnpackBE24Perm);
+}
+
+void REACInt24ToFloat32_VBMI( const UInt8 *src, Float32 *dst, unsigned int numToConvert )
+{
+	Int24ToFloat32_VBMI(src, dst, numToConvert, kUnpackREAC24Perm);
+}
+
+// Converts 16 floats (or the first count of them) and stores them as packed 24-bit ints
+PCM_TARGET_AVX512VBMI
+static inline void Float32x16ToInt24_VBMI(const Float32 *src, UInt8 *dst, __m512i perm, unsigned int count)
+{
+	const __m512 vround = _mm512_set1_ps(0.5f);
+	const __m512 vmin = _mm512_set1_ps(-2147483648.0f);
+	const __m512 vmax = _mm512_set1_ps(kMaxFloat32);
+	const __m512 vscale = _mm512_set1_ps(2147483648.0f);
+	const __mmask16 kLoad = (__mmask16)LowBits64(count);
+
+	// Zero masked, like Int24ToFloat32_VBMI
+	__m512 vf = _mm512_maskz_loadu_ps(kLoad, src);
+	vf = _mm512_mul_ps(vf, vscale);
+	vf = _mm512_add_ps(vf, vround);
+	vf = _mm512_maskz_max_ps(kLoad, vf, vmin);
+	vf = _mm512_maskz_min_ps(kLoad, vf, vmax);
+	__m512i vi = _mm512_maskz_cvtps_epi32(kLoad, vf);	// uses the MXCSR rounding mode, like cvtps2dq in SSE
+	vi = _mm512_maskz_permutexvar_epi8(LowBits64(3*count), perm, vi);
+	_mm512_mask_storeu_epi8(dst, LowBits64(3*count), vi);
+}
+
+PCM_TARGET_AVX512VBMI
+static void Float32ToInt24_VBMI( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const UInt8 *permTable )
+{
+	const __m512i perm = _mm512_load_si512((const void *)permTable);
+	unsigned int count = numToConvert;
+
+	ROUNDMODE_NEG_INF
+
+	while (count >= 16) {
+		Float32x16ToInt24_VBMI(src, dst, perm, 16);
+		src += 16;
+		dst += 3*16;	// bytes
+		count -= 16;
+	}
+
+	if (count > 0) {
+		// masked cleanup
+		Float32x16ToInt24_VBMI(src, dst, perm, count);
+	}
+	RESTORE_ROUNDMODE
+}
+
+// The SSE versions use scalar code (which rounds slightly differently) below 6 samples
+void Float32ToNativeInt24_VBMI( const Float32 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 6) {
+		Float32ToNativeInt24_X86(src, dst, numToConvert);
+		return;
+	}
+	Float32ToInt24_VBMI(src, dst, numToConvert, kPackLE24Perm);
+}
+
+void Float32ToSwapInt24_VBMI( const Float32 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 6) {
+		Float32ToSwapInt24_X86(src, dst, numToConvert);
+		return;
+	}
+	Float32ToInt24_VBMI(src, dst, numToConvert, kPackBE24Perm);
+}
+
+void Float32ToREACInt24_VBMI( const Float32 *src, UInt8 *dst, unsigned int numToConvert )
+{
+	if (numToConvert < 6) {
+		Float32ToREACInt24_X86(src, dst, numToConvert);
+		return;
+	}
+	Float32ToInt24_VBMI(src, dst, numToConvert, kPackREAC24Perm);
+}
+
+#endif // PCMBLITTER_HAVE_AVX512VBMI
+
+// ____________________________________________________________________________
+#pragma mark -
+#pragma mark Runtime dispatch
+
+void (*NativeInt24ToFloat32_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert ) = NativeInt24ToFloat32_X86;
+void (*SwapInt24ToFloat32_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert ) = SwapInt24ToFloat32_X86;
+void (*REACInt24ToFloat32_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert ) = REACInt24ToFloat32_X86;
+void (*Float32ToNativeInt24_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert ) = Float32ToNativeInt24_X86;
+void (*Float32ToSwapInt24_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert ) = Float32ToSwapInt24_X86;
+void (*Float32ToREACInt24_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert ) = Float32ToREACInt24_X86;
+void (*NativeInt24ToFloat32Gain_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame ) = NativeInt24ToFloat32Gain_X86;
+void (*SwapInt24ToFloat32Gain_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame ) = SwapInt24ToFloat32Gain_X86;
+void (*REACInt24ToFloat32Gain_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame ) = REACInt24ToFloat32Gain_X86;
+void (*Float32ToNativeInt24Gain_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame ) = Float32ToNativeInt24Gain_X86;
+void (*Float32ToSwapInt24Gain_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame ) = Float32ToSwapInt24Gain_X86;
+void (*Float32ToREACInt24Gain_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame ) = Float32ToREACInt24Gain_X86;
+
+#if PCMBLITTER_HAVE_AVX2
+static inline void PCMCPUID(UInt32 leaf, UInt32 subleaf, UInt32 regs[4])
+{
+	__asm__ __volatile__ ("cpuid"
+		: "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+		: "a" (leaf), "c" (subleaf));
+}
+#endif
+
+// Returns the best set of blitters that is both compiled in and supported by the CPU and the OS
+int PCMBlitterLibCPULevel(void)
+{
+#if PCMBLITTER_HAVE_AVX2
+	UInt32 regs[4];
+
+	PCMCPUID(0, 0, regs);
+	if (regs[0] < 7) return kPCMBlitterLevelSSE;
+
+	PCMCPUID(1, 0, regs);
+	const UInt32 kOSXSAVE = 1 << 27, kAVX = 1 << 28;
+	if ((regs[2] & (kOSXSAVE | kAVX)) != (kOSXSAVE | kAVX)) return kPCMBlitterLevelSSE;
+
+	// XCR0 has to have both the SSE (bit 1) and AVX (bit 2) state enabled, and for AVX-512
+	// also the opmask (bit 5) and ZMM (bits 6 and 7) state
+	UInt32 xcr0, xcr0High;
+	__asm__ __volatile__ ("xgetbv" : "=a" (xcr0), "=d" (xcr0High) : "c" (0));
+	if ((xcr0 & 0x6) != 0x6) return kPCMBlitterLevelSSE;
+
+	PCMCPUID(7, 0, regs);
+	const UInt32 kAVX2 = 1 << 5, kAVX512F = 1 << 16, kAVX512BW = 1 << 30;
+	const UInt32 kAVX512VBMI = 1 << 1;
+	if (0 == (regs[1] & kAVX2)) return kPCMBlitterLevelSSE;
+
+#if PCMBLITTER_HAVE_AVX512VBMI
+	if ((xcr0 & 0xE6) == 0xE6 &&
+		(regs[1] & (kAVX512F | kAVX512BW)) == (kAVX512F | kAVX512BW) &&
+		(regs[2] & kAVX512VBMI))
+		return kPCMBlitterLevelAVX512VBMI;
+#else
+	(void)kAVX512F; (void)kAVX512BW; (void)kAVX512VBMI;
+#endif
+	return kPCMBlitterLevelAVX2;
+#else
+	return kPCMBlitterLevelSSE;
+#endif
+}
+
+void PCMBlitterLibInit(void)
+{
+	switch (PCMBlitterLibCPULevel()) {
+#if PCMBLITTER_HAVE_AVX512VBMI
+	case kPCMBlitterLevelAVX512VBMI:
+		NativeInt24ToFloat32_Dispatch = NativeInt24ToFloat32_VBMI;
+		SwapInt24ToFloat32_Dispatch = SwapInt24ToFloat32_VBMI;
+		REACInt24ToFloat32_Dispatch = REACInt24ToFloat32_VBMI;
+		Float32ToNativeInt24_Dispatch = Float32ToNativeInt24_VBMI;
+		Float32ToSwapInt24_Dispatch = Float32ToSwapInt24_VBMI;
+		Float32ToREACInt24_Dispatch = Float32ToREACInt24_VBMI;
+		// there are no VBMI versions of the gain blitters
+		NativeInt24ToFloat32Gain_Dispatch = NativeInt24ToFloat32Gain_AVX2;
+		SwapInt24ToFloat32Gain_Dispatch = SwapInt24ToFloat32Gain_AVX2;
+		REACInt24ToFloat32Gain_Dispatch = REACInt24ToFloat32Gain_AVX2;
+		Float32ToNativeInt24Gain_Dispatch = Float32ToNativeInt24Gain_AVX2;
+		Float32ToSwapInt24Gain_Dispatch = Float32ToSwapInt24Gain_AVX2;
+		Float32ToREACInt24Gain_Dispatch = Float32ToREACInt24Gain_AVX2;
+		break;
+#endif
+#if PCMBLITTER_HAVE_AVX2
+	case kPCMBlitterLevelAVX2:
+		NativeInt24ToFloat32_Dispatch = NativeInt24ToFloat32_AVX2;
+		SwapInt24ToFloat32_Dispatch = SwapInt24ToFloat32_AVX2;
+		REACInt24ToFloat32_Dispatch = REACInt24ToFloat32_AVX2;
+		Float32ToNativeInt24_Dispatch = Float32ToNativeInt24_AVX2;
+		Float32ToSwapInt24_Dispatch = Float32ToSwapInt24_AVX2;
+		Float32ToREACInt24_Dispatch = Float32ToREACInt24_AVX2;
+		NativeInt24ToFloat32Gain_Dispatch = NativeInt24ToFloat32Gain_AVX2;
+		SwapInt24ToFloat32Gain_Dispatch = SwapInt24ToFloat32Gain_AVX2;
+		REACInt24ToFloat32Gain_Dispatch = REACInt24ToFloat32Gain_AVX2;
+		Float32ToNativeInt24Gain_Dispatch = Float32ToNativeInt24Gain_AVX2;
+		Float32ToSwapInt24Gain_Dispatch = Float32ToSwapInt24Gain_AVX2;
+		Float32ToREACInt24Gain_Dispatch = Float32ToREACInt24Gain_AVX2;
+		break;
+#endif
+	default:
+		break;
+	}
+}
+
+template <unsigned int kNumChannels>
+static void SetGainBlitters( PCMGainBlitters *blitters, int level )
+{
+#if PCMBLITTER_HAVE_AVX2
+	if (level >= kPCMBlitterLevelAVX2) {
+		blitters->nativeInt24ToFloat32 = Int24ToFloat32GainFrames_AVX2<kPCMInt24Native, kNumChannels>;
+		blitters->swapInt24ToFloat32 = Int24ToFloat32GainFrames_AVX2<kPCMInt24Swap, kNumChannels>;
+		blitters->reacInt24ToFloat32 = Int24ToFloat32GainFrames_AVX2<kPCMInt24REAC, kNumChannels>;
+		blitters->float32ToNativeInt24 = Float32ToInt24GainFrames_AVX2<kPCMInt24Native, kNumChannels>;
+		blitters->float32ToSwapInt24 = Float32ToInt24GainFrames_AVX2<kPCMInt24Swap, kNumChannels>;
+		blitters->float32ToREACInt24 = Float32ToInt24GainFrames_AVX2<kPCMInt24REAC, kNumChannels>;
+		return;
+	}
+#else
+	(void)level;
+#endif
+	blitters->nativeInt24ToFloat32 = Int24ToFloat32GainFrames_X86<kPCMInt24Native, kNumChannels>;
+	blitters->swapInt24ToFloat32 = Int24ToFloat32GainFrames_X86<kPCMInt24Swap, kNumChannels>;
+	blitters->reacInt24ToFloat32 = Int24ToFloat32GainFrames_X86<kPCMInt24REAC, kNumChannels>;
+	blitters->float32ToNativeInt24 = Float32ToInt24GainFrames_X86<kPCMInt24Native, kNumChannels>;
+	blitters->float32ToSwapInt24 = Float32ToInt24GainFrames_X86<kPCMInt24Swap, kNumChannels>;
+	blitters->float32ToREACInt24 = Float32ToInt24GainFrames_X86<kPCMInt24REAC, kNumChannels>;
+}
+
+void PCMGainBlittersInitLevel( PCMGainBlitters *blitters, unsigned int numChannels, int level )
+{
+	blitters->numChannels = numChannels;
+	switch (numChannels) {
+	case 8:		SetGainBlitters<8>(blitters, level); break;
+	case 16:	SetGainBlitters<16>(blitters, level); break;
+	case 24:	SetGainBlitters<24>(blitters, level); break;
+	case 32:	SetGainBlitters<32>(blitters, level); break;
+	case 40:	SetGainBlitters<40>(blitters, level); break;
+	default:
+		blitters->nativeInt24ToFloat32 = NativeInt24ToFloat32Gain;
+		blitters->swapInt24ToFloat32 = SwapInt24ToFloat32Gain;
+		blitters->reacInt24ToFloat32 = REACInt24ToFloat32Gain;
+		blitters->float32ToNativeInt24 = Float32ToNativeInt24Gain;
+		blitters->float32ToSwapInt24 = Float32ToSwapInt24Gain;
+		blitters->float32ToREACInt24 = Float32ToREACInt24Gain;
+		break;
+	}
+}
+
+void PCMGainBlittersInit( PCMGainBlitters *blitters, unsigned int numChannels )
+{
+	PCMGainBlittersInitLevel(blitters, numChannels, PCMBlitterLibCPULevel());
+}
+
 // ____________________________________________________________________________
 #pragma mark -
 
@@ -1311,7 +3929,6 @@ public:
 		double maxInt32 = 2147483648.0;	// 1 << 31
 		double round = mRound;
 		double max32 = maxInt32 - 1.0 - round;
-		double min32 = -2147483648.0;
 		int shift = mShift, count;
 		double f1, f2, f3, f4;
 		int i1, i2, i3, i4;
@@ -1326,7 +3943,7 @@ public:
 			
 			f3 = FloatType::load(src + 2);
 			f2 = f2 * maxInt32 + round;
-			i1 = FloatToInt(f1, min32, max32);
+			i1 = FloatToInt(f1, max32);
 			
 			src += 3;
 			
@@ -1337,22 +3954,22 @@ public:
 			while (count--) {
 				f4 = FloatType::load(src + 0);
 				f3 = f3 * maxInt32 + round;
-				i2 = FloatToInt(f2, min32, max32);
+				i2 = FloatToInt(f2, max32);
 				IntType::store(dest + 0, i1 >> shift);
 	
 				f1 = FloatType::load(src + 1);
 				f4 = f4 * maxInt32 + round;
-				i3 = FloatToInt(f3, min32, max32);
+				i3 = FloatToInt(f3, max32);
 				IntType::store(dest + 1, i2 >> shift);
 	
 				f2 = FloatType::load(src + 2);
 				f1 = f1 * maxInt32 + round;
-				i4 = FloatToInt(f4, min32, max32);
+				i4 = FloatToInt(f4, max32);
 				IntType::store(dest + 2, i3 >> shift);
 				
 				f3 = FloatType::load(src + 3);
 				f2 = f2 * maxInt32 + round;
-				i1 = FloatToInt(f1, min32, max32);
+				i1 = FloatToInt(f1, max32);
 				IntType::store(dest + 3, i4 >> shift);
 				
 				src += 4;
@@ -1361,14 +3978,14 @@ public:
 			
 			f4 = FloatType::load(src);
 			f3 = f3 * maxInt32 + round;
-			i2 = FloatToInt(f2, min32, max32);
+			i2 = FloatToInt(f2, max32);
 			IntType::store(dest + 0, i1 >> shift);
 		
 			f4 = f4 * maxInt32 + round;
-			i3 = FloatToInt(f3, min32, max32);
+			i3 = FloatToInt(f3, max32);
 			IntType::store(dest + 1, i2 >> shift);
 
-			i4 = FloatToInt(f4, min32, max32);
+			i4 = FloatToInt(f4, max32);
 			IntType::store(dest + 2, i3 >> shift);
 
 			IntType::store(dest + 3, i4 >> shift);
@@ -1380,7 +3997,7 @@ public:
 		count = nSamples;
 		while (count--) {
 			f1 = FloatType::load(src) * maxInt32 + round;
-			i1 = FloatToInt(f1, min32, max32) >> shift;
+			i1 = FloatToInt(f1, max32) >> shift;
 			IntType::store(dest, i1);
 			src += 1;
 			dest += 1;
@@ -52,7 +52,24 @@ extern "C" {
 #endif
 
 #if !KERNEL
-	#include <CoreAudio/CoreAudioTypes.h>
+	#if defined(__APPLE__)
+		#include <CoreAudio/CoreAudioTypes.h>
+	#else
+		// Other user space hosts (Linux) only need the basic types, for testing
+		// and benchmarking the blitters
+		#include <stdint.h>
+
+		typedef uint8_t		UInt8;
+		typedef int8_t		SInt8;
+		typedef uint16_t	UInt16;
+		typedef int16_t		SInt16;
+		typedef uint32_t	UInt32;
+		typedef int32_t		SInt32;
+		typedef uint64_t	UInt64;
+		typedef int64_t		SInt64;
+		typedef float		Float32;
+		typedef double		Float64;
+	#endif
 #else
 	#include <TargetConditionals.h>
 	#include <libkern/OSBase.h>
@@ -78,34 +95,286 @@ void Float32ToSwapInt32_X86( const Float32 *src, SInt32 *dst, unsigned int numTo
 void Float32ToNativeInt24_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
 void Float32ToSwapInt24_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
 
+// Converts to/from 24-bit ints in REAC wire order (little-endian with the bytes of each 16-bit
+// word swapped). numToConvert must be even, and the buffers must start at an even sample.
+void REACInt24ToFloat32_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+void Float32ToREACInt24_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+
+// Per-channel gains for the *Gain blitters. The buffers hold interleaved frames of numChannels
+// samples, and have to start at the beginning of a frame. The gain of a sample is
+// gain + step * (firstFrame + f), where f is its frame in the buffer, so step gives a linear ramp.
+// The tables are indexed by position in the frame and continue into the following frames
+// (gain[k] is the gain of channel k % numChannels), so that a vector of samples can load its
+// gains with one load wherever it starts; frame[k] is k / numChannels. Use
+// PCMChannelGainsSet to fill them in.
+#define kPCMMaxGainChannels		64
+#define kPCMGainTablePadding	16
+
+typedef struct PCMChannelGains {
+	unsigned int	numChannels;
+	int				ramping;	// non-zero if any step is non-zero
+	Float32			gain[kPCMMaxGainChannels + kPCMGainTablePadding];
+	Float32			step[kPCMMaxGainChannels + kPCMGainTablePadding];
+	Float32			frame[kPCMMaxGainChannels + kPCMGainTablePadding];
+} PCMChannelGains;
+
+// step may be NULL for constant gains
+void PCMChannelGainsSet( PCMChannelGains *gains, unsigned int numChannels, const Float32 *gain, const Float32 *step );
+
+void NativeInt24ToFloat32Gain_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void SwapInt24ToFloat32Gain_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void REACInt24ToFloat32Gain_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToNativeInt24Gain_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToSwapInt24Gain_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToREACInt24Gain_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void NativeInt32ToFloat32Gain_X86( const SInt32 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToNativeInt32Gain_X86( const Float32 *src, SInt32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+
+// The 24-bit *Gain blitters for a fixed number of channels. For the channel counts of the REAC
+// devices (8, 16, 24, 32 and 40), there are versions that go through the buffers a frame at a time
+// with the gains of the frame in registers, instead of keeping track of the channel of every
+// vector; for other channel counts, these are the *Gain blitters themselves. They take the same
+// arguments and give the same results as the *Gain blitters; gains->numChannels has to be
+// numChannels and the buffers whole frames, or they fall back on them. PCMGainBlittersInit picks
+// the versions for the CPU, and has to be called after PCMBlitterLibInit().
+typedef void (*PCMInt24ToFloat32GainBlitter)( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+typedef void (*PCMFloat32ToInt24GainBlitter)( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+
+typedef struct PCMGainBlitters {
+	unsigned int					numChannels;
+	PCMInt24ToFloat32GainBlitter	nativeInt24ToFloat32;
+	PCMInt24ToFloat32GainBlitter	swapInt24ToFloat32;
+	PCMInt24ToFloat32GainBlitter	reacInt24ToFloat32;
+	PCMFloat32ToInt24GainBlitter	float32ToNativeInt24;
+	PCMFloat32ToInt24GainBlitter	float32ToSwapInt24;
+	PCMFloat32ToInt24GainBlitter	float32ToREACInt24;
+} PCMGainBlitters;
+
+void PCMGainBlittersInit( PCMGainBlitters *blitters, unsigned int numChannels );
+// The versions for one of the kPCMBlitterLevel* levels, which the CPU has to support
+void PCMGainBlittersInitLevel( PCMGainBlitters *blitters, unsigned int numChannels, int level );
+
+// Dithered Float32 to int conversion. The buffers hold whole interleaved frames of
+// state->numChannels samples. TPDF dither of +-1 LSB is added before rounding; with
+// kPCMDitherNoiseShaped, the rounding error of each sample is also subtracted from the next
+// sample of the same channel (first-order noise shaping). The state carries the random number
+// generators and the errors from one call to the next. gains may be NULL, otherwise it is applied
+// as in the *Gain blitters.
+#define kPCMMaxDitherChannels	kPCMMaxGainChannels
+
+enum {
+	kPCMDitherNone = 0,
+	kPCMDitherTPDF = 1,
+	kPCMDitherNoiseShaped = 2
+};
+
+typedef struct PCMDitherState {
+	unsigned int	numChannels;
+	int				mode;		// kPCMDitherTPDF or kPCMDitherNoiseShaped
+	UInt32			rng[8];
+	Float32			error[kPCMMaxDitherChannels + 4];
+} PCMDitherState;
+
+void PCMDitherStateInit( PCMDitherState *state, unsigned int numChannels, int mode );
+
+void Float32ToNativeInt16Dither_X86( const Float32 *src, SInt16 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToSwapInt16Dither_X86( const Float32 *src, SInt16 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToNativeInt24Dither_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToSwapInt24Dither_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToREACInt24Dither_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame );
+// 24-bit samples in the high bytes of native 32-bit ints (the low byte is zero)
+void Float32ToNativeInt24In32Dither_X86( const Float32 *src, SInt32 *dst, unsigned int numToConvert, PCMDitherState *dither, const PCMChannelGains *gains, Float32 firstFrame );
+
+// Per-channel meters. The *Meter blitters measure the samples while they convert them, after the
+// gains: the peak magnitude, the sum of squares for the RMS level, and the number of samples that
+// are within one 24-bit LSB of full scale or beyond it. The buffers hold whole interleaved frames
+// of numChannels samples, and gains may be NULL. The sums are kept by position in a period of
+// lcm(numChannels, 4) samples, so that each vector adds into entries of its own; PCMChannelMetersRead
+// adds them up per channel.
+#define kPCMMaxMeterChannels	kPCMMaxGainChannels
+#define kPCMMeterClipLevel		0.99999988f		// 1 - 2^-23
+
+typedef struct PCMChannelMeters {
+	unsigned int	numChannels;
+	unsigned int	period;		// lcm(numChannels, 4)
+	UInt32			numSamples;
+	Float32			peak[4 * kPCMMaxMeterChannels];
+	Float32			squares[4 * kPCMMaxMeterChannels];
+	UInt32			clipped[4 * kPCMMaxMeterChannels];
+} PCMChannelMeters;
+
+void PCMChannelMetersInit( PCMChannelMeters *meters, unsigned int numChannels );
+// Gets the levels of each channel since the last call, and starts over
+void PCMChannelMetersRead( PCMChannelMeters *meters, Float32 *peak, Float32 *rms, UInt32 *clipped );
+
+void NativeInt24ToFloat32Meter_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters );
+void SwapInt24ToFloat32Meter_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters );
+void REACInt24ToFloat32Meter_X86( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters );
+void Float32ToNativeInt24Meter_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters );
+void Float32ToSwapInt24Meter_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters );
+void Float32ToREACInt24Meter_X86( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters );
+// Only measures, for the formats that have no *Meter blitters
+void Float32Meter_X86( const Float32 *src, unsigned int numToMeter, const PCMChannelGains *gains, Float32 firstFrame, PCMChannelMeters *meters );
+
+// Sample rate conversion of interleaved Float32 frames with a polyphase FIR filter (a half-band
+// filter for 2:1 and 1:2). The caller provides the memory: filter has room for
+// PCMResamplerFilterSize() and history for PCMResamplerHistorySize() Float32s. maxInFrames is the
+// most frames that are passed to one PCMResamplerProcess call. Rates whose ratio does not reduce
+// to terms of at most kPCMResamplerMaxTerm are not supported; PCMResamplerInit returns 0 for them.
+#define kPCMResamplerMaxTerm	1024
+
+enum {
+	kPCMResamplerPolyphase = 0,
+	kPCMResamplerHalfBandDecimator = 1,
+	kPCMResamplerHalfBandInterpolator = 2
+};
+
+typedef struct PCMResampler {
+	unsigned int	numChannels;
+	unsigned int	stride;			// numChannels rounded up to a multiple of 4; the history frames are padded to it
+	unsigned int	L, M;			// outRate / inRate in lowest terms
+	unsigned int	kind;			// kPCMResampler*
+	unsigned int	taps;			// the history frames that an output frame depends on
+	unsigned int	halfTaps;		// K of a 4K+3 tap half-band filter
+	unsigned int	phase;			// of the next output frame
+	unsigned int	next;			// the history frame of the newest input of the next output frame
+	unsigned int	numFrames;		// in the history
+	unsigned int	maxFrames;		// room for in the history
+	Float32			*filter;
+	Float32			*history;
+} PCMResampler;
+
+unsigned int PCMResamplerFilterSize( unsigned int inRate, unsigned int outRate );
+unsigned int PCMResamplerHistorySize( unsigned int inRate, unsigned int outRate, unsigned int numChannels, unsigned int maxInFrames );
+int PCMResamplerInit( PCMResampler *resampler, unsigned int inRate, unsigned int outRate, unsigned int numChannels,
+	unsigned int maxInFrames, Float32 *filter, Float32 *history );
+// Forgets the input so far; the output starts over with silence
+void PCMResamplerReset( PCMResampler *resampler );
+// Adds numInFrames frames of input and converts as many output frames as there is input for, but
+// at most maxOutFrames. The rest is converted by the next call. Returns the number of output
+// frames. After n input frames in all, ceil(n * outRate / inRate) output frames are available.
+unsigned int PCMResamplerProcess( PCMResampler *resampler, const Float32 *src, unsigned int numInFrames,
+	Float32 *dst, unsigned int maxOutFrames );
+
+// Planar (non-interleaved) buffers. Float32ToPlanar copies numFrames interleaved frames of
+// numChannels samples from src to the buffers in dst, one buffer per channelsPerBuffer channels
+// (the last one gets the channels that are left over). Each buffer holds interleaved frames of its
+// own channels, and dst[b] points at the frame in buffer b to start at. PlanarToFloat32 goes the
+// other way. With one channel per buffer, this is a transpose in blocks of 4 by 4 samples, which
+// is unrolled for 8, 16, 24 and 40 channels.
+void Float32ToPlanar_X86( const Float32 *src, Float32 * const *dst, unsigned int numChannels, unsigned int channelsPerBuffer, unsigned int numFrames );
+void PlanarToFloat32_X86( const Float32 * const *src, Float32 *dst, unsigned int numChannels, unsigned int channelsPerBuffer, unsigned int numFrames );
+
+// Swizzles packed 24-bit ints from native (little-endian) order to REAC wire order, or back; the
+// swizzle is the same both ways. numBytes must be even; the buffers can start at any byte, but
+// must not overlap.
+void REACInt24Swizzle_X86( const UInt8 *src, UInt8 *dst, unsigned int numBytes );
+// Packs the high 24 bits of native 32-bit ints into REAC wire order, and unpacks them into the high
+// 24 bits with a zero low byte. numToConvert (ints) must be even, as the swizzle works on pairs of
+// samples; the buffers can start at any byte, but must not overlap.
+void Int24In32ToREACInt24_X86( const UInt8 *src, UInt8 *dst, unsigned int numToConvert );
+void REACInt24ToInt24In32_X86( const UInt8 *src, UInt8 *dst, unsigned int numToConvert );
+
+// AVX2 versions of the 24-bit blitters. They are only compiled in when the compiler can
+// target AVX2; call them through the NativeInt24ToFloat32 etc. names below, which pick
+// the fastest version the CPU supports.
+void NativeInt24ToFloat32_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+void SwapInt24ToFloat32_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+void Float32ToNativeInt24_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+void Float32ToSwapInt24_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+void REACInt24ToFloat32_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+void Float32ToREACInt24_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+void NativeInt24ToFloat32Gain_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void SwapInt24ToFloat32Gain_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void REACInt24ToFloat32Gain_AVX2( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToNativeInt24Gain_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToSwapInt24Gain_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+void Float32ToREACInt24Gain_AVX2( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+
+// AVX-512 VBMI versions of the 24-bit blitters, likewise. Only built in user space; see
+// PCMBLITTER_HAVE_AVX512VBMI in PCMBlitterLib.cpp
+void NativeInt24ToFloat32_VBMI( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+void SwapInt24ToFloat32_VBMI( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+void Float32ToNativeInt24_VBMI( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+void Float32ToSwapInt24_VBMI( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+void REACInt24ToFloat32_VBMI( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+void Float32ToREACInt24_VBMI( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+
+enum {
+	kPCMBlitterLevelSSE = 0,
+	kPCMBlitterLevelAVX2 = 1,
+	kPCMBlitterLevelAVX512VBMI = 2
+};
+
+// Returns the fastest of the kPCMBlitterLevel* blitters that this CPU supports
+int PCMBlitterLibCPULevel(void);
+
+// The 24-bit blitters are dispatched at runtime. The pointers start out pointing at the
+// SSE versions, and PCMBlitterLibInit() switches them to faster versions if the CPU (and
+// the OS) supports it. PCMBlitterLibInit() has to be called once at load time, before any
+// samples are converted.
+void PCMBlitterLibInit(void);
+
+extern void (*NativeInt24ToFloat32_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+extern void (*SwapInt24ToFloat32_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+extern void (*REACInt24ToFloat32_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert );
+extern void (*Float32ToNativeInt24_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+extern void (*Float32ToSwapInt24_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+extern void (*Float32ToREACInt24_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert );
+extern void (*NativeInt24ToFloat32Gain_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+extern void (*SwapInt24ToFloat32Gain_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+extern void (*REACInt24ToFloat32Gain_Dispatch)( const UInt8 *src, Float32 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+extern void (*Float32ToNativeInt24Gain_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+extern void (*Float32ToSwapInt24Gain_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+extern void (*Float32ToREACInt24Gain_Dispatch)( const Float32 *src, UInt8 *dst, unsigned int numToConvert, const PCMChannelGains *gains, Float32 firstFrame );
+
 #define NativeInt16ToFloat32 NativeInt16ToFloat32_X86
 #define SwapInt16ToFloat32 SwapInt16ToFloat32_X86
-#define NativeInt24ToFloat32 NativeInt24ToFloat32_X86
-#define SwapInt24ToFloat32 SwapInt24ToFloat32_X86
+#define NativeInt24ToFloat32 NativeInt24ToFloat32_Dispatch
+#define SwapInt24ToFloat32 SwapInt24ToFloat32_Dispatch
+#define REACInt24ToFloat32 REACInt24ToFloat32_Dispatch
+#define NativeInt24ToFloat32Gain NativeInt24ToFloat32Gain_Dispatch
+#define SwapInt24ToFloat32Gain SwapInt24ToFloat32Gain_Dispatch
+#define REACInt24ToFloat32Gain REACInt24ToFloat32Gain_Dispatch
 #define NativeInt32ToFloat32 NativeInt32ToFloat32_X86
+#define NativeInt32ToFloat32Gain NativeInt32ToFloat32Gain_X86
 #define SwapInt32ToFloat32 SwapInt32ToFloat32_X86
 
 #define Float32ToNativeInt16 Float32ToNativeInt16_X86
 #define Float32ToSwapInt16 Float32ToSwapInt16_X86
 #define Float32ToNativeInt32 Float32ToNativeInt32_X86
+#define Float32ToNativeInt32Gain Float32ToNativeInt32Gain_X86
 #define Float32ToSwapInt32 Float32ToSwapInt32_X86
-#define Float32ToNativeInt24 Float32ToNativeInt24_X86
-#define Float32ToSwapInt24 Float32ToSwapInt24_X86
+#define Float32ToNativeInt24 Float32ToNativeInt24_Dispatch
+#define Float32ToSwapInt24 Float32ToSwapInt24_Dispatch
+#define Float32ToREACInt24 Float32ToREACInt24_Dispatch
+#define Float32ToNativeInt24Gain Float32ToNativeInt24Gain_Dispatch
+#define Float32ToSwapInt24Gain Float32ToSwapInt24Gain_Dispatch
+#define Float32ToREACInt24Gain Float32ToREACInt24Gain_Dispatch
+#define Float32ToNativeInt16Dither Float32ToNativeInt16Dither_X86
+#define Float32ToSwapInt16Dither Float32ToSwapInt16Dither_X86
+#define Float32ToNativeInt24Dither Float32ToNativeInt24Dither_X86
+#define Float32ToSwapInt24Dither Float32ToSwapInt24Dither_X86
+#define Float32ToREACInt24Dither Float32ToREACInt24Dither_X86
+#define Float32ToNativeInt24In32Dither Float32ToNativeInt24In32Dither_X86
+#define NativeInt24ToFloat32Meter NativeInt24ToFloat32Meter_X86
+#define SwapInt24ToFloat32Meter SwapInt24ToFloat32Meter_X86
+#define REACInt24ToFloat32Meter REACInt24ToFloat32Meter_X86
+#define Float32ToNativeInt24Meter Float32ToNativeInt24Meter_X86
+#define Float32ToSwapInt24Meter Float32ToSwapInt24Meter_X86
+#define Float32ToREACInt24Meter Float32ToREACInt24Meter_X86
+#define Float32Meter Float32Meter_X86
+#define Float32ToPlanar Float32ToPlanar_X86
+#define PlanarToFloat32 PlanarToFloat32_X86
+#define REACInt24Swizzle REACInt24Swizzle_X86
+#define Int24In32ToREACInt24 Int24In32ToREACInt24_X86
+#define REACInt24ToInt24In32 REACInt24ToInt24In32_X86
 
 void	Float32ToUInt8(const Float32 *src, UInt8 *dest, unsigned int count);
 void	Float32ToSInt8(const Float32 *src, SInt8 *dest, unsigned int count);
 void	UInt8ToFloat32(const UInt8 *src, Float32 *dest, unsigned int count);
 void	SInt8ToFloat32(const UInt8 *src, Float32 *dest, unsigned int count);
 
-// ____________________________________________________________
-// FloatToInt
-// N.B. Functions which use this should invoke SET_ROUNDMODE / RESTORE_ROUNDMODE.
-static inline SInt32 FloatToInt(double inf, double min32, double max32)
-{
-	if (inf >= max32) return 0x7FFFFFFF;
-	return (SInt32)inf;	// x86 saturates low by itself
-}
-
 
 #ifdef __cplusplus
 }
@@ -65,8 +65,16 @@ void	PCMBlitterLibTest()
 		SwapInt16ToFloat32((SInt16 *)src, dest, nframes);
 		NativeInt24ToFloat32(src, dest, nframes);
 		SwapInt24ToFloat32(src, dest, nframes);
+		REACInt24ToFloat32(src, dest, nframes);
+		NativeInt24ToFloat32Gain(src, dest, nframes, 0, 0);
+		SwapInt24ToFloat32Gain(src, dest, nframes, 0, 0);
+		REACInt24ToFloat32Gain(src, dest, nframes, 0, 0);
 		NativeInt32ToFloat32((SInt32 *)src, dest, nframes);
 		SwapInt32ToFloat32((SInt32 *)src, dest, nframes);
+		NativeInt32ToFloat32Gain((SInt32 *)src, dest, nframes, 0, 0);
+		NativeInt24ToFloat32Meter(src, dest, nframes, 0, 0, 0);
+		SwapInt24ToFloat32Meter(src, dest, nframes, 0, 0, 0);
+		REACInt24ToFloat32Meter(src, dest, nframes, 0, 0, 0);
 	}
 	{
 		Float32 *src = 0;
@@ -78,7 +86,1184 @@ void	PCMBlitterLibTest()
 		Float32ToSwapInt16(src, (SInt16 *)dest, nframes);
 		Float32ToNativeInt24(src, dest, nframes);
 		Float32ToSwapInt24(src, dest, nframes);
+		Float32ToREACInt24(src, dest, nframes);
+		Float32ToNativeInt24Gain(src, dest, nframes, 0, 0);
+		Float32ToSwapInt24Gain(src, dest, nframes, 0, 0);
+		Float32ToREACInt24Gain(src, dest, nframes, 0, 0);
+		Float32ToNativeInt16Dither(src, (SInt16 *)dest, nframes, 0, 0, 0);
+		Float32ToSwapInt16Dither(src, (SInt16 *)dest, nframes, 0, 0, 0);
+		Float32ToNativeInt24Dither(src, dest, nframes, 0, 0, 0);
+		Float32ToSwapInt24Dither(src, dest, nframes, 0, 0, 0);
+		Float32ToREACInt24Dither(src, dest, nframes, 0, 0, 0);
+		Float32ToNativeInt24In32Dither(src, (SInt32 *)dest, nframes, 0, 0, 0);
 		Float32ToNativeInt32(src, (SInt32 *)dest, nframes);
 		Float32ToSwapInt32(src, (SInt32 *)dest, nframes);
+		Float32ToNativeInt32Gain(src, (SInt32 *)dest, nframes, 0, 0);
+		Float32ToNativeInt24Meter(src, dest, nframes, 0, 0, 0);
+		Float32ToSwapInt24Meter(src, dest, nframes, 0, 0, 0);
+		Float32ToREACInt24Meter(src, dest, nframes, 0, 0, 0);
+		Float32Meter(src, nframes, 0, 0, 0);
 	}
+	{
+		PCMResampler resampler;
+		
+		if (PCMResamplerInit(&resampler, 96000, 48000, nframes, nframes, 0, 0))
+			PCMResamplerProcess(&resampler, 0, nframes, 0, nframes);
+	}
+	{
+		Float32 *buffers[1] = { 0 };
+		
+		Float32ToPlanar(0, buffers, 1, 1, nframes);
+		PlanarToFloat32(buffers, 0, 1, 1, nframes);
+	}
+	{
+		UInt8 *src = 0, *dst = 0;
+		
+		REACInt24Swizzle(src, dst, nframes);
+	}
+	{
+		PCMGainBlitters blitters;
+		
+		PCMGainBlittersInit(&blitters, 16);
+		blitters.reacInt24ToFloat32(0, 0, nframes, 0, 0);
+		blitters.float32ToREACInt24(0, 0, nframes, 0, 0);
+	}
+}
+
+#if !KERNEL && defined(__x86_64__)
+
+// Correctness tests and benchmarks of the blitters, for user space builds on an x86-64 host
+// (see test/pcmtest.sh):
+//   g++ -O3 -o pcmtest PCMBlitterLib.cpp PCMBlitterLibTest.cpp && ./pcmtest [bench]
+//
+// Every blitter is compared with a scalar reference version over all lengths up to 40 and a few
+// longer ones, with the source and destination at offsets 0, 4, 8 and 12 from a 16 byte boundary
+// (and 1, 2 and 3 for the packed 8 and 24 bit buffers, 2 for the 16 bit ones), and with edge values (full scale, out of range, infinities, NaN, denormals, and values right
+// at the rounding boundaries) mixed into the samples. The comparison covers a few bytes on
+// either side of the destination, so stray writes are caught as well. With "bench", ns/sample
+// and GB/s (source plus destination bytes) are measured for every blitter and a few buffer sizes.
+// The metering blitters are also checked against meters computed in double precision; the cost of
+// metering is the difference to the corresponding gain blitter.
+
+#include <fenv.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// ____________________________________________________________________________
+// Scalar reference versions
+
+enum Format {
+	kUInt8, kSInt8, kNativeInt16, kSwapInt16, kNativeInt24, kSwapInt24, kREACInt24, kNativeInt32, kSwapInt32,
+	kNativeInt24In32	// in the high bytes
+};
+static const unsigned kFormatBytes[] = { 1, 1, 2, 2, 3, 3, 3, 4, 4, 4 };
+static const unsigned kFormatBits[] = { 8, 8, 16, 16, 24, 24, 24, 32, 32, 24 };
+
+// Sample i of a buffer, sign extended (native is little-endian on x86)
+static SInt32 RefRead(Format format, const UInt8 *buf, unsigned i)
+{
+	const UInt8 *p = buf + kFormatBytes[format] * i;
+	switch (format) {
+	case kUInt8:		return (SInt32)p[0] - 128;
+	case kSInt8:		return (SInt8)p[0];
+	case kNativeInt16:	return (SInt16)(p[0] | (p[1] << 8));
+	case kSwapInt16:	return (SInt16)(p[1] | (p[0] << 8));
+	case kNativeInt24:	return ((SInt8)p[2] << 16) | (p[1] << 8) | p[0];
+	case kSwapInt24:	return ((SInt8)p[0] << 16) | (p[1] << 8) | p[2];
+	case kREACInt24:
+		// each sample pair a, b goes out as a1 a0 b0 a2 b2 b1
+		p = buf + 3 * (i & ~1U);
+		if (0 == (i & 1))
+			return ((SInt8)p[3] << 16) | (p[0] << 8) | p[1];
+		return ((SInt8)p[4] << 16) | (p[5] << 8) | p[2];
+	case kNativeInt32:	return (SInt32)(p[0] | (p[1] << 8) | (p[2] << 16) | ((UInt32)p[3] << 24));
+	case kSwapInt32:	return (SInt32)(p[3] | (p[2] << 8) | (p[1] << 16) | ((UInt32)p[0] << 24));
+	case kNativeInt24In32:	return ((SInt8)p[3] << 16) | (p[2] << 8) | p[1];
+	}
+	return 0;
+}
+
+static void RefWrite(Format format, UInt8 *buf, unsigned i, SInt32 v)
+{
+	UInt8 *p = buf + kFormatBytes[format] * i;
+	switch (format) {
+	case kUInt8:		p[0] = (UInt8)(v + 128); break;
+	case kSInt8:		p[0] = (UInt8)v; break;
+	case kNativeInt16:	p[0] = (UInt8)v; p[1] = (UInt8)(v >> 8); break;
+	case kSwapInt16:	p[1] = (UInt8)v; p[0] = (UInt8)(v >> 8); break;
+	case kNativeInt24:	p[0] = (UInt8)v; p[1] = (UInt8)(v >> 8); p[2] = (UInt8)(v >> 16); break;
+	case kSwapInt24:	p[2] = (UInt8)v; p[1] = (UInt8)(v >> 8); p[0] = (UInt8)(v >> 16); break;
+	case kREACInt24:
+		p = buf + 3 * (i & ~1U);
+		if (0 == (i & 1)) { p[1] = (UInt8)v; p[0] = (UInt8)(v >> 8); p[3] = (UInt8)(v >> 16); }
+		else { p[2] = (UInt8)v; p[5] = (UInt8)(v >> 8); p[4] = (UInt8)(v >> 16); }
+		break;
+	case kNativeInt32:	p[0] = (UInt8)v; p[1] = (UInt8)(v >> 8); p[2] = (UInt8)(v >> 16); p[3] = (UInt8)(v >> 24); break;
+	case kSwapInt32:	p[3] = (UInt8)v; p[2] = (UInt8)(v >> 8); p[1] = (UInt8)(v >> 16); p[0] = (UInt8)(v >> 24); break;
+	case kNativeInt24In32:	p[0] = 0; p[1] = (UInt8)v; p[2] = (UInt8)(v >> 8); p[3] = (UInt8)(v >> 16); break;
+	}
+}
+
+// Ints to floats are exact, except that 32-bit ints are rounded to the nearest float
+static Float32 RefToFloat(SInt32 v, unsigned bits)
+{
+	return (Float32)ldexp((double)v, 1 - (int)bits);
+}
+
+// Floats to ints round half up at the int size for 8 and 16 bits, and at 32 bits (which truncates)
+// for 24 and 32 bits. They clamp to [-2^31, 2^31 - 128], the biggest Float32 below 2^31, before
+// the low bits are dropped. NaN goes to the most negative value.
+static SInt32 RefQuantize(Float32 x, unsigned bits)
+{
+	if (x != x)
+		return (SInt32)0x80000000 >> (32 - bits);
+	double round = (bits <= 16) ? ldexp(1.0, 31 - (int)bits) : 0.5;
+	double v = floor((double)x * 2147483648.0 + round);
+	if (v < -2147483648.0) v = -2147483648.0;
+	if (v > 2147483520.0) v = 2147483520.0;
+	return (SInt32)v >> (32 - bits);
+}
+
+// ____________________________________________________________________________
+// The blitters under test, all with the same signature
+
+typedef void (*Blitter)(const void *src, void *dst, unsigned int n);
+
+#define BLITTER(name, srcType, dstType) \
+	static void name##_T(const void *src, void *dst, unsigned int n) { name((const srcType *)src, (dstType *)dst, n); }
+
+BLITTER(UInt8ToFloat32, UInt8, Float32)
+BLITTER(SInt8ToFloat32, UInt8, Float32)
+BLITTER(NativeInt16ToFloat32_X86, SInt16, Float32)
+BLITTER(SwapInt16ToFloat32_X86, SInt16, Float32)
+BLITTER(NativeInt24ToFloat32_X86, UInt8, Float32)
+BLITTER(NativeInt24ToFloat32_AVX2, UInt8, Float32)
+BLITTER(NativeInt24ToFloat32_VBMI, UInt8, Float32)
+BLITTER(SwapInt24ToFloat32_X86, UInt8, Float32)
+BLITTER(SwapInt24ToFloat32_AVX2, UInt8, Float32)
+BLITTER(SwapInt24ToFloat32_VBMI, UInt8, Float32)
+BLITTER(REACInt24ToFloat32_X86, UInt8, Float32)
+BLITTER(REACInt24ToFloat32_AVX2, UInt8, Float32)
+BLITTER(REACInt24ToFloat32_VBMI, UInt8, Float32)
+BLITTER(NativeInt32ToFloat32_X86, SInt32, Float32)
+BLITTER(SwapInt32ToFloat32_X86, SInt32, Float32)
+
+BLITTER(Float32ToUInt8, Float32, UInt8)
+BLITTER(Float32ToSInt8, Float32, SInt8)
+BLITTER(Float32ToNativeInt16_X86, Float32, SInt16)
+BLITTER(Float32ToSwapInt16_X86, Float32, SInt16)
+BLITTER(Float32ToNativeInt24_X86, Float32, UInt8)
+BLITTER(Float32ToNativeInt24_AVX2, Float32, UInt8)
+BLITTER(Float32ToNativeInt24_VBMI, Float32, UInt8)
+BLITTER(Float32ToSwapInt24_X86, Float32, UInt8)
+BLITTER(Float32ToSwapInt24_AVX2, Float32, UInt8)
+BLITTER(Float32ToSwapInt24_VBMI, Float32, UInt8)
+BLITTER(Float32ToREACInt24_X86, Float32, UInt8)
+BLITTER(Float32ToREACInt24_AVX2, Float32, UInt8)
+BLITTER(Float32ToREACInt24_VBMI, Float32, UInt8)
+BLITTER(Float32ToNativeInt32_X86, Float32, SInt32)
+BLITTER(Float32ToSwapInt32_X86, Float32, SInt32)
+
+// The gain, dither and meter blitters run with these channel gains, dither state and meters,
+// starting at frame sGainFrame of the gains. The channel count leaves a partial vector at the end
+// of every frame.
+enum { kChannels = 10 };
+static PCMChannelGains sGains;
+static PCMDitherState sDither;
+static PCMChannelMeters sMeters;
+static Float32 sGainFrame;
+static bool sDitherGains;
+static bool sMeterGains;
+
+static Float32 RefGain(unsigned i)
+{
+	unsigned c = i % kChannels;
+	return sGains.gain[c] + sGains.step[c] * (sGainFrame + i / kChannels);
+}
+
+#define GAIN_BLITTER(name, srcType, dstType) \
+	static void name##_T(const void *src, void *dst, unsigned int n) \
+		{ name((const srcType *)src, (dstType *)dst, n, &sGains, sGainFrame); }
+#define DITHER_BLITTER(name, dstType) \
+	static void name##_T(const void *src, void *dst, unsigned int n) \
+		{ name((const Float32 *)src, (dstType *)dst, n, &sDither, sDitherGains ? &sGains : NULL, sGainFrame); }
+#define METER_BLITTER(name, srcType, dstType) \
+	static void name##_T(const void *src, void *dst, unsigned int n) \
+		{ name((const srcType *)src, (dstType *)dst, n, sMeterGains ? &sGains : NULL, sGainFrame, &sMeters); }
+
+GAIN_BLITTER(NativeInt24ToFloat32Gain_X86, UInt8, Float32)
+GAIN_BLITTER(NativeInt24ToFloat32Gain_AVX2, UInt8, Float32)
+GAIN_BLITTER(SwapInt24ToFloat32Gain_X86, UInt8, Float32)
+GAIN_BLITTER(SwapInt24ToFloat32Gain_AVX2, UInt8, Float32)
+GAIN_BLITTER(REACInt24ToFloat32Gain_X86, UInt8, Float32)
+GAIN_BLITTER(REACInt24ToFloat32Gain_AVX2, UInt8, Float32)
+GAIN_BLITTER(Float32ToNativeInt24Gain_X86, Float32, UInt8)
+GAIN_BLITTER(Float32ToNativeInt24Gain_AVX2, Float32, UInt8)
+GAIN_BLITTER(Float32ToSwapInt24Gain_X86, Float32, UInt8)
+GAIN_BLITTER(Float32ToSwapInt24Gain_AVX2, Float32, UInt8)
+GAIN_BLITTER(Float32ToREACInt24Gain_X86, Float32, UInt8)
+GAIN_BLITTER(Float32ToREACInt24Gain_AVX2, Float32, UInt8)
+GAIN_BLITTER(NativeInt32ToFloat32Gain_X86, SInt32, Float32)
+GAIN_BLITTER(Float32ToNativeInt32Gain_X86, Float32, SInt32)
+DITHER_BLITTER(Float32ToNativeInt16Dither_X86, SInt16)
+DITHER_BLITTER(Float32ToSwapInt16Dither_X86, SInt16)
+DITHER_BLITTER(Float32ToNativeInt24Dither_X86, UInt8)
+DITHER_BLITTER(Float32ToSwapInt24Dither_X86, UInt8)
+DITHER_BLITTER(Float32ToREACInt24Dither_X86, UInt8)
+DITHER_BLITTER(Float32ToNativeInt24In32Dither_X86, SInt32)
+METER_BLITTER(NativeInt24ToFloat32Meter_X86, UInt8, Float32)
+METER_BLITTER(SwapInt24ToFloat32Meter_X86, UInt8, Float32)
+METER_BLITTER(REACInt24ToFloat32Meter_X86, UInt8, Float32)
+METER_BLITTER(Float32ToNativeInt24Meter_X86, Float32, UInt8)
+METER_BLITTER(Float32ToSwapInt24Meter_X86, Float32, UInt8)
+METER_BLITTER(Float32ToREACInt24Meter_X86, Float32, UInt8)
+
+static void Float32Meter_X86_T(const void *src, void *, unsigned int n)
+{
+	Float32Meter_X86((const Float32 *)src, n, sMeterGains ? &sGains : NULL, sGainFrame, &sMeters);
+}
+
+// kMeterOnly doesn't write to dst
+enum Kind { kPlain, kGain, kDither, kMeter, kMeterOnly };
+
+struct Kernel {
+	const char	*name;
+	int			level;		// the kPCMBlitterLevel* it needs
+	bool		toFloat;
+	Format		format;
+	Kind		kind;
+	Blitter		func;
+};
+
+#define K(name, level, toFloat, format, kind) { #name, level, toFloat, format, kind, name##_T }
+static const Kernel kKernels[] = {
+	K(UInt8ToFloat32,					kPCMBlitterLevelSSE,		true,	kUInt8,			kPlain),
+	K(SInt8ToFloat32,					kPCMBlitterLevelSSE,		true,	kSInt8,			kPlain),
+	K(NativeInt16ToFloat32_X86,			kPCMBlitterLevelSSE,		true,	kNativeInt16,	kPlain),
+	K(SwapInt16ToFloat32_X86,			kPCMBlitterLevelSSE,		true,	kSwapInt16,		kPlain),
+	K(NativeInt24ToFloat32_X86,			kPCMBlitterLevelSSE,		true,	kNativeInt24,	kPlain),
+	K(NativeInt24ToFloat32_AVX2,		kPCMBlitterLevelAVX2,		true,	kNativeInt24,	kPlain),
+	K(NativeInt24ToFloat32_VBMI,		kPCMBlitterLevelAVX512VBMI,	true,	kNativeInt24,	kPlain),
+	K(SwapInt24ToFloat32_X86,			kPCMBlitterLevelSSE,		true,	kSwapInt24,		kPlain),
+	K(SwapInt24ToFloat32_AVX2,			kPCMBlitterLevelAVX2,		true,	kSwapInt24,		kPlain),
+	K(SwapInt24ToFloat32_VBMI,			kPCMBlitterLevelAVX512VBMI,	true,	kSwapInt24,		kPlain),
+	K(REACInt24ToFloat32_X86,			kPCMBlitterLevelSSE,		true,	kREACInt24,		kPlain),
+	K(REACInt24ToFloat32_AVX2,			kPCMBlitterLevelAVX2,		true,	kREACInt24,		kPlain),
+	K(REACInt24ToFloat32_VBMI,			kPCMBlitterLevelAVX512VBMI,	true,	kREACInt24,		kPlain),
+	K(NativeInt32ToFloat32_X86,			kPCMBlitterLevelSSE,		true,	kNativeInt32,	kPlain),
+	K(SwapInt32ToFloat32_X86,			kPCMBlitterLevelSSE,		true,	kSwapInt32,		kPlain),
+	K(NativeInt24ToFloat32Gain_X86,		kPCMBlitterLevelSSE,		true,	kNativeInt24,	kGain),
+	K(NativeInt24ToFloat32Gain_AVX2,	kPCMBlitterLevelAVX2,		true,	kNativeInt24,	kGain),
+	K(SwapInt24ToFloat32Gain_X86,		kPCMBlitterLevelSSE,		true,	kSwapInt24,		kGain),
+	K(SwapInt24ToFloat32Gain_AVX2,		kPCMBlitterLevelAVX2,		true,	kSwapInt24,		kGain),
+	K(REACInt24ToFloat32Gain_X86,		kPCMBlitterLevelSSE,		true,	kREACInt24,		kGain),
+	K(REACInt24ToFloat32Gain_AVX2,		kPCMBlitterLevelAVX2,		true,	kREACInt24,		kGain),
+	K(NativeInt32ToFloat32Gain_X86,		kPCMBlitterLevelSSE,		true,	kNativeInt32,	kGain),
+	K(NativeInt24ToFloat32Meter_X86,	kPCMBlitterLevelSSE,		true,	kNativeInt24,	kMeter),
+	K(SwapInt24ToFloat32Meter_X86,		kPCMBlitterLevelSSE,		true,	kSwapInt24,		kMeter),
+	K(REACInt24ToFloat32Meter_X86,		kPCMBlitterLevelSSE,		true,	kREACInt24,		kMeter),
+
+	K(Float32ToUInt8,					kPCMBlitterLevelSSE,		false,	kUInt8,			kPlain),
+	K(Float32ToSInt8,					kPCMBlitterLevelSSE,		false,	kSInt8,			kPlain),
+	K(Float32ToNativeInt16_X86,			kPCMBlitterLevelSSE,		false,	kNativeInt16,	kPlain),
+	K(Float32ToSwapInt16_X86,			kPCMBlitterLevelSSE,		false,	kSwapInt16,		kPlain),
+	K(Float32ToNativeInt24_X86,			kPCMBlitterLevelSSE,		false,	kNativeInt24,	kPlain),
+	K(Float32ToNativeInt24_AVX2,		kPCMBlitterLevelAVX2,		false,	kNativeInt24,	kPlain),
+	K(Float32ToNativeInt24_VBMI,		kPCMBlitterLevelAVX512VBMI,	false,	kNativeInt24,	kPlain),
+	K(Float32ToSwapInt24_X86,			kPCMBlitterLevelSSE,		false,	kSwapInt24,		kPlain),
+	K(Float32ToSwapInt24_AVX2,			kPCMBlitterLevelAVX2,		false,	kSwapInt24,		kPlain),
+	K(Float32ToSwapInt24_VBMI,			kPCMBlitterLevelAVX512VBMI,	false,	kSwapInt24,		kPlain),
+	K(Float32ToREACInt24_X86,			kPCMBlitterLevelSSE,		false,	kREACInt24,		kPlain),
+	K(Float32ToREACInt24_AVX2,			kPCMBlitterLevelAVX2,		false,	kREACInt24,		kPlain),
+	K(Float32ToREACInt24_VBMI,			kPCMBlitterLevelAVX512VBMI,	false,	kREACInt24,		kPlain),
+	K(Float32ToNativeInt32_X86,			kPCMBlitterLevelSSE,		false,	kNativeInt32,	kPlain),
+	K(Float32ToSwapInt32_X86,			kPCMBlitterLevelSSE,		false,	kSwapInt32,		kPlain),
+	K(Float32ToNativeInt24Gain_X86,		kPCMBlitterLevelSSE,		false,	kNativeInt24,	kGain),
+	K(Float32ToNativeInt24Gain_AVX2,	kPCMBlitterLevelAVX2,		false,	kNativeInt24,	kGain),
+	K(Float32ToSwapInt24Gain_X86,		kPCMBlitterLevelSSE,		false,	kSwapInt24,		kGain),
+	K(Float32ToSwapInt24Gain_AVX2,		kPCMBlitterLevelAVX2,		false,	kSwapInt24,		kGain),
+	K(Float32ToREACInt24Gain_X86,		kPCMBlitterLevelSSE,		false,	kREACInt24,		kGain),
+	K(Float32ToREACInt24Gain_AVX2,		kPCMBlitterLevelAVX2,		false,	kREACInt24,		kGain),
+	K(Float32ToNativeInt32Gain_X86,		kPCMBlitterLevelSSE,		false,	kNativeInt32,	kGain),
+	K(Float32ToNativeInt16Dither_X86,	kPCMBlitterLevelSSE,		false,	kNativeInt16,	kDither),
+	K(Float32ToSwapInt16Dither_X86,		kPCMBlitterLevelSSE,		false,	kSwapInt16,		kDither),
+	K(Float32ToNativeInt24Dither_X86,	kPCMBlitterLevelSSE,		false,	kNativeInt24,	kDither),
+	K(Float32ToSwapInt24Dither_X86,		kPCMBlitterLevelSSE,		false,	kSwapInt24,		kDither),
+	K(Float32ToREACInt24Dither_X86,		kPCMBlitterLevelSSE,		false,	kREACInt24,		kDither),
+	K(Float32ToNativeInt24In32Dither_X86,	kPCMBlitterLevelSSE,	false,	kNativeInt24In32,	kDither),
+	K(Float32ToNativeInt24Meter_X86,	kPCMBlitterLevelSSE,		false,	kNativeInt24,	kMeter),
+	K(Float32ToSwapInt24Meter_X86,		kPCMBlitterLevelSSE,		false,	kSwapInt24,		kMeter),
+	K(Float32ToREACInt24Meter_X86,		kPCMBlitterLevelSSE,		false,	kREACInt24,		kMeter),
+	K(Float32Meter_X86,					kPCMBlitterLevelSSE,		false,	kNativeInt32,	kMeterOnly),
+};
+#undef K
+
+// The meters of the metering blitters, as the reference computes them
+static Float32 sRefPeak[kChannels];
+static double sRefSquares[kChannels];
+static UInt32 sRefClipped[kChannels];
+
+static void RefMeter(unsigned i, Float32 f)
+{
+	unsigned c = i % kChannels;
+	Float32 a = fabsf(f);
+	if (a > sRefPeak[c]) sRefPeak[c] = a;
+	sRefSquares[c] += (double)f * f;
+	if (a >= kPCMMeterClipLevel) sRefClipped[c]++;
+}
+
+// The reference for a kernel, on the same arguments
+static void Reference(const Kernel &k, const void *src, void *dst, unsigned n)
+{
+	unsigned bits = kFormatBits[k.format];
+	bool gain = (kGain == k.kind || ((kMeter == k.kind || kMeterOnly == k.kind) && sMeterGains));
+
+	memset(sRefPeak, 0, sizeof(sRefPeak));
+	memset(sRefSquares, 0, sizeof(sRefSquares));
+	memset(sRefClipped, 0, sizeof(sRefClipped));
+
+	if (k.toFloat) {
+		for (unsigned i = 0; i < n; i++) {
+			Float32 f = RefToFloat(RefRead(k.format, (const UInt8 *)src, i), bits);
+			if (gain)
+				f = f * RefGain(i);
+			RefMeter(i, f);
+			memcpy((Float32 *)dst + i, &f, sizeof(f));	// dst may be misaligned
+		}
+		return;
+	}
+
+	if (kDither != k.kind) {
+		// the float to int blitters apply the gains while rounding to -Inf
+		if (kMeterOnly != k.kind)
+			fesetround(FE_DOWNWARD);
+		for (unsigned i = 0; i < n; i++) {
+			Float32 x;
+			memcpy(&x, (const Float32 *)src + i, sizeof(x));
+			if (gain)
+				x = x * RefGain(i);
+			RefMeter(i, x);
+			if (kMeterOnly != k.kind)
+				RefWrite(k.format, (UInt8 *)dst, i, RefQuantize(x, bits));
+		}
+		fesetround(FE_TONEAREST);
+		return;
+	}
+
+	// Dither: the channels of each frame go in vectors of 4, each of which takes the next random
+	// numbers from one of two alternating sets of four xorshift32 generators
+	const Float32 scale = (Float32)(1 << (bits - 1));
+	PCMDitherState *st = &sDither;
+	fesetround(FE_DOWNWARD);
+	for (unsigned frame = 0; frame < n / kChannels; frame++) {
+		for (unsigned group = 0; group < kChannels; group += 4) {
+			for (unsigned lane = 0; lane < 4; lane++) {
+				UInt32 r = st->rng[lane];
+				r ^= r << 13;
+				r ^= r >> 17;
+				r ^= r << 5;
+				st->rng[lane] = st->rng[lane + 4];
+				st->rng[lane + 4] = r;
+
+				unsigned c = group + lane, i = frame * kChannels + c;
+				if (c >= kChannels)
+					continue;
+				Float32 x;
+				memcpy(&x, (const Float32 *)src + i, sizeof(x));
+				if (sDitherGains)
+					x = x * RefGain(i);
+				Float32 v = x * scale;
+				if (kPCMDitherNoiseShaped == st->mode)
+					v = v - st->error[c];
+				Float32 w = v + (Float32)((SInt32)(r >> 16) - (SInt32)(r & 0xFFFF)) * (1.f / 65536.f);
+				w = w + 0.5f;
+				if (!(w > -scale)) w = -scale;
+				if (!(w < scale - 1)) w = scale - 1;
+				SInt32 q = (SInt32)floorf(w);
+				if (kPCMDitherNoiseShaped == st->mode) {
+					Float32 e = (Float32)q - v;
+					if (!(e > -2.f)) e = -2.f;
+					if (!(e < 2.f)) e = 2.f;
+					st->error[c] = e;
+				}
+				RefWrite(k.format, (UInt8 *)dst, i, q);
+			}
+		}
+	}
+	fesetround(FE_TONEAREST);
+}
+
+// ____________________________________________________________________________
+// Test data
+
+enum { kMaxSamples = 40 * 480, kGuard = 32 };
+
+static UInt8 *sInts;		// random ints
+static Float32 *sFloats;	// random floats with edge values mixed in
+static Float32 *sBenchFloats;	// random floats in range; denormals and NaN would skew the timings
+
+static void MakeTestData()
+{
+	const Float32 edges[] = {
+		0.f, -0.f, 1.f, -1.f, 0.99999994f, -0.99999994f, 1.0000001f, -1.0000001f, 2.f, -2.f,
+		1e10f, -1e10f, 70000.f, -70000.f, INFINITY, -INFINITY, NAN, -NAN,
+		1e-40f, -1e-40f, FLT_MIN, -FLT_MIN, 1e-9f, -1e-9f
+	};
+	const unsigned numEdges = sizeof(edges) / sizeof(edges[0]);
+
+	sInts = (UInt8 *)malloc(4 * kMaxSamples + 2 * kGuard);
+	sFloats = (Float32 *)malloc(sizeof(Float32) * kMaxSamples + 2 * kGuard);
+	sBenchFloats = (Float32 *)malloc(sizeof(Float32) * kMaxSamples);
+
+	srand(1);
+	for (unsigned i = 0; i < 4 * kMaxSamples + 2 * kGuard; i++)
+		sInts[i] = (UInt8)rand();
+	for (unsigned i = 0; i < kMaxSamples + 2 * kGuard / sizeof(Float32); i++) {
+		int r = rand() % 8;
+		if (r < 5) {
+			sFloats[i] = 2.2f * ((Float32)rand() / RAND_MAX) - 1.1f;	// includes clipping
+		} else if (r < 6) {
+			sFloats[i] = edges[rand() % numEdges];
+		} else {
+			// right at, or one ulp off, a rounding boundary of one of the int sizes
+			int bits = 8 << (rand() % 3);
+			Float32 f = ldexpf((Float32)(rand() % 4096 - 2048) + 0.5f, 1 - bits);
+			if (bits == 32) f = ldexpf((Float32)(rand() % 4096 - 2048) + 0.5f, -31 + rand() % 24);
+			sFloats[i] = nextafterf(f, (rand() % 3 - 1) * INFINITY);
+		}
+	}
+	for (unsigned i = 0; i < kMaxSamples; i++)
+		sBenchFloats[i] = 2.f * ((Float32)rand() / RAND_MAX) - 1.f;
+}
+
+// ____________________________________________________________________________
+// Differential test
+
+static const unsigned kOffsets[] = { 0, 1, 2, 3, 4, 8, 12 };
+
+// Buffers are always aligned to their sample size, except the packed 24 bit ones
+static bool OffsetAllowed(unsigned offset, unsigned sampleBytes)
+{
+	return 3 == sampleBytes || 0 == offset % sampleBytes;
+}
+
+// Whether the meters of a metering blitter match the reference. The sums of squares are added up
+// in a different order and in single precision, so the RMS levels only have to be close.
+static bool MetersMatch(unsigned n)
+{
+	Float32 peak[kChannels], rms[kChannels];
+	UInt32 clipped[kChannels];
+	
+	PCMChannelMetersRead(&sMeters, peak, rms, clipped);
+	for (unsigned c = 0; c < kChannels; c++) {
+		double refRMS = (n >= kChannels) ? sqrt(sRefSquares[c] / (n / kChannels)) : 0.;
+		bool rmsMatch = (isnan(refRMS) ? isnan(rms[c]) :
+			isinf(refRMS) ? (Float32)refRMS == rms[c] :
+			fabs(rms[c] - refRMS) <= 1e-5 * refRMS + 1e-30);
+		if (peak[c] != sRefPeak[c] || clipped[c] != sRefClipped[c] || !rmsMatch)
+			return false;
+	}
+	return true;
+}
+
+static unsigned Granularity(const Kernel &k)
+{
+	if (kPlain != k.kind) return kChannels;
+	if (kREACInt24 == k.format) return 2;
+	return 1;
+}
+
+static void ResetState(int variant)
+{
+	Float32 gain[kChannels], step[kChannels];
+	for (unsigned c = 0; c < kChannels; c++) {
+		gain[c] = 0.25f + 0.125f * c;
+		step[c] = (variant & 1) ? (c % 2 ? 1.f : -1.f) / 256 : 0.f;
+	}
+	PCMChannelGainsSet(&sGains, kChannels, gain, step);
+	sGainFrame = (variant & 1) ? 3.f : 0.f;
+	sDitherGains = (variant & 1);
+	PCMDitherStateInit(&sDither, kChannels, (variant & 2) ? kPCMDitherNoiseShaped : kPCMDitherTPDF);
+	sMeterGains = !(variant & 2);
+	PCMChannelMetersInit(&sMeters, kChannels);
+}
+
+// Returns the number of failed runs
+static int TestKernel(const Kernel &k)
+{
+	static const unsigned longLengths[] = { 63, 64, 65, 127, 128, 129, 1000, 4099, kMaxSamples };
+	static UInt8 out[4 * kMaxSamples + 3 * kGuard], refOut[4 * kMaxSamples + 3 * kGuard];
+	unsigned srcBytes = k.toFloat ? kFormatBytes[k.format] : sizeof(Float32);
+	unsigned dstBytes = k.toFloat ? sizeof(Float32) : kFormatBytes[k.format];
+	const UInt8 *srcBase = k.toFloat ? sInts : (const UInt8 *)sFloats;
+	int variants = (kPlain == k.kind) ? 1 : (kGain == k.kind) ? 2 : 4;
+	bool meter = (kMeter == k.kind || kMeterOnly == k.kind);
+	int failures = 0;
+
+	for (unsigned l = 0; l <= 40 + sizeof(longLengths) / sizeof(longLengths[0]); l++) {
+		unsigned n = (l <= 40) ? l : longLengths[l - 41];
+		n -= n % Granularity(k);
+		bool longRun = n > 128;
+
+		for (unsigned so = 0; so < sizeof(kOffsets) / sizeof(kOffsets[0]); so++) {
+			for (unsigned dO = 0; dO < sizeof(kOffsets) / sizeof(kOffsets[0]); dO++) {
+				// the long ones only at a few offsets, to keep the run time down
+				if (longRun && so != dO && so + dO != 4)
+					continue;
+				if (!OffsetAllowed(kOffsets[so], srcBytes) || !OffsetAllowed(kOffsets[dO], dstBytes))
+					continue;
+				for (int variant = 0; variant < variants; variant++) {
+					const UInt8 *src = srcBase + kOffsets[so];
+					unsigned window = n * dstBytes + 2 * kGuard;
+					UInt8 *dst = out + kGuard + kOffsets[dO], *refDst = refOut + kGuard + kOffsets[dO];
+					PCMDitherState after;
+					PCMChannelMeters afterMeters;
+
+					memset(out, 0xA5, window + kOffsets[dO]);
+					memset(refOut, 0xA5, window + kOffsets[dO]);
+					ResetState(variant);
+					k.func(src, dst, n);
+					after = sDither;
+					afterMeters = sMeters;
+					ResetState(variant);
+					Reference(k, src, refDst, n);
+					sMeters = afterMeters;
+
+					if (memcmp(out, refOut, window + kOffsets[dO]) || (meter && !MetersMatch(n)) ||
+						(kDither == k.kind && (memcmp(after.rng, sDither.rng, sizeof(after.rng)) ||
+							memcmp(after.error, sDither.error, sizeof(Float32) * kChannels)))) {
+						if (failures++ < 3) {
+							unsigned b = 0;
+							while (b < window + kOffsets[dO] && out[b] == refOut[b]) b++;
+							printf("  %s: %u samples, offsets %u/%u, variant %d: first difference at dst byte %d\n",
+								k.name, n, kOffsets[so], kOffsets[dO], variant, (int)b - kGuard - (int)kOffsets[dO]);
+						}
+					}
+				}
+			}
+		}
+	}
+	return failures;
+}
+
+// ____________________________________________________________________________
+// Benchmark
+
+static double NowNS()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void BenchKernel(const Kernel &k)
+{
+	static const unsigned sizes[] = { 64, 480, 4800, kMaxSamples };
+	static UInt8 out[4 * kMaxSamples];
+	unsigned srcBytes = k.toFloat ? kFormatBytes[k.format] : sizeof(Float32);
+	unsigned dstBytes = k.toFloat ? sizeof(Float32) : (kMeterOnly == k.kind) ? 0 : kFormatBytes[k.format];
+	const void *src = k.toFloat ? (const void *)sInts : (const void *)sBenchFloats;
+
+	ResetState(0);
+	printf("%-36s", k.name);
+	for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		unsigned n = sizes[s];
+		unsigned reps = 2000000 / n + 10;
+		double best = 1e30;
+		for (int batch = 0; batch < 5; batch++) {
+			double start = NowNS();
+			for (unsigned r = 0; r < reps; r++)
+				k.func(src, out, n);
+			double ns = (NowNS() - start) / reps;
+			if (ns < best) best = ns;
+		}
+		printf(" %7.3f %6.1f", best / n, n * (srcBytes + dstBytes) / best);
+	}
+	printf("\n");
 }
+
+// ____________________________________________________________________________
+// Resampler
+//
+// The converters are fed sines a packet at a time, the way REACAudioEngine does it, and every
+// packet has to come out with the number of frames that the engine expects. The output is then
+// measured a channel at a time with a least squares fit of a sine at the input frequency: the
+// amplitudes of the fits over the passband give the ripple, what is left over at 1 kHz gives
+// THD+N (the images of the interpolators count as noise), and for the decimators the level that
+// is left of sines above the stopband edge gives the alias rejection. A channel must also come
+// out the same whatever the number of channels is. With "bench", the time per input frame is
+// measured for 40 channels.
+
+enum { kDeviceRate = 96000, kPacketFrames = 12, kMaxPacketFrames = 64 };
+
+struct ResamplerCase {
+	unsigned	inRate, outRate;
+	double		maxRipple;		// dB, peak to peak
+	double		maxTHDN;		// dB
+	double		minAlias;		// dB, for the decimators
+};
+
+static const ResamplerCase kResamplerCases[] = {
+	{ 96000, 48000, 0.001, -130., 95. },
+	{ 96000, 44100, 0.001, -115., 95. },
+	{ 48000, 96000, 0.001, -112., 0. },
+	{ 44100, 96000, 0.001, -115., 0. },
+};
+
+static PCMResampler sResampler;
+static Float32 *sResamplerFilter, *sResamplerHistory;
+
+static bool InitResampler(unsigned inRate, unsigned outRate, unsigned nc)
+{
+	free(sResamplerFilter);
+	free(sResamplerHistory);
+	sResamplerFilter = (Float32 *)malloc(PCMResamplerFilterSize(inRate, outRate) * sizeof(Float32));
+	sResamplerHistory = (Float32 *)malloc(PCMResamplerHistorySize(inRate, outRate, nc, kMaxPacketFrames) * sizeof(Float32));
+	return PCMResamplerInit(&sResampler, inRate, outRate, nc, kMaxPacketFrames, sResamplerFilter, sResamplerHistory);
+}
+
+// The number of frames at clientRate that go with the next packet of kPacketFrames frames at
+// kDeviceRate, like REACAudioEngine counts them
+static unsigned PacketClientFrames(UInt32 *acc, unsigned clientRate)
+{
+	UInt32 from = *acc, to = *acc + kPacketFrames * clientRate;
+	*acc = to % kDeviceRate;
+	return (to + kDeviceRate - 1) / kDeviceRate - (from + kDeviceRate - 1) / kDeviceRate;
+}
+
+// Converts about numInFrames frames of sines of amplitude amp, at freq[c] Hz on channel c. Returns
+// the number of output frames, or 0 if a packet came out with the wrong number of frames.
+static unsigned ResampleSignal(unsigned inRate, unsigned outRate, unsigned nc, const double *freq, double amp,
+	unsigned numInFrames, Float32 *out)
+{
+	Float32 *in = (Float32 *)malloc(kMaxPacketFrames * nc * sizeof(Float32));
+	unsigned inDone = 0, outDone = 0;
+	UInt32 acc = 0;
+	bool ok = true;
+
+	while (ok && inDone < numInFrames) {
+		bool decimate = (kDeviceRate == inRate);
+		unsigned n = decimate ? (unsigned)kPacketFrames : PacketClientFrames(&acc, inRate);
+		unsigned expected = decimate ? PacketClientFrames(&acc, outRate) : (unsigned)kPacketFrames;
+		for (unsigned f = 0; f < n; f++)
+			for (unsigned c = 0; c < nc; c++)
+				in[f * nc + c] = (Float32)(amp * sin(2 * M_PI * freq[c] * (inDone + f) / inRate));
+		unsigned got = PCMResamplerProcess(&sResampler, in, n, out + outDone * nc, decimate ? (unsigned)kMaxPacketFrames : expected);
+		ok = (got == expected);
+		inDone += n;
+		outDone += got;
+	}
+	free(in);
+	return ok ? outDone : 0;
+}
+
+// Least squares fit of a sine at freq Hz to channel c of the frames from first to last. Returns its
+// amplitude, and the RMS of the rest in *residual.
+static double FitSine(const Float32 *out, unsigned nc, unsigned c, unsigned first, unsigned last,
+	double freq, unsigned rate, double *residual)
+{
+	double ss = 0, sc = 0, cc = 0, ys = 0, yc = 0, a, b, e = 0;
+	for (unsigned k = first; k < last; k++) {
+		double s = sin(2 * M_PI * freq * k / rate), co = cos(2 * M_PI * freq * k / rate), y = out[k * nc + c];
+		ss += s * s; sc += s * co; cc += co * co; ys += y * s; yc += y * co;
+	}
+	double det = ss * cc - sc * sc;
+	a = (ys * cc - yc * sc) / det;
+	b = (yc * ss - ys * sc) / det;
+	for (unsigned k = first; k < last; k++) {
+		double y = out[k * nc + c] - a * sin(2 * M_PI * freq * k / rate) - b * cos(2 * M_PI * freq * k / rate);
+		e += y * y;
+	}
+	*residual = sqrt(e / (last - first));
+	return sqrt(a * a + b * b);
+}
+
+enum { kSweepPoints = 40 };
+
+static int TestResampler(const ResamplerCase &rc)
+{
+	static const unsigned kChannelCounts[] = { 1, 3, 40 };
+	unsigned numInFrames = rc.inRate / 4;
+	unsigned maxOut = (unsigned)((double)numInFrames * rc.outRate / rc.inRate) + 2 * kMaxPacketFrames;
+	unsigned first = rc.outRate / 50, last;	// the filters have settled after 20 ms
+	Float32 *out = (Float32 *)malloc(maxOut * kSweepPoints * sizeof(Float32));
+	Float32 *single = (Float32 *)malloc(maxOut * kSweepPoints * sizeof(Float32));
+	double freq[kSweepPoints], residual, lowRate = rc.inRate < rc.outRate ? rc.inRate : rc.outRate;
+	double pass = 0.45 * lowRate < 20000. ? 0.45 * lowRate : 20000.;
+	double minGain = 1e9, maxGain = 0, thdn = 0, alias = 1e9;
+	int failures = 0;
+
+	// passband ripple, over a log sweep from 20 Hz to the passband edge
+	for (unsigned c = 0; c < kSweepPoints; c++)
+		freq[c] = 20. * pow(pass / 20., c / (kSweepPoints - 1.));
+	if (!InitResampler(rc.inRate, rc.outRate, kSweepPoints) ||
+		0 == (last = ResampleSignal(rc.inRate, rc.outRate, kSweepPoints, freq, 0.5, numInFrames, out))) {
+		printf("FAIL resampler %u -> %u: wrong number of frames in a packet\n", rc.inRate, rc.outRate);
+		free(out);
+		free(single);
+		return 1;
+	}
+	for (unsigned c = 0; c < kSweepPoints; c++) {
+		double gain = FitSine(out, kSweepPoints, c, first, last, freq[c], rc.outRate, &residual) / 0.5;
+		if (gain < minGain) minGain = gain;
+		if (gain > maxGain) maxGain = gain;
+	}
+
+	// the channels don't depend on the number of channels
+	for (unsigned n = 0; n < sizeof(kChannelCounts) / sizeof(kChannelCounts[0]); n++) {
+		unsigned nc = kChannelCounts[n], got;
+		InitResampler(rc.inRate, rc.outRate, nc);
+		got = ResampleSignal(rc.inRate, rc.outRate, nc, freq + kSweepPoints - nc, 0.5, numInFrames, single);
+		for (unsigned k = 0; k < got && got == last; k++)
+			for (unsigned c = 0; c < nc; c++)
+				if (single[k * nc + c] != out[k * kSweepPoints + kSweepPoints - nc + c])
+					got = 0;
+		if (got != last) {
+			printf("FAIL resampler %u -> %u: the output of %u channels differs\n", rc.inRate, rc.outRate, nc);
+			failures++;
+		}
+	}
+
+	// THD+N of a 1 kHz sine at -1 dBFS
+	freq[0] = 1000.;
+	InitResampler(rc.inRate, rc.outRate, 1);
+	last = ResampleSignal(rc.inRate, rc.outRate, 1, freq, 0.891, numInFrames, out);
+	double amp = FitSine(out, 1, 0, first, last, freq[0], rc.outRate, &residual);
+	thdn = 20 * log10(residual / (amp / sqrt(2.)));
+
+	// alias rejection, over a linear sweep from the stopband edge to half the input rate
+	if (rc.inRate > rc.outRate) {
+		for (unsigned c = 0; c < kSweepPoints; c++)
+			freq[c] = (lowRate - pass) + (rc.inRate / 2. - 100. - (lowRate - pass)) * c / (kSweepPoints - 1.);
+		InitResampler(rc.inRate, rc.outRate, kSweepPoints);
+		last = ResampleSignal(rc.inRate, rc.outRate, kSweepPoints, freq, 0.5, numInFrames, out);
+		for (unsigned c = 0; c < kSweepPoints; c++) {
+			double e = 0;
+			for (unsigned k = first; k < last; k++)
+				e += (double)out[k * kSweepPoints + c] * out[k * kSweepPoints + c];
+			double rejection = -20 * log10(sqrt(e / (last - first)) / (0.5 / sqrt(2.)));
+			if (rejection < alias) alias = rejection;
+		}
+	}
+
+	double ripple = 20 * log10(maxGain / minGain);
+	printf("resampler %5u -> %5u: %-11s %4u taps, passband ripple %.5f dB, THD+N %.1f dB",
+		rc.inRate, rc.outRate,
+		kPCMResamplerPolyphase == sResampler.kind ? "polyphase," : "half-band,",
+		sResampler.taps, ripple, thdn);
+	if (rc.inRate > rc.outRate)
+		printf(", alias rejection %.1f dB", alias);
+	printf("\n");
+	if (ripple > rc.maxRipple || thdn > rc.maxTHDN || (rc.inRate > rc.outRate && alias < rc.minAlias)) {
+		printf("FAIL resampler %u -> %u: worse than %.4f dB ripple, %.1f dB THD+N or %.1f dB alias rejection\n",
+			rc.inRate, rc.outRate, rc.maxRipple, rc.maxTHDN, rc.minAlias);
+		failures++;
+	}
+
+	free(out);
+	free(single);
+	return failures;
+}
+
+static void BenchResampler(const ResamplerCase &rc)
+{
+	enum { kBenchChannels = 40 };
+	unsigned numInFrames = rc.inRate / 4;
+	Float32 *in = (Float32 *)malloc((numInFrames + kMaxPacketFrames) * kBenchChannels * sizeof(Float32));
+	Float32 *out = (Float32 *)malloc(kMaxPacketFrames * kBenchChannels * sizeof(Float32));
+	double best = 1e30;
+
+	for (unsigned i = 0; i < (numInFrames + kMaxPacketFrames) * kBenchChannels; i++)
+		in[i] = (Float32)(2. * random() / RAND_MAX - 1.);
+	InitResampler(rc.inRate, rc.outRate, kBenchChannels);
+	for (int batch = 0; batch < 5; batch++) {
+		bool decimate = (kDeviceRate == rc.inRate);
+		unsigned inDone = 0;
+		UInt32 acc = 0;
+		double start = NowNS();
+		while (inDone < numInFrames) {
+			unsigned n = decimate ? (unsigned)kPacketFrames : PacketClientFrames(&acc, rc.inRate);
+			PCMResamplerProcess(&sResampler, in + inDone * kBenchChannels, n, out, decimate ? kMaxPacketFrames : kPacketFrames);
+			inDone += n;
+		}
+		double ns = (NowNS() - start) / inDone;
+		if (ns < best) best = ns;
+	}
+	free(in);
+	free(out);
+	printf("resampler %5u -> %5u, %u channels: %7.1f ns/input frame, %5.2f%% of a core in real time\n",
+		rc.inRate, rc.outRate, (unsigned)kBenchChannels, best, 100. * best * rc.inRate / 1e9);
+}
+
+// ____________________________________________________________________________
+// Planar buffers
+//
+// The frames are copied from sFloats to planar buffers and back, for channel counts around the
+// unrolled ones, several channels per buffer and all frame counts up to 40, with the buffers at
+// offsets 0 to 3 Float32s from a 16 byte boundary. Both ways have to match a scalar reference bit
+// for bit (NaNs included), and the guard Float32s around each buffer have to be left alone. With
+// "bench", the time per 12 frame packet is measured against the reference.
+
+enum { kMaxPlanarChannels = 64, kMaxPlanarFrames = 40, kPlanarGuard = 4 };
+
+static const Float32 kPlanarGuardValue = -12345.f;
+
+static void RefToPlanar(const Float32 *src, Float32 * const *dst, unsigned nc, unsigned cpb, unsigned numFrames)
+{
+	for (unsigned f = 0; f < numFrames; f++)
+		for (unsigned c = 0; c < nc; c++) {
+			unsigned b = c / cpb, count = (nc - b * cpb < cpb) ? nc - b * cpb : cpb;
+			dst[b][f * count + c % cpb] = src[f * nc + c];
+		}
+}
+
+static int TestPlanar()
+{
+	static const unsigned kChannelCounts[] = { 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 24, 33, 40, 64 };
+	static const unsigned kChannelsPerBuffer[] = { 1, 2, 3, 4, 6, 8, 64 };
+	static Float32 buffers[kMaxPlanarChannels][kMaxPlanarChannels * kMaxPlanarFrames + 2 * kPlanarGuard + 4];
+	static Float32 refBuffers[kMaxPlanarChannels][kMaxPlanarChannels * kMaxPlanarFrames + 2 * kPlanarGuard + 4];
+	static Float32 back[kMaxPlanarChannels * kMaxPlanarFrames + 2 * kPlanarGuard];
+	int failures = 0;
+
+	for (unsigned n = 0; n < sizeof(kChannelCounts) / sizeof(kChannelCounts[0]); n++)
+	for (unsigned p = 0; p < sizeof(kChannelsPerBuffer) / sizeof(kChannelsPerBuffer[0]); p++)
+	for (unsigned numFrames = 0; numFrames <= kMaxPlanarFrames; numFrames++) {
+		unsigned nc = kChannelCounts[n], cpb = kChannelsPerBuffer[p];
+		unsigned numBuffers = (nc + cpb - 1) / cpb;
+		Float32 *dst[kMaxPlanarChannels], *ref[kMaxPlanarChannels];
+		bool ok = true;
+
+		if (cpb > nc && cpb != kMaxPlanarChannels)
+			continue;
+		for (unsigned b = 0; b < numBuffers; b++) {
+			unsigned offset = (b + numFrames) % 4;
+			for (unsigned i = 0; i < sizeof(buffers[b]) / sizeof(Float32); i++)
+				buffers[b][i] = refBuffers[b][i] = kPlanarGuardValue;
+			dst[b] = buffers[b] + kPlanarGuard + offset;
+			ref[b] = refBuffers[b] + kPlanarGuard + offset;
+		}
+		Float32ToPlanar(sFloats + numFrames % 4, dst, nc, cpb, numFrames);
+		RefToPlanar(sFloats + numFrames % 4, ref, nc, cpb, numFrames);
+		for (unsigned b = 0; b < numBuffers; b++)
+			ok = ok && 0 == memcmp(buffers[b], refBuffers[b], sizeof(buffers[b]));
+
+		for (unsigned i = 0; i < sizeof(back) / sizeof(Float32); i++)
+			back[i] = kPlanarGuardValue;
+		PlanarToFloat32(dst, back + kPlanarGuard, nc, cpb, numFrames);
+		ok = ok && 0 == memcmp(back + kPlanarGuard, sFloats + numFrames % 4, numFrames * nc * sizeof(Float32));
+		for (unsigned i = 0; i < kPlanarGuard; i++)
+			ok = ok && back[i] == kPlanarGuardValue && back[kPlanarGuard + numFrames * nc + i] == kPlanarGuardValue;
+
+		if (!ok) {
+			if (failures < 10)
+				printf("FAIL planar buffers: %u channels, %u per buffer, %u frames\n", nc, cpb, numFrames);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+static void BenchPlanar()
+{
+	static const unsigned kBenchChannels[] = { 8, 16, 24, 40 };
+	static Float32 buffers[kMaxPlanarChannels][kPacketFrames];
+	static Float32 frames[kMaxPlanarChannels * kPacketFrames];
+
+	printf("%-36s %14s %14s %14s %14s\n", "ns/packet of 12 frames", "to planar", "reference", "from planar", "reference");
+	for (unsigned n = 0; n < sizeof(kBenchChannels) / sizeof(kBenchChannels[0]); n++) {
+		unsigned nc = kBenchChannels[n];
+		Float32 *dst[kMaxPlanarChannels];
+		char name[40];
+		for (unsigned c = 0; c < nc; c++)
+			dst[c] = buffers[c];
+		snprintf(name, sizeof(name), "%u channels", nc);
+		printf("%-36s", name);
+		for (int way = 0; way < 4; way++) {
+			double best = 1e30;
+			for (int batch = 0; batch < 5; batch++) {
+				double start = NowNS();
+				for (unsigned r = 0; r < 100000; r++) {
+					if (0 == way)
+						Float32ToPlanar(sBenchFloats + r % 64, dst, nc, 1, kPacketFrames);
+					else if (1 == way)
+						RefToPlanar(sBenchFloats + r % 64, dst, nc, 1, kPacketFrames);
+					else if (2 == way)
+						PlanarToFloat32(dst, frames, nc, 1, kPacketFrames);
+					else
+						for (unsigned f = 0; f < kPacketFrames; f++)
+							for (unsigned c = 0; c < nc; c++)
+								frames[f * nc + c] = dst[c][f];
+					__asm__ __volatile__("" : : "r"(frames), "r"(buffers) : "memory");
+				}
+				double ns = (NowNS() - start) / 100000;
+				if (ns < best) best = ns;
+			}
+			printf(" %14.1f", best);
+		}
+		printf("\n");
+	}
+}
+
+// ____________________________________________________________________________
+// REAC wire order swizzle
+//
+// REACInt24Swizzle is compared with swapping the bytes of each 16-bit word one at a time, for every
+// even length up to 3 blocks of 48 bytes and a tail, with the source and destination at all 16 byte
+// offsets. The guard bytes around the destination have to be left alone.
+
+enum { kMaxSwizzleBytes = 3 * 48 + 46, kSwizzleGuard = 16 };
+
+static int TestSwizzle()
+{
+	static UInt8 dst[kMaxSwizzleBytes + 2 * kSwizzleGuard + 16], ref[sizeof(dst)];
+	int failures = 0;
+
+	for (unsigned numBytes = 0; numBytes <= kMaxSwizzleBytes; numBytes += 2)
+	for (unsigned srcOffset = 0; srcOffset < 16; srcOffset++)
+	for (unsigned dstOffset = 0; dstOffset < 16; dstOffset++) {
+		const UInt8 *src = sInts + srcOffset;
+		memset(dst, 0xA5, sizeof(dst));
+		memset(ref, 0xA5, sizeof(ref));
+		REACInt24Swizzle(src, dst + kSwizzleGuard + dstOffset, numBytes);
+		for (unsigned i = 0; i < numBytes; i++)
+			ref[kSwizzleGuard + dstOffset + i] = src[i ^ 1];
+		if (0 != memcmp(dst, ref, sizeof(dst))) {
+			if (failures < 10)
+				printf("FAIL REAC swizzle: %u bytes, source offset %u, destination offset %u\n", numBytes, srcOffset, dstOffset);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+// Int24In32ToREACInt24 and REACInt24ToInt24In32 are compared with packing and unpacking the ints a
+// pair at a time, for every even count up to kMaxSwizzleInts and at all 16 byte offsets of the
+// destination. The guard bytes around the destination have to be left alone.
+
+enum { kMaxSwizzleInts = 3 * 8 + 6 };
+
+static int TestInt24In32Swizzle()
+{
+	static UInt8 dst[4 * kMaxSwizzleInts + 2 * kSwizzleGuard + 16], ref[sizeof(dst)];
+	int failures = 0;
+
+	for (unsigned numInts = 0; numInts <= kMaxSwizzleInts; numInts += 2)
+	for (unsigned dstOffset = 0; dstOffset < 16; dstOffset++) {
+		const UInt8 *src = sInts + dstOffset;
+		UInt8 *out = dst + kSwizzleGuard + dstOffset;
+		UInt8 *refOut = ref + kSwizzleGuard + dstOffset;
+
+		memset(dst, 0xA5, sizeof(dst));
+		memset(ref, 0xA5, sizeof(ref));
+		Int24In32ToREACInt24(src, out, numInts);
+		for (unsigned i = 0; i < numInts; i += 2) {
+			const UInt8 *in = src + 4 * i;
+			UInt8 le[6] = { in[1], in[2], in[3], in[5], in[6], in[7] };
+			for (unsigned b = 0; b < 6; b++)
+				refOut[3 * i + b] = le[b ^ 1];
+		}
+		if (0 != memcmp(dst, ref, sizeof(dst))) {
+			if (failures < 10)
+				printf("FAIL Int24In32 to REAC: %u ints, destination offset %u\n", numInts, dstOffset);
+			failures++;
+		}
+
+		memset(dst, 0xA5, sizeof(dst));
+		memset(ref, 0xA5, sizeof(ref));
+		REACInt24ToInt24In32(src, out, numInts);
+		for (unsigned i = 0; i < numInts; i++) {
+			refOut[4 * i] = 0;
+			for (unsigned b = 0; b < 3; b++)
+				refOut[4 * i + 1 + b] = src[(3 * i + b) ^ 1];
+		}
+		if (0 != memcmp(dst, ref, sizeof(dst))) {
+			if (failures < 10)
+				printf("FAIL REAC to Int24In32: %u ints, destination offset %u\n", numInts, dstOffset);
+			failures++;
+		}
+	}
+	return failures;
+}
+
+// ____________________________________________________________________________
+// Gain blitters for a fixed number of channels
+//
+// The PCMGainBlitters of every level the CPU supports are compared with the *Gain_X86 blitters,
+// for the REAC channel counts, constant and ramping gains, a few frame counts and first frames,
+// and also with a partial frame at the end (which falls back on the *Gain blitters). The
+// destination has to match bit for bit, guard bytes included. With "bench", the time per buffer
+// of 12 (a packet) and 480 frames with constant gains is measured against the dispatched *Gain
+// blitters.
+
+static const unsigned kFixedChannelCounts[] = { 8, 16, 24, 32, 40 };
+
+static void SetFixedGains(PCMChannelGains *gains, unsigned nc, bool ramping)
+{
+	Float32 gain[kPCMMaxGainChannels], step[kPCMMaxGainChannels];
+	for (unsigned c = 0; c < nc; c++) {
+		gain[c] = 2.f * ((Float32)rand() / RAND_MAX);
+		step[c] = ramping ? 0.01f * ((Float32)rand() / RAND_MAX) - 0.005f : 0.f;
+	}
+	PCMChannelGainsSet(gains, nc, gain, step);
+}
+
+static int TestGainBlitters()
+{
+	static const unsigned kFrameCounts[] = { 1, 2, 3, 12, 13, 64 };
+	static const Float32 kFirstFrames[] = { 0.f, 7.f };
+	static UInt8 out[4 * 40 * 64 + 2 * kGuard], ref[4 * 40 * 64 + 2 * kGuard];
+	int maxLevel = PCMBlitterLibCPULevel();
+	int failures = 0;
+
+	for (int level = kPCMBlitterLevelSSE; level <= maxLevel; level++)
+	for (unsigned n = 0; n < sizeof(kFixedChannelCounts) / sizeof(kFixedChannelCounts[0]); n++)
+	for (int ramping = 0; ramping < 2; ramping++)
+	for (unsigned f = 0; f < sizeof(kFrameCounts) / sizeof(kFrameCounts[0]); f++)
+	for (unsigned ff = 0; ff < sizeof(kFirstFrames) / sizeof(kFirstFrames[0]); ff++)
+	for (int partial = 0; partial < 2; partial++) {
+		unsigned nc = kFixedChannelCounts[n];
+		unsigned count = kFrameCounts[f] * nc - (partial ? 3 : 0);
+		Float32 firstFrame = kFirstFrames[ff];
+		PCMChannelGains gains;
+		PCMGainBlitters blitters;
+
+		SetFixedGains(&gains, nc, ramping);
+		PCMGainBlittersInitLevel(&blitters, nc, level);
+		for (int b = 0; b < 6; b++) {
+			bool toFloat = b < 3;
+			const UInt8 *ints = sInts + f % 4;
+			const Float32 *floats = sFloats + f % 4;
+			UInt8 *dst = out + kGuard, *refDst = ref + kGuard;
+
+			memset(out, 0xA5, sizeof(out));
+			memset(ref, 0xA5, sizeof(ref));
+			switch (b) {
+			case 0:
+				blitters.nativeInt24ToFloat32(ints, (Float32 *)dst, count, &gains, firstFrame);
+				NativeInt24ToFloat32Gain_X86(ints, (Float32 *)refDst, count, &gains, firstFrame);
+				break;
+			case 1:
+				blitters.swapInt24ToFloat32(ints, (Float32 *)dst, count, &gains, firstFrame);
+				SwapInt24ToFloat32Gain_X86(ints, (Float32 *)refDst, count, &gains, firstFrame);
+				break;
+			case 2:
+				blitters.reacInt24ToFloat32(ints, (Float32 *)dst, count, &gains, firstFrame);
+				REACInt24ToFloat32Gain_X86(ints, (Float32 *)refDst, count, &gains, firstFrame);
+				break;
+			case 3:
+				blitters.float32ToNativeInt24(floats, dst, count, &gains, firstFrame);
+				Float32ToNativeInt24Gain_X86(floats, refDst, count, &gains, firstFrame);
+				break;
+			case 4:
+				blitters.float32ToSwapInt24(floats, dst, count, &gains, firstFrame);
+				Float32ToSwapInt24Gain_X86(floats, refDst, count, &gains, firstFrame);
+				break;
+			default:
+				blitters.float32ToREACInt24(floats, dst, count, &gains, firstFrame);
+				Float32ToREACInt24Gain_X86(floats, refDst, count, &gains, firstFrame);
+				break;
+			}
+			if (0 != memcmp(out, ref, (toFloat ? 4 : 3) * count + 2 * kGuard)) {
+				if (failures < 10)
+					printf("FAIL fixed gain blitter %d: level %d, %u channels, %s gains, %u samples, first frame %g\n",
+						b, level, nc, ramping ? "ramping" : "constant", count, firstFrame);
+				failures++;
+			}
+		}
+	}
+	return failures;
+}
+
+static void BenchGainBlitters()
+{
+	static const unsigned kBenchFrames[] = { kPacketFrames, 480 };
+	static UInt8 out[4 * kMaxSamples];
+
+	PCMBlitterLibInit();	// for the dispatched *Gain blitters
+	printf("%-36s %14s %14s %14s %14s\n", "ns/buffer, REAC order", "to float", "*Gain", "from float", "*Gain");
+	for (unsigned n = 0; n < sizeof(kFixedChannelCounts) / sizeof(kFixedChannelCounts[0]); n++)
+	for (unsigned s = 0; s < sizeof(kBenchFrames) / sizeof(kBenchFrames[0]); s++) {
+		unsigned nc = kFixedChannelCounts[n], count = nc * kBenchFrames[s];
+		unsigned reps = 20000000 / count + 10;
+		PCMChannelGains gains;
+		PCMGainBlitters blitters;
+		char name[40];
+
+		SetFixedGains(&gains, nc, false);
+		PCMGainBlittersInit(&blitters, nc);
+		snprintf(name, sizeof(name), "%u channels, %u frames", nc, kBenchFrames[s]);
+		printf("%-36s", name);
+		for (int way = 0; way < 4; way++) {
+			double best = 1e30;
+			for (int batch = 0; batch < 5; batch++) {
+				double start = NowNS();
+				for (unsigned r = 0; r < reps; r++) {
+					if (0 == way)
+						blitters.reacInt24ToFloat32(sInts, (Float32 *)out, count, &gains, 0.f);
+					else if (1 == way)
+						REACInt24ToFloat32Gain(sInts, (Float32 *)out, count, &gains, 0.f);
+					else if (2 == way)
+						blitters.float32ToREACInt24(sBenchFloats, out, count, &gains, 0.f);
+					else
+						Float32ToREACInt24Gain(sBenchFloats, out, count, &gains, 0.f);
+					__asm__ __volatile__("" : : "r"(out) : "memory");
+				}
+				double ns = (NowNS() - start) / reps;
+				if (ns < best) best = ns;
+			}
+			printf(" %14.1f", best);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool bench = (argc > 1 && 0 == strcmp(argv[1], "bench"));
+	int level = PCMBlitterLibCPULevel();
+	int failures = 0, skipped = 0;
+
+	MakeTestData();
+
+	for (unsigned i = 0; i < sizeof(kKernels) / sizeof(kKernels[0]); i++) {
+		if (kKernels[i].level > level) {
+			skipped++;
+			continue;
+		}
+		int f = TestKernel(kKernels[i]);
+		if (f)
+			printf("FAIL %s (%d runs)\n", kKernels[i].name, f);
+		failures += f;
+	}
+	for (unsigned i = 0; i < sizeof(kResamplerCases) / sizeof(kResamplerCases[0]); i++)
+		failures += TestResampler(kResamplerCases[i]);
+	failures += TestPlanar();
+	failures += TestSwizzle();
+	failures += TestInt24In32Swizzle();
+	failures += TestGainBlitters();
+	printf("%s: %u blitters tested, %d skipped (not supported by this CPU)\n", failures ? "FAILED" : "OK",
+		(unsigned)(sizeof(kKernels) / sizeof(kKernels[0])) - skipped, skipped);
+
+	if (bench) {
+		printf("\n%-36s %14s %14s %14s %14s\n", "ns/sample GB/s", "64", "480", "4800", "19200");
+		for (unsigned i = 0; i < sizeof(kKernels) / sizeof(kKernels[0]); i++)
+			if (kKernels[i].level <= level)
+				BenchKernel(kKernels[i]);
+		printf("\n");
+		for (unsigned i = 0; i < sizeof(kResamplerCases) / sizeof(kResamplerCases[0]); i++)
+			BenchResampler(kResamplerCases[i]);
+		printf("\n");
+		BenchPlanar();
+		printf("\n");
+		BenchGainBlitters();
+	}
+
+	return failures ? 1 : 0;
+}
+
+#endif
@@ -30,6 +30,365 @@
 
 #include "PCMBlitterLib.h"
 
+// 2^x, for the dB conversions below (there is no libm in the kernel). Accurate to about 1e-7,
+// and exactly 1 for x == 0.
+static Float32 Exp2(Float32 x)
+{
+	if (x < -126.f) return 0.f;
+	if (x > 127.f) x = 127.f;
+	
+	// x = i + f, with f in [-0.5, 0.5]
+	SInt32 i = (SInt32)(x + (x < 0 ? -0.5f : 0.5f));
+	Float32 f = x - i;
+	Float32 p = 1.f + f*(0.693147181f + f*(0.240226507f + f*(0.0555041087f +
+		f*(0.00961812911f + f*(0.00133335581f + f*0.000154035304f)))));
+	
+	union { UInt32 i; Float32 f; } scale;
+	scale.i = (UInt32)(i + 127) << 23;
+	return p * scale.f;
+}
+
+// log2(10) / 20
+#define kDBToLog2 0.166096405f
+
+// The volume controls go from -71.5 dB at 0 (which is silence) to 0 dB at kVolumeMax
+static Float32 VolumeToLinear(SInt32 value)
+{
+	if (value <= 0) return 0.f;
+	return Exp2((-71.5f + 71.5f * value / REACAudioEngine::kVolumeMax) * kDBToLog2);
+}
+
+// The gain controls go from 0 dB at 0 to 72.5 dB at kGainMax
+static Float32 GainToLinear(SInt32 value)
+{
+	return Exp2((72.5f * value / REACAudioEngine::kGainMax) * kDBToLog2);
+}
+
+void REACAudioEngine::updateGains(REACGainState *state, bool output, UInt32 numChannels, UInt32 firstSampleFrame)
+{
+	const SInt32 *level = output ? mVolume : mGain;
+	const SInt32 *mute = output ? mMuteOut : mMuteIn;
+	Float32 (*toLinear)(SInt32) = output ? VolumeToLinear : GainToLinear;
+	Float32 target[kPCMMaxGainChannels];
+	Float32 from[kPCMMaxGainChannels];
+	Float32 step[kPCMMaxGainChannels];
+	Float32 master = mute[0] ? 0.f : toLinear(level[0]);
+	bool unity = true;
+	
+	for (UInt32 channel = 0; channel < numChannels; channel++) {
+		UInt32 id = channel + 1;	// the streams start at channel ID 1
+		Float32 gain = master;
+		if (id <= REAC_MAX_CHANNEL_COUNT)
+			gain = mute[id] ? 0.f : gain * toLinear(level[id]);
+		target[channel] = gain;
+		unity = unity && gain == 1.f;
+	}
+	
+	if (state->valid && state->steady.numChannels == numChannels) {
+		// ramp from wherever the gains are at firstSampleFrame
+		SInt64 start = engineSampleFrame(firstSampleFrame);
+		SInt64 rampFrame = start - state->rampStart;
+		for (UInt32 channel = 0; channel < numChannels; channel++) {
+			if (state->ramping && rampFrame < 0)
+				from[channel] = state->previous.gain[channel];
+			else if (state->ramping && rampFrame < REAC_GAIN_RAMP_FRAMES)
+				from[channel] = state->ramp.gain[channel] + state->ramp.step[channel] * (Float32)rampFrame;
+			else
+				from[channel] = state->steady.gain[channel];
+			step[channel] = (target[channel] - from[channel]) * (1.f / REAC_GAIN_RAMP_FRAMES);
+		}
+		PCMChannelGainsSet(&state->previous, numChannels, from, NULL);
+		PCMChannelGainsSet(&state->ramp, numChannels, from, step);
+		state->ramping = true;
+		state->rampStart = start;
+	} else {
+		// nothing to ramp from
+		state->ramping = false;
+	}
+	
+	PCMChannelGainsSet(&state->steady, numChannels, target, NULL);
+	state->unity = unity;
+	state->valid = true;
+}
+
+SInt64 REACAudioEngine::engineSampleFrame(UInt32 firstSampleFrame) const
+{
+	SInt32 bufferFrames = blockSize * numBlocks;
+	SInt32 offset = (SInt32)((firstSampleFrame + bufferFrames - currentBlock * blockSize) % bufferFrames);
+	
+	if (offset >= bufferFrames / 2)
+		offset -= bufferFrames;
+	return (SInt64)(mBlockCount * blockSize) + offset;
+}
+
+void REACAudioEngine::resetGainRamps()
+{
+	// the ramps are placed from the start of the engine
+	mOutGains.ramping = mInGains.ramping = false;
+}
+
+UInt32 REACAudioEngine::gainSegment(REACGainState *state, bool output, UInt32 numChannels, UInt32 firstSampleFrame,
+                                    UInt32 numSampleFrames, const PCMChannelGains **gains, Float32 *gainFrame)
+{
+	*gains = NULL;
+	*gainFrame = 0.f;
+	if (numChannels > kPCMMaxGainChannels)
+		return numSampleFrames;
+	
+	UInt32 serial = state->serial;
+	if (!state->valid || state->seenSerial != serial || state->steady.numChannels != numChannels) {
+		state->seenSerial = serial;
+		updateGains(state, output, numChannels, firstSampleFrame);
+	}
+	
+	if (state->ramping) {
+		SInt64 rampFrame = engineSampleFrame(firstSampleFrame) - state->rampStart;
+		if (rampFrame < 0) {
+			// a client behind the one that the ramp started at
+			*gains = &state->previous;
+			return (-rampFrame < (SInt64)numSampleFrames) ? (UInt32)-rampFrame : numSampleFrames;
+		}
+		if (rampFrame < REAC_GAIN_RAMP_FRAMES) {
+			UInt32 frames = REAC_GAIN_RAMP_FRAMES - (UInt32)rampFrame;
+			if (frames > numSampleFrames)
+				frames = numSampleFrames;
+			*gains = &state->ramp;
+			*gainFrame = (Float32)rampFrame;
+			return frames;
+		}
+	}
+	
+	if (!state->unity)
+		*gains = &state->steady;
+	return numSampleFrames;
+}
+
+// With Float32 sample buffers, the samples of each packet are converted once, as the packet arrives or
+// right before it is sent, and the CoreAudio clients only copy them. The gain, volume and mute controls
+// and the output dither are applied here then. The packet buffers hold REAC_SAMPLES_PER_PACKET packed
+// 24 bit sample frames, in wire order when mInWireOrder/mOutWireOrder is set and native order otherwise.
+//
+// At the other sample rates, the packets are converted to Float32 at REAC_SAMPLE_RATE, through
+// mInRateBuffer and mOutRateBuffer, and resampled between them and the sample buffers. The gains and
+// meters work at REAC_SAMPLE_RATE then.
+// The planar streams get a transpose of the interleaved frames, one block of 4 frames by 4 channels
+// at a time (see Float32ToPlanar)
+void REACAudioEngine::copyToInputStreams(const Float32 *src, UInt32 firstSampleFrame, UInt32 numSampleFrames)
+{
+	Float32 *dst[REAC_MAX_CHANNEL_COUNT];
+	
+	for (UInt32 s = 0; s < mNumInStreams; s++)
+		dst[s] = &(((Float32*)mInStreams[s]->getSampleBuffer())[firstSampleFrame * mInStreams[s]->format.fNumChannels]);
+	Float32ToPlanar(src, dst, protocol->getReceiveChannels(), mStreamChannels, numSampleFrames);
+}
+
+void REACAudioEngine::copyFromOutputStreams(Float32 *dst, UInt32 firstSampleFrame, UInt32 numSampleFrames)
+{
+	const Float32 *src[REAC_MAX_CHANNEL_COUNT];
+	
+	for (UInt32 s = 0; s < mNumOutStreams; s++)
+		src[s] = &(((Float32*)mOutStreams[s]->getSampleBuffer())[firstSampleFrame * mOutStreams[s]->format.fNumChannels]);
+	PlanarToFloat32(src, dst, protocol->getDeviceInfo()->out_channels, mStreamChannels, numSampleFrames);
+}
+
+void REACAudioEngine::convertPacketToFloat(const UInt8 *src, UInt32 firstSampleFrame)
+{
+	UInt32 theNumChannels = protocol->getReceiveChannels();
+	UInt32 numSampleFrames = REAC_SAMPLES_PER_PACKET;
+	UInt32 packetFrame = firstSampleFrame;
+	Float32 *dst;
+	
+	if (mResampling)
+		dst = mInRateBuffer;
+	else if (0 != mStreamChannels)
+		dst = mInFrameBuffer;
+	else
+		dst = &(((Float32*)mInBuffer)[firstSampleFrame * theNumChannels]);
+	
+	while (numSampleFrames > 0) {
+		const PCMChannelGains *gains;
+		Float32 gainFrame;
+		UInt32 frames = gainSegment(&mInGains, false, theNumChannels, firstSampleFrame, numSampleFrames, &gains, &gainFrame);
+		UInt32 samples = frames * theNumChannels;
+		
+		if (mMeters) {
+			if (mInWireOrder)
+				REACInt24ToFloat32Meter(src, dst, samples, gains, gainFrame, &mInMeters);
+			else
+				NativeInt24ToFloat32Meter(src, dst, samples, gains, gainFrame, &mInMeters);
+		} else if (NULL == gains) {
+			if (mInWireOrder)
+				REACInt24ToFloat32(src, dst, samples);
+			else
+				NativeInt24ToFloat32(src, dst, samples);
+		} else {
+			if (mInWireOrder)
+				mInGainBlitters.reacInt24ToFloat32(src, dst, samples, gains, gainFrame);
+			else
+				mInGainBlitters.nativeInt24ToFloat32(src, dst, samples, gains, gainFrame);
+		}
+		
+		src += 3 * samples;
+		dst += samples;
+		firstSampleFrame += frames;
+		numSampleFrames -= frames;
+	}
+	
+	if (mResampling && 0 != mStreamChannels) {
+		// the frames of the packet at the client rate, which may wrap around
+		UInt32 frames = PCMResamplerProcess(&mInResampler, mInRateBuffer, REAC_SAMPLES_PER_PACKET,
+											mInFrameBuffer, REAC_SAMPLES_PER_PACKET);
+		UInt32 firstFrames = mClientFrames - mInPacketClientFrame;
+		
+		if (firstFrames > frames)
+			firstFrames = frames;
+		copyToInputStreams(mInFrameBuffer, mInPacketClientFrame, firstFrames);
+		copyToInputStreams(&mInFrameBuffer[firstFrames * theNumChannels], 0, frames - firstFrames);
+	}
+	else if (mResampling) {
+		// the sample buffer wraps around in the middle of some of the packets
+		Float32 *buffer = (Float32*)mInBuffer;
+		UInt32 frames = PCMResamplerProcess(&mInResampler, mInRateBuffer, REAC_SAMPLES_PER_PACKET,
+											&buffer[mInPacketClientFrame * theNumChannels], mClientFrames - mInPacketClientFrame);
+		if (mInPacketClientFrame + frames == mClientFrames)
+			PCMResamplerProcess(&mInResampler, NULL, 0, buffer, mClientFrames);
+	}
+	else if (0 != mStreamChannels) {
+		copyToInputStreams(mInFrameBuffer, packetFrame, REAC_SAMPLES_PER_PACKET);
+	}
+}
+
+void REACAudioEngine::convertPacketFromFloat(UInt32 firstSampleFrame)
+{
+	UInt32 theNumChannels = protocol->getDeviceInfo()->out_channels;
+	UInt32 numSampleFrames = REAC_SAMPLES_PER_PACKET;
+	const Float32 *src = &(((Float32*)mOutBuffer)[firstSampleFrame * theNumChannels]);
+	UInt8 *dst = mOutPacketBuffer;
+	
+	if (mResampling && 0 != mStreamChannels) {
+		UInt32 clientFrames = clientFramesInPacket();
+		UInt32 firstFrames = mClientFrames - mClientFrame;
+		
+		if (firstFrames > clientFrames)
+			firstFrames = clientFrames;
+		copyFromOutputStreams(mOutFrameBuffer, mClientFrame, firstFrames);
+		copyFromOutputStreams(&mOutFrameBuffer[firstFrames * theNumChannels], 0, clientFrames - firstFrames);
+		PCMResamplerProcess(&mOutResampler, mOutFrameBuffer, clientFrames, mOutRateBuffer, REAC_SAMPLES_PER_PACKET);
+		src = mOutRateBuffer;
+	}
+	else if (0 != mStreamChannels) {
+		copyFromOutputStreams(mOutFrameBuffer, firstSampleFrame, REAC_SAMPLES_PER_PACKET);
+		src = mOutFrameBuffer;
+	}
+	else if (mResampling) {
+		// the frames of the packet at the client rate, which may wrap around
+		Float32 *buffer = (Float32*)mOutBuffer;
+		UInt32 clientFrames = clientFramesInPacket();
+		UInt32 firstFrames = mClientFrames - mClientFrame;
+		UInt32 frames;
+		
+		if (firstFrames > clientFrames)
+			firstFrames = clientFrames;
+		frames = PCMResamplerProcess(&mOutResampler, &buffer[mClientFrame * theNumChannels], firstFrames,
+									 mOutRateBuffer, REAC_SAMPLES_PER_PACKET);
+		PCMResamplerProcess(&mOutResampler, buffer, clientFrames - firstFrames,
+							&mOutRateBuffer[frames * theNumChannels], REAC_SAMPLES_PER_PACKET - frames);
+		src = mOutRateBuffer;
+	}
+	
+	if (kPCMDitherNone != mOutDitherMode &&
+		(mOutDither.numChannels != theNumChannels || mOutDither.mode != mOutDitherMode))
+		PCMDitherStateInit(&mOutDither, theNumChannels, mOutDitherMode);
+	while (numSampleFrames > 0) {
+		const PCMChannelGains *gains;
+		Float32 gainFrame;
+		UInt32 frames = gainSegment(&mOutGains, true, theNumChannels, firstSampleFrame, numSampleFrames, &gains, &gainFrame);
+		UInt32 samples = frames * theNumChannels;
+		
+		if (kPCMDitherNone != mOutDitherMode) {
+			if (mMeters)
+				Float32Meter(src, samples, gains, gainFrame, &mOutMeters);
+			if (mOutWireOrder)
+				Float32ToREACInt24Dither(src, dst, samples, &mOutDither, gains, gainFrame);
+			else
+				Float32ToNativeInt24Dither(src, dst, samples, &mOutDither, gains, gainFrame);
+		} else if (mMeters) {
+			if (mOutWireOrder)
+				Float32ToREACInt24Meter(src, dst, samples, gains, gainFrame, &mOutMeters);
+			else
+				Float32ToNativeInt24Meter(src, dst, samples, gains, gainFrame, &mOutMeters);
+		} else if (NULL == gains) {
+			if (mOutWireOrder)
+				Float32ToREACInt24(src, dst, samples);
+			else
+				Float32ToNativeInt24(src, dst, samples);
+		} else {
+			if (mOutWireOrder)
+				mOutGainBlitters.float32ToREACInt24(src, dst, samples, gains, gainFrame);
+			else
+				mOutGainBlitters.float32ToNativeInt24(src, dst, samples, gains, gainFrame);
+		}
+		
+		src += samples;
+		dst += 3 * samples;
+		firstSampleFrame += frames;
+		numSampleFrames -= frames;
+	}
+}
+
+// In the integer sample buffers, the CoreAudio clients convert the samples themselves, once per
+// client, so the meters are measured here instead: the input once the samples of a packet are in
+// the buffer, and the output (the mix of the clients, with the volume applied) as the packet is
+// sent. Each frame is measured once.
+void REACAudioEngine::meterPacket(const UInt8 *src, UInt32 bitWidth, bool wireOrder, UInt32 numChannels,
+                                  PCMChannelMeters *meters)
+{
+	UInt32 samples = REAC_SAMPLES_PER_PACKET * numChannels;
+	
+	if (numChannels != meters->numChannels || samples > sizeof(mMeterBuffer) / sizeof(mMeterBuffer[0]))
+		return;
+	if (32 == bitWidth) {
+		NativeInt32ToFloat32((const SInt32 *)src, mMeterBuffer, samples);
+		Float32Meter(mMeterBuffer, samples, NULL, 0.f, meters);
+	} else if (wireOrder) {
+		REACInt24ToFloat32Meter(src, mMeterBuffer, samples, NULL, 0.f, meters);
+	} else {
+		NativeInt24ToFloat32Meter(src, mMeterBuffer, samples, NULL, 0.f, meters);
+	}
+}
+
+void REACAudioEngine::publishMeters(PCMChannelMeters *meters, const char *key)
+{
+	Float32 peak[kPCMMaxMeterChannels], rms[kPCMMaxMeterChannels];
+	UInt32 clipped[kPCMMaxMeterChannels];
+	REACChannelMeter levels[kPCMMaxMeterChannels];
+	UInt32 numChannels = meters->numChannels;
+	OSData *data;
+	
+	// The meters are only updated as the packets are sent and received, like this is called
+	PCMChannelMetersRead(meters, peak, rms, clipped);
+	
+	for (UInt32 channel = 0; channel < numChannels; channel++) {
+		levels[channel].peak = peak[channel];
+		levels[channel].rms = rms[channel];
+		levels[channel].clipped = clipped[channel];
+	}
+	
+	data = OSData::withBytes(levels, numChannels * sizeof(REACChannelMeter));
+	if (NULL != data) {
+		setProperty(key, data);
+		data->release();
+	}
+}
+
+void REACAudioEngine::publishMeters()
+{
+	if (NULL != inputStream)
+		publishMeters(&mInMeters, INPUT_METERS_KEY);
+	if (NULL != outputStream)
+		publishMeters(&mOutMeters, OUTPUT_METERS_KEY);
+}
+
 // The function clipOutputSamples() is called to clip and convert samples from the float mix buffer into the actual
 // hardware sample buffer.  The samples to be clipped, are guaranteed not to wrap from the end of the buffer to the
 // beginning.
@@ -43,8 +402,11 @@
 //		numSampleFrames - the total number of sample frames to clip and convert
 //		streamFormat - the current format of the IOAudioStream this function is operating on
 //		audioStream - the audio stream this function is operating on
-IOReturn REACAudioEngine::clipOutputSamples(const void* inMixBuffer, void* destBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames, const IOAudioStreamFormat* streamFormat, IOAudioStream* /*audioStream*/)
+IOReturn REACAudioEngine::clipOutputSamples(const void* inMixBuffer, void* destBuf, UInt32 firstSampleFrame, UInt32 numSampleFrames, const IOAudioStreamFormat* streamFormat, IOAudioStream* audioStream)
 {
+	//	the packets up to here can be sent (see getSamples)
+	outputWritten(audioStream, firstSampleFrame + numSampleFrames);
+	
 	//	figure out what sort of blit we need to do
 	if((streamFormat->fSampleFormat == kIOAudioStreamSampleFormatLinearPCM) && streamFormat->fIsMixable)
 	{
@@ -75,30 +437,114 @@ IOReturn REACAudioEngine::clipOutputSamples(const void* inMixBuffer, void* destB
 				case 16:
                 {
                     SInt16* theTargetBuffer = (SInt16*)destBuf;
-                    if (nativeEndianInts)
-                        Float32ToNativeInt16(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[theFirstSample]), theNumberSamples);
-                    else
-                        Float32ToSwapInt16(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[theFirstSample]), theNumberSamples);
+                    UInt32 theNumChannels = streamFormat->fNumChannels;
+                    if (kPCMDitherNone == mOutDitherMode) {
+                        if (nativeEndianInts)
+                            Float32ToNativeInt16(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[theFirstSample]), theNumberSamples);
+                        else
+                            Float32ToSwapInt16(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[theFirstSample]), theNumberSamples);
+                        break;
+                    }
+                    
+                    if (mOutDither.numChannels != theNumChannels || mOutDither.mode != mOutDitherMode)
+                        PCMDitherStateInit(&mOutDither, theNumChannels, mOutDitherMode);
+                    // the dithering blitters apply the volume and mute controls as well
+                    while (numSampleFrames > 0) {
+                        const PCMChannelGains *gains;
+                        Float32 gainFrame;
+                        UInt32 frames = gainSegment(&mOutGains, true, theNumChannels, firstSampleFrame, numSampleFrames, &gains, &gainFrame);
+                        Float32 *src = &(theMixBuffer[firstSampleFrame * theNumChannels]);
+                        SInt16 *dst = &(theTargetBuffer[firstSampleFrame * theNumChannels]);
+                        UInt32 samples = frames * theNumChannels;
+                        
+                        if (nativeEndianInts)
+                            Float32ToNativeInt16Dither(src, dst, samples, &mOutDither, gains, gainFrame);
+                        else
+                            Float32ToSwapInt16Dither(src, dst, samples, &mOutDither, gains, gainFrame);
+                        
+                        firstSampleFrame += frames;
+                        numSampleFrames -= frames;
+                    }
                 }
 					break;
                     
 				case 24:
                 {
                     UInt8* theTargetBuffer = (UInt8*)destBuf;
-                    if (nativeEndianInts)
-                        Float32ToNativeInt24(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[3*theFirstSample]), theNumberSamples);
-                    else
-                        Float32ToSwapInt24(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[3*theFirstSample]), theNumberSamples);
+                    UInt32 theNumChannels = streamFormat->fNumChannels;
+                    if (kPCMDitherNone != mOutDitherMode &&
+                        (mOutDither.numChannels != theNumChannels || mOutDither.mode != mOutDitherMode))
+                        PCMDitherStateInit(&mOutDither, theNumChannels, mOutDitherMode);
+                    // the volume and mute controls are applied here, one segment of constant or ramping gains at a time
+                    while (numSampleFrames > 0) {
+                        const PCMChannelGains *gains;
+                        Float32 gainFrame;
+                        UInt32 frames = gainSegment(&mOutGains, true, theNumChannels, firstSampleFrame, numSampleFrames, &gains, &gainFrame);
+                        Float32 *src = &(theMixBuffer[firstSampleFrame * theNumChannels]);
+                        UInt8 *dst = &(theTargetBuffer[3 * firstSampleFrame * theNumChannels]);
+                        UInt32 samples = frames * theNumChannels;
+                        
+                        if (kPCMDitherNone != mOutDitherMode) {
+                            if (mOutWireOrder)
+                                Float32ToREACInt24Dither(src, dst, samples, &mOutDither, gains, gainFrame);
+                            else if (nativeEndianInts)
+                                Float32ToNativeInt24Dither(src, dst, samples, &mOutDither, gains, gainFrame);
+                            else
+                                Float32ToSwapInt24Dither(src, dst, samples, &mOutDither, gains, gainFrame);
+                        } else if (NULL == gains) {
+                            if (mOutWireOrder)
+                                Float32ToREACInt24(src, dst, samples);
+                            else if (nativeEndianInts)
+                                Float32ToNativeInt24(src, dst, samples);
+                            else
+                                Float32ToSwapInt24(src, dst, samples);
+                        } else {
+                            if (mOutWireOrder)
+                                mOutGainBlitters.float32ToREACInt24(src, dst, samples, gains, gainFrame);
+                            else if (nativeEndianInts)
+                                mOutGainBlitters.float32ToNativeInt24(src, dst, samples, gains, gainFrame);
+                            else
+                                mOutGainBlitters.float32ToSwapInt24(src, dst, samples, gains, gainFrame);
+                        }
+                        
+                        firstSampleFrame += frames;
+                        numSampleFrames -= frames;
+                    }
                 }
 					break;
                     
 				case 32:
                 {
                     SInt32* theTargetBuffer = (SInt32*)destBuf;
-                    if (nativeEndianInts)
-                        Float32ToNativeInt32(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[theFirstSample]), theNumberSamples);
-                    else
+                    UInt32 theNumChannels = streamFormat->fNumChannels;
+                    if (!nativeEndianInts) {
                         Float32ToSwapInt32(&(theMixBuffer[theFirstSample]), &(theTargetBuffer[theFirstSample]), theNumberSamples);
+                        break;
+                    }
+                    
+                    // 24 bit samples in 32 bit ints (see mInt24In32) are dithered at 24 bits. Without dither,
+                    // the plain 32 bit conversion gives the same 24 high bits as the 24 bit blitters.
+                    bool dither = (kPCMDitherNone != mOutDitherMode && REAC_RESOLUTION*8 == streamFormat->fBitDepth);
+                    if (dither && (mOutDither.numChannels != theNumChannels || mOutDither.mode != mOutDitherMode))
+                        PCMDitherStateInit(&mOutDither, theNumChannels, mOutDitherMode);
+                    while (numSampleFrames > 0) {
+                        const PCMChannelGains *gains;
+                        Float32 gainFrame;
+                        UInt32 frames = gainSegment(&mOutGains, true, theNumChannels, firstSampleFrame, numSampleFrames, &gains, &gainFrame);
+                        Float32 *src = &(theMixBuffer[firstSampleFrame * theNumChannels]);
+                        SInt32 *dst = &(theTargetBuffer[firstSampleFrame * theNumChannels]);
+                        UInt32 samples = frames * theNumChannels;
+                        
+                        if (dither)
+                            Float32ToNativeInt24In32Dither(src, dst, samples, &mOutDither, gains, gainFrame);
+                        else if (NULL == gains)
+                            Float32ToNativeInt32(src, dst, samples);
+                        else
+                            Float32ToNativeInt32Gain(src, dst, samples, gains, gainFrame);
+                        
+                        firstSampleFrame += frames;
+                        numSampleFrames -= frames;
+                    }
                 }
 					break;
                     
@@ -133,6 +579,7 @@ IOReturn REACAudioEngine::clipOutputSamples(const void* inMixBuffer, void* destB
 	else
 	{
 		//	it's not linear PCM or it's not mixable, so just copy the data into the target buffer
+		//	(with the passthrough format, this is all that happens to the samples between the client and the wire swizzle)
 		SInt8* theMixBuffer = (SInt8*)inMixBuffer;
 		SInt8* theTargetBuffer = (SInt8*)destBuf;
 		UInt32 theFirstByte = firstSampleFrame * (streamFormat->fBitWidth / 8) * streamFormat->fNumChannels;
@@ -162,20 +609,14 @@ IOReturn REACAudioEngine::convertInputSamples(const void* sampleBuf, void* destB
                                               UInt32 numSampleFrames, const IOAudioStreamFormat* streamFormat,
                                               IOAudioStream* /*audioStream*/) {
     { // Check if we'll have an audio drop out, and log if that's the case.
-        const int numChannels = inputStream->format.fNumChannels;
-        const int resolution = inputStream->format.fBitWidth/8;
-        const int bytesPerSample = resolution * numChannels;
-        
-        // This is the place in the buffer where we're currently receiving data from the network
-        UInt8 *inBufferPosition = (UInt8 *)mInBuffer + currentBlock*blockSize*bytesPerSample;
-        // Pointers to where we'll begin and stop writing
-        UInt8 *bufferBeginWritePosition = ((UInt8 *)sampleBuf) + firstSampleFrame*bytesPerSample;
-        UInt8 *bufferStopWritePosition = bufferBeginWritePosition + numSampleFrames*bytesPerSample;
+        // This is the sample frame in the buffers where we're currently receiving data from the network
+        // (the same one in each of the planar streams)
+        const UInt32 inBufferPosition = getCurrentSampleFrame();
         
         // Check if we're going to cross inBufferPosition (this leads to audio dropouts)
-        if (inBufferPosition >= bufferBeginWritePosition && inBufferPosition < bufferStopWritePosition) {
+        if (inBufferPosition >= firstSampleFrame && inBufferPosition < firstSampleFrame + numSampleFrames) {
             IOLog("REACAudioEngine::convertInputSamples(): Audio drop-out! (by %d samples, when converting %d samples)\n",
-                  (int) (firstSampleFrame+numSampleFrames - currentBlock*blockSize), (int) numSampleFrames);
+                  (int) (firstSampleFrame+numSampleFrames - inBufferPosition), (int) numSampleFrames);
         }
     }
     
@@ -184,8 +625,8 @@ IOReturn REACAudioEngine::convertInputSamples(const void* sampleBuf, void* destB
 	{
 		//	it's linear PCM, which means the target is Float32 and we will be calling a blitter, which works in samples not frames
 		Float32* theTargetBuffer = (Float32*)destBuf;
-        const UInt32 theFirstSample = firstSampleFrame * inputStream->format.fNumChannels;
-        const UInt32 theNumberSamples = numSampleFrames * inputStream->format.fNumChannels;
+        const UInt32 theFirstSample = firstSampleFrame * streamFormat->fNumChannels;
+        const UInt32 theNumberSamples = numSampleFrames * streamFormat->fNumChannels;
         
 		if(streamFormat->fNumericRepresentation == kIOAudioStreamNumericRepresentationSignedInt)
 		{
@@ -219,20 +660,63 @@ IOReturn REACAudioEngine::convertInputSamples(const void* sampleBuf, void* destB
 				case 24:
                 {
                     UInt8* theSourceBuffer = (UInt8*)sampleBuf;
-                    if (nativeEndianInts)
-                        NativeInt24ToFloat32(&(theSourceBuffer[3*theFirstSample]), theTargetBuffer, theNumberSamples);
-                    else
-                        SwapInt24ToFloat32(&(theSourceBuffer[3*theFirstSample]), theTargetBuffer, theNumberSamples);
+                    UInt32 theNumChannels = inputStream->format.fNumChannels;
+                    // the gain and mute controls are applied here, one segment of constant or ramping gains at a time
+                    while (numSampleFrames > 0) {
+                        const PCMChannelGains *gains;
+                        Float32 gainFrame;
+                        UInt32 frames = gainSegment(&mInGains, false, theNumChannels, firstSampleFrame, numSampleFrames, &gains, &gainFrame);
+                        UInt8 *src = &(theSourceBuffer[3 * firstSampleFrame * theNumChannels]);
+                        UInt32 samples = frames * theNumChannels;
+                        
+                        if (NULL == gains) {
+                            if (mInWireOrder)
+                                REACInt24ToFloat32(src, theTargetBuffer, samples);
+                            else if (nativeEndianInts)
+                                NativeInt24ToFloat32(src, theTargetBuffer, samples);
+                            else
+                                SwapInt24ToFloat32(src, theTargetBuffer, samples);
+                        } else {
+                            if (mInWireOrder)
+                                mInGainBlitters.reacInt24ToFloat32(src, theTargetBuffer, samples, gains, gainFrame);
+                            else if (nativeEndianInts)
+                                mInGainBlitters.nativeInt24ToFloat32(src, theTargetBuffer, samples, gains, gainFrame);
+                            else
+                                mInGainBlitters.swapInt24ToFloat32(src, theTargetBuffer, samples, gains, gainFrame);
+                        }
+                        
+                        theTargetBuffer += samples;
+                        firstSampleFrame += frames;
+                        numSampleFrames -= frames;
+                    }
                 }
 					break;
                     
 				case 32:
                 {
                     SInt32* theSourceBuffer = (SInt32*)sampleBuf;
-                    if (nativeEndianInts)
-                        NativeInt32ToFloat32(&(theSourceBuffer[theFirstSample]), theTargetBuffer, theNumberSamples);
-                    else
+                    UInt32 theNumChannels = inputStream->format.fNumChannels;
+                    if (!nativeEndianInts) {
                         SwapInt32ToFloat32(&(theSourceBuffer[theFirstSample]), theTargetBuffer, theNumberSamples);
+                        break;
+                    }
+                    
+                    while (numSampleFrames > 0) {
+                        const PCMChannelGains *gains;
+                        Float32 gainFrame;
+                        UInt32 frames = gainSegment(&mInGains, false, theNumChannels, firstSampleFrame, numSampleFrames, &gains, &gainFrame);
+                        SInt32 *src = &(theSourceBuffer[firstSampleFrame * theNumChannels]);
+                        UInt32 samples = frames * theNumChannels;
+                        
+                        if (NULL == gains)
+                            NativeInt32ToFloat32(src, theTargetBuffer, samples);
+                        else
+                            NativeInt32ToFloat32Gain(src, theTargetBuffer, samples, gains, gainFrame);
+                        
+                        theTargetBuffer += samples;
+                        firstSampleFrame += frames;
+                        numSampleFrames -= frames;
+                    }
                 }
 					break;
                     
@@ -267,6 +751,7 @@ IOReturn REACAudioEngine::convertInputSamples(const void* sampleBuf, void* destB
 	else
 	{
 		//	it's not linear PCM or it's not mixable, so just copy the data into the target buffer
+		//	(with the passthrough format, this is all that happens to the samples between the client and the wire swizzle)
 		SInt8* theSourceBuffer = (SInt8*)sampleBuf;
 		UInt32 theFirstByte = firstSampleFrame * (streamFormat->fBitWidth / 8) * streamFormat->fNumChannels;
 		UInt32 theNumberBytes = numSampleFrames     * (streamFormat->fBitWidth / 8) * streamFormat->fNumChannels;
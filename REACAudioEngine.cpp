@@ -54,6 +54,9 @@
 // Note that this is only the default value, and is overridden if found in Info.plist
 #define NUM_BLOCKS_DEFAULT             1024
 
+// The most sample rates that the Float32 formats are offered at besides REAC_SAMPLE_RATE
+#define MAX_SAMPLE_RATES               8
+
 #define super IOAudioEngine
 
 OSDefineMetaClassAndStructors(REACAudioEngine, super)
@@ -90,10 +93,93 @@ bool REACAudioEngine::init(REACConnection* proto, OSDictionary *properties) {
     number = OSDynamicCast(OSNumber, getProperty(BUFFER_OFFSET_FACTOR_KEY));
     bufferOffsetFactor = (number ? number->unsigned32BitValue() : BUFFER_OFFSET_FACTOR_DEFAULT);
     
+    // The dither to use for the output stream: 0 is none, 1 is TPDF and 2 is noise shaped TPDF
+    number = OSDynamicCast(OSNumber, getProperty(OUT_DITHER_KEY));
+    mOutDitherMode = (number ? number->unsigned32BitValue() : kPCMDitherNone);
+    if (mOutDitherMode > kPCMDitherNoiseShaped) {
+        IOLog("REACAudioEngine::init(): Unknown %s %d, not dithering.\n", OUT_DITHER_KEY, mOutDitherMode);
+        mOutDitherMode = kPCMDitherNone;
+    }
+    mOutDither.numChannels = 0;
+    
+    // When non-zero, the sample buffers hold each 24 bit sample in the high bytes of a native endian
+    // 32 bit int instead of packed in 3 bytes. The conversion to and from the CoreAudio floats is then
+    // a plain 32 bit int conversion, and the packing is done while copying to and from the packets,
+    // at the cost of buffers that are a third bigger.
+    number = OSDynamicCast(OSNumber, getProperty(INT24_IN_32_KEY));
+    mInt24In32 = (number && 0 != number->unsigned32BitValue());
+    
+    // When non-zero, the streams offer Float32 formats in addition to the integer ones, and start out
+    // with them. The samples are then converted when the packets arrive and right before they are sent,
+    // so that the CoreAudio clients only copy them.
+    number = OSDynamicCast(OSNumber, getProperty(FLOAT_BUFFERS_KEY));
+    mFloatBuffers = (number && 0 != number->unsigned32BitValue());
+    
+    // When non-zero, the peak and RMS levels and the number of clipped samples of each channel are
+    // measured once per packet, and published in the InputMeters and OutputMeters properties.
+    number = OSDynamicCast(OSNumber, getProperty(METERS_KEY));
+    mMeters = (number && 0 != number->unsigned32BitValue());
+    
+    // When non-zero (and with FloatBuffers), each direction has a stream per this many channels
+    // instead of one stream with all of them, so that the clients get the channels in buffers of
+    // their own (1 gives a mono stream per channel).
+    number = OSDynamicCast(OSNumber, getProperty(STREAM_CHANNELS_KEY));
+    mStreamChannels = (number ? number->unsigned32BitValue() : 0);
+    
+    initInputRouting();
+    
+    // The number of packets that the connection keeps ready to be sent in master and slave mode (0
+    // allocates each one as it is sent). How the sending goes is published in SendStatistics.
+    number = OSDynamicCast(OSNumber, getProperty(PACKET_POOL_KEY));
+    if (number && kIOReturnSuccess != protocol->setPacketPoolSize(number->unsigned32BitValue())) {
+        IOLog("REACAudioEngine::init(): %s is larger than %d, using the default.\n",
+              PACKET_POOL_KEY, REAC_MAX_PACKET_POOL_SIZE);
+    }
+    
+    // In master mode, the number of packets that are sent each time the timer fires (1 sends each
+    // packet on its own, 8000 times a second).
+    number = OSDynamicCast(OSNumber, getProperty(PACKETS_PER_WAKE_KEY));
+    if (number && kIOReturnSuccess != protocol->setPacketsPerWake(number->unsigned32BitValue())) {
+        IOLog("REACAudioEngine::init(): %s has to be 1 to %d, using 1.\n",
+              PACKETS_PER_WAKE_KEY, REAC_MAX_PACKETS_PER_WAKE);
+    }
+    
+    // What is sent when the clients haven't written the samples of a packet in time: 0 is silence,
+    // 1 fades the previous packet out and 2 holds its last sample frame. The underruns are counted in
+    // UnderrunStatistics.
+    number = OSDynamicCast(OSNumber, getProperty(UNDERRUN_FALLBACK_KEY));
+    mUnderrunFallback = (number ? number->unsigned32BitValue() : kREACUnderrunSilence);
+    if (mUnderrunFallback > kREACUnderrunHold) {
+        IOLog("REACAudioEngine::init(): Unknown %s %d, sending silence.\n", UNDERRUN_FALLBACK_KEY, mUnderrunFallback);
+        mUnderrunFallback = kREACUnderrunSilence;
+    }
+    bzero(&mUnderrunStatistics, sizeof(mUnderrunStatistics));
+    mOutReadFrame = 0;
+    resetOutputUnderrun();
+    
     mInBuffer = mOutBuffer = NULL;
+    mInPacketBuffer = mOutPacketBuffer = NULL;
+    mInPacketBufferSize = mOutPacketBufferSize = 0;
+    mInFloat = mOutFloat = false;
+    mInPacketFrame = 0;
+    mClientRate = REAC_SAMPLE_RATE;
+    mResampling = false;
+    mClientFrames = blockSize * numBlocks;
+    mClientFrame = mClientFrameAcc = mInPacketClientFrame = 0;
+    mResamplerMemory = mInRateBuffer = mOutRateBuffer = NULL;
+    mResamplerMemorySize = 0;
     inputStream = outputStream = NULL;
+    mNumInStreams = mNumOutStreams = 0;
+    mInFrameBuffer = mOutFrameBuffer = NULL;
+    mInFrameBufferSize = mOutFrameBufferSize = 0;
     duringHardwareInit = FALSE;
     mLastValidSampleFrame = 0;
+    mInWireOrder = mOutWireOrder = false;
+    mOutGains.serial = mInGains.serial = 0;
+    mOutGains.seenSerial = mInGains.seenSerial = 0;
+    mOutGains.valid = mInGains.valid = false;
+    mOutGains.ramping = mInGains.ramping = false;
+    mBlockCount = 0;
     result = true;
     
 Done:
@@ -156,31 +242,23 @@ Done:
 bool REACAudioEngine::createAudioStreams(IOAudioSampleRate *sampleRate) {
     bool            result = false;
     
-    UInt32              numInChannels  = protocol->getDeviceInfo()->in_channels;
+    UInt32              numInChannels  = protocol->getReceiveChannels();
     UInt32              numOutChannels = protocol->getDeviceInfo()->out_channels;
     UInt32              bufferSizePerChannel;
     OSDictionary       *inFormatDict;
     OSDictionary       *outFormatDict;
+    OSArray            *sampleRates;
+    IOAudioSampleRate   clientRates[MAX_SAMPLE_RATES];
+    UInt32              numClientRates = 0;
     
     IOAudioStreamFormat inFormat;
     IOAudioStreamFormat outFormat;
+    IOAudioStreamFormat inFloatFormat;
+    IOAudioStreamFormat outFloatFormat;
     
     sampleRate->whole = REAC_SAMPLE_RATE;
     sampleRate->fraction = 0;
     
-    inputStream = new IOAudioStream;
-    outputStream = new IOAudioStream;
-    if (NULL == inputStream || NULL == outputStream) {
-        IOLog("REAC: Could not create IOAudioStreams\n");
-        goto Error;
-    }
-        
-    if (!inputStream->initWithAudioEngine(this, kIOAudioStreamDirectionInput, 1 /* Starting channel ID */, "REAC Input Stream") ||
-        !outputStream->initWithAudioEngine(this, kIOAudioStreamDirectionOutput, 1 /* Starting channel ID */, "REAC Output Stream")) {
-        IOLog("REAC: Could not init one of the streams with audio engine. \n");
-        goto Error;
-    }
-    
     inFormatDict = OSDynamicCast(OSDictionary, getProperty(IN_FORMAT_KEY));
     outFormatDict = OSDynamicCast(OSDictionary, getProperty(OUT_FORMAT_KEY));
     if (NULL == inFormatDict || NULL == outFormatDict) {
@@ -197,16 +275,119 @@ bool REACAudioEngine::createAudioStreams(IOAudioSampleRate *sampleRate) {
     inFormat.fNumChannels = numInChannels;
     outFormat.fNumChannels = numOutChannels;
     
+    if (numInChannels > kPCMMaxMeterChannels || numOutChannels > kPCMMaxMeterChannels) {
+        mMeters = false;
+    }
+    PCMChannelMetersInit(&mInMeters, numInChannels);
+    PCMChannelMetersInit(&mOutMeters, numOutChannels);
+    PCMGainBlittersInit(&mInGainBlitters, numInChannels);
+    PCMGainBlittersInit(&mOutGainBlitters, numOutChannels);
+    
+    // The planar streams are filled in when the packets are converted to and from Float32
+    if (0 != mStreamChannels &&
+        (!mFloatBuffers || numInChannels > REAC_MAX_CHANNEL_COUNT || numOutChannels > REAC_MAX_CHANNEL_COUNT)) {
+        IOLog("REAC: %s needs %s and at most %d channels, using one stream.\n",
+              STREAM_CHANNELS_KEY, FLOAT_BUFFERS_KEY, REAC_MAX_CHANNEL_COUNT);
+        mStreamChannels = 0;
+    }
+    mNumInStreams = (numInChannels <= mStreamChannels || 0 == mStreamChannels ?
+                     1 : (numInChannels + mStreamChannels - 1) / mStreamChannels);
+    mNumOutStreams = (numOutChannels <= mStreamChannels || 0 == mStreamChannels ?
+                      1 : (numOutChannels + mStreamChannels - 1) / mStreamChannels);
+    
     inFormat.fBitDepth = REAC_RESOLUTION * 8;
     outFormat.fBitDepth = REAC_RESOLUTION * 8;
     
-    inputStream->addAvailableFormat(&inFormat, sampleRate, sampleRate);
-    outputStream->addAvailableFormat(&outFormat, sampleRate, sampleRate);
+    if (mInt24In32) {
+        inFormat.fBitWidth = outFormat.fBitWidth = 32;
+        inFormat.fAlignment = outFormat.fAlignment = kIOAudioStreamAlignmentHighByte;
+#if TARGET_RT_BIG_ENDIAN
+        inFormat.fByteOrder = outFormat.fByteOrder = kIOAudioStreamByteOrderBigEndian;
+#else
+        inFormat.fByteOrder = outFormat.fByteOrder = kIOAudioStreamByteOrderLittleEndian;
+#endif
+    }
     
-    inputStream->setFormat(&inFormat);
-    outputStream->setFormat(&outFormat);
+    if (mFloatBuffers) {
+        inFloatFormat = inFormat;
+        outFloatFormat = outFormat;
+        inFloatFormat.fNumericRepresentation = outFloatFormat.fNumericRepresentation = kIOAudioStreamNumericRepresentationIEEE754Float;
+        inFloatFormat.fBitDepth = outFloatFormat.fBitDepth = 32;
+        inFloatFormat.fBitWidth = outFloatFormat.fBitWidth = 32;
+        inFloatFormat.fAlignment = outFloatFormat.fAlignment = kIOAudioStreamAlignmentLowByte;
+        inFloatFormat.fIsMixable = outFloatFormat.fIsMixable = true;
+#if TARGET_RT_BIG_ENDIAN
+        inFloatFormat.fByteOrder = outFloatFormat.fByteOrder = kIOAudioStreamByteOrderBigEndian;
+#else
+        inFloatFormat.fByteOrder = outFloatFormat.fByteOrder = kIOAudioStreamByteOrderLittleEndian;
+#endif
+        
+        // The other sample rates are converted to and from REAC_SAMPLE_RATE in the driver. The memory
+        // for the resamplers is allocated once, for the rate that needs the most.
+        sampleRates = OSDynamicCast(OSArray, getProperty(SAMPLE_RATES_KEY));
+        for (UInt32 i = 0; NULL != sampleRates && i < sampleRates->getCount(); i++) {
+            OSNumber *number = OSDynamicCast(OSNumber, sampleRates->getObject(i));
+            UInt32 clientRate;
+            UInt32 memorySize;
+            
+            if (NULL == number || REAC_SAMPLE_RATE == number->unsigned32BitValue()) {
+                continue;
+            }
+            clientRate = number->unsigned32BitValue();
+            memorySize = resamplerMemorySize(clientRate);
+            if (clientRate > REAC_SAMPLE_RATE || 0 == memorySize || numClientRates >= MAX_SAMPLE_RATES) {
+                IOLog("REAC: Can't resample to %d Hz, leaving it out.\n", (int)clientRate);
+                continue;
+            }
+            if (memorySize > mResamplerMemorySize) {
+                mResamplerMemorySize = memorySize;
+            }
+            clientRates[numClientRates].whole = clientRate;
+            clientRates[numClientRates].fraction = 0;
+            numClientRates++;
+        }
+        if (0 != mResamplerMemorySize && NULL == mResamplerMemory) {
+            mResamplerMemory = (Float32 *)IOMalloc(mResamplerMemorySize * sizeof(Float32));
+            if (NULL == mResamplerMemory) {
+                IOLog("REAC: Error allocating resampler memory - %lu bytes.\n", (unsigned long)(mResamplerMemorySize * sizeof(Float32)));
+                goto Error;
+            }
+            mInRateBuffer = mResamplerMemory;
+            mOutRateBuffer = mInRateBuffer + REAC_SAMPLES_PER_PACKET * numInChannels;
+        }
+        
+        mInPacketBufferSize = REAC_SAMPLES_PER_PACKET * REAC_RESOLUTION * numInChannels;
+        mOutPacketBufferSize = REAC_SAMPLES_PER_PACKET * REAC_RESOLUTION * numOutChannels;
+        if (NULL == mInPacketBuffer) {
+            mInPacketBuffer = (UInt8 *)IOMalloc(mInPacketBufferSize);
+        }
+        if (NULL == mOutPacketBuffer) {
+            mOutPacketBuffer = (UInt8 *)IOMalloc(mOutPacketBufferSize);
+        }
+        if (NULL == mInPacketBuffer || NULL == mOutPacketBuffer) {
+            IOLog("REAC: Error allocating packet buffers.\n");
+            goto Error;
+        }
+        bzero(mOutPacketBuffer, mOutPacketBufferSize);
+        
+        if (0 != mStreamChannels) {
+            mInFrameBufferSize = REAC_SAMPLES_PER_PACKET * sizeof(Float32) * numInChannels;
+            mOutFrameBufferSize = REAC_SAMPLES_PER_PACKET * sizeof(Float32) * numOutChannels;
+            if (NULL == mInFrameBuffer) {
+                mInFrameBuffer = (Float32 *)IOMalloc(mInFrameBufferSize);
+            }
+            if (NULL == mOutFrameBuffer) {
+                mOutFrameBuffer = (Float32 *)IOMalloc(mOutFrameBufferSize);
+            }
+            if (NULL == mInFrameBuffer || NULL == mOutFrameBuffer) {
+                IOLog("REAC: Error allocating frame buffers.\n");
+                goto Error;
+            }
+        }
+    }
     
-    bufferSizePerChannel = blockSize * numBlocks * REAC_RESOLUTION;
+    // The sample buffers are big enough for any of the formats
+    bufferSizePerChannel = blockSize * numBlocks * (mFloatBuffers ? sizeof(Float32) : inFormat.fBitWidth/8);
     mInBufferSize = bufferSizePerChannel * numInChannels;
     mOutBufferSize = bufferSizePerChannel * numOutChannels;
     
@@ -226,24 +407,28 @@ bool REACAudioEngine::createAudioStreams(IOAudioSampleRate *sampleRate) {
         }
     }
     
-    inputStream->setSampleBuffer(mInBuffer, mInBufferSize);
-    addAudioStream(inputStream);
-    inputStream->release();
-    
-    outputStream->setSampleBuffer(mOutBuffer, mOutBufferSize);       
-    addAudioStream(outputStream);
-    outputStream->release();
+    for (UInt32 s = 0; s < mNumInStreams; s++) {
+        mInStreams[s] = createAudioStream(kIOAudioStreamDirectionInput, s, numInChannels, &inFormat,
+                                          mFloatBuffers ? &inFloatFormat : NULL, clientRates, numClientRates);
+        if (NULL == mInStreams[s]) {
+            goto Error;
+        }
+    }
+    for (UInt32 s = 0; s < mNumOutStreams; s++) {
+        mOutStreams[s] = createAudioStream(kIOAudioStreamDirectionOutput, s, numOutChannels, &outFormat,
+                                           mFloatBuffers ? &outFloatFormat : NULL, clientRates, numClientRates);
+        if (NULL == mOutStreams[s]) {
+            goto Error;
+        }
+    }
+    inputStream = mInStreams[0];
+    outputStream = mOutStreams[0];
     
     result = true;
     goto Done;
 
 Error:
     IOLog("REACAudioEngine[%p]::createAudioStreams() - ERROR\n", this);
-
-    if (inputStream)
-        inputStream->release();
-    if (outputStream)
-        outputStream->release();
     
 Done:
     if (!result)
@@ -251,6 +436,72 @@ Done:
     return result;
 }
 
+// Creates stream number stream of the direction, with the formats for its channels out of numChannels,
+// and adds it to the engine. floatFormat is NULL without Float32 buffers.
+IOAudioStream *REACAudioEngine::createAudioStream(IOAudioStreamDirection direction, UInt32 stream, UInt32 numChannels,
+                                                  IOAudioStreamFormat *format, IOAudioStreamFormat *floatFormat,
+                                                  const IOAudioSampleRate *clientRates, UInt32 numClientRates) {
+    bool                input = (kIOAudioStreamDirectionInput == direction);
+    UInt32              firstChannel = stream * mStreamChannels;
+    IOAudioStream      *audioStream;
+    IOAudioStreamFormat streamFormat;
+    IOAudioSampleRate   sampleRate;
+    char                name[32];
+    
+    sampleRate.whole = REAC_SAMPLE_RATE;
+    sampleRate.fraction = 0;
+    
+    if (0 == mStreamChannels) {
+        snprintf(name, sizeof(name), input ? "REAC Input Stream" : "REAC Output Stream");
+    }
+    else if (1 == streamChannels(numChannels, stream)) {
+        snprintf(name, sizeof(name), "REAC %s %d", input ? "Input" : "Output", (int)firstChannel + 1);
+    }
+    else {
+        snprintf(name, sizeof(name), "REAC %s %d-%d", input ? "Input" : "Output",
+                 (int)firstChannel + 1, (int)(firstChannel + streamChannels(numChannels, stream)));
+    }
+    
+    audioStream = new IOAudioStream;
+    if (NULL == audioStream) {
+        IOLog("REAC: Could not create IOAudioStreams\n");
+        return NULL;
+    }
+    if (!audioStream->initWithAudioEngine(this, direction, firstChannel + 1 /* Starting channel ID */, name)) {
+        IOLog("REAC: Could not init one of the streams with audio engine. \n");
+        audioStream->release();
+        return NULL;
+    }
+    
+    // The planar streams only have the Float32 formats
+    if (0 == mStreamChannels) {
+        audioStream->addAvailableFormat(format, &sampleRate, &sampleRate);
+        if (!isPassthroughFormat(format)) {
+            passthroughFormat(format, &streamFormat);
+            audioStream->addAvailableFormat(&streamFormat, &sampleRate, &sampleRate);
+        }
+    }
+    if (NULL != floatFormat) {
+        streamFormat = *floatFormat;
+        streamFormat.fNumChannels = streamChannels(numChannels, stream);
+        audioStream->addAvailableFormat(&streamFormat, &sampleRate, &sampleRate);
+        for (UInt32 i = 0; i < numClientRates; i++) {
+            audioStream->addAvailableFormat(&streamFormat, &clientRates[i], &clientRates[i]);
+        }
+    }
+    else {
+        streamFormat = *format;
+    }
+    
+    audioStream->setFormat(&streamFormat);
+    setStreamLayout(audioStream, &streamFormat);
+    resetSampleBuffer(audioStream, &streamFormat);
+    addAudioStream(audioStream);
+    audioStream->release();
+    
+    return audioStream;
+}
+
  
 void REACAudioEngine::free() {
     //IOLog("REACAudioEngine[%p]::free()\n", this);
@@ -267,6 +518,26 @@ void REACAudioEngine::free() {
         IOFree(mOutBuffer, mOutBufferSize);
         mOutBuffer = NULL;
     }
+    if (NULL != mInPacketBuffer) {
+        IOFree(mInPacketBuffer, mInPacketBufferSize);
+        mInPacketBuffer = NULL;
+    }
+    if (NULL != mOutPacketBuffer) {
+        IOFree(mOutPacketBuffer, mOutPacketBufferSize);
+        mOutPacketBuffer = NULL;
+    }
+    if (NULL != mResamplerMemory) {
+        IOFree(mResamplerMemory, mResamplerMemorySize * sizeof(Float32));
+        mResamplerMemory = NULL;
+    }
+    if (NULL != mInFrameBuffer) {
+        IOFree(mInFrameBuffer, mInFrameBufferSize);
+        mInFrameBuffer = NULL;
+    }
+    if (NULL != mOutFrameBuffer) {
+        IOFree(mOutFrameBuffer, mOutFrameBufferSize);
+        mOutFrameBuffer = NULL;
+    }
         
     super::free();
 }
@@ -288,6 +559,15 @@ IOReturn REACAudioEngine::performAudioEngineStart() {
     
     takeTimeStamp(false);
     currentBlock = 0;
+    mBlockCount = 0;
+    resetGainRamps();
+    mClientFrame = mClientFrameAcc = 0;
+    mOutReadFrame = 0;
+    resetOutputUnderrun();
+    if (mResampling) {
+        PCMResamplerReset(&mInResampler);
+        PCMResamplerReset(&mOutResampler);
+    }
     
     return kIOReturnSuccess;
 }
@@ -308,6 +588,9 @@ UInt32 REACAudioEngine::getCurrentSampleFrame() {
     // frame returned by this function.  If it is too large a value, sound data that hasn't been played will be 
     // erased.
     
+    if (mResampling) {
+        return mClientFrame;
+    }
     return currentBlock * blockSize;
 }
 
@@ -320,15 +603,364 @@ IOReturn REACAudioEngine::performFormatChange(IOAudioStream *audioStream, const
 
     // It is possible that this function will be called with only a format or only a sample rate
     // We need to check for NULL for each of the parameters
-    if (NULL != newFormat) {
+    bool inFloat = mInFloat;
+    bool outFloat = mOutFloat;
+    UInt32 clientRate = (NULL != newSampleRate ? newSampleRate->whole : mClientRate);
+    
+    if (NULL != newFormat && NULL != audioStream) {
+        bool isFloat = (kIOAudioStreamNumericRepresentationIEEE754Float == newFormat->fNumericRepresentation);
+        if (isFloat && !mFloatBuffers) {
+            return kIOReturnUnsupported;
+        }
+        if (kIOAudioStreamDirectionInput == audioStream->getDirection()) {
+            inFloat = isFloat;
+        }
+        else {
+            outFloat = isFloat;
+        }
     }
     
-    if (NULL != newSampleRate) {
+    // Both streams have the sample rate of the engine, and only the Float32 formats are resampled
+    if (REAC_SAMPLE_RATE != clientRate && (!inFloat || !outFloat)) {
+        return kIOReturnUnsupported;
+    }
+    if (clientRate != mClientRate && !setClientRate(clientRate)) {
+        return kIOReturnUnsupported;
+    }
+    
+    if (NULL != newFormat && NULL != audioStream) {
+        setStreamLayout(audioStream, newFormat);
+        
+        // The sample buffer holds the samples of the previous format; start over with silence
+        resetSampleBuffer(audioStream, newFormat);
     }
     
     return kIOReturnSuccess;
 }
 
+// The passthrough format is the exclusive (non-mixable) packed 24 bit native endian integer format. The
+// samples are then only swizzled between wire order and the sample buffer, and convertInputSamples and
+// clipOutputSamples copy them as they are, so they get to and from the client bit for bit, without the
+// gains, meters or dither.
+bool REACAudioEngine::isPassthroughFormat(const IOAudioStreamFormat *format) {
+    return (!format->fIsMixable &&
+            kIOAudioStreamSampleFormatLinearPCM == format->fSampleFormat &&
+            kIOAudioStreamNumericRepresentationSignedInt == format->fNumericRepresentation &&
+            REAC_RESOLUTION*8 == format->fBitWidth &&
+            REAC_RESOLUTION*8 == format->fBitDepth &&
+#if TARGET_RT_BIG_ENDIAN
+            kIOAudioStreamByteOrderBigEndian == format->fByteOrder);
+#else
+            kIOAudioStreamByteOrderLittleEndian == format->fByteOrder);
+#endif
+}
+
+void REACAudioEngine::passthroughFormat(const IOAudioStreamFormat *format, IOAudioStreamFormat *passthrough) {
+    *passthrough = *format;
+    passthrough->fSampleFormat = kIOAudioStreamSampleFormatLinearPCM;
+    passthrough->fNumericRepresentation = kIOAudioStreamNumericRepresentationSignedInt;
+    passthrough->fBitDepth = REAC_RESOLUTION*8;
+    passthrough->fBitWidth = REAC_RESOLUTION*8;
+    passthrough->fAlignment = kIOAudioStreamAlignmentLowByte;
+#if TARGET_RT_BIG_ENDIAN
+    passthrough->fByteOrder = kIOAudioStreamByteOrderBigEndian;
+#else
+    passthrough->fByteOrder = kIOAudioStreamByteOrderLittleEndian;
+#endif
+    passthrough->fIsMixable = false;
+}
+
+UInt32 REACAudioEngine::sampleBufferSize(const IOAudioStreamFormat *format) {
+    return mClientFrames * format->fNumChannels * (format->fBitWidth/8);
+}
+
+// The number of channels of stream number stream, out of numChannels
+UInt32 REACAudioEngine::streamChannels(UInt32 numChannels, UInt32 stream) {
+    UInt32 firstChannel = stream * mStreamChannels;
+    
+    if (0 == mStreamChannels) {
+        return numChannels;
+    }
+    return (numChannels - firstChannel < mStreamChannels ? numChannels - firstChannel : mStreamChannels);
+}
+
+// Clears the sample buffer of audioStream and sets it for format. With planar streams, it is the
+// part of mInBuffer or mOutBuffer from the first channel of the stream on.
+void REACAudioEngine::resetSampleBuffer(IOAudioStream *audioStream, const IOAudioStreamFormat *format) {
+    bool input = (kIOAudioStreamDirectionInput == audioStream->getDirection());
+    UInt8 *buffer = (UInt8 *)(input ? mInBuffer : mOutBuffer);
+    UInt32 size = sampleBufferSize(format);
+    
+    if (NULL == buffer) {
+        return;
+    }
+    if (0 != mStreamChannels) {
+        buffer += (audioStream->getStartingChannelID() - 1) * blockSize * numBlocks * sizeof(Float32);
+    }
+    bzero(buffer, size);
+    audioStream->setSampleBuffer(buffer, size);
+    if (!input) {
+        resetOutputUnderrun();
+    }
+}
+
+// The clients write ahead of the packets that are sent, by the sample offset and their IO buffer,
+// which is much less than half the sample buffer. A write that ends further ahead than that ends
+// behind the packets instead (a client that is late), and doesn't move the write head.
+//
+// The planar streams are written one at a time, so the packets can only be sent up to where all
+// of them have been written. Streams without clients are left out, since nothing writes them.
+void REACAudioEngine::outputWritten(IOAudioStream *audioStream, UInt32 endSampleFrame) {
+    const UInt32 stream = (0 != mStreamChannels ? (audioStream->getStartingChannelID() - 1) / mStreamChannels : 0);
+    const UInt64 readFrame = mOutReadFrame;
+    const UInt32 ahead = (endSampleFrame + mClientFrames - (UInt32)(readFrame % mClientFrames)) % mClientFrames;
+    UInt64 writeFrame;
+    
+    if (ahead > mClientFrames/2 || stream >= mNumOutStreams) {
+        return;
+    }
+    if (!mOutStreamWritten[stream] || readFrame + ahead > mOutStreamWriteFrame[stream]) {
+        mOutStreamWriteFrame[stream] = readFrame + ahead;
+    }
+    mOutStreamWritten[stream] = true;
+    
+    writeFrame = mOutStreamWriteFrame[stream];
+    for (UInt32 s = 0; s < mNumOutStreams; s++) {
+        if (mOutStreamWritten[s] && mOutStreamWriteFrame[s] < writeFrame && 0 != mOutStreams[s]->getNumClients()) {
+            writeFrame = mOutStreamWriteFrame[s];
+        }
+    }
+    mOutWriteFrame = writeFrame;
+    mOutWritten = true;
+}
+
+void REACAudioEngine::resetOutputUnderrun() {
+    mOutWriteFrame = 0;
+    mOutWritten = false;
+    bzero(mOutStreamWritten, sizeof(mOutStreamWritten));
+    mUnderrunPackets = 0;
+    mLastOutPacketSize = 0;
+}
+
+// Fades the samples of packet out linearly, from full scale at the first sample frame to 1/12 at the
+// last. The samples are 24 bit ints, packed or in the high bytes of 32 bit ints. In REAC wire order,
+// the bytes of each 16 bit word are swapped, so byte i of the packed samples is at i^1.
+static void fadeOutPacket(UInt8 *packet, UInt32 packetSize, UInt32 sampleSize, bool wireOrder) {
+    const UInt32 frameSize = packetSize/REAC_SAMPLES_PER_PACKET;
+    const UInt32 swap = (wireOrder ? 1 : 0);
+    
+    for (UInt32 frame = 0; frame < REAC_SAMPLES_PER_PACKET; frame++) {
+        const SInt32 gain = REAC_SAMPLES_PER_PACKET-frame;
+        
+        for (UInt32 i = frame*frameSize; i < (frame+1)*frameSize; i += sampleSize) {
+            if (sizeof(SInt32) == sampleSize) {
+                SInt32 *sample = (SInt32 *)(packet+i);
+                *sample = (*sample/REAC_SAMPLES_PER_PACKET*gain) & ~0xff;
+            }
+            else {
+                SInt32 sample = (SInt32)(((UInt32)packet[i^swap] << 8) |
+                                         ((UInt32)packet[(i+1)^swap] << 16) |
+                                         ((UInt32)packet[(i+2)^swap] << 24)) >> 8;
+                sample = sample*gain/(SInt32)REAC_SAMPLES_PER_PACKET;
+                packet[i^swap] = (UInt8)sample;
+                packet[(i+1)^swap] = (UInt8)(sample >> 8);
+                packet[(i+2)^swap] = (UInt8)(sample >> 16);
+            }
+        }
+    }
+}
+
+void REACAudioEngine::concealUnderrun(UInt8 **data, UInt32 *bufferSize, UInt32 packetSize) {
+    // The packed samples are in wire order when the packet buffer or the sample buffer is
+    const bool wireOrder = mOutWireOrder;
+    const UInt32 sampleSize = (!mOutFloat && sizeof(UInt32)*8 == outputStream->format.fBitWidth ?
+                               sizeof(UInt32) : REAC_RESOLUTION);
+    const UInt32 frameSize = packetSize/REAC_SAMPLES_PER_PACKET;
+    
+    if (0 == mUnderrunPackets) {
+        mUnderrunStatistics.underruns++;
+    }
+    mUnderrunStatistics.packets++;
+    
+    // The packet isn't sent, but the resampler history, the gain ramps and the dither have to move
+    // on as if it were, or they would pick up where the underrun started when the clients catch up
+    if (mOutFloat) {
+        convertPacketFromFloat(currentBlock*blockSize);
+    }
+    
+    if (packetSize != mLastOutPacketSize || kREACUnderrunSilence == mUnderrunFallback ||
+        (kREACUnderrunFade == mUnderrunFallback && 0 != mUnderrunPackets)) {
+        bzero(mLastOutPacket, packetSize);
+    }
+    else if (kREACUnderrunFade == mUnderrunFallback) {
+        fadeOutPacket(mLastOutPacket, packetSize, sampleSize, wireOrder);
+    }
+    else {
+        // The frames are whole 16 bit words in wire order (which takes an even number of channels)
+        for (UInt32 frame = 0; frame < REAC_SAMPLES_PER_PACKET-1; frame++) {
+            memcpy(mLastOutPacket+frame*frameSize, mLastOutPacket+packetSize-frameSize, frameSize);
+        }
+    }
+    mUnderrunPackets++;
+    
+    *data = mLastOutPacket;
+    *bufferSize = packetSize;
+}
+
+// When InputRouting is set, the input channels of the engine are the REAC input channels (1 based) that
+// it lists, in that order, instead of all of them in wire order. The routing is applied when the samples
+// are copied out of the packets, so the other channels are never copied, converted or buffered.
+void REACAudioEngine::initInputRouting() {
+    OSArray *routing = OSDynamicCast(OSArray, getProperty(INPUT_ROUTING_KEY));
+    UInt8 channels[REAC_MAX_CHANNEL_COUNT];
+    UInt32 numRouted = (routing ? routing->getCount() : 0);
+    
+    if (numRouted > REAC_MAX_CHANNEL_COUNT) {
+        IOLog("REACAudioEngine::initInputRouting(): %s has more than %d channels, not routing.\n",
+              INPUT_ROUTING_KEY, REAC_MAX_CHANNEL_COUNT);
+        numRouted = 0;
+    }
+    for (UInt32 i = 0; i < numRouted; i++) {
+        OSNumber *number = OSDynamicCast(OSNumber, routing->getObject(i));
+        UInt32 channel = (number ? number->unsigned32BitValue() : 0);
+        
+        if (channel < 1 || channel > protocol->getDeviceInfo()->in_channels) {
+            IOLog("REACAudioEngine::initInputRouting(): %s entry %d is not an input channel of the device, not routing.\n",
+                  INPUT_ROUTING_KEY, (int)i);
+            numRouted = 0;
+            break;
+        }
+        channels[i] = channel-1;
+    }
+    
+    if (kIOReturnSuccess != protocol->setInputRouting(channels, numRouted)) {
+        protocol->setInputRouting(NULL, 0);
+    }
+}
+
+// The Float32s that the packet buffers and the resamplers need for clientRate, or 0 if it can't be resampled
+UInt32 REACAudioEngine::resamplerMemorySize(UInt32 clientRate) {
+    UInt32 numInChannels  = protocol->getReceiveChannels();
+    UInt32 numOutChannels = protocol->getDeviceInfo()->out_channels;
+    UInt32 inFilterSize = PCMResamplerFilterSize(REAC_SAMPLE_RATE, clientRate);
+    UInt32 outFilterSize = PCMResamplerFilterSize(clientRate, REAC_SAMPLE_RATE);
+    
+    if (0 == inFilterSize || 0 == outFilterSize) {
+        return 0;
+    }
+    return REAC_SAMPLES_PER_PACKET * (numInChannels + numOutChannels) + inFilterSize + outFilterSize +
+        PCMResamplerHistorySize(REAC_SAMPLE_RATE, clientRate, numInChannels, REAC_SAMPLES_PER_PACKET) +
+        PCMResamplerHistorySize(clientRate, REAC_SAMPLE_RATE, numOutChannels, REAC_SAMPLES_PER_PACKET);
+}
+
+// Sets up the resamplers and the sample buffers for clientRate, and starts the sample buffers over
+bool REACAudioEngine::setClientRate(UInt32 clientRate) {
+    IOAudioSampleRate sampleRate;
+    
+    if (REAC_SAMPLE_RATE != clientRate) {
+        UInt32 numInChannels  = protocol->getReceiveChannels();
+        UInt32 numOutChannels = protocol->getDeviceInfo()->out_channels;
+        Float32 *inFilter, *inHistory, *outFilter, *outHistory;
+        
+        if (NULL == mResamplerMemory || resamplerMemorySize(clientRate) > mResamplerMemorySize) {
+            return false;
+        }
+        inFilter = mOutRateBuffer + REAC_SAMPLES_PER_PACKET * numOutChannels;
+        inHistory = inFilter + PCMResamplerFilterSize(REAC_SAMPLE_RATE, clientRate);
+        outFilter = inHistory + PCMResamplerHistorySize(REAC_SAMPLE_RATE, clientRate, numInChannels, REAC_SAMPLES_PER_PACKET);
+        outHistory = outFilter + PCMResamplerFilterSize(clientRate, REAC_SAMPLE_RATE);
+        if (!PCMResamplerInit(&mInResampler, REAC_SAMPLE_RATE, clientRate, numInChannels, REAC_SAMPLES_PER_PACKET,
+                              inFilter, inHistory) ||
+            !PCMResamplerInit(&mOutResampler, clientRate, REAC_SAMPLE_RATE, numOutChannels, REAC_SAMPLES_PER_PACKET,
+                              outFilter, outHistory)) {
+            return false;
+        }
+    }
+    
+    mClientRate = clientRate;
+    mResampling = (REAC_SAMPLE_RATE != clientRate);
+    mClientFrames = (UInt32)((UInt64)blockSize * numBlocks * clientRate / REAC_SAMPLE_RATE);
+    currentBlock = 0;
+    mBlockCount = 0;
+    resetGainRamps();
+    mClientFrame = mClientFrameAcc = 0;
+    mOutReadFrame = 0;
+    resetOutputUnderrun();
+    if (kIOAudioEngineRunning == getState()) {
+        takeTimeStamp(false);
+    }
+    
+    sampleRate.whole = clientRate;
+    sampleRate.fraction = 0;
+    setSampleRate(&sampleRate);
+    setNumSampleFramesPerBuffer(mClientFrames);
+    setSampleOffset((UInt32)(((UInt64)blockSize * bufferOffsetFactor * clientRate + REAC_SAMPLE_RATE - 1) / REAC_SAMPLE_RATE));
+    
+    for (UInt32 s = 0; s < mNumInStreams; s++) {
+        resetSampleBuffer(mInStreams[s], &mInStreams[s]->format);
+    }
+    for (UInt32 s = 0; s < mNumOutStreams; s++) {
+        resetSampleBuffer(mOutStreams[s], &mOutStreams[s]->format);
+    }
+    return true;
+}
+
+// The number of sample frames at the client rate that the current packet holds. Packet p starts at
+// sample frame ceil(p * REAC_SAMPLES_PER_PACKET * mClientRate / REAC_SAMPLE_RATE), which is how
+// many frames the resamplers have output by then as well.
+UInt32 REACAudioEngine::clientFramesInPacket() {
+    UInt32 end = mClientFrameAcc + REAC_SAMPLES_PER_PACKET * mClientRate;
+    return (end + REAC_SAMPLE_RATE - 1) / REAC_SAMPLE_RATE - (mClientFrameAcc + REAC_SAMPLE_RATE - 1) / REAC_SAMPLE_RATE;
+}
+
+void REACAudioEngine::setStreamLayout(IOAudioStream *audioStream, const IOAudioStreamFormat *format) {
+    bool isFloat = (kIOAudioStreamNumericRepresentationIEEE754Float == format->fNumericRepresentation);
+    bool input = (kIOAudioStreamDirectionInput == audioStream->getDirection());
+    
+    // The packet buffers hold all the channels, also when they are split up into planar streams
+    UInt32 numChannels = format->fNumChannels;
+    if (0 != mStreamChannels) {
+        numChannels = (input ? protocol->getReceiveChannels() : protocol->getDeviceInfo()->out_channels);
+    }
+    
+    // When the streams are mixable, mInBuffer is only read by convertInputSamples and mOutBuffer
+    // is only written by clipOutputSamples, so they can hold the samples in wire order. They are
+    // then copied from and into the packets as they are. With Float32 buffers, the packet buffers
+    // are in wire order instead.
+    bool wireOrder = (format->fIsMixable &&
+                      kIOAudioStreamSampleFormatLinearPCM == format->fSampleFormat &&
+                      (isFloat ||
+                       (kIOAudioStreamNumericRepresentationSignedInt == format->fNumericRepresentation &&
+                        REAC_RESOLUTION*8 == format->fBitWidth)) &&
+                      0 == numChannels % 2 && // the REACInt24 blitters work on sample pairs
+                      !(input && protocol->isInputRouted())); // and so does the wire order
+    
+    REACConnection::REACSampleLayout layout;
+    if (wireOrder) {
+        layout = REACConnection::REAC_LAYOUT_WIRE;
+    }
+    else if (mInt24In32 && !isFloat && !isPassthroughFormat(format)) {
+        layout = REACConnection::REAC_LAYOUT_NATIVE_32;
+    }
+    else {
+        layout = REACConnection::REAC_LAYOUT_NATIVE;
+    }
+    
+    if (input) {
+        mInFloat = isFloat;
+        mInWireOrder = wireOrder;
+        protocol->setReceiveSampleLayout(layout);
+        // The Float32 conversion can read the samples straight from the packet. Integer buffers in
+        // wire order are the sample buffer itself, so the samples have to be copied there.
+        protocol->setReceiveInPlace(isFloat && wireOrder);
+    }
+    else {
+        mOutFloat = isFloat;
+        mOutWireOrder = wireOrder;
+        protocol->setSendSampleLayout(layout);
+    }
+}
+
 void REACAudioEngine::gotSamples(UInt8 **data, UInt32 *bufferSize) {
     if (NULL == mInBuffer) {
         // This should never happen. But better complain than crash the computer I guess
@@ -336,12 +968,27 @@ void REACAudioEngine::gotSamples(UInt8 **data, UInt32 *bufferSize) {
         return;
     }
     
-    if (inputStream->format.fNumChannels != protocol->getDeviceInfo()->in_channels ||
-        inputStream->format.fBitWidth != REAC_RESOLUTION*8) {
+    if (inputStream->format.fNumChannels != streamChannels(protocol->getReceiveChannels(), 0) ||
+        inputStream->format.fBitWidth != (mInFloat || (mInt24In32 && !isPassthroughFormat(&inputStream->format)) ?
+                                          32 : REAC_RESOLUTION*8)) {
         IOLog("REACAudioEngine::gotSamples(): Invalid input stream format.\n");
         return;
     }
     
+    if (mInFloat) {
+        // The samples are converted into mInBuffer by samplesCopied, from mInPacketBuffer or from
+        // the packet itself
+        mInPacketFrame = currentBlock*blockSize;
+        mInPacketClientFrame = mClientFrame;
+        *data = mInPacketBuffer;
+        *bufferSize = mInPacketBufferSize;
+        
+        if (REACConnection::REAC_MASTER != protocol->getMode()) {
+            incrementBlockCounter();
+        }
+        return;
+    }
+    
     const int bytesPerSample = inputStream->format.fBitWidth/8 * inputStream->format.fNumChannels;
     const int bytesPerPacket = bytesPerSample * REAC_SAMPLES_PER_PACKET;
     
@@ -356,9 +1003,34 @@ void REACAudioEngine::gotSamples(UInt8 **data, UInt32 *bufferSize) {
 void REACAudioEngine::getSamples(UInt8 **data, UInt32 *bufferSize) {
     const int bytesPerSample = outputStream->format.fBitWidth/8 * outputStream->format.fNumChannels;
     const int bytesPerPacket = bytesPerSample * REAC_SAMPLES_PER_PACKET;
+    const UInt32 packetSize = (mOutFloat ? mOutPacketBufferSize : bytesPerPacket);
+    const UInt32 packetFrames = (mResampling ? clientFramesInPacket() : blockSize);
 
-    *data = (UInt8 *)mOutBuffer + currentBlock*blockSize*bytesPerSample;
-    *bufferSize = bytesPerPacket;
+    if (mOutWritten && mOutWriteFrame < mOutReadFrame+packetFrames && packetSize <= sizeof(mLastOutPacket)) {
+        // The clients haven't written the samples of this packet (yet); the sample buffer holds the
+        // ones of a turn earlier, or the zeros of the erase head
+        concealUnderrun(data, bufferSize, packetSize);
+    }
+    else if (mOutFloat) {
+        convertPacketFromFloat(currentBlock*blockSize);
+        *data = mOutPacketBuffer;
+        *bufferSize = mOutPacketBufferSize;
+    }
+    else {
+        *data = (UInt8 *)mOutBuffer + currentBlock*blockSize*bytesPerSample;
+        *bufferSize = bytesPerPacket;
+        if (mMeters) {
+            meterPacket(*data, outputStream->format.fBitWidth, mOutWireOrder, outputStream->format.fNumChannels, &mOutMeters);
+        }
+    }
+    
+    if (*data != mLastOutPacket) {
+        mUnderrunPackets = 0;
+        if (kREACUnderrunSilence != mUnderrunFallback && packetSize <= sizeof(mLastOutPacket)) {
+            memcpy(mLastOutPacket, *data, packetSize);
+            mLastOutPacketSize = packetSize;
+        }
+    }
     
     if (REACConnection::REAC_MASTER == protocol->getMode()) {
         incrementBlockCounter();
@@ -366,14 +1038,98 @@ void REACAudioEngine::getSamples(UInt8 **data, UInt32 *bufferSize) {
     return;
 }
 
+void REACAudioEngine::samplesCopied(UInt8 *data, UInt32 bufferSize) {
+    if (mInFloat && bufferSize == mInPacketBufferSize) {
+        convertPacketToFloat(data, mInPacketFrame);
+    }
+    else if (!mInFloat && mMeters) {
+        meterPacket(data, inputStream->format.fBitWidth, mInWireOrder, inputStream->format.fNumChannels, &mInMeters);
+    }
+}
+
 void REACAudioEngine::incrementBlockCounter() {
+    mOutReadFrame += (mResampling ? clientFramesInPacket() : blockSize);
+    if (mResampling) {
+        // The sample buffers wrap around in the middle of a packet; the time stamp is taken at the
+        // packet, up to one packet late.
+        mClientFrame += clientFramesInPacket();
+        mClientFrameAcc = (mClientFrameAcc + REAC_SAMPLES_PER_PACKET * mClientRate) % REAC_SAMPLE_RATE;
+        if (mClientFrame >= mClientFrames) {
+            mClientFrame -= mClientFrames;
+            takePacketTimeStamp();
+        }
+    }
+    
     currentBlock++;
+    mBlockCount++;
     if (currentBlock >= numBlocks) {
         currentBlock = 0;
+        if (!mResampling) {
+            takePacketTimeStamp();
+        }
+        if (mMeters) {
+            publishMeters();
+        }
+        publishStatistics();
+    }
+}
+
+void REACAudioEngine::takePacketTimeStamp() {
+    if (REACConnection::REAC_MASTER == protocol->getMode()) {
+        // The packet goes out at a wake of the timer of the connection, which is jittery; its clock
+        // isn't
+        AbsoluteTime timestamp;
+        uint64_t time;
+        
+        nanoseconds_to_absolutetime(protocol->getPacketTimeNS(), &time);
+        AbsoluteTime_to_scalar(&timestamp) = time;
+        takeTimeStamp(true, &timestamp);
+    }
+    else {
         takeTimeStamp();
     }
 }
 
+void REACAudioEngine::publishStatistics() {
+    REACReceiveStatistics receiveStatistics;
+    OSData *data;
+    
+    protocol->getReceiveStatistics(&receiveStatistics);
+    data = OSData::withBytes(&receiveStatistics, sizeof(receiveStatistics));
+    if (NULL != data) {
+        setProperty(RECEIVE_STATISTICS_KEY, data);
+        data->release();
+    }
+    
+    if (REACConnection::REAC_SPLIT != protocol->getMode()) {
+        REACSendStatistics sendStatistics;
+        
+        protocol->getSendStatistics(&sendStatistics);
+        data = OSData::withBytes(&sendStatistics, sizeof(sendStatistics));
+        if (NULL != data) {
+            setProperty(SEND_STATISTICS_KEY, data);
+            data->release();
+        }
+        
+        data = OSData::withBytes(&mUnderrunStatistics, sizeof(mUnderrunStatistics));
+        if (NULL != data) {
+            setProperty(UNDERRUN_STATISTICS_KEY, data);
+            data->release();
+        }
+    }
+    
+    if (REACConnection::REAC_MASTER == protocol->getMode()) {
+        REACClockStatistics clockStatistics;
+        
+        protocol->getClockStatistics(&clockStatistics);
+        data = OSData::withBytes(&clockStatistics, sizeof(clockStatistics));
+        if (NULL != data) {
+            setProperty(CLOCK_STATISTICS_KEY, data);
+            data->release();
+        }
+    }
+}
+
 
 
 #define addControl(control, handler) \
@@ -386,7 +1142,7 @@ void REACAudioEngine::incrementBlockCounter() {
     control->release();
 
 bool REACAudioEngine::initControls() {
-    const char *channelNameMap[17] = {
+    const char *channelNameMap[REAC_MAX_CHANNEL_COUNT+1] = {
         kIOAudioControlChannelNameAll,
         kIOAudioControlChannelNameLeft,
         kIOAudioControlChannelNameRight,
@@ -398,17 +1154,22 @@ bool REACAudioEngine::initControls() {
     
     bool               result = false;
     IOAudioControl    *control = NULL;
+    UInt32             numOutChannels = protocol->getDeviceInfo()->out_channels;
+    UInt32             numInChannels  = protocol->getReceiveChannels();
     
-    for (UInt32 channel=0; channel <= 16; channel++) {
-        mVolume[channel] = mGain[channel] = 65535;
+    if (numOutChannels > REAC_MAX_CHANNEL_COUNT) numOutChannels = REAC_MAX_CHANNEL_COUNT;
+    if (numInChannels > REAC_MAX_CHANNEL_COUNT) numInChannels = REAC_MAX_CHANNEL_COUNT;
+    
+    for (UInt32 channel=0; channel <= REAC_MAX_CHANNEL_COUNT; channel++) {
+        mVolume[channel] = kVolumeMax;
+        mGain[channel] = 0;
         mMuteOut[channel] = mMuteIn[channel] = false;
     }
     
-    for (UInt32 channel=7; channel <= 16; channel++)
+    for (UInt32 channel=7; channel <= REAC_MAX_CHANNEL_COUNT; channel++)
         channelNameMap[channel] = "Unknown Channel";
     
-    for (unsigned channel=0; channel <= 16; channel++) {
-        
+    for (unsigned channel=0; channel <= numOutChannels; channel++) {
         // Create an output volume control for each channel with an int range from 0 to 65535
         // and a db range from -72 to 0
         // Once each control is added to the audio engine, they should be released
@@ -423,9 +1184,11 @@ bool REACAudioEngine::initControls() {
                                                            channel,                             // control ID - driver-defined
                                                            kIOAudioControlUsageOutput);
         addControl(control, (IOAudioControl::IntValueChangeHandler)volumeChangeHandler);
-        
-        // Gain control for each channel
-        control = IOAudioLevelControl::createVolumeControl(REACAudioEngine::kGainMax,           // Initial value
+    }
+    
+    for (unsigned channel=0; channel <= numInChannels; channel++) {
+        // Gain control for each channel, starting at 0 dB
+        control = IOAudioLevelControl::createVolumeControl(0,                                   // Initial value
                                                            0,                                   // min value
                                                            REACAudioEngine::kGainMax,           // max value
                                                            0,                                   // min 0.0 in IOFixed
@@ -471,8 +1234,10 @@ IOReturn REACAudioEngine::volumeChangeHandler(IOService *target, IOAudioControl
 
 
 IOReturn REACAudioEngine::volumeChanged(IOAudioControl *volumeControl, SInt32 oldValue, SInt32 newValue) {
-    if (volumeControl)
+    if (volumeControl && volumeControl->getChannelID() <= REAC_MAX_CHANNEL_COUNT) {
         mVolume[volumeControl->getChannelID()] = newValue;
+        mOutGains.serial++;
+    }
     return kIOReturnSuccess;
 }
 
@@ -488,8 +1253,10 @@ IOReturn REACAudioEngine::outputMuteChangeHandler(IOService *target, IOAudioCont
 
 
 IOReturn REACAudioEngine::outputMuteChanged(IOAudioControl *muteControl, SInt32 oldValue, SInt32 newValue) {
-    if (muteControl)
+    if (muteControl && muteControl->getChannelID() <= REAC_MAX_CHANNEL_COUNT) {
         mMuteOut[muteControl->getChannelID()] = newValue;
+        mOutGains.serial++;
+    }
     return kIOReturnSuccess;
 }
 
@@ -505,8 +1272,10 @@ IOReturn REACAudioEngine::gainChangeHandler(IOService *target, IOAudioControl *g
 
 
 IOReturn REACAudioEngine::gainChanged(IOAudioControl *gainControl, SInt32 oldValue, SInt32 newValue) {
-    if (gainControl)
+    if (gainControl && gainControl->getChannelID() <= REAC_MAX_CHANNEL_COUNT) {
         mGain[gainControl->getChannelID()] = newValue;
+        mInGains.serial++;
+    }
     return kIOReturnSuccess;
 }
 
@@ -522,7 +1291,9 @@ IOReturn REACAudioEngine::inputMuteChangeHandler(IOService *target, IOAudioContr
 
 
 IOReturn REACAudioEngine::inputMuteChanged(IOAudioControl *muteControl, SInt32 oldValue, SInt32 newValue) {
-    if (muteControl)
+    if (muteControl && muteControl->getChannelID() <= REAC_MAX_CHANNEL_COUNT) {
         mMuteIn[muteControl->getChannelID()] = newValue;
+        mInGains.serial++;
+    }
     return kIOReturnSuccess;
 }
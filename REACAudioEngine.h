@@ -29,9 +29,53 @@
 #include <IOKit/audio/IOAudioEngine.h>
 
 #include "REACDevice.h"
+#include "PCMBlitterLib.h"
 
 #define REACAudioEngine                com_pereckerdal_driver_REACAudioEngine
 
+// The per-channel gains that are applied by the blitters of one of the streams. Volume, gain and
+// mute changes are not applied at once; the gains ramp linearly to the new values over
+// REAC_GAIN_RAMP_FRAMES sample frames, counted from the sample frame that is converted next.
+// Each CoreAudio client converts its own range of sample frames, so the gains of a frame only
+// depend on where it is from the start of the ramp; the state is only changed by updateGains.
+#define REAC_GAIN_RAMP_FRAMES 256
+
+struct REACGainState {
+    UInt32              serial;                   // bumped by the control handlers
+    UInt32              seenSerial;               // the serial that the gains were last computed for
+    bool                valid;                    // false until the gains have been computed once
+    bool                unity;                    // the steady gains are all 1; use the plain blitters
+    bool                ramping;                  // there are gains before the steady ones
+    SInt64              rampStart;                // the sample frame where the ramp starts, from the start of the engine
+    PCMChannelGains     steady;
+    PCMChannelGains     ramp;                     // ramps from the previous gains to the steady ones
+    PCMChannelGains     previous;                 // the gains before the ramp, for the clients that lag behind it
+};
+
+// The InputMeters and OutputMeters properties of the engine hold an array of these, one per channel,
+// with the levels since the previous time they were published. They are published once every time
+// the sample buffers wrap around.
+struct REACChannelMeter {
+    Float32             peak;                     // the largest magnitude, 1.0 is full scale
+    Float32             rms;
+    UInt32              clipped;                  // the number of samples at or beyond full scale
+};
+
+// What is sent in place of a packet whose samples the CoreAudio clients haven't written in time (an
+// output underrun), as set by UnderrunFallback
+enum REACUnderrunFallback {
+    kREACUnderrunSilence,                         // zeros
+    kREACUnderrunFade,                            // the previous packet once more, faded out over its frames, then zeros
+    kREACUnderrunHold                             // the last sample frame of the previous packet, until the clients catch up
+};
+
+// The UnderrunStatistics property of the engine, in REAC_MASTER and REAC_SLAVE mode. An underrun is
+// a run of packets that were due to be sent before the clients had written them.
+struct REACUnderrunStatistics {
+    UInt64              underruns;
+    UInt64              packets;                  // the packets that the fallback was sent in place of
+};
+
 class REACAudioEngine : public IOAudioEngine
 {
     OSDeclareDefaultStructors(REACAudioEngine)
@@ -49,20 +93,95 @@ class REACAudioEngine : public IOAudioEngine
 
     UInt32              mLastValidSampleFrame;
     
-	SInt32              mVolume[17];
-    SInt32              mMuteOut[17];
-    SInt32              mMuteIn[17];
-    SInt32              mGain[17];
+    // Indexed by control channel ID: 0 is the master control, and channel n of a stream is n
+    SInt32              mVolume[REAC_MAX_CHANNEL_COUNT+1];
+    SInt32              mMuteOut[REAC_MAX_CHANNEL_COUNT+1];
+    SInt32              mMuteIn[REAC_MAX_CHANNEL_COUNT+1];
+    SInt32              mGain[REAC_MAX_CHANNEL_COUNT+1];
+    REACGainState       mOutGains;
+    REACGainState       mInGains;
+    PCMGainBlitters     mOutGainBlitters;         // the gain blitters for the channel count of the device
+    PCMGainBlitters     mInGainBlitters;
+    int                 mOutDitherMode;           // kPCMDitherNone, kPCMDitherTPDF or kPCMDitherNoiseShaped
+    PCMDitherState      mOutDither;
+    bool                mMeters;                  // measure the levels of the samples of each packet
+    PCMChannelMeters    mInMeters;
+    PCMChannelMeters    mOutMeters;
+    Float32             mMeterBuffer[REAC_SAMPLES_PER_PACKET*REAC_MAX_CHANNEL_COUNT]; // the Float32 samples of meterPacket
     
     UInt32              blockSize;                // In sample frames -- fixed, as defined in the Info.plist (e.g. 8192)
     UInt32              numBlocks;
     UInt32              bufferOffsetFactor;
     UInt32              currentBlock;
+    UInt64              mBlockCount;              // the blocks since the engine was started
 
     bool                duringHardwareInit;
     
     // For clipping routines
     UInt64              lastSampleTimeNS;
+    bool                mInWireOrder;             // mInBuffer (mInPacketBuffer when mInFloat) holds samples in REAC wire order
+    bool                mOutWireOrder;            // mOutBuffer (mOutPacketBuffer when mOutFloat) holds samples in REAC wire order
+    bool                mInt24In32;               // the buffers hold 24 bit samples in the high bytes of 32 bit ints
+    
+    // Float32 buffers: the streams can use IEEE754 float formats, and the samples are then converted
+    // once per packet, between the packet buffers and the sample buffers, instead of per client.
+    bool                mFloatBuffers;
+    bool                mInFloat;                 // mInBuffer holds Float32 samples
+    bool                mOutFloat;                // mOutBuffer holds Float32 samples
+    UInt32              mInPacketBufferSize;
+    UInt8              *mInPacketBuffer;          // the samples of the packet that is being received
+    UInt32              mOutPacketBufferSize;
+    UInt8              *mOutPacketBuffer;         // the samples of the packet that is being sent
+    UInt32              mInPacketFrame;           // the sample frame in mInBuffer that mInPacketBuffer goes to
+    
+    // The Float32 formats are also offered at the other SampleRates of the Info.plist. The samples of
+    // each packet are then converted between REAC_SAMPLE_RATE and the client rate as well, and the
+    // sample buffers and getCurrentSampleFrame count sample frames at the client rate.
+    UInt32              mClientRate;
+    bool                mResampling;              // mClientRate != REAC_SAMPLE_RATE
+    UInt32              mClientFrames;            // the sample frames in the sample buffers
+    UInt32              mClientFrame;             // the sample frame in the sample buffers that the current packet starts at
+    UInt32              mClientFrameAcc;          // the fraction of a frame that the packets so far add up to, in 1/REAC_SAMPLE_RATE
+    UInt32              mInPacketClientFrame;     // the sample frame in mInBuffer that the resampled mInPacketBuffer goes to
+    PCMResampler        mInResampler;
+    PCMResampler        mOutResampler;
+    UInt32              mResamplerMemorySize;     // in Float32s
+    Float32            *mResamplerMemory;         // the packets at REAC_SAMPLE_RATE, and the filters and histories
+    Float32            *mInRateBuffer;
+    Float32            *mOutRateBuffer;
+    
+    // Planar streams: with StreamChannels set, there is a stream per mStreamChannels channels in each
+    // direction instead of one stream with all of them (mStreamChannels is then 0). The streams only
+    // offer the Float32 formats, and the sample buffer of stream s is the part of mInBuffer or
+    // mOutBuffer from channel s*mStreamChannels on, for all the sample frames. The frames of each
+    // packet are interleaved in mInFrameBuffer and mOutFrameBuffer, and are transposed from and to
+    // the streams there. inputStream and outputStream are the first streams.
+    UInt32              mStreamChannels;
+    UInt32              mNumInStreams;
+    UInt32              mNumOutStreams;
+    IOAudioStream      *mInStreams[REAC_MAX_CHANNEL_COUNT];
+    IOAudioStream      *mOutStreams[REAC_MAX_CHANNEL_COUNT];
+    UInt32              mInFrameBufferSize;
+    Float32            *mInFrameBuffer;
+    UInt32              mOutFrameBufferSize;
+    Float32            *mOutFrameBuffer;
+    
+    // Output underruns: the sample frames (at the client rate) that the packets have been sent from
+    // and the clients have written up to, counted from the start of the engine, so that a client that
+    // stalls is noticed instead of the samples from a turn of the buffer earlier being sent again.
+    // mOutWriteFrame is only valid once the clients have written something (mOutWritten). With
+    // planar streams, clipOutputSamples is called once per stream, and mOutWriteFrame is the
+    // least of the write heads of the streams that are played.
+    UInt64              mOutReadFrame;
+    UInt64              mOutWriteFrame;
+    bool                mOutWritten;
+    UInt64              mOutStreamWriteFrame[REAC_MAX_CHANNEL_COUNT];
+    bool                mOutStreamWritten[REAC_MAX_CHANNEL_COUNT];
+    int                 mUnderrunFallback;        // a REACUnderrunFallback
+    UInt32              mUnderrunPackets;         // the packets of the current underrun so far
+    REACUnderrunStatistics mUnderrunStatistics;
+    UInt32              mLastOutPacketSize;       // 0 when there is no previous packet for the fallback
+    UInt8               mLastOutPacket[REAC_SAMPLES_PER_PACKET*REAC_MAX_CHANNEL_COUNT*sizeof(UInt32)];
     
     
 public:
@@ -95,9 +214,65 @@ public:
     
     void gotSamples(UInt8 **data, UInt32 *bufferSize);
     void getSamples(UInt8 **data, UInt32 *bufferSize);
+    void samplesCopied(UInt8 *data, UInt32 bufferSize);
     
 protected:
     void incrementBlockCounter();
+    static bool isPassthroughFormat(const IOAudioStreamFormat *format);
+    static void passthroughFormat(const IOAudioStreamFormat *format, IOAudioStreamFormat *passthrough);
+    UInt32 sampleBufferSize(const IOAudioStreamFormat *format);
+    void setStreamLayout(IOAudioStream *audioStream, const IOAudioStreamFormat *format);
+    UInt32 resamplerMemorySize(UInt32 clientRate);
+    bool setClientRate(UInt32 clientRate);
+    UInt32 clientFramesInPacket();
+    UInt32 streamChannels(UInt32 numChannels, UInt32 stream);
+    IOAudioStream *createAudioStream(IOAudioStreamDirection direction, UInt32 stream, UInt32 numChannels,
+                                     IOAudioStreamFormat *format, IOAudioStreamFormat *floatFormat,
+                                     const IOAudioSampleRate *clientRates, UInt32 numClientRates);
+    void resetSampleBuffer(IOAudioStream *audioStream, const IOAudioStreamFormat *format);
+    void initInputRouting();
+    // Moves the write head of audioStream forward to endSampleFrame, which clipOutputSamples has
+    // written it up to, and the write head of the output to the least of those of the streams
+    void outputWritten(IOAudioStream *audioStream, UInt32 endSampleFrame);
+    // Forgets the write head and the previous packet, for when the sample buffer starts over
+    void resetOutputUnderrun();
+    // Sets *data to the fallback for a packet that the clients haven't written yet. The Float32
+    // conversion of the packet is still run, so that the resampler and the gain ramps go on.
+    void concealUnderrun(UInt8 **data, UInt32 *bufferSize, UInt32 packetSize);
+    // Sets the ReceiveStatistics, and (when sending) SendStatistics, UnderrunStatistics and
+    // ClockStatistics properties
+    void publishStatistics();
+    // Takes the time stamp of the packet that is being sent or received
+    void takePacketTimeStamp();
+    
+    // Implemented in REACAudioClip.cpp. Convert one packet of samples, starting at firstSampleFrame in
+    // the Float32 sample buffers, from src (mInPacketBuffer or the received packet) and to
+    // mOutPacketBuffer. When resampling,
+    // firstSampleFrame only places the gain ramps, and the samples go to and come from mInPacketClientFrame
+    // and mClientFrame.
+    void convertPacketToFloat(const UInt8 *src, UInt32 firstSampleFrame);
+    void convertPacketFromFloat(UInt32 firstSampleFrame);
+    // Implemented in REACAudioClip.cpp. Copy numSampleFrames interleaved frames to and from the
+    // sample buffers of the planar streams, starting at firstSampleFrame.
+    void copyToInputStreams(const Float32 *src, UInt32 firstSampleFrame, UInt32 numSampleFrames);
+    void copyFromOutputStreams(Float32 *dst, UInt32 firstSampleFrame, UInt32 numSampleFrames);
+    // Implemented in REACAudioClip.cpp. Sets the InputMeters and OutputMeters properties.
+    void publishMeters();
+    void publishMeters(PCMChannelMeters *meters, const char *key);
+    // Implemented in REACAudioClip.cpp. Measures a packet of samples in the integer sample buffers.
+    void meterPacket(const UInt8 *src, UInt32 bitWidth, bool wireOrder, UInt32 numChannels, PCMChannelMeters *meters);
+    
+    // Implemented in REACAudioClip.cpp. Returns the number of sample frames, starting at firstSampleFrame,
+    // that can be converted with the same gains, and sets *gains and *gainFrame to the arguments of the
+    // *Gain blitters for them. *gains is set to NULL when the plain blitters can be used.
+    UInt32 gainSegment(REACGainState *state, bool output, UInt32 numChannels, UInt32 firstSampleFrame,
+                       UInt32 numSampleFrames, const PCMChannelGains **gains, Float32 *gainFrame);
+    void updateGains(REACGainState *state, bool output, UInt32 numChannels, UInt32 firstSampleFrame);
+    // The sample frame firstSampleFrame of the sample buffers, counted from the start of the engine.
+    // It is taken to be the one nearest to the block of the engine, which the clients are always
+    // well within half a turn of the buffers from.
+    SInt64 engineSampleFrame(UInt32 firstSampleFrame) const;
+    void resetGainRamps();
     
     virtual bool initControls();
     
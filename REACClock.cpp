@@ -0,0 +1,91 @@
+/*
+ *  REACClock.cpp
+ *  REAC
+ *
+ *  This file is part of the OS X REAC driver.
+ *  
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *  
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *  
+ */
+
+#include "REACClock.h"
+
+// Adds delta, in 32.32 fixed point nanoseconds, to a time
+static void addToTime(UInt64 *ns, UInt32 *fraction, SInt64 delta) {
+    SInt64 sum = (SInt64)*fraction + delta;
+    *ns += sum >> 32;
+    *fraction = (UInt32)sum;
+}
+
+void REACClock::init(UInt64 nowNS, UInt64 nominalPeriod_, UInt32 bandwidthShift) {
+    nominalPeriod = nominalPeriod_;
+    bShift = bandwidthShift;
+    cShift = 2*bandwidthShift+1;
+    maxErrorNS = 0;
+    resets = 0;
+    restart(nowNS);
+}
+
+void REACClock::restart(UInt64 nowNS) {
+    period = nominalPeriod;
+    timeNS = nowNS;
+    timeFraction = 0;
+    nextNS = nowNS;
+    nextFraction = 0;
+    addToTime(&nextNS, &nextFraction, (SInt64)period);
+}
+
+bool REACClock::update(UInt64 nowNS, UInt32 maxErrorPeriods) {
+    SInt64 limit = (SInt64)((period >> 32) * maxErrorPeriods);
+    SInt64 errorNS = (SInt64)(nowNS - nextNS);
+    SInt64 error;
+    
+    if (limit > 0x7fffffff) {
+        // The error has to fit in 32.32 fixed point
+        limit = 0x7fffffff;
+    }
+    if (errorNS > limit || errorNS < -limit) {
+        resets++;
+        restart(nowNS);
+        return false;
+    }
+    if ((UInt32)(errorNS < 0 ? -errorNS : errorNS) > maxErrorNS) {
+        maxErrorNS = (UInt32)(errorNS < 0 ? -errorNS : errorNS);
+    }
+    error = errorNS * ((SInt64)1 << 32) - (SInt64)nextFraction;
+    
+    timeNS = nextNS;
+    timeFraction = nextFraction;
+    addToTime(&nextNS, &nextFraction, (SInt64)period + (error >> bShift));
+    period += error >> cShift;
+    return true;
+}
+
+UInt64 REACClock::getTimeNS(UInt32 num, UInt32 den) const {
+    UInt64 ns = timeNS;
+    UInt32 fraction = timeFraction;
+    
+    addToTime(&ns, &fraction, (SInt64)(period / den * num));
+    return ns;
+}
+
+void REACClock::getStatistics(REACClockStatistics *statistics) {
+    // The period is within a fraction of a percent of the nominal one, so the difference has room
+    // for the extra bits
+    statistics->rateRatio = (1ULL << 32) + (SInt64)(period - nominalPeriod) * 1024 / (SInt64)(nominalPeriod >> 22);
+    statistics->maxErrorNS = maxErrorNS;
+    statistics->resets = resets;
+    maxErrorNS = 0;
+}
@@ -0,0 +1,80 @@
+/*
+ *  REACClock.h
+ *  REAC
+ *
+ *  This file is part of the OS X REAC driver.
+ *  
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *  
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *  
+ */
+
+#ifndef _REACCLOCK_H
+#define _REACCLOCK_H
+
+#include <libkern/OSTypes.h>
+
+#define REACClock                   com_pereckerdal_driver_REACClock
+#define REACClockStatistics         com_pereckerdal_driver_REACClockStatistics
+
+// How closely the clock follows the times it is fed
+struct REACClockStatistics {
+    UInt64              rateRatio;                // the estimated period over the nominal one, in 32.32 fixed point
+    UInt32              maxErrorNS;               // the largest distance between a time and its prediction since the statistics were last read
+    UInt32              resets;                   // the times the clock started over because it was too far off
+};
+
+// A second order delay-locked loop that filters a series of times that should be a fixed period
+// apart (the wakes of the REAC_MASTER timer), so that the jitter of each one is smoothed out of the
+// estimated time and period. All of it is integer math on nanoseconds in 32.32 fixed point, which
+// also keeps the fractions of a nanosecond of a period that isn't a whole number of them.
+//
+// The loop has a bandwidth of about 0.11/period*2^-bandwidthShift Hz (0.9 Hz with a period of
+// 125 us and a shift of 10) and is critically damped.
+class REACClock {
+public:
+    // Starts at nowNS, with the nominal period in 32.32 fixed point nanoseconds
+    void init(UInt64 nowNS, UInt64 nominalPeriod, UInt32 bandwidthShift);
+    // Feeds the time of the next period. When it is more than maxErrorPeriods periods from the
+    // prediction, the clock starts over from it and false is returned.
+    bool update(UInt64 nowNS, UInt32 maxErrorPeriods = 10);
+    
+    // The filtered time of the last update, and the time num/den of a period after it
+    UInt64 getTimeNS() const { return timeNS; }
+    UInt64 getTimeNS(UInt32 num, UInt32 den) const;
+    // The estimated period, in 32.32 fixed point nanoseconds
+    UInt64 getPeriod() const { return period; }
+    // Copies the statistics, and starts over on the largest error
+    void getStatistics(REACClockStatistics *statistics);
+    
+    // 32.32 fixed point nanoseconds per second
+    static UInt64 periodFromRate(UInt32 perSecond) { return (1000000000ULL << 32) / perSecond; }
+    
+private:
+    void restart(UInt64 nowNS);
+    
+    UInt64 nominalPeriod;
+    UInt64 period;          // e2 of the loop
+    UInt64 timeNS;          // the filtered time of the last update
+    UInt32 timeFraction;
+    UInt64 nextNS;          // the prediction of the time of the next update
+    UInt32 nextFraction;
+    UInt32 bShift;          // the first order coefficient is 2^-bShift,
+    UInt32 cShift;          // and the second order one is 2^-cShift, half of its square
+    UInt32 maxErrorNS;
+    UInt32 resets;
+};
+
+
+#endif
@@ -46,6 +46,7 @@ bool REACConnection::initWithInterface(IOWorkLoop *workLoop_, ifnet_t interface_
                                        reac_connection_callback_t connectionCallback_,
                                        reac_samples_callback_t samplesCallback_,
                                        reac_get_samples_callback_t getSamplesCallback_,
+                                       reac_samples_copied_callback_t samplesCopiedCallback_,
                                        void *cookieA_,
                                        void *cookieB_,
                                        UInt8 inChannels_,
@@ -56,6 +57,19 @@ bool REACConnection::initWithInterface(IOWorkLoop *workLoop_, ifnet_t interface_
     workLoop = NULL;
     timerEventSource = NULL;
     interface = NULL;
+    packetPoolCount = 0;
+    packetPoolSize = REAC_DEFAULT_PACKET_POOL_SIZE;
+    packetPoolPayloadSize = 0;
+    bzero(&sendStatistics, sizeof(sendStatistics));
+    sendStatistics.minLatencyNS = (UInt32) -1;
+    packetsPerWake = 1;
+    batchHead = batchTail = NULL;
+    batchCount = 0;
+    batchStartNS = 0;
+    clockPacketsPerWake = 0;
+    wakePacket = 0;
+    receiveInPlace = false;
+    bzero(&receiveStatistics, sizeof(receiveStatistics));
     
     if (NULL == workLoop_) {
         goto Fail;
@@ -94,6 +108,11 @@ bool REACConnection::initWithInterface(IOWorkLoop *workLoop_, ifnet_t interface_
     deviceInfo->addr[5] = 0xf6;
     deviceInfo->in_channels = 16;
     deviceInfo->out_channels = 8;
+    if (REAC_MASTER == mode_) {
+        // The audio engine is made once, so it has room for the channels of a slave from the start
+        deviceInfo->in_channels = cascadeChannels(outChannels_);
+        deviceInfo->out_channels = cascadeChannels(inChannels_);
+    }
     started = false;
     connected = false;
     
@@ -104,11 +123,15 @@ bool REACConnection::initWithInterface(IOWorkLoop *workLoop_, ifnet_t interface_
     connectionCallback = connectionCallback_;
     samplesCallback = samplesCallback_;
     getSamplesCallback = getSamplesCallback_;
+    samplesCopiedCallback = samplesCopiedCallback_;
     cookieA = cookieA_;
     cookieB = cookieB_;
     mode = mode_;
     inChannels = inChannels_;
     outChannels = outChannels_;
+    sendSampleLayout = REAC_LAYOUT_NATIVE;
+    receiveSampleLayout = REAC_LAYOUT_NATIVE;
+    numRoutedInputs = 0;
     
     dataStream = REACDataStream::withConnection(this); // mode has to be set before this is called.
     if (NULL == dataStream) {
@@ -122,6 +145,7 @@ bool REACConnection::initWithInterface(IOWorkLoop *workLoop_, ifnet_t interface_
         IOLog("REACConnection::initWithInterface() - Error: Failed to get interface address.\n");
         goto Fail;
     }
+    packetBuilder.init(interfaceAddr);
     
     // TODO This is a hack. It seems to be needless though.
     //static const UInt8 counterfeitMac[] = {
@@ -132,6 +156,7 @@ bool REACConnection::initWithInterface(IOWorkLoop *workLoop_, ifnet_t interface_
     // Calculate our timeout in nanosecs, taking care to keep 64bits
     if (REAC_MASTER == mode_) {
         timeoutNS = 1000000000;
+        timeoutNS *= packetsPerWake;
         timeoutNS /= REAC_PACKETS_PER_SECOND;
     }
     else {
@@ -157,6 +182,7 @@ REACConnection *REACConnection::withInterface(IOWorkLoop *workLoop, ifnet_t inte
                                               reac_connection_callback_t connectionCallback,
                                               reac_samples_callback_t samplesCallback,
                                               reac_get_samples_callback_t getSamplesCallback,
+                                              reac_samples_copied_callback_t samplesCopiedCallback,
                                               void *cookieA,
                                               void *cookieB,
                                               UInt8 inChannels,
@@ -164,7 +190,8 @@ REACConnection *REACConnection::withInterface(IOWorkLoop *workLoop, ifnet_t inte
     REACConnection *p = new REACConnection;
     if (NULL == p) return NULL;
     bool result = p->initWithInterface(workLoop, interface, mode, connectionCallback, samplesCallback,
-                                       getSamplesCallback, cookieA, cookieB, inChannels, outChannels);
+                                       getSamplesCallback, samplesCopiedCallback, cookieA, cookieB,
+                                       inChannels, outChannels);
     if (!result) {
         p->release();
         return NULL;
@@ -243,6 +270,10 @@ bool REACConnection::start() {
     
     started = true;
     
+    if (REAC_MASTER == mode || REAC_SLAVE == mode) {
+        fillPacketPool();
+    }
+    
     return true;
 }
 
@@ -263,12 +294,67 @@ void REACConnection::stop() {
         iflt_detach(filterRef);
         started = false;
     }
+    
+    drainPacketPool();
 }
 
 const REACDeviceInfo *REACConnection::getDeviceInfo() const {
     return deviceInfo;
 }
 
+IOReturn REACConnection::setInputRouting(const UInt8 *routing, UInt32 numRouted) {
+    if (numRouted > REAC_MAX_CHANNEL_COUNT) {
+        return kIOReturnBadArgument;
+    }
+    for (UInt32 i = 0; i < numRouted; i++) {
+        if (routing[i] >= deviceInfo->in_channels) {
+            return kIOReturnBadArgument;
+        }
+    }
+    
+    memcpy(inputRouting, routing, numRouted);
+    numRoutedInputs = numRouted;
+    return kIOReturnSuccess;
+}
+
+IOReturn REACConnection::setPacketPoolSize(UInt32 size) {
+    if (size > REAC_MAX_PACKET_POOL_SIZE) {
+        return kIOReturnBadArgument;
+    }
+    
+    packetPoolSize = size;
+    while (packetPoolCount > packetPoolSize) {
+        mbuf_freem(packetPool[--packetPoolCount]);
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn REACConnection::setPacketsPerWake(UInt32 packets) {
+    if (0 == packets || packets > REAC_MAX_PACKETS_PER_WAKE) {
+        return kIOReturnBadArgument;
+    }
+    
+    packetsPerWake = packets;
+    if (REAC_MASTER == mode) {
+        // Takes effect when the timer fires next
+        timeoutNS = 1000000000;
+        timeoutNS *= packetsPerWake;
+        timeoutNS /= REAC_PACKETS_PER_SECOND;
+    }
+    return kIOReturnSuccess;
+}
+
+void REACConnection::getSendStatistics(REACSendStatistics *statistics) {
+    *statistics = sendStatistics;
+    if ((UInt32) -1 == statistics->minLatencyNS) {
+        statistics->minLatencyNS = 0;
+    }
+    
+    sendStatistics.minLatencyNS = (UInt32) -1;
+    sendStatistics.maxLatencyNS = 0;
+    bzero(sendStatistics.latencyHistogram, sizeof(sendStatistics.latencyHistogram));
+}
+
 void REACConnection::timerFired(OSObject *target, IOTimerEventSource *sender) {
     REACConnection *proto = OSDynamicCast(REACConnection, target);
     if (NULL == proto) {
@@ -280,6 +366,10 @@ void REACConnection::timerFired(OSObject *target, IOTimerEventSource *sender) {
     UInt64            thisTimeNS;
     uint64_t          time;
     SInt64            diff;
+    bool              late = false;
+    
+    clock_get_uptime(&time);
+    absolutetime_to_nanoseconds(time, &thisTimeNS);
     
     do {
         if (proto->isConnected()) {
@@ -295,7 +385,18 @@ void REACConnection::timerFired(OSObject *target, IOTimerEventSource *sender) {
         }
         
         if (REAC_MASTER == proto->mode) {
-            proto->getAndSendSamples();
+            // The wakes that are caught up on are taken at the time they were due; the time after
+            // the packets of the last one were sent would pull the clock off
+            proto->updateClock(late ? proto->nextTime : thisTimeNS);
+            
+            // The packets of this wake, and of the wakes that were missed, are sent in one chain
+            for (proto->wakePacket = 0; proto->wakePacket < proto->packetsPerWake; proto->wakePacket++) {
+                proto->getAndSendSamples(true);
+            }
+            proto->wakePacket = 0;
+            if (late) {
+                proto->sendStatistics.latePackets += proto->packetsPerWake;
+            }
         }
         else if (REAC_SPLIT == proto->mode) {
             proto->lastSentAnnouncementCounter++;
@@ -312,36 +413,228 @@ void REACConnection::timerFired(OSObject *target, IOTimerEventSource *sender) {
         // This next calculation must be signed
         diff = ((SInt64)proto->nextTime - (SInt64)thisTimeNS);
         
-        if (diff < -((SInt64)proto->timeoutNS)*10) {
-            // TODO After a certain amount of lost packets we probably ought to skip output packets
+        if (diff < -((SInt64)proto->timeoutNS)*REAC_MAX_LATE_WAKES) {
             IOLog("REACConnection::timerFired(): Lost the time by %lld us\n", diff/1000);
+            if (REAC_MASTER == proto->mode) {
+                // Too late to catch up without a burst that the device can't take. Skip to the
+                // wake that is due now.
+                UInt64 skippedWakes = (UInt64)(-diff) / proto->timeoutNS;
+                proto->sendStatistics.skippedPackets += skippedWakes*proto->packetsPerWake;
+                for (UInt64 i = 0; i < skippedWakes; i++) {
+                    proto->skipWake(proto->nextTime);
+                    proto->nextTime += proto->timeoutNS;
+                }
+                diff += (SInt64)(skippedWakes*proto->timeoutNS);
+            }
         }
+        late = true;
     } while (diff < 0);
+    
+    // Now that the packets are out, there's time to replace them
+    if (REAC_MASTER == proto->mode) {
+        proto->sendBatch();
+        proto->fillPacketPool();
+        
+        // The timeout is relative, so it has to be taken from after the sending and the refill
+        clock_get_uptime(&time);
+        absolutetime_to_nanoseconds(time, &thisTimeNS);
+        diff = ((SInt64)proto->nextTime - (SInt64)thisTimeNS);
+        if (diff < 0) {
+            // The next wake is due already; the late packets of it are caught up on then
+            diff = 0;
+        }
+    }
+    
     sender->setTimeout(diff);
 }
 
-IOReturn REACConnection::getAndSendSamples() {
+void REACConnection::updateClock(UInt64 nowNS) {
+    if (clockPacketsPerWake != packetsPerWake) {
+        // The first wake, or the timer period has changed. The bandwidth of the clock is kept at
+        // about 1 Hz.
+        UInt32 bandwidthShift = 10;
+        for (UInt32 n = packetsPerWake; n > 1; n /= 2) {
+            bandwidthShift--;
+        }
+        clock.init(nowNS, REACClock::periodFromRate(REAC_PACKETS_PER_SECOND)*packetsPerWake, bandwidthShift);
+        clockPacketsPerWake = packetsPerWake;
+    }
+    else if (!clock.update(nowNS)) {
+        IOLog("REACConnection::updateClock(): The timer is too far off, starting the clock over.\n");
+    }
+}
+
+void REACConnection::skipWake(UInt64 dueNS) {
+    UInt8 *sampleBuffer;
+    UInt32 bufSize;
+    
+    updateClock(dueNS);
+    for (wakePacket = 0; wakePacket < packetsPerWake; wakePacket++) {
+        if (getSamplesCallback) {
+            sampleBuffer = NULL;
+            bufSize = 0;
+            getSamplesCallback(this, &cookieA, &cookieB, &sampleBuffer, &bufSize);
+        }
+    }
+    wakePacket = 0;
+}
+
+UInt32 REACConnection::getSamplePayloadSize() const {
+    return REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*getSentPacketChannels();
+}
+
+UInt32 REACConnection::cascadeChannels(UInt32 channels) {
+    return (2*channels > REAC_MAX_CHANNEL_COUNT ? REAC_MAX_CHANNEL_COUNT : 2*channels);
+}
+
+UInt32 REACConnection::getSentPacketChannels() const {
+    REACMasterDataStream *masterDataStream = OSDynamicCast(REACMasterDataStream, dataStream);
+    if (NULL != masterDataStream && !masterDataStream->isConnectedToSlave()) {
+        return inChannels;
+    }
+    return deviceInfo->out_channels;
+}
+
+UInt32 REACConnection::getReceivedPacketChannels() const {
+    REACMasterDataStream *masterDataStream = OSDynamicCast(REACMasterDataStream, dataStream);
+    if (NULL != masterDataStream && !masterDataStream->isConnectedToSlave()) {
+        return outChannels;
+    }
+    return deviceInfo->in_channels;
+}
+
+void REACConnection::gotMasterAnnouncement(UInt32 masterInChannels, UInt32 masterOutChannels) {
+    // The engine is sized from deviceInfo when it is created, and it is only
+    // created once, so the counts can't change after that
+    if (REAC_MASTER == mode || isConnected() || NULL != cookieB) {
+        return;
+    }
+    if (masterInChannels < 1 || masterInChannels > REAC_MAX_CHANNEL_COUNT ||
+        masterOutChannels < 1 || masterOutChannels > REAC_MAX_CHANNEL_COUNT) {
+        IOLog("REACConnection::gotMasterAnnouncement(): Unsupported number of channels [%d %d]\n",
+              masterInChannels, masterOutChannels);
+        return;
+    }
+    // We get the channels that the master sends, and send the ones it gets
+    deviceInfo->in_channels = masterInChannels;
+    deviceInfo->out_channels = masterOutChannels;
+}
+
+IOReturn REACConnection::copyNarrowAudioToBuffer(MbufCursor *cursor, REACSampleLayout layout,
+                                                 UInt32 packetChannels, UInt32 bufferChannels, UInt8 *buffer) {
+    const UInt32 resolution = sampleLayoutResolution(layout);
+    const UInt32 packetFrameSize = resolution*packetChannels;
+    const UInt32 bufferFrameSize = resolution*bufferChannels;
+    IOReturn result;
+    
+    // The samples are swapped in pairs on the wire, so each frame has to be whole pairs
+    if (0 != packetChannels % 2 || packetChannels > bufferChannels) {
+        return kIOReturnBadArgument;
+    }
+    for (UInt32 frame = 0; frame < REAC_SAMPLES_PER_PACKET; frame++) {
+        UInt8 *bufferFrame = buffer+frame*bufferFrameSize;
+        if (REAC_LAYOUT_WIRE == layout) {
+            result = cursor->copyToBuffer(packetFrameSize, bufferFrame);
+        }
+        else if (REAC_LAYOUT_NATIVE_32 == layout) {
+            result = cursor->copyAudio32ToBuffer(packetFrameSize, bufferFrame);
+        }
+        else {
+            result = cursor->copyAudioToBuffer(packetFrameSize, bufferFrame);
+        }
+        if (kIOReturnSuccess != result) {
+            return result;
+        }
+        bzero(bufferFrame+packetFrameSize, bufferFrameSize-packetFrameSize);
+    }
+    return kIOReturnSuccess;
+}
+
+mbuf_t REACConnection::allocatePacket(UInt32 payloadSize, const UInt8 *dhost, const REACPacketHeader *packetHeader) {
+    const UInt32 packetLen = REACPacketBuilder::getPacketLength(payloadSize);
+    mbuf_t mbuf = NULL;
+    
+    if (0 != mbuf_allocpacket(MBUF_DONTWAIT, packetLen, NULL, &mbuf) ||
+        kIOReturnSuccess != MbufUtils::setChainLength(mbuf, packetLen) ||
+        kIOReturnSuccess != packetBuilder.build(mbuf, dhost, packetHeader, payloadSize)) {
+        goto Fail;
+    }
+    
+    return mbuf;
+    
+Fail:
+    if (NULL != mbuf) {
+        mbuf_freem(mbuf);
+    }
+    return NULL;
+}
+
+void REACConnection::fillPacketPool() {
+    const UInt32 payloadSize = getSamplePayloadSize();
+    
+    if (payloadSize != packetPoolPayloadSize) {
+        // The number of channels has changed
+        drainPacketPool();
+        packetPoolPayloadSize = payloadSize;
+    }
+    
+    while (packetPoolCount < packetPoolSize) {
+        mbuf_t mbuf = allocatePacket(payloadSize);
+        if (NULL == mbuf) {
+            // Tried again after the next packet
+            break;
+        }
+        packetPool[packetPoolCount++] = mbuf;
+    }
+}
+
+void REACConnection::drainPacketPool() {
+    while (packetPoolCount) {
+        mbuf_freem(packetPool[--packetPoolCount]);
+    }
+}
+
+void REACConnection::addSendLatency(UInt64 startNS, UInt32 packets) {
+    uint64_t time;
+    UInt64 nowNS;
+    UInt32 latencyNS;
+    UInt32 bucket = 0;
+    
+    clock_get_uptime(&time);
+    absolutetime_to_nanoseconds(time, &nowNS);
+    latencyNS = (nowNS-startNS > (UInt32) -1 ? (UInt32) -1 : (UInt32) (nowNS-startNS));
+    
+    while (bucket+1 < REAC_SEND_LATENCY_BUCKETS && latencyNS >= (1000U << bucket)) {
+        bucket++;
+    }
+    sendStatistics.latencyHistogram[bucket] += packets;
+    if (latencyNS < sendStatistics.minLatencyNS) {
+        sendStatistics.minLatencyNS = latencyNS;
+    }
+    if (latencyNS > sendStatistics.maxLatencyNS) {
+        sendStatistics.maxLatencyNS = latencyNS;
+    }
+}
+
+IOReturn REACConnection::getAndSendSamples(bool batch) {
     UInt8 *sampleBuffer = NULL;
     UInt32 bufSize = 0;
     if (getSamplesCallback) {
         getSamplesCallback(this, &cookieA, &cookieB, &sampleBuffer, &bufSize);
     }
-    return sendSamples(bufSize, sampleBuffer);
+    return sendSamples(bufSize, sampleBuffer, batch);
 }
 
-IOReturn REACConnection::sendSamples(UInt32 bufSize, UInt8 *sampleBuffer) {
-    REACMasterDataStream *masterDataStream = OSDynamicCast(REACMasterDataStream, dataStream);
-    const UInt32 ourSamplesSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*
-                                (NULL != masterDataStream ?
-                                    inChannels : deviceInfo->out_channels);
-    // TODO This is not complete
-    const UInt32 slaveSamplesSize = (NULL != masterDataStream && masterDataStream->isConnectedToSlave()) ? ourSamplesSize : 0;
-    const UInt32 sentSamplesSize = ourSamplesSize+slaveSamplesSize;
-    const UInt32 sampleOffset = sizeof(EthernetHeader)+sizeof(REACPacketHeader);
-    const UInt32 endingOffset = sampleOffset+sentSamplesSize;
-    const UInt32 packetLen = endingOffset+sizeof(REACConstants::ENDING);
+IOReturn REACConnection::sendSamples(UInt32 bufSize, UInt8 *sampleBuffer, bool batch) {
+    const UInt32 resolution = sampleLayoutResolution(sendSampleLayout);
+    const UInt32 ourBufferSize = REAC_SAMPLES_PER_PACKET*resolution*deviceInfo->out_channels;
+    const UInt32 packetChannels = getSentPacketChannels();
+    const UInt32 payloadSize = getSamplePayloadSize();
+    UInt8 dhost[ETHER_ADDR_LEN];
     REACPacketHeader rph;
     mbuf_t mbuf = NULL;
+    uint64_t time;
+    UInt64 startNS;
     IOReturn result = kIOReturnError;
     IOReturn processPacketRet;
     
@@ -350,19 +643,17 @@ IOReturn REACConnection::sendSamples(UInt32 bufSize, UInt8 *sampleBuffer) {
         result = kIOReturnInvalid;
         goto Done;
     }
-    if (ourSamplesSize != bufSize && NULL != sampleBuffer) { // bufSize is ignored when sampleBuffer is NULL
+    if (ourBufferSize != bufSize && NULL != sampleBuffer) { // bufSize is ignored when sampleBuffer is NULL
         result = kIOReturnBadArgument;
         goto Done;
     }
     
-    /// Prepare ethernet header
-    EthernetHeader header;
-    memcpy(header.shost, interfaceAddr, sizeof(header.shost));
-    // Don't initialize header.dhost; that's the responsibility of dataStream->processPacket
-    memcpy(&header.type, REACConstants::PROTOCOL, sizeof(REACConstants::PROTOCOL));
+    clock_get_uptime(&time);
+    absolutetime_to_nanoseconds(time, &startNS);
     
-    /// Do REAC data stream processing
-    processPacketRet = dataStream->processPacket(&rph, sizeof(header.dhost), header.dhost);
+    /// Do REAC data stream processing. It fills in the destination address; the rest of the ethernet
+    /// header is in place in the packet already
+    processPacketRet = dataStream->processPacket(&rph, sizeof(dhost), dhost);
     if (kIOReturnAborted == processPacketRet) {
         // The REACDataStream indicates to us that it doesn't want us to send a packet.
         goto Done;
@@ -372,55 +663,51 @@ IOReturn REACConnection::sendSamples(UInt32 bufSize, UInt8 *sampleBuffer) {
         goto Done;
     }
     
-    /// Allocate mbuf
-    if (0 != mbuf_allocpacket(MBUF_DONTWAIT, packetLen, NULL, &mbuf) ||
-        kIOReturnSuccess != MbufUtils::setChainLength(mbuf, packetLen)) {
-        IOLog("REACConnection::sendSamples() - Error: Failed to allocate packet mbuf.\n");
-        goto Done;
-    }
-    
-    /// Copy ethernet header
-    if (kIOReturnSuccess != MbufUtils::copyFromBufferToMbuf(mbuf, 0, sizeof(EthernetHeader), &header)) {
-        IOLog("REACConnection::sendSamples() - Error: Failed to copy REAC header to packet mbuf.\n");
-        goto Done;
-    }
-    
-    /// Copy REAC header
-    if (kIOReturnSuccess != MbufUtils::copyFromBufferToMbuf(mbuf, sizeof(EthernetHeader), sizeof(REACPacketHeader), &rph)) {
-        IOLog("REACConnection::sendSamples() - Error: Failed to copy REAC header to packet mbuf.\n");
-        goto Done;
-    }
-    
-    /// Copy sample data
-    if (NULL != sampleBuffer) {
-        if (kIOReturnSuccess != MbufUtils::copyAudioFromBufferToMbuf(mbuf, sampleOffset, bufSize, sampleBuffer)) {
-            IOLog("REACConnection::sendSamples() - Error: Failed to copy sample data to packet mbuf.\n");
-            goto Done;
-        }
+    /// Take a packet from the pool, or allocate one if it has run dry
+    if (0 != packetPoolCount && packetPoolPayloadSize == payloadSize) {
+        mbuf = packetPool[--packetPoolCount];
     }
     else {
-        if (kIOReturnSuccess != MbufUtils::zeroMbuf(mbuf, sampleOffset, ourSamplesSize)) {
-            IOLog("REACConnection::sendSamples() - Error: Failed to zero sample data in mbuf.\n");
-            goto Done;
+        if (0 != packetPoolSize) {
+            sendStatistics.poolMisses++;
         }
-    }
-    if (NULL != masterDataStream && masterDataStream->isConnectedToSlave()) {
-        // TODO This is very incorrect: It doesn't send the slave data, and even if it would, the order of the
-        // data would be jumbled, because it has to send the whole first sample first and so on.
-        if (kIOReturnSuccess != MbufUtils::zeroMbuf(mbuf, sampleOffset+ourSamplesSize, slaveSamplesSize)) {
-            IOLog("REACConnection::sendSamples() - Error: Failed to zero slave sample data in mbuf.\n");
+        mbuf = allocatePacket(payloadSize);
+        if (NULL == mbuf) {
+            sendStatistics.allocationFailures++;
+            IOLog("REACConnection::sendSamples() - Error: Failed to allocate packet mbuf.\n");
             goto Done;
         }
     }
     
-    /// Copy packet ending
-    if (kIOReturnSuccess != MbufUtils::copyFromBufferToMbuf(mbuf, endingOffset,
-                                                            sizeof(REACConstants::ENDING), (void *)REACConstants::ENDING)) {
-        IOLog("REACConnection::sendSamples() - Error: Failed to copy ending to packet mbuf.\n");
+    /// Copy the destination address, the REAC header and the sample data. Without samples, the zeros
+    /// of the packet are sent. When the packets carry fewer channels than the buffer (in REAC_MASTER
+    /// mode without a slave), only the first channels of each sample frame are sent.
+    if (kIOReturnSuccess != packetBuilder.update(mbuf, dhost, &rph,
+                                                 REAC_LAYOUT_WIRE == sendSampleLayout ? REACPacketBuilder::PAYLOAD_WIRE :
+                                                 REAC_LAYOUT_NATIVE_32 == sendSampleLayout ? REACPacketBuilder::PAYLOAD_NATIVE_32 :
+                                                 REACPacketBuilder::PAYLOAD_NATIVE,
+                                                 sampleBuffer, REAC_SAMPLES_PER_PACKET*resolution*packetChannels,
+                                                 packetChannels != deviceInfo->out_channels ?
+                                                 resolution*deviceInfo->out_channels : 0)) {
+        IOLog("REACConnection::sendSamples() - Error: Failed to copy REAC header and sample data to packet mbuf.\n");
         goto Done;
     }
     
-    /// Send packet
+    /// Send packet. The packet ending is in place already
+    if (batch) {
+        if (NULL == batchHead) {
+            batchHead = mbuf;
+            batchStartNS = startNS;
+        }
+        else {
+            mbuf_setnextpkt(batchTail, mbuf);
+        }
+        batchTail = mbuf;
+        batchCount++;
+        mbuf = NULL;
+        result = kIOReturnSuccess;
+        goto Done;
+    }
     if (0 != ifnet_output_raw(interface, 0, mbuf)) {
         mbuf = NULL; // ifnet_output_raw always frees the mbuf
         IOLog("REACConnection::sendSamples() - Error: Failed to send packet.\n");
@@ -428,6 +715,8 @@ IOReturn REACConnection::sendSamples(UInt32 bufSize, UInt8 *sampleBuffer) {
     }
     
     mbuf = NULL; // ifnet_output_raw always frees the mbuf
+    addSendLatency(startNS);
+    sendStatistics.packets++;
     result = kIOReturnSuccess;
 Done:
     if (NULL != mbuf) {
@@ -437,11 +726,33 @@ Done:
     return result;
 }
 
+IOReturn REACConnection::sendBatch() {
+    const UInt32 count = batchCount;
+    errno_t error;
+    
+    if (NULL == batchHead) {
+        return kIOReturnSuccess;
+    }
+    
+    // ifnet_output_raw takes a chain of packets, and always frees it
+    error = ifnet_output_raw(interface, 0, batchHead);
+    batchHead = batchTail = NULL;
+    batchCount = 0;
+    if (0 != error) {
+        IOLog("REACConnection::sendBatch() - Error: Failed to send %u packets.\n", (unsigned)count);
+        return kIOReturnError;
+    }
+    
+    addSendLatency(batchStartNS, count);
+    sendStatistics.packets += count;
+    if (count > 1) {
+        sendStatistics.burstPackets += count;
+    }
+    return kIOReturnSuccess;
+}
+
 IOReturn REACConnection::sendSplitAnnouncementPacket() {
     const UInt32 fillerSize = 288;
-    const UInt32 fillerOffset = sizeof(EthernetHeader)+sizeof(REACPacketHeader);
-    const UInt32 endingOffset = fillerOffset+fillerSize;
-    const UInt32 packetLen = endingOffset+sizeof(REACConstants::ENDING);
     REACSplitDataStream *splitDataStream;
     REACPacketHeader rph;
     mbuf_t mbuf = NULL;
@@ -465,42 +776,13 @@ IOReturn REACConnection::sendSplitAnnouncementPacket() {
         goto Done;
     }
     
-    /// Allocate mbuf
-    if (0 != mbuf_allocpacket(MBUF_DONTWAIT, packetLen, NULL, &mbuf) ||
-        kIOReturnSuccess != MbufUtils::setChainLength(mbuf, packetLen)) {
+    /// Allocate and build the packet, with zeros for filler
+    mbuf = allocatePacket(fillerSize, deviceInfo->addr, &rph);
+    if (NULL == mbuf) {
         IOLog("REACConnection::sendSplitAnnouncementPacket() - Error: Failed to allocate packet mbuf.\n");
         goto Done;
     }
     
-    /// Copy ethernet header
-    EthernetHeader header;
-    memcpy(header.shost, interfaceAddr, sizeof(header.shost));
-    memcpy(header.dhost, deviceInfo->addr, sizeof(header.dhost));
-    memcpy(&header.type, REACConstants::PROTOCOL, sizeof(REACConstants::PROTOCOL));
-    if (kIOReturnSuccess != MbufUtils::copyFromBufferToMbuf(mbuf, 0, sizeof(EthernetHeader), &header)) {
-        IOLog("REACConnection::sendSplitAnnouncementPacket() - Error: Failed to copy REAC header to packet mbuf.\n");
-        goto Done;
-    }
-    
-    /// Copy REAC header
-    if (kIOReturnSuccess != MbufUtils::copyFromBufferToMbuf(mbuf, sizeof(EthernetHeader), sizeof(REACPacketHeader), &rph)) {
-        IOLog("REACConnection::sendSplitAnnouncementPacket() - Error: Failed to copy REAC header to packet mbuf.\n");
-        goto Done;
-    }
-    
-    /// Copy filler
-    if (kIOReturnSuccess != MbufUtils::zeroMbuf(mbuf, fillerOffset, fillerSize)) {
-        IOLog("REACConnection::sendSplitAnnouncementPacket() - Error: Failed to zero filler data in mbuf.\n");
-        goto Done;
-    }
-    
-    /// Copy packet ending
-    if (kIOReturnSuccess != MbufUtils::copyFromBufferToMbuf(mbuf, endingOffset,
-                                                            sizeof(REACConstants::ENDING), (void *)REACConstants::ENDING)) {
-        IOLog("REACConnection::sendSplitAnnouncementPacket() - Error: Failed to copy ending to packet mbuf.\n");
-        goto Done;
-    }
-    
     /// Send packet
     if (0 != ifnet_output_raw(interface, 0, mbuf)) {
         mbuf = NULL; // ifnet_output_raw always frees the mbuf
@@ -527,21 +809,46 @@ void REACConnection::filterCommandGateMsg(OSObject *target, void *data_mbuf, voi
     }
     
     const EthernetHeader *ethernetHeader = (const EthernetHeader *)eth_header_ptr;
-    const int samplesSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*proto->deviceInfo->in_channels;
+    const UInt32 packetChannels = proto->getReceivedPacketChannels();
+    const UInt32 samplesSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*packetChannels;
+    const bool narrow = packetChannels != proto->deviceInfo->in_channels;
     
     mbuf_t *data = (mbuf_t *)data_mbuf;
-    UInt32 len = MbufUtils::mbufTotalLength(*data);
-    REACPacketHeader packetHeader;
+    MbufCursor cursor;
+    UInt8 *packetData = NULL;
+    REACPacketHeader packetHeaderCopy;
+    REACPacketHeader *packetHeader = &packetHeaderCopy;
+    
+    // The packet is parsed in one pass, with a cursor that moves forward through it
+    if (kIOReturnSuccess != cursor.init(*data)) {
+        IOLog("REACConnection[%p]::filterCommandGateMsg(): Failed to read packet\n", proto);
+        return;
+    }
+    const UInt32 len = cursor.getRemaining();
     
     // Check that the packet length is long enough
     if (len < sizeof(REACPacketHeader)+sizeof(REACConstants::ENDING)) {
         IOLog("REACConnection[%p]::filterCommandGateMsg(): Got packet of too short length\n", proto);
         return;
     }
+    
+    // A packet of this size nearly always is in one piece in the first mbuf, and is then read where
+    // it is. Otherwise the parts are copied out. Pulling the packet up into one mbuf would copy it
+    // all, which is no better.
+    if (mbuf_len(*data) >= len) {
+        packetData = (UInt8 *)mbuf_data(*data);
+        proto->receiveStatistics.contiguousPackets++;
+    }
+    else {
+        proto->receiveStatistics.segmentedPackets++;
+    }
         
     // Check packet ending
     UInt8 packetEnding[sizeof(REACConstants::ENDING)];
-    if (0 != mbuf_copydata(*data, len-sizeof(REACConstants::ENDING), sizeof(REACConstants::ENDING), &packetEnding)) {
+    if (NULL != packetData) {
+        memcpy(packetEnding, packetData+len-sizeof(REACConstants::ENDING), sizeof(packetEnding));
+    }
+    else if (kIOReturnSuccess != cursor.copyEndToBuffer(sizeof(REACConstants::ENDING), &packetEnding)) {
         IOLog("REACConnection[%p]::filterCommandGateMsg(): Failed to fetch REAC packet ending\n", proto);
         return;
     }
@@ -552,7 +859,11 @@ void REACConnection::filterCommandGateMsg(OSObject *target, void *data_mbuf, voi
     }
     
     // Fetch packet header
-    if (0 != mbuf_copydata(*data, 0, sizeof(REACPacketHeader), &packetHeader)) {
+    if (NULL != packetData) {
+        packetHeader = (REACPacketHeader *)packetData;
+        cursor.skip(sizeof(REACPacketHeader));
+    }
+    else if (kIOReturnSuccess != cursor.copyToBuffer(sizeof(REACPacketHeader), packetHeader)) {
         IOLog("REACConnection[%p]::filterCommandGateMsg(): Failed to fetch REAC packet header\n", proto);
         return;
     }
@@ -560,15 +871,15 @@ void REACConnection::filterCommandGateMsg(OSObject *target, void *data_mbuf, voi
     // Check packet counter
     // TODO This doesn't work when more than one unit (for instance two splits) is connected
     if (proto->isConnected() && /* This prunes a lost packet message when connecting */
-        proto->lastCounter+1 != packetHeader.getCounter()) {
-        if (!(65535 == proto->lastCounter && 0 == packetHeader.getCounter())) {
+        proto->lastCounter+1 != packetHeader->getCounter()) {
+        if (!(65535 == proto->lastCounter && 0 == packetHeader->getCounter())) {
             IOLog("REACConnection[%p]::filterCommandGateMsg(): Lost packet [%d %d]\n",
-                  proto, proto->lastCounter, packetHeader.getCounter());
+                  proto, proto->lastCounter, packetHeader->getCounter());
         }
     }
     
     // Process packet header
-    proto->dataStream->gotPacket(&packetHeader, ethernetHeader);
+    proto->dataStream->gotPacket(packetHeader, ethernetHeader);
     
     // Check packet length
     if (sizeof(REACPacketHeader)+samplesSize+sizeof(UInt16) == len) {
@@ -590,14 +901,67 @@ void REACConnection::filterCommandGateMsg(OSObject *target, void *data_mbuf, voi
                 proto->samplesCallback(proto, &proto->cookieA, &proto->cookieB, &inBuffer, &inBufferSize);
                 
                 if (NULL != inBuffer) {
-                    const UInt32 bytesPerSample = REAC_RESOLUTION * proto->deviceInfo->in_channels;
+                    const UInt32 bytesPerSample = sampleLayoutResolution(proto->receiveSampleLayout) * proto->getReceiveChannels();
                     const UInt32 bytesPerPacket = bytesPerSample * REAC_SAMPLES_PER_PACKET;
                     
+                    IOReturn copyResult = kIOReturnError;
+                    
                     if (inBufferSize != bytesPerPacket) {
                         IOLog("REACConnection::filterCommandGateMsg(): Got incorrectly sized buffer (not the same as a packet).\n");
                     }
+                    else if (proto->isInputRouted()) {
+                        if (REAC_LAYOUT_WIRE == proto->receiveSampleLayout) {
+                            IOLog("REACConnection[%p]::filterCommandGateMsg(): Routed samples can't be in wire order\n", proto);
+                        }
+                        else if (narrow) {
+                            // The routing is of the channels of the device, which the packet only
+                            // has the first of
+                            const REACSampleLayout layout = proto->receiveSampleLayout;
+                            const UInt32 resolution = sampleLayoutResolution(layout);
+                            const UInt32 channels = proto->deviceInfo->in_channels;
+                            copyResult = copyNarrowAudioToBuffer(&cursor, layout, packetChannels, channels, proto->narrowSamples);
+                            for (UInt32 frame = 0; kIOReturnSuccess == copyResult && frame < REAC_SAMPLES_PER_PACKET; frame++) {
+                                for (UInt32 i = 0; i < proto->numRoutedInputs; i++) {
+                                    memcpy(inBuffer+(frame*proto->numRoutedInputs+i)*resolution,
+                                           proto->narrowSamples+(frame*channels+proto->inputRouting[i])*resolution,
+                                           resolution);
+                                }
+                            }
+                        }
+                        else {
+                            copyResult = cursor.copyRoutedAudioToBuffer(proto->deviceInfo->in_channels,
+                                                                        proto->inputRouting, proto->numRoutedInputs,
+                                                                        REAC_LAYOUT_NATIVE_32 == proto->receiveSampleLayout,
+                                                                        inBufferSize, inBuffer);
+                        }
+                    }
+                    else if (narrow) {
+                        copyResult = copyNarrowAudioToBuffer(&cursor, proto->receiveSampleLayout, packetChannels,
+                                                             proto->deviceInfo->in_channels, inBuffer);
+                    }
+                    else if (REAC_LAYOUT_WIRE == proto->receiveSampleLayout && proto->receiveInPlace && NULL != packetData) {
+                        // The samples are used as they are in the packet
+                        inBuffer = packetData+sizeof(REACPacketHeader);
+                        copyResult = kIOReturnSuccess;
+                        proto->receiveStatistics.inPlacePackets++;
+                    }
+                    else if (REAC_LAYOUT_WIRE == proto->receiveSampleLayout) {
+                        if (kIOReturnSuccess != cursor.copyToBuffer(inBufferSize, inBuffer)) {
+                            IOLog("REACConnection[%p]::filterCommandGateMsg(): Failed to copy sample data\n", proto);
+                        }
+                        else {
+                            copyResult = kIOReturnSuccess;
+                        }
+                    }
+                    else if (REAC_LAYOUT_NATIVE_32 == proto->receiveSampleLayout) {
+                        copyResult = cursor.copyAudio32ToBuffer(inBufferSize, inBuffer);
+                    }
                     else {
-                        MbufUtils::copyAudioFromMbufToBuffer(*data, sizeof(REACPacketHeader), inBufferSize, inBuffer);
+                        copyResult = cursor.copyAudioToBuffer(inBufferSize, inBuffer);
+                    }
+                    
+                    if (kIOReturnSuccess == copyResult && NULL != proto->samplesCopiedCallback) {
+                        proto->samplesCopiedCallback(proto, &proto->cookieA, &proto->cookieB, inBuffer, inBufferSize);
                     }
                 }
             }
@@ -606,9 +970,10 @@ void REACConnection::filterCommandGateMsg(OSObject *target, void *data_mbuf, voi
     
     if (REAC_SLAVE == proto->mode) {
         proto->getAndSendSamples();
+        proto->fillPacketPool();
     }
     
-    proto->lastCounter = packetHeader.getCounter();
+    proto->lastCounter = packetHeader->getCounter();
 }
 
 
@@ -36,9 +36,42 @@
 #include "REACDataStream.h"
 #include "REACConstants.h"
 #include "EthernetHeader.h"
+#include "REACPacketBuilder.h"
+#include "REACClock.h"
 
 #define REACConnection              com_pereckerdal_driver_REACConnection
 
+#define REAC_MAX_PACKET_POOL_SIZE   64  // 8 ms of packets
+#define REAC_DEFAULT_PACKET_POOL_SIZE 16
+#define REAC_SEND_LATENCY_BUCKETS   8
+#define REAC_MAX_PACKETS_PER_WAKE   8   // 1 ms of packets
+#define REAC_MAX_LATE_WAKES         10  // the timer skips the packets it is later than this many wakes
+
+// Statistics of the packets that are sent in REAC_MASTER and REAC_SLAVE mode. The latency is the time
+// it takes to get a packet, fill it in and hand it to ifnet_output_raw; for the packets of a batch
+// (REAC_MASTER), it is counted from the start of the first packet of the batch. Bucket i of the
+// latency histogram counts the packets that took less than 2^i us (the last one counts the rest).
+struct REACSendStatistics {
+    UInt64              packets;                  // the packets that were sent
+    UInt64              allocationFailures;       // the packets that were dropped because no mbuf could be had
+    UInt64              poolMisses;               // the packets that were allocated on the spot, with the pool on
+    UInt64              latePackets;              // the packets that were sent a whole wake or more late (REAC_MASTER)
+    UInt64              skippedPackets;           // the packets that were never sent, because the timer was too late to catch up
+    UInt64              burstPackets;             // the packets that were handed to the interface in a chain with others
+    // The latencies since the statistics were last read
+    UInt32              minLatencyNS;
+    UInt32              maxLatencyNS;
+    UInt32              latencyHistogram[REAC_SEND_LATENCY_BUCKETS];
+};
+
+// How the received packets were read. Contiguous packets (the whole packet in the first mbuf) are
+// parsed where they are, and the others through an MbufCursor.
+struct REACReceiveStatistics {
+    UInt64              contiguousPackets;
+    UInt64              segmentedPackets;
+    UInt64              inPlacePackets;           // the packets whose samples were used without a copy
+};
+
 class REACConnection;
 
 // Device is NULL on disconnect
@@ -48,6 +81,9 @@ typedef void(*reac_samples_callback_t)(REACConnection *proto, void **cookieA, vo
 // Is only called when in REAC_MASTER or REAC_SLAVE mode and the connection callback has
 // indicated that there is a connection.
 typedef void(*reac_get_samples_callback_t)(REACConnection *proto, void **cookieA, void **cookieB, UInt8 **data, UInt32 *bufferSize);
+// Is called after the samples of a packet have been copied into the buffer that the samples callback
+// returned. When receiving in place, data may instead point at the samples in the packet itself.
+typedef void(*reac_samples_copied_callback_t)(REACConnection *proto, void **cookieA, void **cookieB, UInt8 *data, UInt32 bufferSize);
 
 
 // This class is not thread safe; the only functions that can be called
@@ -64,10 +100,23 @@ public:
         REAC_MASTER, REAC_SLAVE, REAC_SPLIT
     };
     
+    // How the sample buffers that are passed through the samples callbacks are laid out
+    enum REACSampleLayout {
+        REAC_LAYOUT_NATIVE, // Packed 24 bit native endian ints; swizzled to/from wire order when copied
+        REAC_LAYOUT_WIRE,   // Packed 24 bit ints already in wire order; copied as is
+        REAC_LAYOUT_NATIVE_32 // 24 bit native endian ints in the high bytes of 32 bit ints; packed when copied
+    };
+    
+    // The number of bytes that one sample takes in a sample buffer of the given layout
+    static UInt32 sampleLayoutResolution(REACSampleLayout layout) {
+        return REAC_LAYOUT_NATIVE_32 == layout ? sizeof(UInt32) : REAC_RESOLUTION;
+    }
+    
     virtual bool initWithInterface(IOWorkLoop *workLoop, ifnet_t interface, REACMode mode,
                                    reac_connection_callback_t connectionCallback,
                                    reac_samples_callback_t samplesCallback,
                                    reac_get_samples_callback_t getSamplesCallback,
+                                   reac_samples_copied_callback_t samplesCopiedCallback,
                                    void *cookieA,
                                    void *cookieB,
                                    UInt8 inChannels = 0, // Only used in REAC_MASTER mode
@@ -76,6 +125,7 @@ public:
                                          reac_connection_callback_t connectionCallback,
                                          reac_samples_callback_t samplesCallback,
                                          reac_get_samples_callback_t getSamplesCallback,
+                                         reac_samples_copied_callback_t samplesCopiedCallback,
                                          void *cookieA,
                                          void *cookieB,
                                          UInt8 inChannels = 0, // Only used in REAC_MASTER mode
@@ -89,6 +139,14 @@ public:
     void stop();
     
     const REACDeviceInfo *getDeviceInfo() const;
+    // The number of channels in each sample frame of the packets that are sent and received. In
+    // REAC_MASTER mode, the device info has room for the channels of a slave cascaded behind the
+    // device; without one, the packets carry only the first channels of the audio engine.
+    UInt32 getSentPacketChannels() const;
+    UInt32 getReceivedPacketChannels() const;
+    // The channels of the master, from its announcement. Until the connection is made, they size the
+    // device info, and with it the audio engine.
+    void gotMasterAnnouncement(UInt32 masterInChannels, UInt32 masterOutChannels);
     bool isStarted() const { return started; }
     bool isConnected() const { return connected; }
     // If you want to continue using the ifnet_t object, make sure to call
@@ -106,6 +164,37 @@ public:
     }
     UInt8 getInChannels() const { return inChannels; }
     UInt8 getOutChannels() const { return outChannels; }
+    REACSampleLayout getSendSampleLayout() const { return sendSampleLayout; }
+    void setSendSampleLayout(REACSampleLayout layout) { sendSampleLayout = layout; }
+    REACSampleLayout getReceiveSampleLayout() const { return receiveSampleLayout; }
+    void setReceiveSampleLayout(REACSampleLayout layout) { receiveSampleLayout = layout; }
+    // With an input routing table, the buffers of the samples callback hold only the wire channels in
+    // routing (0 based), in that order; the other channels are not copied. numRouted 0 passes all the
+    // channels through as they are. The routed samples are always copied in one of the native layouts.
+    IOReturn setInputRouting(const UInt8 *routing, UInt32 numRouted);
+    bool isInputRouted() const { return 0 != numRoutedInputs; }
+    // The number of channels in the buffers of the samples callback
+    UInt32 getReceiveChannels() const { return isInputRouted() ? numRoutedInputs : deviceInfo->in_channels; }
+    // The number of packets to keep ready to be sent, so that allocating and laying out a packet
+    // happens after the previous one is sent instead of in the way of the next one. 0 turns the pool
+    // off, which allocates every packet as it is sent.
+    IOReturn setPacketPoolSize(UInt32 size);
+    // In REAC_MASTER mode, the timer fires once per this many packets and sends them all at once,
+    // as one chain of packets. Packets that are overdue when the timer fires late go out in the
+    // same chain.
+    IOReturn setPacketsPerWake(UInt32 packets);
+    // Copies the statistics, and starts over on the latencies
+    void getSendStatistics(REACSendStatistics *statistics);
+    // In REAC_MASTER mode, the time of the packet that is being sent (from within the get samples
+    // callback), from a clock that follows the timer without the jitter of its wakes
+    UInt64 getPacketTimeNS() const { return clock.getTimeNS(wakePacket, packetsPerWake); }
+    void getClockStatistics(REACClockStatistics *statistics) { clock.getStatistics(statistics); }
+    // With REAC_LAYOUT_WIRE, the samples of a packet that is contiguous in its first mbuf can be
+    // used where they are. They are then not copied into the buffer of the samples callback; the
+    // samples copied callback gets a pointer to them in the packet instead, which is only valid
+    // during the call.
+    void setReceiveInPlace(bool inPlace) { receiveInPlace = inPlace; }
+    void getReceiveStatistics(REACReceiveStatistics *statistics) const { *statistics = receiveStatistics; }
 
 protected:
     // IOKit handles
@@ -117,6 +206,7 @@ protected:
     
     // Network handles
     UInt8               interfaceAddr[ETHER_ADDR_LEN];
+    REACPacketBuilder   packetBuilder;           // lays out the packets that are sent from interfaceAddr
     ifnet_t             interface;
     interface_filter_t  filterRef;
     
@@ -124,6 +214,7 @@ protected:
     reac_connection_callback_t  connectionCallback;
     reac_samples_callback_t     samplesCallback;
     reac_get_samples_callback_t getSamplesCallback;
+    reac_samples_copied_callback_t samplesCopiedCallback;
     void *cookieA;
     void *cookieB;
     
@@ -142,12 +233,63 @@ protected:
     REACDataStream     *dataStream;
     REACDeviceInfo     *deviceInfo;
     UInt16              lastCounter; // Tracks input REAC counter
+    REACSampleLayout    sendSampleLayout;
+    REACSampleLayout    receiveSampleLayout;
+    UInt8               inputRouting[REAC_MAX_CHANNEL_COUNT]; // The wire channel of each received channel
+    UInt32              numRoutedInputs;                      // 0 when the input is not routed
+    
+    // Packets with everything but the destination address, the REAC header and the samples in
+    // place; the samples are zeros. They all have packetPoolPayloadSize bytes of payload.
+    mbuf_t              packetPool[REAC_MAX_PACKET_POOL_SIZE];
+    UInt32              packetPoolCount;
+    UInt32              packetPoolSize;
+    UInt32              packetPoolPayloadSize;
+    REACSendStatistics  sendStatistics;
+    UInt32              packetsPerWake;
+    mbuf_t              batchHead;                // the chain of packets that sendSamples has made ready, when batching
+    mbuf_t              batchTail;
+    UInt32              batchCount;
+    UInt64              batchStartNS;             // when the first packet of the batch was started
+    REACClock           clock;                    // fed with the wakes of the timer in REAC_MASTER mode
+    UInt32              clockPacketsPerWake;      // the packetsPerWake of clock; 0 before the first wake
+    UInt32              wakePacket;               // the packet of the wake that is being sent
+    // The received samples of all the channels of the device, when they are routed out of packets
+    // with fewer channels than that
+    UInt8               narrowSamples[REAC_SAMPLES_PER_PACKET*sizeof(SInt32)*REAC_MAX_CHANNEL_COUNT];
+    bool                receiveInPlace;
+    REACReceiveStatistics receiveStatistics;
     
     static void timerFired(OSObject *target, IOTimerEventSource *sender);
+    // Feeds clock with the time of a wake of the timer
+    void updateClock(UInt64 nowNS);
+    // Takes the packets of a wake that is skipped, due at dueNS, from the get samples callback
+    // without sending them, so that the clock and the position of the audio engine go on as if
+    // they had been sent
+    void skipWake(UInt64 dueNS);
+    
+    // The number of channels of a cascade of two units with channels channels each, as far as there
+    // is room for them in the packets
+    static UInt32 cascadeChannels(UInt32 channels);
+    // Copies the sample frames of a packet with fewer channels than the frames of buffer into the
+    // first channels of each of them, and zeros the rest
+    static IOReturn copyNarrowAudioToBuffer(MbufCursor *cursor, REACSampleLayout layout,
+                                            UInt32 packetChannels, UInt32 bufferChannels, UInt8 *buffer);
     
-    IOReturn getAndSendSamples();
+    // The payload size of the packets that sendSamples sends
+    UInt32 getSamplePayloadSize() const;
+    // Allocates a packet and lays it out with packetBuilder, with zeros for the payload (and for
+    // dhost and packetHeader when they are NULL, as in the pool). Returns NULL on failure.
+    mbuf_t allocatePacket(UInt32 payloadSize, const UInt8 *dhost = NULL, const REACPacketHeader *packetHeader = NULL);
+    // Tops the pool up, after a packet has been sent
+    void fillPacketPool();
+    void drainPacketPool();
+    // Counts packets that were started at startNS and have been handed to ifnet_output_raw now
+    void addSendLatency(UInt64 startNS, UInt32 packets = 1);
+    IOReturn getAndSendSamples(bool batch = false);
     // When sampleBuffer is NULL, the sample data will be zeros (and bufSize will be disregarded).
-    IOReturn sendSamples(UInt32 bufSize, UInt8 *sampleBuffer);
+    // With batch, the packet is added to the batch chain instead of sent; sendBatch sends it.
+    IOReturn sendSamples(UInt32 bufSize, UInt8 *sampleBuffer, bool batch = false);
+    IOReturn sendBatch();
     IOReturn sendSplitAnnouncementPacket();
     
     static void filterCommandGateMsg(OSObject *target, void *data_mbuf, void *eth_header_ptr, void*, void*);
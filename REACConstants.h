@@ -34,7 +34,7 @@
 #define REAC_RESOLUTION 3 // 3 bytes per sample per channel
 #define REAC_SAMPLES_PER_PACKET 12
 
-#define REAC_SAMPLE_RATE REAC_PACKETS_PER_SECOND * REAC_SAMPLES_PER_PACKET
+#define REAC_SAMPLE_RATE (REAC_PACKETS_PER_SECOND * REAC_SAMPLES_PER_PACKET)
 
 #define REACConstants          com_pereckerdal_driver_REACConstants
 
@@ -113,6 +113,13 @@ bool REACDataStream::gotPacket(const REACPacketHeader *packet, const EthernetHea
         return true;
     }
     
+    if (isPacketType(packet, REAC_STREAM_MASTER_ANNOUNCE)) {
+        const MasterAnnouncePacket *map = (const MasterAnnouncePacket *)packet->data;
+        if (isMasterAnnounceKind(map, MASTER_ANNOUNCE_CHANNELS)) {
+            connection->gotMasterAnnouncement(map->inChannels, map->outChannels);
+        }
+    }
+    
     /*IOLog("Got packet: "); // TODO Debug
      for (UInt32 i=0; i<sizeof(REACPacketHeader); i++) {
      IOLog("%02x", ((UInt8*)packet)[i]);
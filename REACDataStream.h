@@ -34,8 +34,8 @@
 
 #include "REACConstants.h"
 #include "EthernetHeader.h"
+#include "REACPacketHeader.h"
 
-#define REACPacketHeader        com_pereckerdal_driver_REACPacketHeader
 #define REACDataStream          com_pereckerdal_driver_REACDataStream
 #define REACDeviceInfo          com_pereckerdal_driver_REACDeviceInfo
 
@@ -47,23 +47,6 @@ struct REACDeviceInfo {
     UInt32 out_channels;
 };
 
-/* REAC packet header */
-struct REACPacketHeader {
-    UInt8 counter[2];
-    UInt8 type[2];
-    UInt8 data[32];
-    
-    UInt16 getCounter() {
-        UInt16 ret = counter[0];
-        ret += ((UInt16) counter[1]) << 8;
-        return ret;
-    }
-    void setCounter(UInt16 c) {
-        counter[0] = c;
-        counter[1] = c >> 8;
-    }
-};
-
 // Handles the data stream part of a REAC stream (both input and output).
 // Each REAC connection is supposed to have one of these objects.
 //
@@ -85,6 +68,17 @@ class REACDataStream : public OSObject {
         UInt8 unknown2[4];
     };
     
+    // What a master announcement is for, from unknown1[6]. Only the first
+    // kind carries the channel counts; the others reuse those bytes.
+    enum REACMasterAnnounceKind {
+        MASTER_ANNOUNCE_CHANNELS = 0x0d,
+        MASTER_ANNOUNCE_SPLIT_IDENTIFIER = 0x0a
+    };
+    
+    static bool isMasterAnnounceKind(const MasterAnnouncePacket *map, REACMasterAnnounceKind kind) {
+        return kind == map->unknown1[6];
+    }
+    
     enum REACStreamType {
         REAC_STREAM_FILLER = 0,
         REAC_STREAM_CONTROL = 1,
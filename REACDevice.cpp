@@ -33,12 +33,16 @@
 #include <net/kpi_interface.h>
 
 #include "REACAudioEngine.h"
+#include "PCMBlitterLib.h"
 
 #define super IOAudioDevice
 
 OSDefineMetaClassAndStructors(REACDevice, super)
 
 bool REACDevice::init(OSDictionary *properties) {
+    // Select the sample conversion routines for this CPU
+    PCMBlitterLibInit();
+    
     protocols = OSArray::withCapacity(5);
     if (NULL == protocols) {
         return false;
@@ -122,6 +126,7 @@ bool REACDevice::createProtocolListeners() {
                                                  &REACDevice::connectionCallback,
                                                  &REACDevice::samplesCallback,
                                                  &REACDevice::getSamplesCallback,
+                                                 &REACDevice::samplesCopiedCallback,
                                                  this, // Cookie A (the REACAudioDevice)
                                                  NULL, // Cookie B (the REACAudioEngine)
                                                  16, // inChannels (in REAC_MASTER mode)
@@ -201,6 +206,13 @@ void REACDevice::getSamplesCallback(REACConnection *proto, void **cookieA, void*
     }
 }
 
+void REACDevice::samplesCopiedCallback(REACConnection *proto, void **cookieA, void** cookieB, UInt8 *data, UInt32 bufferSize) {
+    REACAudioEngine *engine = (REACAudioEngine *)*cookieB;
+    if (NULL != engine) {
+        engine->samplesCopied(data, bufferSize);
+    }
+}
+
 REACAudioEngine* REACDevice::createAudioEngine(REACConnection *proto) {
     OSDictionary *originalAudioEngineParams = OSDynamicCast(OSDictionary, getProperty(AUDIO_ENGINE_PARAMS_KEY));
     OSDictionary *audioEngineParams = NULL;
@@ -39,7 +39,22 @@
 #define BUFFER_OFFSET_FACTOR_KEY        "BufferOffsetFactor"
 #define IN_FORMAT_KEY                   "InFormat"
 #define OUT_FORMAT_KEY                  "OutFormat"
+#define OUT_DITHER_KEY                  "OutDither"
+#define INT24_IN_32_KEY                 "Int24In32"
+#define FLOAT_BUFFERS_KEY               "FloatBuffers"
+#define METERS_KEY                      "Meters"
+#define INPUT_METERS_KEY                "InputMeters"
+#define OUTPUT_METERS_KEY               "OutputMeters"
 #define SAMPLE_RATES_KEY				"SampleRates"
+#define STREAM_CHANNELS_KEY             "StreamChannels"
+#define INPUT_ROUTING_KEY               "InputRouting"
+#define PACKET_POOL_KEY                 "PacketPool"
+#define PACKETS_PER_WAKE_KEY            "PacketsPerWake"
+#define UNDERRUN_FALLBACK_KEY           "UnderrunFallback"
+#define UNDERRUN_STATISTICS_KEY         "UnderrunStatistics"
+#define SEND_STATISTICS_KEY             "SendStatistics"
+#define RECEIVE_STATISTICS_KEY          "ReceiveStatistics"
+#define CLOCK_STATISTICS_KEY            "ClockStatistics"
 #define SEPARATE_STREAM_BUFFERS_KEY     "SeparateStreamBuffers"
 #define SEPARATE_INPUT_BUFFERS_KEY      "SeparateInputBuffers"
 
@@ -67,6 +82,7 @@ class REACDevice : public IOAudioDevice
     static void connectionCallback(REACConnection *proto, void **cookieA, void** cookieB, REACDeviceInfo *device);
     static void samplesCallback(REACConnection *proto, void **cookieA, void** cookieB, UInt8 **data, UInt32 *bufferSize);
     static void getSamplesCallback(REACConnection *proto, void **cookieA, void** cookieB, UInt8 **data, UInt32 *bufferSize);
+    static void samplesCopiedCallback(REACConnection *proto, void **cookieA, void** cookieB, UInt8 *data, UInt32 bufferSize);
     virtual REACAudioEngine* createAudioEngine(REACConnection *proto);
     virtual IOReturn performPowerStateChange(IOAudioDevicePowerState oldPowerState, 
                                              IOAudioDevicePowerState newPowerState,
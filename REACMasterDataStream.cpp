@@ -153,14 +153,9 @@ IOReturn REACMasterDataStream::processPacket(REACPacketHeader *packet, UInt32 dh
         MasterAnnouncePacket *ap = (MasterAnnouncePacket *)packet->data;
         memcpy(ap->unknown1, masterAnnounce, sizeof(ap->unknown1));
         connection->getInterfaceAddr(sizeof(ap->address), ap->address);
-        ap->inChannels = connection->getInChannels();
-        ap->outChannels = connection->getOutChannels();
-        
-        if (REACMasterDataStream::isConnectedToSlave()) {
-            // TODO This implementation is not complete
-            ap->inChannels *= 2; // TODO Cap this at 40 channels?
-            ap->outChannels *= 2;
-        }
+        // With a slave, the packets carry its channels too
+        ap->inChannels = connection->getSentPacketChannels();
+        ap->outChannels = connection->getReceivedPacketChannels();
         
         ap->unknown2[0] = 0x01;
         // This byte has something to do with splits
@@ -0,0 +1,161 @@
+/*
+ *  REACPacketBuilder.cpp
+ *  REAC
+ *
+ *  This file is part of the OS X REAC driver.
+ *  
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *  
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *  
+ */
+
+#include "REACPacketBuilder.h"
+
+#include <IOKit/IOLib.h>
+#include "REACConstants.h"
+
+// The bytes of the payload that samplesSize bytes of samples take
+static UInt32 payloadBytes(REACPacketBuilder::PayloadSource source, UInt32 samplesSize) {
+    return REACPacketBuilder::PAYLOAD_NATIVE_32 == source ? samplesSize/4*REAC_RESOLUTION : samplesSize;
+}
+
+static IOReturn copySamples(MbufCursor *cursor, REACPacketBuilder::PayloadSource source,
+                            const UInt8 *samples, UInt32 samplesSize) {
+    switch (source) {
+        case REACPacketBuilder::PAYLOAD_WIRE:
+            return cursor->copyFromBuffer(samplesSize, samples);
+        case REACPacketBuilder::PAYLOAD_NATIVE:
+            return cursor->copyAudioFromBuffer(samplesSize, samples);
+        case REACPacketBuilder::PAYLOAD_NATIVE_32:
+            return cursor->copyAudio32FromBuffer(samplesSize, samples);
+        default:
+            return cursor->zero(samplesSize);
+    }
+}
+
+// The first samplesSize/REAC_SAMPLES_PER_PACKET bytes of each of the sample frames of samples, which
+// are samplesFrameSize bytes apart
+static IOReturn copyFrames(MbufCursor *cursor, REACPacketBuilder::PayloadSource source,
+                           const UInt8 *samples, UInt32 samplesSize, UInt32 samplesFrameSize) {
+    const UInt32 frameSize = samplesSize/REAC_SAMPLES_PER_PACKET;
+    IOReturn result;
+    
+    for (UInt32 frame = 0; frame < REAC_SAMPLES_PER_PACKET; frame++) {
+        if (kIOReturnSuccess != (result = copySamples(cursor, source, samples+frame*samplesFrameSize, frameSize))) {
+            return result;
+        }
+    }
+    return kIOReturnSuccess;
+}
+
+void REACPacketBuilder::init(const UInt8 *shost) {
+    bzero(header.dhost, sizeof(header.dhost));
+    memcpy(header.shost, shost, sizeof(header.shost));
+    memcpy(header.type, REACConstants::PROTOCOL, sizeof(REACConstants::PROTOCOL));
+}
+
+UInt32 REACPacketBuilder::getPacketLength(UInt32 payloadSize) {
+    return sizeof(EthernetHeader)+sizeof(REACPacketHeader)+payloadSize+sizeof(REACConstants::ENDING);
+}
+
+IOReturn REACPacketBuilder::build(mbuf_t mbuf, const UInt8 *dhost, const REACPacketHeader *packetHeader,
+                                  UInt32 payloadSize, PayloadSource source, const UInt8 *samples,
+                                  UInt32 samplesSize) const {
+    const UInt32 samplesBytes = (NULL == samples ? 0 : payloadBytes(source, samplesSize));
+    MbufCursor cursor;
+    IOReturn result;
+    
+    if (kIOReturnSuccess != (result = cursor.init(mbuf))) {
+        return result;
+    }
+    if (getPacketLength(payloadSize) != cursor.getRemaining() || samplesBytes > payloadSize) {
+        return kIOReturnBadArgument;
+    }
+    
+    if (kIOReturnSuccess != (result = writeHead(&cursor, true, dhost, packetHeader, source, samples, samplesSize, 0)) ||
+        kIOReturnSuccess != (result = cursor.zero(payloadSize-samplesBytes)) ||
+        kIOReturnSuccess != (result = cursor.copyFromBuffer(sizeof(REACConstants::ENDING), REACConstants::ENDING))) {
+        return result;
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn REACPacketBuilder::update(mbuf_t mbuf, const UInt8 *dhost, const REACPacketHeader *packetHeader,
+                                   PayloadSource source, const UInt8 *samples, UInt32 samplesSize,
+                                   UInt32 samplesFrameSize) const {
+    MbufCursor cursor;
+    IOReturn result;
+    
+    if (kIOReturnSuccess != (result = cursor.init(mbuf))) {
+        return result;
+    }
+    if (NULL != samples && 0 != samplesFrameSize) {
+        // The frames of the packet have to be whole sample pairs, and fit in those of samples
+        const UInt32 frameSize = samplesSize/REAC_SAMPLES_PER_PACKET;
+        if (0 != samplesSize % REAC_SAMPLES_PER_PACKET || frameSize > samplesFrameSize ||
+            0 != payloadBytes(source, frameSize) % (2*REAC_RESOLUTION)) {
+            return kIOReturnBadArgument;
+        }
+    }
+    if (getPacketLength(0)+(NULL == samples ? 0 : payloadBytes(source, samplesSize)) > cursor.getRemaining()) {
+        return kIOReturnBadArgument;
+    }
+    return writeHead(&cursor, false, dhost, packetHeader, source, samples, samplesSize, samplesFrameSize);
+}
+
+IOReturn REACPacketBuilder::writeHead(MbufCursor *cursor, bool whole, const UInt8 *dhost,
+                                      const REACPacketHeader *packetHeader, PayloadSource source,
+                                      const UInt8 *samples, UInt32 samplesSize, UInt32 samplesFrameSize) const {
+    IOReturn result;
+    
+    /// Ethernet header. The prepared one has zeros for the destination address
+    if (NULL != dhost) {
+        result = cursor->copyFromBuffer(sizeof(header.dhost), dhost);
+    }
+    else if (whole) {
+        result = cursor->copyFromBuffer(sizeof(header.dhost), header.dhost);
+    }
+    else {
+        result = cursor->skip(sizeof(header.dhost));
+    }
+    if (kIOReturnSuccess != result) {
+        return result;
+    }
+    result = (whole ?
+              cursor->copyFromBuffer(sizeof(EthernetHeader)-sizeof(header.dhost), header.shost) :
+              cursor->skip(sizeof(EthernetHeader)-sizeof(header.dhost)));
+    if (kIOReturnSuccess != result) {
+        return result;
+    }
+    
+    /// REAC header
+    if (NULL != packetHeader) {
+        result = cursor->copyFromBuffer(sizeof(REACPacketHeader), packetHeader);
+    }
+    else {
+        result = (whole ? cursor->zero(sizeof(REACPacketHeader)) : cursor->skip(sizeof(REACPacketHeader)));
+    }
+    if (kIOReturnSuccess != result) {
+        return result;
+    }
+    
+    /// Samples
+    if (NULL != samples && 0 != samplesFrameSize) {
+        return copyFrames(cursor, source, samples, samplesSize, samplesFrameSize);
+    }
+    if (NULL != samples) {
+        return copySamples(cursor, source, samples, samplesSize);
+    }
+    return kIOReturnSuccess;
+}
@@ -0,0 +1,84 @@
+/*
+ *  REACPacketBuilder.h
+ *  REAC
+ *
+ *  This file is part of the OS X REAC driver.
+ *  
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *  
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *  
+ */
+
+#ifndef _REACPACKETBUILDER_H
+#define _REACPACKETBUILDER_H
+
+#include <libkern/OSTypes.h>
+#include <IOKit/IOReturn.h>
+#include <sys/kpi_mbuf.h>
+
+#include "EthernetHeader.h"
+#include "REACPacketHeader.h"
+#include "MbufUtils.h"
+
+#define REACPacketBuilder           com_pereckerdal_driver_REACPacketBuilder
+
+// Writes REAC frames into mbuf chains: the Ethernet header, the REAC header, the payload and the
+// ending, in one pass with an MbufCursor. The Ethernet header is prepared once; only the destination
+// address changes from packet to packet. It neither allocates nor sends the packets, so it builds
+// them the same way in the host tests (see test/MbufUtilsTest.cpp).
+class REACPacketBuilder {
+public:
+    // Where the payload comes from
+    enum PayloadSource {
+        PAYLOAD_ZEROS,          // Zeros (filler, or a packet without samples)
+        PAYLOAD_WIRE,           // Samples in REAC wire order, copied as they are
+        PAYLOAD_NATIVE,         // Packed native 24 bit samples
+        PAYLOAD_NATIVE_32       // Native 24 bit samples in the high bytes of 32 bit ints (the low byte is dropped)
+    };
+    
+    // Prepares the Ethernet header, with shost as the source address
+    void init(const UInt8 *shost);
+    
+    // The length of a frame with payloadSize bytes of payload
+    static UInt32 getPacketLength(UInt32 payloadSize);
+    
+    // Writes a whole frame into mbuf, which has to be getPacketLength(payloadSize) bytes long. dhost
+    // and packetHeader may be NULL, which leaves zeros in their place. The payload starts with
+    // samplesSize bytes of samples, and the rest of it is zeros.
+    IOReturn build(mbuf_t mbuf, const UInt8 *dhost, const REACPacketHeader *packetHeader, UInt32 payloadSize,
+                   PayloadSource source = PAYLOAD_ZEROS, const UInt8 *samples = NULL, UInt32 samplesSize = 0) const;
+    // Fills in a frame that build wrote earlier with the same payload size and no samples (a packet
+    // from the pool, see REACConnection). Only the destination address, the REAC header and the
+    // samples are written; the rest is in place already.
+    //
+    // With samplesFrameSize, the sample frames of samples are that many bytes apart, and are wider
+    // than those of the packet (samplesSize/REAC_SAMPLES_PER_PACKET bytes each): only the first
+    // channels of each are sent, a frame at a time. The frames of the packet have to be whole sample
+    // pairs then.
+    IOReturn update(mbuf_t mbuf, const UInt8 *dhost, const REACPacketHeader *packetHeader,
+                    PayloadSource source, const UInt8 *samples, UInt32 samplesSize,
+                    UInt32 samplesFrameSize = 0) const;
+    
+private:
+    // Writes the Ethernet header, the REAC header and the samples. When whole is false, the parts
+    // that are NULL and the source address and type are skipped instead of written.
+    IOReturn writeHead(MbufCursor *cursor, bool whole, const UInt8 *dhost, const REACPacketHeader *packetHeader,
+                       PayloadSource source, const UInt8 *samples, UInt32 samplesSize,
+                       UInt32 samplesFrameSize) const;
+    
+    EthernetHeader header;      // with a zero destination address
+};
+
+
+#endif
@@ -0,0 +1,47 @@
+/*
+ *  REACPacketHeader.h
+ *  REAC
+ *
+ *  This file is part of the OS X REAC driver.
+ *  
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *  
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *  
+ */
+
+#ifndef _REACPACKETHEADER_H
+#define _REACPACKETHEADER_H
+
+#include <libkern/OSTypes.h>
+
+#define REACPacketHeader            com_pereckerdal_driver_REACPacketHeader
+
+/* REAC packet header */
+struct REACPacketHeader {
+    UInt8 counter[2];
+    UInt8 type[2];
+    UInt8 data[32];
+    
+    UInt16 getCounter() {
+        UInt16 ret = counter[0];
+        ret += ((UInt16) counter[1]) << 8;
+        return ret;
+    }
+    void setCounter(UInt16 c) {
+        counter[0] = c;
+        counter[1] = c >> 8;
+    }
+};
+
+#endif
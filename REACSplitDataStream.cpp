@@ -48,7 +48,7 @@ bool REACSplitDataStream::gotPacket(const REACPacketHeader *packet, const Ethern
     if (isPacketType(packet, REAC_STREAM_MASTER_ANNOUNCE)) {
         MasterAnnouncePacket *map = (MasterAnnouncePacket *)packet->data;
         if (HANDSHAKE_NOT_INITIATED == handshakeState) {
-            if (0x0d == map->unknown1[6]) {
+            if (isMasterAnnounceKind(map, MASTER_ANNOUNCE_CHANNELS)) {
                 memcpy(masterDevice.addr, map->address, sizeof(masterDevice.addr));
                 masterDevice.in_channels = map->inChannels;
                 masterDevice.out_channels = map->outChannels;
@@ -57,7 +57,7 @@ bool REACSplitDataStream::gotPacket(const REACPacketHeader *packet, const Ethern
             result = true;
         }
         else if (HANDSHAKE_SENT_FIRST_ANNOUNCE == handshakeState) {
-            if (0x0a == map->unknown1[6]) {
+            if (isMasterAnnounceKind(map, MASTER_ANNOUNCE_SPLIT_IDENTIFIER)) {
                 if (0 == connection->interfaceAddrCmp(sizeof(map->address), map->address)) {
                     splitIdentifier = map->outChannels;
                     handshakeState = HANDSHAKE_GOT_SECOND_MASTER_ANNOUNCE;
@@ -0,0 +1,617 @@
+/*
+ *  MbufUtilsTest.cpp
+ *  REAC
+ *
+ *  This file is part of the OS X REAC driver.
+ *
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// Correctness tests and benchmarks of MbufUtils, for user space builds against the mock kernel
+// headers in mock/ (see mbuftest.sh):
+//   g++ -O2 -Imock -I.. -o mbuftest ../MbufUtils.cpp ../PCMBlitterLib.cpp ../REACPacketBuilder.cpp
+//       ../REACConstants.cpp MbufUtilsTest.cpp && ./mbuftest [bench]
+//
+// Each function runs on mbuf chains of a REAC packet cut into segments in many ways: one segment,
+// segments of a fixed size from 1 byte up, random sizes, and empty segments in between. The
+// segments are apart from each other in memory, with guard bytes around them, so a copy that runs
+// off the end of a segment is caught. The result, gathered from the segments, has to match a plain
+// byte by byte version on a flat buffer. A whole packet is also built and parsed with one
+// MbufCursor, the way sendSamples and the receive path do it, and REACPacketBuilder builds the
+// frames of every channel count from every payload source. With "bench", these are timed per packet.
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "MbufUtils.h"
+#include "REACConstants.h"
+#include "REACPacketBuilder.h"
+
+static bool sQuiet = true;
+
+extern "C" void IOLog(const char *format, ...) {
+    if (!sQuiet) {
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+    }
+}
+
+// The sizes of the parts of a packet, as in REACConnection::sendSamples
+enum {
+    kEthernetHeaderSize = 14,
+    kPacketHeaderSize = 36,
+    kEndingSize = 2,
+    kMaxChannels = REAC_MAX_CHANNEL_COUNT,
+    kMaxPayloadSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*kMaxChannels,
+    kMaxPacketSize = kEthernetHeaderSize + kPacketHeaderSize + kMaxPayloadSize + kEndingSize
+};
+
+// ____________________________________________________________________________
+// Mock mbuf chains
+
+enum { kMaxSegments = 2*kMaxPacketSize, kSegmentGuard = 8 };
+static const UInt8 kGuardByte = 0x5a;
+
+struct Chain {
+    struct mbuf     segments[kMaxSegments];
+    UInt32          numSegments;
+    UInt32          length;
+    UInt8           arena[kMaxPacketSize + (kMaxSegments+1)*kSegmentGuard];
+};
+
+// Cuts length bytes into segments of the given lengths (the last one takes the rest), each with
+// guard bytes before and after it
+static void buildChain(Chain *chain, UInt32 length, const UInt32 *segmentLengths, UInt32 numLengths) {
+    UInt8 *p = chain->arena + kSegmentGuard;
+    UInt32 left = length;
+    UInt32 n = 0;
+
+    memset(chain->arena, kGuardByte, sizeof(chain->arena));
+    do {
+        UInt32 segmentLength = (n < numLengths && segmentLengths[n] < left ? segmentLengths[n] : left);
+        if (n+1 == kMaxSegments) {
+            segmentLength = left;
+        }
+        chain->segments[n].data = p;
+        chain->segments[n].len = chain->segments[n].maxlen = segmentLength;
+        chain->segments[n].next = NULL;
+        if (n > 0) {
+            chain->segments[n-1].next = &chain->segments[n];
+        }
+        p += segmentLength + kSegmentGuard;
+        left -= segmentLength;
+        n++;
+    } while (left > 0);
+    chain->numSegments = n;
+    chain->length = length;
+}
+
+static void chainToFlat(const Chain *chain, UInt8 *flat) {
+    for (UInt32 i = 0; i < chain->numSegments; i++) {
+        memcpy(flat, chain->segments[i].data, chain->segments[i].len);
+        flat += chain->segments[i].len;
+    }
+}
+
+static void flatToChain(const UInt8 *flat, Chain *chain) {
+    for (UInt32 i = 0; i < chain->numSegments; i++) {
+        memcpy(chain->segments[i].data, flat, chain->segments[i].len);
+        flat += chain->segments[i].len;
+    }
+}
+
+static bool guardsIntact(const Chain *chain) {
+    const UInt8 *end = (const UInt8 *)chain->segments[chain->numSegments-1].data + chain->segments[chain->numSegments-1].len;
+    const UInt8 *p = chain->arena;
+
+    for (UInt32 i = 0; i < chain->numSegments; i++) {
+        for (; p < (const UInt8 *)chain->segments[i].data; p++) {
+            if (kGuardByte != *p) return false;
+        }
+        p += chain->segments[i].len;
+    }
+    for (; p < end + kSegmentGuard; p++) {
+        if (kGuardByte != *p) return false;
+    }
+    return true;
+}
+
+// The ways a packet is cut up: the segment lengths of each layout, up to kEnd. kRepeat repeats the
+// previous length to the end, and kRandom fills up with random lengths from 1 to 64. The last segment
+// takes whatever is left.
+enum { kEnd = -100, kRepeat = -1, kRandom = -2 };
+
+static const int kLayouts[][8] = {
+    { kEnd },                           // one segment
+    { 1, kRepeat, kEnd },
+    { 2, kRepeat, kEnd },
+    { 3, kRepeat, kEnd },
+    { 5, kRepeat, kEnd },
+    { 6, kRepeat, kEnd },
+    { 7, kRepeat, kEnd },
+    { 64, kRepeat, kEnd },
+    { 97, kRepeat, kEnd },              // whole 48 byte blocks and a split word in each
+    { 200, kEnd },                      // a packet header mbuf and a cluster
+    { 13, 0, 0, 51, kEnd },             // empty segments in between
+    { 1, 0, 1, 0, kRepeat, kEnd },
+    { kRandom, kEnd },
+    { kRandom, kEnd },
+    { kRandom, kEnd },
+};
+
+static void buildLayout(Chain *chain, UInt32 length, UInt32 layout) {
+    static UInt32 lengths[kMaxSegments];
+    UInt32 n = 0, total = 0;
+
+    for (const int *l = kLayouts[layout]; kEnd != *l; l++) {
+        if (kRepeat == *l || kRandom == *l) {
+            while (total < length && n < kMaxSegments) {
+                lengths[n] = (kRepeat == *l ? l[-1] : 1 + rand() % 64);
+                total += lengths[n++];
+            }
+        }
+        else {
+            lengths[n] = *l;
+            total += lengths[n++];
+        }
+    }
+    buildChain(chain, length, lengths, n);
+}
+
+// ____________________________________________________________________________
+// Reference versions, on a flat packet
+
+static void refAudioToWire(const UInt8 *in, UInt8 *wire, UInt32 numPairs, bool int32) {
+    for (UInt32 i = 0; i < numPairs; i++, wire += 6) {
+        const UInt8 *a = in + i*2*(int32 ? 4 : 3) + (int32 ? 1 : 0);
+        const UInt8 *b = a + (int32 ? 4 : 3);
+        wire[0] = a[1]; wire[1] = a[0]; wire[2] = b[0];
+        wire[3] = a[2]; wire[4] = b[2]; wire[5] = b[1];
+    }
+}
+
+static void refWireToAudio(const UInt8 *wire, UInt8 *out, UInt32 channel, bool int32) {
+    const UInt8 *pair = wire + channel/2*6;
+    if (int32) {
+        *out++ = 0;
+    }
+    if (channel % 2) {
+        out[0] = pair[2]; out[1] = pair[5]; out[2] = pair[4];
+    }
+    else {
+        out[0] = pair[1]; out[1] = pair[0]; out[2] = pair[3];
+    }
+}
+
+// ____________________________________________________________________________
+// Tests
+
+static UInt8 sData[4*kMaxPayloadSize];
+
+static int sFailures = 0;
+
+static void check(bool ok, const char *what, UInt32 layout, UInt32 from, UInt32 size) {
+    if (!ok) {
+        if (sFailures < 20) {
+            printf("FAIL %s: layout %u, from %u, size %u\n", what, (unsigned)layout, (unsigned)from, (unsigned)size);
+        }
+        sFailures++;
+    }
+}
+
+static void testZeroAndCopy(Chain *chain, UInt32 layout) {
+    static const UInt32 kFroms[] = { 0, 1, 13, 14, 50, 51 };
+    static const UInt32 kSizes[] = { 0, 1, 2, 14, 36, 199, 200, 1440 };
+    UInt8 flat[kMaxPacketSize], ref[kMaxPacketSize];
+
+    for (UInt32 f = 0; f < sizeof(kFroms)/sizeof(kFroms[0]); f++) {
+        for (UInt32 s = 0; s < sizeof(kSizes)/sizeof(kSizes[0]); s++) {
+            UInt32 from = kFroms[f], size = kSizes[s];
+            bool fits = (from + size <= chain->length);
+            IOReturn result;
+
+            for (UInt32 i = 0; i < chain->length; i++) {
+                ref[i] = (UInt8)(i*7 + 1);
+            }
+            flatToChain(ref, chain);
+            result = MbufUtils::zeroMbuf(&chain->segments[0], from, size);
+            if (fits) {
+                memset(ref + from, 0, size);
+            }
+            chainToFlat(chain, flat);
+            check((fits ? kIOReturnSuccess == result : kIOReturnSuccess != result) &&
+                  0 == memcmp(flat, ref, chain->length) && guardsIntact(chain), "zeroMbuf", layout, from, size);
+
+            result = MbufUtils::copyFromBufferToMbuf(&chain->segments[0], from, size, sData);
+            if (fits) {
+                memcpy(ref + from, sData, size);
+            }
+            chainToFlat(chain, flat);
+            check((fits ? kIOReturnSuccess == result : kIOReturnSuccess != result) &&
+                  0 == memcmp(flat, ref, chain->length) && guardsIntact(chain), "copyFromBufferToMbuf", layout, from, size);
+        }
+    }
+}
+
+static void testAudio(Chain *chain, UInt32 layout, UInt32 numChannels) {
+    const UInt32 from = kEthernetHeaderSize + kPacketHeaderSize;
+    const UInt32 wireSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*numChannels;
+    UInt8 flat[kMaxPacketSize], ref[kMaxPacketSize];
+    UInt8 out[4*kMaxPayloadSize + 8], refOut[4*kMaxPayloadSize + 8];
+    IOReturn result;
+
+    for (int int32 = 0; int32 < 2; int32++) {
+        const UInt32 bufferSize = wireSize/REAC_RESOLUTION*(int32 ? 4 : 3);
+
+        // Buffer to mbuf
+        memset(ref, 0xee, chain->length);
+        flatToChain(ref, chain);
+        result = (int32 ?
+                  MbufUtils::copyAudio32FromBufferToMbuf(&chain->segments[0], from, bufferSize, sData) :
+                  MbufUtils::copyAudioFromBufferToMbuf(&chain->segments[0], from, bufferSize, sData));
+        refAudioToWire(sData, ref + from, wireSize/6, int32);
+        chainToFlat(chain, flat);
+        check(kIOReturnSuccess == result && 0 == memcmp(flat, ref, chain->length) && guardsIntact(chain),
+              int32 ? "copyAudio32FromBufferToMbuf" : "copyAudioFromBufferToMbuf", layout, from, bufferSize);
+
+        // Mbuf to buffer
+        for (UInt32 i = 0; i < chain->length; i++) {
+            ref[i] = sData[i + 5];
+        }
+        flatToChain(ref, chain);
+        memset(out, 0xee, sizeof(out));
+        memset(refOut, 0xee, sizeof(refOut));
+        result = (int32 ?
+                  MbufUtils::copyAudio32FromMbufToBuffer(&chain->segments[0], from, bufferSize, out) :
+                  MbufUtils::copyAudioFromMbufToBuffer(&chain->segments[0], from, bufferSize, out));
+        for (UInt32 i = 0; i < wireSize/REAC_RESOLUTION; i++) {
+            refWireToAudio(ref + from + i/numChannels*numChannels*REAC_RESOLUTION, refOut + i*(int32 ? 4 : 3),
+                           i % numChannels, int32);
+        }
+        check(kIOReturnSuccess == result && 0 == memcmp(out, refOut, sizeof(out)),
+              int32 ? "copyAudio32FromMbufToBuffer" : "copyAudioFromMbufToBuffer", layout, from, bufferSize);
+
+        // Routed, to a random subset of the channels (with repeats)
+        UInt8 routing[kMaxChannels];
+        UInt32 numRouted = 1 + rand() % kMaxChannels;
+        UInt32 routedSize = REAC_SAMPLES_PER_PACKET*numRouted*(int32 ? 4 : 3);
+        for (UInt32 i = 0; i < numRouted; i++) {
+            routing[i] = rand() % numChannels;
+        }
+        memset(out, 0xee, sizeof(out));
+        memset(refOut, 0xee, sizeof(refOut));
+        result = MbufUtils::copyRoutedAudioFromMbufToBuffer(&chain->segments[0], from, numChannels, routing, numRouted,
+                                                            int32, routedSize, out);
+        for (UInt32 i = 0; i < REAC_SAMPLES_PER_PACKET*numRouted; i++) {
+            refWireToAudio(ref + from + i/numRouted*numChannels*REAC_RESOLUTION, refOut + i*(int32 ? 4 : 3),
+                           routing[i % numRouted], int32);
+        }
+        check(kIOReturnSuccess == result && 0 == memcmp(out, refOut, sizeof(out)) && guardsIntact(chain),
+              "copyRoutedAudioFromMbufToBuffer", layout, from, routedSize);
+    }
+}
+
+// A packet built with one cursor, part after part, and parsed again with another
+static void testCursor(Chain *chain, UInt32 layout, UInt32 numChannels) {
+    static const UInt8 ending[kEndingSize] = { 0xc2, 0xea };
+    const UInt32 from = kEthernetHeaderSize + kPacketHeaderSize;
+    const UInt32 wireSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*numChannels;
+    UInt8 flat[kMaxPacketSize], ref[kMaxPacketSize];
+    UInt8 out[kMaxPacketSize], refOut[kMaxPacketSize];
+    MbufCursor cursor;
+    bool ok = true;
+
+    memset(ref, 0xee, chain->length);
+    flatToChain(ref, chain);
+    ok = ok && kIOReturnSuccess == cursor.init(&chain->segments[0]);
+    ok = ok && kIOReturnSuccess == cursor.copyFromBuffer(kEthernetHeaderSize, sData);
+    ok = ok && kIOReturnSuccess == cursor.zero(kPacketHeaderSize);
+    ok = ok && kIOReturnSuccess == cursor.copyAudioFromBuffer(wireSize, sData + 100);
+    ok = ok && kIOReturnSuccess == cursor.copyFromBuffer(kEndingSize, ending);
+    ok = ok && 0 == cursor.getRemaining();
+    ok = ok && kIOReturnNoMemory == cursor.zero(1);
+    memcpy(ref, sData, kEthernetHeaderSize);
+    memset(ref + kEthernetHeaderSize, 0, kPacketHeaderSize);
+    refAudioToWire(sData + 100, ref + from, wireSize/6, false);
+    memcpy(ref + from + wireSize, ending, kEndingSize);
+    chainToFlat(chain, flat);
+    check(ok && 0 == memcmp(flat, ref, chain->length) && guardsIntact(chain), "MbufCursor build", layout, 0, chain->length);
+
+    ok = true;
+    memset(out, 0xee, sizeof(out));
+    memset(refOut, 0xee, sizeof(refOut));
+    ok = ok && kIOReturnSuccess == cursor.init(&chain->segments[0], kEthernetHeaderSize);
+    ok = ok && chain->length - kEthernetHeaderSize == cursor.getRemaining();
+    ok = ok && kIOReturnSuccess == cursor.copyEndToBuffer(kEndingSize, out);
+    ok = ok && kIOReturnSuccess == cursor.copyToBuffer(kPacketHeaderSize, out + kEndingSize);
+    ok = ok && kIOReturnSuccess == cursor.copyAudioToBuffer(wireSize, out + kEndingSize + kPacketHeaderSize);
+    ok = ok && kEndingSize == cursor.getRemaining();
+    ok = ok && kIOReturnSuccess == cursor.skip(kEndingSize);
+    ok = ok && kIOReturnNoMemory == cursor.skip(1);
+    memcpy(refOut, ending, kEndingSize);
+    memset(refOut + kEndingSize, 0, kPacketHeaderSize);
+    memcpy(refOut + kEndingSize + kPacketHeaderSize, sData + 100, wireSize);
+    check(ok && 0 == memcmp(out, refOut, sizeof(out)), "MbufCursor parse", layout, 0, chain->length);
+}
+
+// Frames from REACPacketBuilder, both built whole and updated from a pool packet, against a plain
+// version. payloadSize may be larger than the samples.
+static void testBuilder(Chain *chain, UInt32 layout, UInt32 numChannels, UInt32 payloadSize) {
+    static const UInt8 shost[] = { 0x00, 0x40, 0xab, 0xc4, 0xb7, 0x58 };
+    static const UInt8 type[] = { 0x88, 0x19 };
+    static const UInt8 ending[kEndingSize] = { 0xc2, 0xea };
+    const UInt32 wireSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*numChannels;
+    const UInt8 *dhost = sData + 1000;
+    const REACPacketHeader *packetHeader = (const REACPacketHeader *)(sData + 2000);
+    UInt8 flat[kMaxPacketSize], ref[kMaxPacketSize];
+    REACPacketBuilder builder;
+
+    builder.init(shost);
+    check(chain->length == REACPacketBuilder::getPacketLength(payloadSize), "getPacketLength", layout, 0, payloadSize);
+    for (int source = REACPacketBuilder::PAYLOAD_ZEROS; source <= REACPacketBuilder::PAYLOAD_NATIVE_32; source++) {
+        const bool int32 = REACPacketBuilder::PAYLOAD_NATIVE_32 == source;
+        const UInt8 *samples = (REACPacketBuilder::PAYLOAD_ZEROS == source ? NULL : sData + 100);
+        const UInt32 samplesSize = (int32 ? wireSize/3*4 : wireSize);
+
+        memcpy(ref, dhost, 6);
+        memcpy(ref + 6, shost, 6);
+        memcpy(ref + 12, type, 2);
+        memcpy(ref + kEthernetHeaderSize, packetHeader, kPacketHeaderSize);
+        memset(ref + kEthernetHeaderSize + kPacketHeaderSize, 0, payloadSize);
+        if (REACPacketBuilder::PAYLOAD_WIRE == source) {
+            memcpy(ref + kEthernetHeaderSize + kPacketHeaderSize, samples, wireSize);
+        }
+        else if (NULL != samples) {
+            refAudioToWire(samples, ref + kEthernetHeaderSize + kPacketHeaderSize, wireSize/6, int32);
+        }
+        memcpy(ref + kEthernetHeaderSize + kPacketHeaderSize + payloadSize, ending, kEndingSize);
+
+        memset(flat, 0xee, chain->length);
+        flatToChain(flat, chain);
+        IOReturn result = builder.build(&chain->segments[0], dhost, packetHeader, payloadSize,
+                                        (REACPacketBuilder::PayloadSource)source, samples, samplesSize);
+        chainToFlat(chain, flat);
+        check(kIOReturnSuccess == result && 0 == memcmp(flat, ref, chain->length) && guardsIntact(chain),
+              "REACPacketBuilder build", layout, source, payloadSize);
+
+        // A pool packet, with zeros in place of the destination and the REAC header
+        memset(flat, 0xee, chain->length);
+        flatToChain(flat, chain);
+        result = builder.build(&chain->segments[0], NULL, NULL, payloadSize);
+        chainToFlat(chain, flat);
+        bool ok = (kIOReturnSuccess == result && 0 == memcmp(flat + 6, ref + 6, 8) &&
+                   0 == memcmp(flat + chain->length - kEndingSize, ending, kEndingSize));
+        for (UInt32 i = 0; i < chain->length - kEndingSize; i++) {
+            ok = ok && (0 == flat[i] || (i >= 6 && i < kEthernetHeaderSize));
+        }
+        check(ok && guardsIntact(chain), "REACPacketBuilder build pool packet", layout, source, payloadSize);
+
+        result = builder.update(&chain->segments[0], dhost, packetHeader,
+                                (REACPacketBuilder::PayloadSource)source, samples, samplesSize);
+        chainToFlat(chain, flat);
+        check(kIOReturnSuccess == result && 0 == memcmp(flat, ref, chain->length) && guardsIntact(chain),
+              "REACPacketBuilder update", layout, source, payloadSize);
+    }
+
+    // Only the first channels of sample frames twice as wide as those of the packet, as with a master
+    // that has no slave
+    if (wireSize == payloadSize) {
+        const UInt32 frameSize = REAC_RESOLUTION*numChannels;
+        for (int source = REACPacketBuilder::PAYLOAD_WIRE; source <= REACPacketBuilder::PAYLOAD_NATIVE_32; source++) {
+            const bool int32 = REACPacketBuilder::PAYLOAD_NATIVE_32 == source;
+            const UInt8 *samples = sData + 100;
+            const UInt32 samplesSize = (int32 ? wireSize/3*4 : wireSize);
+            const UInt32 samplesFrameSize = 2*samplesSize/REAC_SAMPLES_PER_PACKET;
+            UInt8 *payload = ref + kEthernetHeaderSize + kPacketHeaderSize;
+
+            if (0 != numChannels % 2) {
+                builder.build(&chain->segments[0], NULL, NULL, payloadSize);
+                check(kIOReturnBadArgument == builder.update(&chain->segments[0], dhost, packetHeader,
+                                                             (REACPacketBuilder::PayloadSource)source, samples, samplesSize,
+                                                             samplesFrameSize),
+                      "REACPacketBuilder frames of odd channels", layout, source, payloadSize);
+                continue;
+            }
+
+            for (UInt32 frame = 0; frame < REAC_SAMPLES_PER_PACKET; frame++) {
+                if (REACPacketBuilder::PAYLOAD_WIRE == source) {
+                    memcpy(payload + frame*frameSize, samples + frame*samplesFrameSize, frameSize);
+                }
+                else {
+                    refAudioToWire(samples + frame*samplesFrameSize, payload + frame*frameSize, frameSize/6, int32);
+                }
+            }
+
+            memset(flat, 0xee, chain->length);
+            flatToChain(flat, chain);
+            IOReturn result = builder.build(&chain->segments[0], NULL, NULL, payloadSize);
+            result = (kIOReturnSuccess != result ? result :
+                      builder.update(&chain->segments[0], dhost, packetHeader,
+                                     (REACPacketBuilder::PayloadSource)source, samples, samplesSize, samplesFrameSize));
+            chainToFlat(chain, flat);
+            check(kIOReturnSuccess == result && 0 == memcmp(flat, ref, chain->length) && guardsIntact(chain),
+                  "REACPacketBuilder update frames", layout, source, payloadSize);
+        }
+        check(kIOReturnBadArgument == builder.update(&chain->segments[0], NULL, NULL, REACPacketBuilder::PAYLOAD_NATIVE,
+                                                     sData, wireSize, wireSize/REAC_SAMPLES_PER_PACKET - 1),
+              "REACPacketBuilder frames wider than their stride", layout, 0, payloadSize);
+    }
+
+    // Frames of the wrong length, and more samples than payload
+    check(kIOReturnBadArgument == builder.build(&chain->segments[0], NULL, NULL, payloadSize + 1),
+          "REACPacketBuilder wrong length", layout, 0, payloadSize + 1);
+    check(kIOReturnBadArgument == builder.build(&chain->segments[0], NULL, NULL, payloadSize,
+                                                REACPacketBuilder::PAYLOAD_WIRE, sData, payloadSize + 6),
+          "REACPacketBuilder too many samples", layout, 0, payloadSize + 6);
+    check(kIOReturnBadArgument == builder.update(&chain->segments[0], NULL, NULL,
+                                                 REACPacketBuilder::PAYLOAD_NATIVE, sData, payloadSize + kEndingSize + 6),
+          "REACPacketBuilder update too many samples", layout, 0, payloadSize + kEndingSize + 6);
+}
+
+static void testErrors(Chain *chain) {
+    UInt8 out[4*kMaxPayloadSize];
+    UInt8 routing[1] = { 0 };
+
+    // Sizes that are not whole sample pairs, and buffers that don't fit in the mbuf
+    check(kIOReturnBadArgument == MbufUtils::copyAudioFromBufferToMbuf(&chain->segments[0], 0, 5, sData), "bad size", 0, 0, 5);
+    check(kIOReturnBadArgument == MbufUtils::copyAudioFromMbufToBuffer(&chain->segments[0], 0, 5, out), "bad size", 0, 0, 5);
+    check(kIOReturnNoMemory == MbufUtils::copyAudioFromMbufToBuffer(&chain->segments[0], 6, chain->length/6*6, out),
+          "mbuf too small", 0, 6, chain->length/6*6);
+    check(kIOReturnNoMemory == MbufUtils::copyFromBufferToMbuf(&chain->segments[0], 1, chain->length, sData),
+          "mbuf too small", 0, 1, chain->length);
+    check(kIOReturnBadArgument == MbufUtils::copyRoutedAudioFromMbufToBuffer(&chain->segments[0], 0, 3, routing, 1, false, 3, out),
+          "odd wire channels", 0, 0, 3);
+    routing[0] = 8;
+    check(kIOReturnBadArgument == MbufUtils::copyRoutedAudioFromMbufToBuffer(&chain->segments[0], 0, 8, routing, 1, false, 3, out),
+          "routed channel out of range", 0, 0, 3);
+}
+
+// ____________________________________________________________________________
+// Benchmark
+
+static double nowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+enum { kBenchPayload, kBenchWire, kBenchZero, kBenchReceive, kBenchBuild, kBenchUpdate, kBenchPayload32, kBenchReceive32 };
+
+// One packet of 40 channels through an MbufCursor, as in sendSamples and filterCommandGateMsg, or
+// through a REACPacketBuilder
+static void benchPacket(Chain *chain, int what) {
+    static const UInt8 header[kEthernetHeaderSize + kPacketHeaderSize] = { 0 };
+    static const UInt8 ending[kEndingSize] = { 0xc2, 0xea };
+    static UInt8 out[kMaxPayloadSize/3*4];
+    static UInt8 in[kPacketHeaderSize + kEndingSize];
+    static REACPacketBuilder builder;
+    MbufCursor cursor;
+
+    if (kBenchBuild == what || kBenchUpdate == what) {
+        if (kBenchBuild == what) {
+            builder.build(&chain->segments[0], header, (const REACPacketHeader *)(header + kEthernetHeaderSize),
+                          kMaxPayloadSize, REACPacketBuilder::PAYLOAD_NATIVE, sData, kMaxPayloadSize);
+        }
+        else {
+            builder.update(&chain->segments[0], header, (const REACPacketHeader *)(header + kEthernetHeaderSize),
+                           REACPacketBuilder::PAYLOAD_NATIVE, sData, kMaxPayloadSize);
+        }
+        return;
+    }
+    if (kBenchReceive == what || kBenchReceive32 == what) {
+        cursor.init(&chain->segments[0], kEthernetHeaderSize);
+        cursor.copyEndToBuffer(kEndingSize, in + kPacketHeaderSize);
+        cursor.copyToBuffer(kPacketHeaderSize, in);
+        if (kBenchReceive32 == what) {
+            cursor.copyAudio32ToBuffer(kMaxPayloadSize/3*4, out);
+        }
+        else {
+            cursor.copyAudioToBuffer(kMaxPayloadSize, out);
+        }
+        return;
+    }
+    cursor.init(&chain->segments[0]);
+    cursor.copyFromBuffer(kEthernetHeaderSize, header);
+    cursor.copyFromBuffer(kPacketHeaderSize, header + kEthernetHeaderSize);
+    if (kBenchPayload == what) {
+        cursor.copyAudioFromBuffer(kMaxPayloadSize, sData);
+    }
+    else if (kBenchPayload32 == what) {
+        cursor.copyAudio32FromBuffer(kMaxPayloadSize/3*4, sData);
+    }
+    else if (kBenchWire == what) {
+        cursor.copyFromBuffer(kMaxPayloadSize, sData);
+    }
+    else {
+        cursor.zero(kMaxPayloadSize);
+    }
+    cursor.copyFromBuffer(kEndingSize, ending);
+}
+
+static void bench(Chain *chain) {
+    static const char *kWhat[] = { "send, native samples", "send, wire order samples", "send, zeros", "receive, native samples",
+                                   "REACPacketBuilder build, native", "REACPacketBuilder update, native",
+                                   "send, 24 in 32 bit samples", "receive, 24 in 32 bit samples" };
+    static const UInt32 kBenchLayouts[] = { 0, 9 };
+
+    printf("\n%-36s %14s %14s\n", "ns/packet of 40 channels", "1 segment", "200 + rest");
+    for (int what = 0; what < (int)(sizeof(kWhat)/sizeof(kWhat[0])); what++) {
+        printf("%-36s", kWhat[what]);
+        for (UInt32 l = 0; l < sizeof(kBenchLayouts)/sizeof(kBenchLayouts[0]); l++) {
+            double best = 1e30;
+            buildLayout(chain, kMaxPacketSize, kBenchLayouts[l]);
+            for (int batch = 0; batch < 5; batch++) {
+                double start = nowNS();
+                for (int r = 0; r < 20000; r++) {
+                    benchPacket(chain, what);
+                    __asm__ __volatile__("" : : "r"(chain) : "memory");
+                }
+                double ns = (nowNS() - start) / 20000;
+                if (ns < best) best = ns;
+            }
+            printf(" %14.1f", best);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    static const UInt32 kChannelCounts[] = { 2, 8, 16, 24, 40 };
+    static Chain chain;
+    bool benchmark = (argc > 1 && 0 == strcmp(argv[1], "bench"));
+    int runs = 0;
+
+    srand(1);
+    for (UInt32 i = 0; i < sizeof(sData); i++) {
+        sData[i] = (UInt8)rand();
+    }
+
+    for (UInt32 layout = 0; layout < sizeof(kLayouts)/sizeof(kLayouts[0]); layout++) {
+        for (UInt32 n = 0; n < sizeof(kChannelCounts)/sizeof(kChannelCounts[0]); n++) {
+            UInt32 numChannels = kChannelCounts[n];
+            UInt32 length = kEthernetHeaderSize + kPacketHeaderSize +
+                REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*numChannels + kEndingSize;
+
+            buildLayout(&chain, length, layout);
+            testZeroAndCopy(&chain, layout);
+            testAudio(&chain, layout, numChannels);
+            testCursor(&chain, layout, numChannels);
+            runs++;
+        }
+        // Every channel count, with and (when there is room) without the slave samples
+        for (UInt32 numChannels = 1; numChannels <= kMaxChannels; numChannels++) {
+            UInt32 wireSize = REAC_SAMPLES_PER_PACKET*REAC_RESOLUTION*numChannels;
+            for (UInt32 payloadSize = wireSize; payloadSize <= 2*wireSize && payloadSize <= kMaxPayloadSize; payloadSize += wireSize) {
+                buildLayout(&chain, REACPacketBuilder::getPacketLength(payloadSize), layout);
+                testBuilder(&chain, layout, numChannels, payloadSize);
+                runs++;
+            }
+        }
+    }
+    buildLayout(&chain, 200, 0);
+    testErrors(&chain);
+    printf("%s: %d mbuf chains tested, %d failures\n", sFailures ? "FAILED" : "OK", runs, sFailures);
+
+    if (benchmark) {
+        bench(&chain);
+    }
+    return sFailures ? 1 : 0;
+}
@@ -0,0 +1,194 @@
+/*
+ *  REACClockTest.cpp
+ *  REAC
+ *
+ *  This file is part of the OS X REAC driver.
+ *
+ *  The OS X REAC driver is free software: you can redistribute it
+ *  and/or modify it under the terms of the GNU General Public License
+ *  as published by the Free Software Foundation, either version 3 of
+ *  the License, or (at your option) any later version.
+ *
+ *  The OS X REAC driver is distributed in the hope that it will be
+ *  useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ *  of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with OS X REAC driver.  If not, see
+ *  <http://www.gnu.org/licenses/>.
+ *
+ */
+
+// A simulation of the REAC_MASTER timer, for user space builds against the mock kernel headers in
+// mock/ (see clocktest.sh):
+//   g++ -O2 -Imock -I.. -o clocktest ../REACClock.cpp REACClockTest.cpp && ./clocktest
+//
+// The timer is due every period, and wakes up late by a random scheduler latency: a fixed part,
+// an exponential part and now and then a spike. REACClock is fed the wake times, and the spread
+// of the intervals between them is compared with that of the filtered times. The packet clock can
+// also run off the nominal rate (as a device clock would), which the rate ratio has to find. It
+// is also checked that a period that isn't a whole number of nanoseconds doesn't drift, and that
+// the clock starts over after a wake that is far too late.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "REACClock.h"
+#include "REACConstants.h"
+
+static int sFailures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        printf("FAIL %s\n", what);
+        sFailures++;
+    }
+}
+
+static UInt64 sRandom = 1;
+
+// Uniform in [0, 1)
+static double uniform() {
+    sRandom = sRandom * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (sRandom >> 11) * (1.0 / 9007199254740992.0);
+}
+
+struct Jitter {
+    const char     *name;
+    double          fixedNS;
+    double          meanNS;         // of the exponential part
+    double          spikeNS;
+    double          spikeRate;
+    double          maxRatioErrorPPM;
+};
+
+static const Jitter kJitters[] = {
+    { "none",       0,      0,      0,      0,      0.1 },
+    { "light",      10000,  5000,   0,      0,      2 },
+    { "heavy",      20000,  30000,  300000, 0.002,  10 },
+};
+
+struct Spread {
+    double          sum, sum2;
+    UInt64          n;
+
+    Spread() : sum(0), sum2(0), n(0) {}
+    void add(double x) { sum += x; sum2 += x*x; n++; }
+    double deviation() const { return n > 1 && sum2 > sum*sum/n ? sqrt((sum2 - sum*sum/n) / (n - 1)) : 0; }
+};
+
+// Runs the timer for seconds, with the packet clock ppm off the nominal rate. Checks that the
+// filtered intervals are much steadier than the wake ones, and that the rate ratio is found.
+static void simulate(UInt32 packetsPerWake, const Jitter *jitter, double ppm, double seconds) {
+    const double periodNS = 1e9 * packetsPerWake / REAC_PACKETS_PER_SECOND;
+    const double truePeriodNS = periodNS * (1 + ppm*1e-6);
+    const UInt32 wakes = (UInt32)(seconds * 1e9 / periodNS);
+    const UInt32 settle = wakes / 4;
+    UInt32 shift = 10;
+    REACClock clock;
+    Spread raw, filtered, timeError;
+    UInt64 lastWake = 0, lastTime = 0;
+    UInt32 resets = 0;
+    char what[100];
+
+    for (UInt32 n = packetsPerWake; n > 1; n /= 2) {
+        shift--;
+    }
+
+    for (UInt32 i = 0; i < wakes; i++) {
+        double due = 1e12 + i * truePeriodNS;
+        double latency = jitter->fixedNS - jitter->meanNS * log(1 - uniform());
+        if (uniform() < jitter->spikeRate) {
+            latency += jitter->spikeNS * uniform();
+        }
+        UInt64 wake = (UInt64)(due + latency);
+
+        if (0 == i) {
+            clock.init(wake, REACClock::periodFromRate(REAC_PACKETS_PER_SECOND / packetsPerWake), shift);
+        }
+        else if (!clock.update(wake)) {
+            resets++;
+        }
+        if (i > settle) {
+            raw.add((double)(SInt64)(wake - lastWake));
+            filtered.add((double)(SInt64)(clock.getTimeNS() - lastTime));
+            timeError.add((double)clock.getTimeNS() - due);
+        }
+        lastWake = wake;
+        lastTime = clock.getTimeNS();
+    }
+
+    REACClockStatistics statistics;
+    clock.getStatistics(&statistics);
+    double ratioPPM = ((double)statistics.rateRatio / 4294967296.0 - 1) * 1e6;
+    printf("%6u %-6s %+6.0f %14.1f %14.2f %14.1f %12.2f\n", (unsigned)packetsPerWake, jitter->name, ppm,
+           raw.deviation(), filtered.deviation(), timeError.deviation(), ratioPPM - ppm);
+
+    snprintf(what, sizeof(what), "%u packets per wake, %s jitter, %+.0f ppm", (unsigned)packetsPerWake, jitter->name, ppm);
+    check(0 == resets && 0 == statistics.resets, what);
+    check(filtered.deviation() <= raw.deviation() / 20 + 1, what);
+    check(fabs(ratioPPM - ppm) < jitter->maxRatioErrorPPM, what);
+}
+
+// A period of a fractional number of nanoseconds, with wakes that are exactly on time, has to stay
+// on time for as long as the simulation runs
+static void testFraction() {
+    const UInt32 rate = 44100;
+    const UInt64 start = 1000000000000ULL;
+    const UInt32 updates = 10 * rate;
+    REACClock clock;
+    double worst = 0;
+
+    clock.init(start, REACClock::periodFromRate(rate), 10);
+    for (UInt32 i = 1; i <= updates; i++) {
+        double exact = start + i * (1e9 / rate);
+        clock.update((UInt64)exact);
+        double error = fabs((double)clock.getTimeNS() - exact);
+        if (error > worst) worst = error;
+    }
+    printf("\n%u updates of %.4f ns: largest error %.2f ns\n", (unsigned)updates, 1e9 / rate, worst);
+    check(worst < 2, "fractional period");
+
+    // Half a period after the last update
+    double half = (double)clock.getTimeNS(1, 2) - (double)clock.getTimeNS();
+    check(fabs(half - 0.5e9 / rate) < 1, "getTimeNS(1, 2)");
+}
+
+static void testReset() {
+    const UInt64 period = 125000;
+    REACClock clock;
+    REACClockStatistics statistics;
+
+    clock.init(0, REACClock::periodFromRate(REAC_PACKETS_PER_SECOND), 10);
+    check(clock.update(period), "update");
+    check(clock.update(2*period + 9*period), "nine periods late");
+    check(!clock.update(50000000), "50 ms late");
+    check(50000000 == clock.getTimeNS(), "restarted at the late wake");
+    check(clock.update(50000000 + period), "update after restart");
+    clock.getStatistics(&statistics);
+    check(1 == statistics.resets && 9*period == statistics.maxErrorNS, "statistics");
+    clock.getStatistics(&statistics);
+    check(0 == statistics.maxErrorNS, "statistics start over");
+}
+
+int main() {
+    static const UInt32 kPacketsPerWake[] = { 1, 2, 4, 8 };
+    static const double kPPMs[] = { 0, 100 };
+
+    printf("%6s %-6s %6s %14s %14s %14s %12s\n", "wake", "jitter", "ppm", "wake ns sd", "DLL ns sd",
+           "time ns sd", "ratio err");
+    for (UInt32 p = 0; p < sizeof(kPacketsPerWake)/sizeof(kPacketsPerWake[0]); p++) {
+        for (UInt32 j = 0; j < sizeof(kJitters)/sizeof(kJitters[0]); j++) {
+            for (UInt32 r = 0; r < sizeof(kPPMs)/sizeof(kPPMs[0]); r++) {
+                simulate(kPacketsPerWake[p], &kJitters[j], kPPMs[r], 20);
+            }
+        }
+    }
+    testFraction();
+    testReset();
+
+    printf("%s: %d failures\n", sFailures ? "FAILED" : "OK", sFailures);
+    return sFailures ? 1 : 0;
+}
@@ -0,0 +1,3 @@
+#!/bin/sh
+# Simulates the REAC_MASTER timer with scheduler jitter, and checks how REACClock filters it
+g++ -O2 -Imock -I.. -o clocktest ../REACClock.cpp REACClockTest.cpp && ./clocktest "$@"
@@ -0,0 +1,4 @@
+#!/bin/sh
+# Tests MbufUtils on mock mbuf chains; "./mbuftest.sh bench" benchmarks it as well
+g++ -O2 -Imock -I.. -o mbuftest ../MbufUtils.cpp ../PCMBlitterLib.cpp ../REACPacketBuilder.cpp ../REACConstants.cpp \
+    MbufUtilsTest.cpp && ./mbuftest "$@"
@@ -0,0 +1,12 @@
+// Host build mock of <IOKit/IOLib.h> for the user space tests (see MbufUtilsTest.cpp). The test
+// defines IOLog.
+#ifndef _MOCK_IOLIB_H
+#define _MOCK_IOLIB_H
+
+#include <string.h>
+#include <strings.h>
+#include <IOKit/IOReturn.h>
+
+extern "C" void IOLog(const char *format, ...);
+
+#endif
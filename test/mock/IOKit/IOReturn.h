@@ -0,0 +1,13 @@
+// Host build mock of <IOKit/IOReturn.h> for the user space tests (see MbufUtilsTest.cpp)
+#ifndef _MOCK_IORETURN_H
+#define _MOCK_IORETURN_H
+
+typedef int IOReturn;
+
+#define kIOReturnSuccess        0
+#define kIOReturnError          ((IOReturn)0xe00002bc)
+#define kIOReturnNoMemory       ((IOReturn)0xe00002bd)
+#define kIOReturnBadArgument    ((IOReturn)0xe00002c2)
+#define kIOReturnInternalError  ((IOReturn)0xe00002c9)
+
+#endif
@@ -0,0 +1,18 @@
+// Host build mock of <libkern/OSTypes.h> for the user space tests (see MbufUtilsTest.cpp)
+#ifndef _MOCK_OSTYPES_H
+#define _MOCK_OSTYPES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t     UInt8;
+typedef int8_t      SInt8;
+typedef uint16_t    UInt16;
+typedef int16_t     SInt16;
+typedef uint32_t    UInt32;
+typedef int32_t     SInt32;
+typedef uint64_t    UInt64;
+typedef int64_t     SInt64;
+typedef bool        Boolean;
+
+#endif
@@ -0,0 +1,7 @@
+// Host build mock of <libkern/c++/OSObject.h> for the user space tests (see MbufUtilsTest.cpp)
+#ifndef _MOCK_OSOBJECT_H
+#define _MOCK_OSOBJECT_H
+
+#include <libkern/OSTypes.h>
+
+#endif
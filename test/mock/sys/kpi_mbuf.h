@@ -0,0 +1,22 @@
+// Host build mock of <sys/kpi_mbuf.h> for the user space tests (see MbufUtilsTest.cpp). An mbuf
+// is a segment of a chain that the test builds itself, with the accessors that MbufUtils uses.
+#ifndef _MOCK_KPI_MBUF_H
+#define _MOCK_KPI_MBUF_H
+
+#include <stddef.h>
+
+struct mbuf {
+    void           *data;
+    size_t          len;
+    size_t          maxlen;
+    struct mbuf    *next;
+};
+typedef struct mbuf *mbuf_t;
+
+inline void *mbuf_data(mbuf_t mbuf) { return mbuf->data; }
+inline size_t mbuf_len(mbuf_t mbuf) { return mbuf->len; }
+inline size_t mbuf_maxlen(mbuf_t mbuf) { return mbuf->maxlen; }
+inline void mbuf_setlen(mbuf_t mbuf, size_t len) { mbuf->len = len; }
+inline mbuf_t mbuf_next(mbuf_t mbuf) { return mbuf->next; }
+
+#endif
@@ -0,0 +1,3 @@
+#!/bin/sh
+# Tests PCMBlitterLib against its reference versions; "./pcmtest.sh bench" benchmarks it as well
+g++ -O3 -o pcmtest ../PCMBlitterLib.cpp ../PCMBlitterLibTest.cpp && ./pcmtest "$@"